@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+"""Streams CN105 packets from /api/capture as pcapng.
+
+Usage: ./capture.py <host[:port]> [file.pcapng]
+
+The port defaults to 8081, where the device serves its websockets.
+
+Writes to stdout without a file so it can feed Wireshark live:
+  ./capture.py hackvac.local | wireshark -X lua_script:cn105.lua -k -i -
+
+The device closes the stream if this falls behind rather than leave gaps.
+"""
+
+import sys
+
+from eventstream import FrameReader, connect
+
+
+def main():
+  if len(sys.argv) < 2:
+    print(__doc__)
+    sys.exit(1)
+  host, _, port = sys.argv[1].partition(':')
+  out = open(sys.argv[2], 'wb') if len(sys.argv) > 2 else sys.stdout.buffer
+  sock, buffered = connect(host, int(port or 8081), '/api/capture')
+  reader = FrameReader(sock, buffered)
+  try:
+    while True:
+      try:
+        message = reader.next_message()
+      except EOFError:
+        message = None
+      if message is None:
+        sys.stderr.write('Capture closed by device.\n')
+        break
+      out.write(message[1])
+      out.flush()
+  except (KeyboardInterrupt, BrokenPipeError):
+    pass
+
+
+if __name__ == '__main__':
+  main()
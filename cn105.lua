@@ -0,0 +1,125 @@
+-- Wireshark dissector for /api/capture streams. See capture.py.
+--
+-- Each packet is an 8 byte capture pseudo-header followed by the raw CN105
+-- bytes. Interfaces are named after the Controller tags: T-Rx and T-Tx for
+-- the thermostat link, H-Rx and H-Tx for the heat pump.
+--
+-- Load with: wireshark -X lua_script:cn105.lua capture.pcapng
+-- or copy into the Wireshark personal plugins directory.
+
+local capture = Proto("hackvac", "hackvac capture")
+local cn105 = Proto("cn105", "Mitsubishi CN105")
+
+local packet_types = {
+  [0x5a] = "Connect",
+  [0x7a] = "ConnectAck",
+  [0x5b] = "ExtendedConnect",
+  [0x7b] = "ExtendedConnectAck",
+  [0x41] = "Update",
+  [0x61] = "UpdateAck",
+  [0x42] = "Info",
+  [0x62] = "InfoAck",
+}
+
+local command_types = {
+  [0x01] = "SetSettings",
+  [0x02] = "Settings",
+  [0x03] = "ExtendedSettings",
+  [0x05] = "Timers",
+  [0x06] = "Status",
+  [0x07] = "SetExtendedSettings",
+  [0x09] = "EnterStandby",
+}
+
+local f = capture.fields
+f.version = ProtoField.uint8("hackvac.version", "Version")
+f.flags = ProtoField.uint8("hackvac.flags", "Flags", base.HEX)
+f.junk = ProtoField.bool("hackvac.flags.junk", "Junk", 8, nil, 0x01)
+f.incomplete = ProtoField.bool("hackvac.flags.incomplete", "Incomplete", 8, nil, 0x02)
+f.bad_checksum = ProtoField.bool("hackvac.flags.bad_checksum", "Bad checksum", 8, nil, 0x04)
+f.uart_errors = ProtoField.uint16("hackvac.uart_errors", "UART errors")
+f.unexpected_events = ProtoField.uint16("hackvac.unexpected_events", "Unexpected UART events")
+
+local c = cn105.fields
+c.start = ProtoField.uint8("cn105.start", "Start marker", base.HEX)
+c.type = ProtoField.uint8("cn105.type", "Type", base.HEX, packet_types)
+c.header = ProtoField.bytes("cn105.header", "Header")
+c.len = ProtoField.uint8("cn105.len", "Data length")
+c.command = ProtoField.uint8("cn105.command", "Command", base.HEX, command_types)
+c.data = ProtoField.bytes("cn105.data", "Data")
+c.checksum = ProtoField.uint8("cn105.checksum", "Checksum", base.HEX)
+
+local kPseudoHeaderSize = 8
+local kHeaderLength = 5
+
+function capture.dissector(buffer, pinfo, tree)
+  if buffer:len() < kPseudoHeaderSize then
+    return 0
+  end
+  local subtree = tree:add(capture, buffer(0, kPseudoHeaderSize))
+  subtree:add(f.version, buffer(0, 1))
+  local flags = subtree:add(f.flags, buffer(1, 1))
+  flags:add(f.junk, buffer(1, 1))
+  flags:add(f.incomplete, buffer(1, 1))
+  flags:add(f.bad_checksum, buffer(1, 1))
+  subtree:add_le(f.uart_errors, buffer(2, 2))
+  subtree:add_le(f.unexpected_events, buffer(4, 2))
+
+  if buffer:len() > kPseudoHeaderSize then
+    cn105.dissector:call(buffer(kPseudoHeaderSize):tvb(), pinfo, tree)
+  end
+  return buffer:len()
+end
+
+function cn105.dissector(buffer, pinfo, tree)
+  pinfo.cols.protocol = "CN105"
+  local len = buffer:len()
+  local subtree = tree:add(cn105, buffer())
+  subtree:add(c.start, buffer(0, 1))
+  if buffer(0, 1):uint() ~= 0xfc then
+    pinfo.cols.info = "Junk"
+    return len
+  end
+  if len < kHeaderLength then
+    pinfo.cols.info = "Truncated"
+    return len
+  end
+
+  local packet_type = buffer(1, 1):uint()
+  subtree:add(c.type, buffer(1, 1))
+  subtree:add(c.header, buffer(2, 2))
+  subtree:add(c.len, buffer(4, 1))
+  local data_len = buffer(4, 1):uint()
+  local info = packet_types[packet_type] or string.format("0x%02x", packet_type)
+
+  local available = math.min(data_len, len - kHeaderLength)
+  if available > 0 then
+    local command = buffer(kHeaderLength, 1):uint()
+    subtree:add(c.command, buffer(kHeaderLength, 1))
+    subtree:add(c.data, buffer(kHeaderLength, available))
+    if command_types[command] and packet_type ~= 0x5a and packet_type ~= 0x5b then
+      info = info .. " " .. command_types[command]
+    end
+  end
+
+  local checksum_pos = kHeaderLength + data_len
+  if len > checksum_pos then
+    local sum = 0
+    for i = 0, checksum_pos - 1 do
+      sum = sum + buffer(i, 1):uint()
+    end
+    local expected = bit.band(0xfc - sum, 0xff)
+    local item = subtree:add(c.checksum, buffer(checksum_pos, 1))
+    if buffer(checksum_pos, 1):uint() ~= expected then
+      item:add_expert_info(PI_CHECKSUM, PI_ERROR,
+                           string.format("Bad checksum, expected 0x%02x", expected))
+      info = info .. " [bad checksum]"
+    end
+  else
+    info = info .. " [incomplete]"
+  end
+  pinfo.cols.info = info
+  return len
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, capture)
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Tails /api/events and reports throughput and latency.
+
+Usage: ./eventstream.py <host[:port]> [--quiet]
+
+The port defaults to 8081, where the device serves its websockets.
+
+Every few seconds prints events/s, frames/s, events the device skipped for
+this client, and how long events waited on the device before their frame
+went out ("now" - "t" in each frame). Only needs the standard library.
+"""
+
+import base64
+import json
+import os
+import socket
+import struct
+import sys
+import time
+
+REPORT_INTERVAL_S = 5
+
+
+def connect(host, port, path):
+  sock = socket.create_connection((host, port))
+  key = base64.b64encode(os.urandom(16)).decode()
+  sock.sendall((
+      'GET %s HTTP/1.1\r\n'
+      'Host: %s\r\n'
+      'Upgrade: websocket\r\n'
+      'Connection: Upgrade\r\n'
+      'Sec-WebSocket-Key: %s\r\n'
+      'Sec-WebSocket-Version: 13\r\n\r\n' % (path, host, key)).encode())
+  response = b''
+  while b'\r\n\r\n' not in response:
+    chunk = sock.recv(1024)
+    if not chunk:
+      raise IOError('Connection closed during handshake')
+    response += chunk
+  status = response.split(b'\r\n', 1)[0]
+  if b' 101 ' not in status:
+    raise IOError('Handshake failed: %s' % status.decode(errors='replace'))
+  return sock, response.split(b'\r\n\r\n', 1)[1]
+
+
+class FrameReader(object):
+  def __init__(self, sock, buffered):
+    self.sock = sock
+    self.buf = buffered
+
+  def _read(self, n):
+    while len(self.buf) < n:
+      chunk = self.sock.recv(4096)
+      if not chunk:
+        raise EOFError()
+      self.buf += chunk
+    data, self.buf = self.buf[:n], self.buf[n:]
+    return data
+
+  def next_message(self):
+    """Returns the next message as (opcode, bytes), or None on close."""
+    message = b''
+    message_opcode = None
+    while True:
+      b0, b1 = struct.unpack('!BB', self._read(2))
+      opcode = b0 & 0x0f
+      length = b1 & 0x7f
+      if length == 126:
+        length = struct.unpack('!H', self._read(2))[0]
+      elif length == 127:
+        length = struct.unpack('!Q', self._read(8))[0]
+      mask = self._read(4) if b1 & 0x80 else None
+      payload = self._read(length)
+      if mask:
+        payload = bytes(c ^ mask[i % 4] for i, c in enumerate(payload))
+      if opcode == 0x8:
+        return None
+      if opcode in (0x9, 0xa):
+        continue  # Ping/pong. Mongoose answers pings itself.
+      if opcode != 0x0:
+        message_opcode = opcode
+      message += payload
+      if b0 & 0x80:
+        return message_opcode, message
+
+  def next_text(self):
+    """Returns the next text message, or None on close."""
+    message = self.next_message()
+    if message is None:
+      return None
+    return message[1].decode(errors='replace')
+
+
+def main():
+  if len(sys.argv) < 2:
+    print(__doc__)
+    sys.exit(1)
+  host, _, port = sys.argv[1].partition(':')
+  quiet = '--quiet' in sys.argv[2:]
+  sock, buffered = connect(host, int(port or 8081), '/api/events')
+  reader = FrameReader(sock, buffered)
+
+  frames = events = missed = 0
+  latencies = []
+  last_report = time.time()
+  while True:
+    try:
+      text = reader.next_text()
+    except EOFError:
+      text = None
+    if text is None:
+      print('Connection closed by device. Evicted as a slow consumer?')
+      break
+    frame = json.loads(text)
+    frames += 1
+    missed += frame['missed']
+    for event in frame['events']:
+      events += 1
+      latencies.append(frame['now'] - event['t'])
+      if not quiet:
+        sys.stdout.write(event['m'])
+
+    now = time.time()
+    if now - last_report >= REPORT_INTERVAL_S:
+      elapsed = now - last_report
+      latencies.sort()
+      p50 = latencies[len(latencies) // 2] if latencies else 0
+      p99 = latencies[len(latencies) * 99 // 100] if latencies else 0
+      print('== %.1f events/s, %.1f frames/s, %d missed, latency p50 %dms '
+            'p99 %dms max %dms' % (
+                events / elapsed, frames / elapsed, missed, p50, p99,
+                latencies[-1] if latencies else 0))
+      frames = events = missed = 0
+      latencies = []
+      last_report = now
+
+
+if __name__ == '__main__':
+  main()
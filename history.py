@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Fetches and decodes the history kept in flash across reboots.
+
+Usage: ./history.py <host[:port] | image file> [--save file] [--packets]
+
+Prints, oldest first, a line per boot saying how the previous boot ended,
+warning and error log lines, and orderly restarts. With --packets also
+prints the packets from each stored journal chunk like journal.py does.
+Lines start with the boot number (low byte) and seconds since that boot.
+
+The image is the partition's sectors in the order /api/history?sector=N
+returns them. The format is described in src/main/flash_ring.h.
+"""
+
+import json
+import os
+import struct
+import sys
+import urllib.error
+import urllib.request
+
+import journal
+
+SECTOR_MAGIC = 0x31465648
+SECTOR_HEADER_SIZE = 8
+RECORD_HEADER_SIZE = 10
+
+BOOT, CRASH, LOG, JOURNAL_CHUNK, RESTART = range(1, 6)
+
+# esp_reset_reason_t.
+RESET_REASONS = ['unknown', 'power on', 'external pin', 'software restart',
+                 'panic', 'interrupt watchdog', 'task watchdog', 'watchdog',
+                 'deep sleep', 'brownout', 'sdio']
+
+
+def fletcher16(data):
+  sum1 = sum2 = 0
+  for b in data:
+    sum1 = (sum1 + b) % 255
+    sum2 = (sum2 + sum1) % 255
+  return (sum2 << 8) | sum1
+
+
+def records(sector):
+  """Yields (type, boot, time_ms, payload) for the valid records of a sector."""
+  pos = SECTOR_HEADER_SIZE
+  while pos + RECORD_HEADER_SIZE <= len(sector):
+    if sector[pos] == 0xff:
+      return
+    kind, boot, size, time_ms, check = struct.unpack_from('<BBHIH', sector, pos)
+    payload = sector[pos + RECORD_HEADER_SIZE:pos + RECORD_HEADER_SIZE + size]
+    if len(payload) != size or fletcher16(sector[pos:pos + 8] + payload) != check:
+      return  # Torn by a reset. Nothing after it was written.
+    yield kind, boot, time_ms, payload
+    pos += (RECORD_HEADER_SIZE + size + 3) & ~3
+
+
+def fetch(host):
+  host, _, port = host.partition(':')
+  base = 'http://%s:%s/api/history' % (host, port or 8080)
+  info = json.loads(urllib.request.urlopen(base).read())
+  print('== boot %d, %d sectors, %d pages written, %d erases, %d dropped' % (
+      info['boot'], info['sectors'], info['pages_written'], info['erases'],
+      info['dropped']))
+  image = b''
+  for i in range(info['sectors']):
+    try:
+      image += urllib.request.urlopen('%s?sector=%d' % (base, i)).read()
+    except urllib.error.HTTPError as e:
+      if e.code != 404:
+        raise
+  return image, info['sector_size']
+
+
+def main():
+  if len(sys.argv) < 2:
+    print(__doc__)
+    sys.exit(1)
+  source = sys.argv[1]
+  show_packets = '--packets' in sys.argv
+  if '--save' in sys.argv:
+    save_path = sys.argv[sys.argv.index('--save') + 1]
+  else:
+    save_path = None
+
+  if os.path.exists(source):
+    with open(source, 'rb') as f:
+      image = f.read()
+    sector_size = 4096
+  else:
+    image, sector_size = fetch(source)
+  if save_path:
+    with open(save_path, 'wb') as f:
+      f.write(image)
+
+  sectors = []
+  for offset in range(0, len(image), sector_size):
+    sector = image[offset:offset + sector_size]
+    magic, sequence = struct.unpack_from('<II', sector, 0)
+    if magic == SECTOR_MAGIC:
+      sectors.append((sequence, sector))
+  # A sector being started when the image was read may still hold old data.
+  sectors.sort(key=lambda s: s[0])
+
+  for _, sector in sectors:
+    for kind, boot, time_ms, payload in records(sector):
+      prefix = '[%3d] %10.3f' % (boot, time_ms / 1000.0)
+      if kind in (BOOT, CRASH):
+        number, reason, address = struct.unpack_from('<IB3xI', payload, 0)
+        reason = RESET_REASONS[reason] if reason < len(RESET_REASONS) else reason
+        print('%s %s boot %d from app at 0x%x, previous ended by %s' % (
+            prefix, '!! CRASH,' if kind == CRASH else '==', number, address,
+            reason))
+      elif kind == LOG:
+        print('%s %s' % (prefix, payload.decode(errors='replace')))
+      elif kind == RESTART:
+        print('%s == orderly restart' % prefix)
+      elif kind == JOURNAL_CHUNK:
+        if not show_packets:
+          _, _, count = struct.unpack_from('<IHH', payload, 0)
+          print('%s -- %d packets in a journal chunk' % (prefix, count))
+          continue
+        blob = b'HVJ1' + struct.pack('<HH', len(payload), 1) + payload
+        for interface, packet_ms, frame in journal.decode(blob):
+          print('[%3d] %10.3f %s %s' % (
+              boot, packet_ms / 1000.0, journal.INTERFACES[interface],
+              ','.join('%x' % b for b in frame)))
+      else:
+        print('%s ?? record type %d, %d bytes' % (prefix, kind, len(payload)))
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Fetches and decodes the compressed packet history from /api/journal.
+
+Usage: ./journal.py <host[:port] | snapshot file> [--save file]
+
+Prints one line per packet, oldest first:
+  <ms since boot> <interface> <bytes in hex>
+then how many packets were held and the compression ratio. The format is
+described in src/main/packet_journal.h.
+"""
+
+import os
+import struct
+import sys
+import urllib.request
+
+INTERFACES = ['T-Rx', 'T-Tx', 'H-Rx', 'H-Tx']
+
+OP_LITERAL, OP_REF, OP_DELTA, OP_RUN = range(4)
+MAX_PERIOD = 8
+
+
+class Reader(object):
+  def __init__(self, data):
+    self.data = data
+    self.pos = 0
+
+  def byte(self):
+    if self.pos >= len(self.data):
+      raise ValueError('Truncated entry')
+    value = self.data[self.pos]
+    self.pos += 1
+    return value
+
+  def varint(self):
+    value = 0
+    shift = 0
+    while True:
+      b = self.byte()
+      value |= (b & 0x7f) << shift
+      if not b & 0x80:
+        return value
+      shift += 7
+
+  def done(self):
+    return self.pos >= len(self.data)
+
+
+def unzigzag(value):
+  return (value >> 1) ^ -(value & 1)
+
+
+def decode(blob):
+  """Yields (interface, time_ms, bytes) oldest first."""
+  if blob[:4] != b'HVJ1':
+    raise ValueError('Not a journal snapshot')
+  chunk_size, num_chunks = struct.unpack_from('<HH', blob, 4)
+  for c in range(num_chunks):
+    chunk = blob[8 + c * chunk_size:8 + (c + 1) * chunk_size]
+    time_ms, used, _ = struct.unpack_from('<IHH', chunk, 0)
+    reader = Reader(chunk[8:8 + used])
+    slots = {}
+    history = []
+
+    def emit(interface, slot, dt):
+      nonlocal time_ms
+      time_ms += dt
+      history.append((interface, slot, dt))
+      del history[:-MAX_PERIOD]
+      return interface, time_ms, bytes(slots.get(slot, b''))
+
+    while not reader.done():
+      header = reader.byte()
+      op = header >> 6
+      if op == OP_RUN:
+        period = (header & 0x7) + 1
+        for _ in range(reader.byte()):
+          interface, slot, dt = history[-period]
+          yield emit(interface, slot, dt + unzigzag(reader.varint()))
+        continue
+
+      interface = (header >> 4) & 0x3
+      slot = header & 0xf
+      dt = reader.varint()
+      if op == OP_LITERAL:
+        size = reader.byte()
+        slots[slot] = bytearray(reader.byte() for _ in range(size))
+      elif op == OP_DELTA:
+        changed = reader.varint()
+        frame = slots[slot]
+        for i in range(len(frame)):
+          if changed & (1 << i):
+            frame[i] ^= reader.byte()
+      yield emit(interface, slot, dt)
+
+
+def main():
+  if len(sys.argv) < 2:
+    print(__doc__)
+    sys.exit(1)
+  source = sys.argv[1]
+  if '--save' in sys.argv:
+    save_path = sys.argv[sys.argv.index('--save') + 1]
+  else:
+    save_path = None
+
+  if os.path.exists(source):
+    with open(source, 'rb') as f:
+      blob = f.read()
+  else:
+    host, _, port = source.partition(':')
+    url = 'http://%s:%s/api/journal' % (host, port or 8080)
+    blob = urllib.request.urlopen(url).read()
+  if save_path:
+    with open(save_path, 'wb') as f:
+      f.write(blob)
+
+  chunk_size, num_chunks = struct.unpack_from('<HH', blob, 4)
+  count = 0
+  raw = 0
+  for interface, time_ms, frame in decode(blob):
+    print('%10.3f %s %s' % (time_ms / 1000.0, INTERFACES[interface],
+                            ','.join('%x' % b for b in frame)))
+    count += 1
+    raw += len(frame) + 4
+  # Unused chunk tails are not counted, matching the device's stored_bytes.
+  stored = sum(8 + struct.unpack_from('<H', blob, 8 + c * chunk_size + 4)[0]
+               for c in range(num_chunks))
+  print('== %d packets, %d bytes raw in %d bytes, %.1fx' % (
+      count, raw, stored, raw / stored if stored else 0))
+
+
+if __name__ == '__main__':
+  main()
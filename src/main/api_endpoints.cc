@@ -0,0 +1,943 @@
+#include "api_endpoints.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cJSON.h>
+
+#include "boot_timeline.h"
+#include "controller.h"
+#include "event_log.h"
+#include "log_limiter.h"
+#include "packet_rewriter.h"
+
+#include "esp_cxx/logging.h"
+
+#ifndef FAKE_ESP_IDF
+#include "esp_system.h"
+#include "sdkconfig.h"
+#endif
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "api";
+
+constexpr char kContentTypeBinary[] = "Content-Type: application/octet-stream";
+
+// See Kconfig.projbuild.
+#ifndef FAKE_ESP_IDF
+constexpr int kEventBatchIntervalMs = CONFIG_HACKVAC_EVENT_BATCH_INTERVAL_MS;
+#else
+constexpr int kEventBatchIntervalMs = 50;
+#endif
+
+// Differs between boots. See SettingsHandler.
+uint32_t BootEpoch() {
+#ifndef FAKE_ESP_IDF
+  return esp_random();
+#else
+  return 1;
+#endif
+}
+
+template <typename T>
+struct NamedValue {
+  const char* name;
+  T value;
+};
+
+constexpr NamedValue<RewriteDirection> kDirectionNames[] = {
+  {"tstat", RewriteDirection::kFromThermostat},
+  {"hvac", RewriteDirection::kFromHvac},
+};
+
+constexpr NamedValue<PacketType> kPacketTypeNames[] = {
+  {"update", PacketType::kUpdate},
+  {"info_ack", PacketType::kInfoAck},
+};
+
+constexpr NamedValue<CommandType> kCommandTypeNames[] = {
+  {"set_settings", CommandType::kSetSettings},
+  {"settings", CommandType::kSettings},
+};
+
+constexpr NamedValue<RewriteRule::Action> kActionNames[] = {
+  {"set", RewriteRule::Action::kSetField},
+  {"clamp_temp", RewriteRule::Action::kClampTargetTemp},
+};
+
+template <typename T, size_t n>
+std::optional<T> ValueForName(const NamedValue<T> (&table)[n], const char* name) {
+  if (!name) {
+    return {};
+  }
+  for (const auto& entry : table) {
+    if (strcmp(entry.name, name) == 0) {
+      return entry.value;
+    }
+  }
+  return {};
+}
+
+template <typename T, size_t n>
+const char* NameForValue(const NamedValue<T> (&table)[n], T value) {
+  for (const auto& entry : table) {
+    if (entry.value == value) {
+      return entry.name;
+    }
+  }
+  return "unknown";
+}
+
+const char* GetString(const cJSON* object, const char* key) {
+  const cJSON* item = cJSON_GetObjectItemCaseSensitive(object, key);
+  return cJSON_IsString(item) ? item->valuestring : nullptr;
+}
+
+int GetInt(const cJSON* object, const char* key) {
+  const cJSON* item = cJSON_GetObjectItemCaseSensitive(object, key);
+  return cJSON_IsNumber(item) ? item->valueint : 0;
+}
+
+// The decimal value of |name| in a query string such as "a=1&sector=3".
+std::optional<long> QueryNumber(std::string_view query, std::string_view name) {
+  while (!query.empty()) {
+    size_t end = query.find('&');
+    std::string_view param = query.substr(0, end);
+    query = end == std::string_view::npos ? std::string_view() : query.substr(end + 1);
+    if (param.size() <= name.size() || param.substr(0, name.size()) != name ||
+        param[name.size()] != '=') {
+      continue;
+    }
+    std::string value(param.substr(name.size() + 1));
+    char* value_end = nullptr;
+    long number = strtol(value.c_str(), &value_end, 10);
+    if (value.empty() || *value_end != '\0') {
+      return {};
+    }
+    return number;
+  }
+  return {};
+}
+
+// |item| as a target temp in half degrees, if it is a whole number of half
+// degrees within the range the unit accepts.
+std::optional<uint8_t> TargetHalfDegrees(const cJSON* item) {
+  if (!cJSON_IsNumber(item)) {
+    return {};
+  }
+  double half_degrees = item->valuedouble * 2;
+  if (!(half_degrees >= 0 && half_degrees <= UINT8_MAX) ||
+      half_degrees != static_cast<int>(half_degrees) ||
+      !HvacSettings::IsValidFieldInt(SettingsField::kTargetTemp,
+                                     static_cast<int>(half_degrees))) {
+    return {};
+  }
+  return static_cast<uint8_t>(half_degrees);
+}
+
+// Parses a rule in the form
+//   {"dir":"tstat", "packet":"update", "command":"set_settings",
+//    "action":"set", "field":"fan", "value":0}
+//   {"dir":"tstat", "packet":"update", "command":"set_settings",
+//    "action":"clamp_temp", "min":18.5, "max":24}
+//   {"dir":"hvac", "packet":"info_ack", "command":"settings",
+//    "action":"set", "field":"power", "value":1}
+// Only update/set_settings and info_ack/settings carry settings. A set needs
+// a settings field and a value the unit accepts for it, as a wire value or
+// half degrees. A clamp needs min <= max within the target temp range.
+std::optional<RewriteRule> ParseRule(const cJSON* json) {
+  auto direction = ValueForName(kDirectionNames, GetString(json, "dir"));
+  auto packet_type = ValueForName(kPacketTypeNames, GetString(json, "packet"));
+  auto command_type = ValueForName(kCommandTypeNames, GetString(json, "command"));
+  auto action = ValueForName(kActionNames, GetString(json, "action"));
+  if (!direction || !packet_type || !command_type || !action) {
+    return {};
+  }
+
+  RewriteRule rule;
+  rule.direction = direction.value();
+  rule.packet_type = packet_type.value();
+  rule.command_type = command_type.value();
+  rule.action = action.value();
+
+  if (rule.action == RewriteRule::Action::kSetField) {
+    auto field = SettingsFieldFromName(GetString(json, "field"));
+    const cJSON* value = cJSON_GetObjectItemCaseSensitive(json, "value");
+    // Also rules out kRoomTemp, which is not in the settings layout.
+    if (!field || !cJSON_IsNumber(value) || value->valuedouble != value->valueint ||
+        !HvacSettings::IsValidFieldInt(field.value(), value->valueint)) {
+      return {};
+    }
+    rule.field = field.value();
+    rule.value = static_cast<uint8_t>(value->valueint);
+  } else {
+    auto min = TargetHalfDegrees(cJSON_GetObjectItemCaseSensitive(json, "min"));
+    auto max = TargetHalfDegrees(cJSON_GetObjectItemCaseSensitive(json, "max"));
+    if (!min || !max || min.value() > max.value()) {
+      return {};
+    }
+    rule.field = SettingsField::kTargetTemp;
+    rule.min_half_degrees = min.value();
+    rule.max_half_degrees = max.value();
+  }
+  if (!rule.IsSupported()) {
+    return {};
+  }
+  return rule;
+}
+
+cJSON* RuleToJson(const RewriteRule& rule) {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddStringToObject(json, "dir", NameForValue(kDirectionNames, rule.direction));
+  cJSON_AddStringToObject(json, "packet", NameForValue(kPacketTypeNames, rule.packet_type));
+  cJSON_AddStringToObject(json, "command", NameForValue(kCommandTypeNames, rule.command_type));
+  cJSON_AddStringToObject(json, "action", NameForValue(kActionNames, rule.action));
+  if (rule.action == RewriteRule::Action::kSetField) {
+    cJSON_AddStringToObject(json, "field", SettingsFieldName(rule.field));
+    cJSON_AddNumberToObject(json, "value", rule.value);
+  } else {
+    cJSON_AddNumberToObject(json, "min", rule.min_half_degrees / 2.0);
+    cJSON_AddNumberToObject(json, "max", rule.max_half_degrees / 2.0);
+  }
+  return json;
+}
+
+void SendJson(cJSON* root, esp_cxx::HttpResponse* response) {
+  char* printed = cJSON_PrintUnformatted(root);
+  if (!printed) {
+    response->SendError(500);
+    return;
+  }
+  std::string_view body(printed);
+  response->Send(200, body.size(), esp_cxx::HttpResponse::kContentTypeJson, body);
+  free(printed);
+}
+
+// Serializes per-bucket |counts| as [[bucket lower bound, count], ...].
+// Empty buckets are skipped.
+cJSON* HistogramToJson(const std::array<uint32_t, Histogram::kNumBuckets>& counts) {
+  cJSON* histogram = cJSON_CreateArray();
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    cJSON* bucket = cJSON_CreateArray();
+    cJSON_AddItemToArray(bucket, cJSON_CreateNumber(Histogram::BucketLowerBound(i)));
+    cJSON_AddItemToArray(bucket, cJSON_CreateNumber(counts[i]));
+    cJSON_AddItemToArray(histogram, bucket);
+  }
+  return histogram;
+}
+
+// Adds |prefix|count, |prefix|min_us, |prefix|max_us, and |prefix|histogram
+// for |histogram| to |json|.
+void AddHistogramStats(cJSON* json, const std::string& prefix, const Histogram& histogram) {
+  std::array<uint32_t, Histogram::kNumBuckets> counts;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    counts[i] = histogram.bucket(i);
+  }
+  cJSON_AddNumberToObject(json, (prefix + "count").c_str(), histogram.count());
+  cJSON_AddNumberToObject(json, (prefix + "min_us").c_str(),
+                          histogram.count() ? histogram.min() : 0);
+  cJSON_AddNumberToObject(json, (prefix + "max_us").c_str(), histogram.max());
+  cJSON_AddItemToObject(json, (prefix + "histogram").c_str(), HistogramToJson(counts));
+}
+
+// Serializes |stats| in the form
+//   {"command":"connect", "srtt_us":41000, "rttvar_us":2000,
+//    "timeout_us":51000, "timeouts":0, "min_us":39000, "max_us":47000,
+//    "histogram":[[32768, 12], [65536, 1]]}
+cJSON* RttStatsToJson(const CommandRttStats& stats) {
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddStringToObject(json, "command", stats.command);
+  cJSON_AddNumberToObject(json, "srtt_us", stats.srtt.count());
+  cJSON_AddNumberToObject(json, "rttvar_us", stats.rttvar.count());
+  cJSON_AddNumberToObject(json, "timeout_us", stats.timeout.count());
+  cJSON_AddNumberToObject(json, "timeouts", stats.timeouts);
+  cJSON_AddNumberToObject(json, "min_us", stats.min_us);
+  cJSON_AddNumberToObject(json, "max_us", stats.max_us);
+
+  cJSON_AddItemToObject(json, "histogram", HistogramToJson(stats.histogram));
+  return json;
+}
+
+// Serializes the present fields of |settings| as {"power":1, "temp":22.5}.
+// Enum fields are their wire values.
+cJSON* SettingsToJson(const HvacSettings& settings) {
+  cJSON* json = cJSON_CreateObject();
+  settings.ForEachPresentField(
+      [&](const char* name, SettingsField, int value, int json_scale) {
+        cJSON_AddNumberToObject(json, name, static_cast<double>(value) / json_scale);
+      });
+  return json;
+}
+
+// Serializes how long ago each field in |mask| was stamped, in ms.
+cJSON* AgesToJson(
+    SettingsFieldMask mask,
+    const std::array<HvacSettingsShadow::TimePoint, kNumSettingsFields>& stamps) {
+  auto now = HvacSettingsShadow::TimePoint::clock::now();
+  cJSON* json = cJSON_CreateObject();
+  for (size_t i = 0; i < kNumSettingsFields; ++i) {
+    if (mask & (1 << i)) {
+      auto age = std::chrono::duration_cast<std::chrono::milliseconds>(now - stamps[i]);
+      cJSON_AddNumberToObject(json, SettingsFieldName(static_cast<SettingsField>(1 << i)),
+                              age.count());
+    }
+  }
+  return json;
+}
+
+// Parses {"tag":"chan", "rate":10, "burst":20, "sample":1} into |tag| and
+// |limit|. Missing numbers are 0 which, for "sample", keeps every line.
+bool ParseLogLimit(const cJSON* json, LogLimiter::Tag** tag, LogLimit* limit) {
+  const char* name = GetString(json, "tag");
+  *tag = name ? LogLimiter::Get()->FindTag(name) : nullptr;
+  if (!*tag) {
+    return false;
+  }
+  int rate = GetInt(json, "rate");
+  int burst = GetInt(json, "burst");
+  int sample = GetInt(json, "sample");
+  if (rate < 0 || burst < 0 || sample < 0) {
+    return false;
+  }
+  limit->rate_per_sec = rate;
+  limit->burst = burst;
+  limit->sample_every = sample;
+  return true;
+}
+
+}  // namespace
+
+ApiEndpoints::ApiEndpoints(Controller* controller,
+                           esp_cxx::EventManager* net_event_manager,
+                           PacketCapture* packet_capture,
+                           FlashRing* flash_ring)
+  : settings_endpoint_(controller, net_event_manager),
+    rewrite_rules_endpoint_(controller),
+    rtt_endpoint_(controller),
+    shadow_endpoint_(controller),
+    jitter_endpoint_(controller),
+    loop_endpoint_(controller),
+    events_endpoint_(net_event_manager),
+    event_stats_endpoint_(&events_endpoint_),
+    capture_endpoint_(net_event_manager, packet_capture),
+    journal_endpoint_(packet_capture),
+    history_endpoint_(flash_ring),
+    udp_log_endpoint_(&events_endpoint_) {
+  // Info and lower lines now reach the console from the network task rather
+  // than from whichever task logged them.
+  events_endpoint_.AddSink(&console_sink_);
+  SetEventLogConsoleDeferred(true);
+}
+
+ApiEndpoints::~ApiEndpoints() {
+  SetEventLogConsoleDeferred(false);
+}
+
+void ApiEndpoints::RegisterEndpoints(esp_cxx::HttpServer* server,
+                                     StreamServer* stream_server) {
+  server->RegisterEndpoint("/api/rewrite_rules$", &rewrite_rules_endpoint_);
+  server->RegisterEndpoint("/api/rtt$", &rtt_endpoint_);
+  server->RegisterEndpoint("/api/shadow$", &shadow_endpoint_);
+  server->RegisterEndpoint("/api/boot$", &boot_endpoint_);
+  server->RegisterEndpoint("/api/jitter$", &jitter_endpoint_);
+  server->RegisterEndpoint("/api/loop$", &loop_endpoint_);
+  server->RegisterEndpoint("/api/event_stats$", &event_stats_endpoint_);
+  server->RegisterEndpoint("/api/log_limits$", &log_limits_endpoint_);
+  server->RegisterEndpoint("/api/journal$", &journal_endpoint_);
+  server->RegisterEndpoint("/api/history$", &history_endpoint_);
+  server->RegisterEndpoint("/api/udp_log$", &udp_log_endpoint_);
+
+  stream_server->RegisterEndpoint("/api/settings", &settings_endpoint_);
+  stream_server->RegisterEndpoint("/api/events", &events_endpoint_);
+  stream_server->RegisterEndpoint("/api/capture", &capture_endpoint_);
+}
+
+void ApiEndpoints::SetUdpLogShipper(UdpLogShipper* shipper) {
+  udp_log_endpoint_.SetShipper(shipper);
+}
+
+ApiEndpoints::SettingsEndpoint::SettingsEndpoint(Controller* controller,
+                                                 esp_cxx::EventManager* event_manager)
+  : handler_(controller, event_manager, BootEpoch()) {
+}
+
+void ApiEndpoints::SettingsEndpoint::OnHttp(const StreamServer::Request& request,
+                                            StreamServer::Connection client) {
+  if (request.method() == "GET") {
+    handler_.Get(request.header("If-None-Match"),
+                 QueryNumber(request.query_string(), "wait_for_change"), client);
+  } else if (request.method() == "PUT") {
+    handler_.Put(request.body(), client);
+  } else {
+    client.SendError(405);
+  }
+}
+
+void ApiEndpoints::SettingsEndpoint::OnClose(StreamServer::Connection client) {
+  handler_.OnClose(client);
+}
+
+void ApiEndpoints::RewriteRulesEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                                esp_cxx::HttpResponse response) {
+  if (request.method() == esp_cxx::HttpMethod::kPut) {
+    std::string body(request.body());
+    cJSON* root = cJSON_Parse(body.c_str());
+    if (!cJSON_IsArray(root)) {
+      cJSON_Delete(root);
+      response.SendError(400, "Expected array of rules");
+      return;
+    }
+
+    std::vector<RewriteRule> rules;
+    const cJSON* item = nullptr;
+    cJSON_ArrayForEach(item, root) {
+      auto rule = ParseRule(item);
+      if (!rule) {
+        cJSON_Delete(root);
+        response.SendError(400, "Invalid rule");
+        return;
+      }
+      rules.push_back(rule.value());
+    }
+    cJSON_Delete(root);
+
+    ESP_LOGI(kTag, "Installing %d rewrite rules", static_cast<int>(rules.size()));
+    controller_->SetRewriteRules(std::move(rules));
+  } else if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  // Both GET and a successful PUT reply with the active rules.
+  cJSON* root = cJSON_CreateArray();
+  for (const auto& rule : controller_->GetRewriteRules()) {
+    cJSON_AddItemToArray(root, RuleToJson(rule));
+  }
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+void ApiEndpoints::RttEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                       esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  cJSON* root = cJSON_CreateArray();
+  for (const auto& stats : controller_->GetRttStats()) {
+    cJSON_AddItemToArray(root, RttStatsToJson(stats));
+  }
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+// Replies in the form
+//   {"desired":{"fan":1}, "reported":{"power":1, "fan":0},
+//    "pending":["fan"], "desired_age_ms":{"fan":1200},
+//    "reported_age_ms":{"power":5000, "fan":5000}}
+void ApiEndpoints::ShadowEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                          esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  HvacSettingsShadow shadow = controller_->GetSettingsShadow();
+  cJSON* root = cJSON_CreateObject();
+  cJSON_AddItemToObject(root, "desired", SettingsToJson(shadow.desired));
+  cJSON_AddItemToObject(root, "reported", SettingsToJson(shadow.reported));
+
+  cJSON* pending = cJSON_CreateArray();
+  for (size_t i = 0; i < kNumSettingsFields; ++i) {
+    if (shadow.pending_fields & (1 << i)) {
+      cJSON_AddItemToArray(
+          pending, cJSON_CreateString(SettingsFieldName(static_cast<SettingsField>(1 << i))));
+    }
+  }
+  cJSON_AddItemToObject(root, "pending", pending);
+  cJSON_AddItemToObject(root, "desired_age_ms",
+                        AgesToJson(shadow.desired.present_fields(),
+                                   shadow.desired_changed_at));
+  cJSON_AddItemToObject(root, "reported_age_ms",
+                        AgesToJson(shadow.reported.present_fields(),
+                                   shadow.reported_at));
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+// Replies in the form
+//   {"nvs_ready":41000, "controller_started":43000, "hvac_connected":180000}
+// with microseconds since boot for each milestone reached so far.
+void ApiEndpoints::BootEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                        esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  const BootTimeline* timeline = BootTimeline::Get();
+  cJSON* root = cJSON_CreateObject();
+  for (size_t i = 0; i < BootTimeline::kNumMilestones; ++i) {
+    BootMilestone milestone = static_cast<BootMilestone>(i);
+    if (int64_t us = timeline->time_us(milestone)) {
+      cJSON_AddNumberToObject(root, BootTimeline::MilestoneName(milestone), us);
+    }
+  }
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+// Replies in the form
+//   {"interval_ms":100, "count":600, "min_us":0, "max_us":10500,
+//    "histogram":[[0, 12], [8192, 588]]}
+void ApiEndpoints::JitterEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                          esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  const LoopJitterProbe& probe = controller_->loop_jitter();
+  cJSON* root = cJSON_CreateObject();
+  cJSON_AddNumberToObject(root, "interval_ms", probe.interval_ms());
+  AddHistogramStats(root, "", probe.lateness());
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+// Replies in the form
+//   {"queue_depth":0, "queue_high_water":3, "slow_threshold_us":10000,
+//    "running":"hvac_rx", "running_us":120,
+//    "sites":[{"site":"hvac_rx", "slow":0,
+//              "exec_count":40, "exec_min_us":30, "exec_max_us":900,
+//              "exec_histogram":[[16, 2], [32, 38]],
+//              "delay_count":0, ...}]}
+// where delay is queueing time for posted work and lateness for timers.
+void ApiEndpoints::LoopEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                        esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  const LoopProfiler& profiler = controller_->loop_profiler();
+  cJSON* root = cJSON_CreateObject();
+  cJSON_AddNumberToObject(root, "queue_depth", profiler.queue_depth());
+  cJSON_AddNumberToObject(root, "queue_high_water", profiler.queue_high_water());
+  cJSON_AddNumberToObject(root, "slow_threshold_us", profiler.slow_threshold_us());
+  if (const LoopProfiler::Site* running = profiler.running_site()) {
+    cJSON_AddStringToObject(root, "running", running->name());
+    cJSON_AddNumberToObject(root, "running_us", profiler.running_us());
+  }
+
+  cJSON* sites = cJSON_CreateArray();
+  for (size_t i = 0; i < profiler.num_sites(); ++i) {
+    const LoopProfiler::Site& site = profiler.site(i);
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "site", site.name());
+    cJSON_AddNumberToObject(json, "slow", site.slow_count());
+    AddHistogramStats(json, "exec_", site.exec_us());
+    AddHistogramStats(json, "delay_", site.delay_us());
+    cJSON_AddItemToArray(sites, json);
+  }
+  cJSON_AddItemToObject(root, "sites", sites);
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+constexpr size_t ApiEndpoints::EventsEndpoint::kMaxConnections;
+
+ApiEndpoints::EventsEndpoint::EventsEndpoint(esp_cxx::EventManager* event_manager)
+  : event_manager_(event_manager),
+    streamer_(GetEventLogRing()) {
+}
+
+ApiEndpoints::EventsEndpoint::~EventsEndpoint() {
+  for (auto& connection : connections_) {
+    if (connection) {
+      streamer_.RemoveClient(&*connection);
+    }
+  }
+}
+
+void ApiEndpoints::EventsEndpoint::OnWebsocketConnect(StreamServer::Connection client) {
+  for (auto& connection : connections_) {
+    if (!connection) {
+      connection.emplace(client);
+      streamer_.AddClient(&*connection);
+      SchedulePublish();
+      return;
+    }
+  }
+  ESP_LOGW(kTag, "Rejecting /api/events client. %zu already connected.",
+           kMaxConnections);
+  rejected_++;
+  client.Close();
+}
+
+void ApiEndpoints::EventsEndpoint::OnClose(StreamServer::Connection client) {
+  for (auto& connection : connections_) {
+    if (connection && connection->connection() == client) {
+      // No-op if the streamer already evicted it.
+      streamer_.RemoveClient(&*connection);
+      connection.reset();
+      return;
+    }
+  }
+}
+
+void ApiEndpoints::EventsEndpoint::AddSink(EventStreamer::Sink* sink) {
+  streamer_.AddSink(sink);
+  SchedulePublish();
+}
+
+void ApiEndpoints::EventsEndpoint::SchedulePublish() {
+  if (!is_publish_scheduled_) {
+    is_publish_scheduled_ = true;
+    event_manager_->RunDelayed([this] { PublishBatch(); },
+                               kEventBatchIntervalMs);
+  }
+}
+
+void ApiEndpoints::EventsEndpoint::PublishBatch() {
+  streamer_.PublishBatch(EventLogTimestampMs());
+  if (streamer_.num_clients() == 0 && streamer_.num_sinks() == 0) {
+    // Evicted clients stay in |connections_| until their close arrives.
+    is_publish_scheduled_ = false;
+    return;
+  }
+  event_manager_->RunDelayed([this] { PublishBatch(); },
+                             kEventBatchIntervalMs);
+}
+
+// Replies in the form
+//   {"clients":1, "rejected":0, "batches":120, "events":900, "frames":120,
+//    "bytes":81000, "skipped":0, "evictions":0, "dropped":3,
+//    "drops":[{"tag":"hackvac:channel", "count":3}],
+//    "latency_count":900, "latency_min_us":0, "latency_max_us":51000,
+//    "latency_histogram":[[32768, 880], [65536, 20]]}
+// Latency is from when an event is logged to when its frame is queued on
+// the sockets, and only has millisecond resolution.
+void ApiEndpoints::EventStatsEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                              esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  const EventStreamer::Stats& stats = events_->streamer().stats();
+  cJSON* root = cJSON_CreateObject();
+  cJSON_AddNumberToObject(root, "clients", events_->streamer().num_clients());
+  cJSON_AddNumberToObject(root, "rejected", events_->rejected());
+  cJSON_AddNumberToObject(root, "batches", stats.batches);
+  cJSON_AddNumberToObject(root, "events", stats.events);
+  cJSON_AddNumberToObject(root, "frames", stats.frames_sent);
+  cJSON_AddNumberToObject(root, "bytes", stats.bytes_sent);
+  cJSON_AddNumberToObject(root, "skipped", stats.skipped);
+  cJSON_AddNumberToObject(root, "evictions", stats.evictions);
+  cJSON_AddNumberToObject(root, "dropped", GetEventLogRing()->total_drops());
+
+  LogRing::DropCount drop_counts[LogRing::kMaxDropTags + 1];
+  size_t num_drop_counts = GetEventLogDrops(drop_counts, std::size(drop_counts));
+  cJSON* drops = cJSON_CreateArray();
+  for (size_t i = 0; i < num_drop_counts; ++i) {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "tag", drop_counts[i].tag ? drop_counts[i].tag : "other");
+    cJSON_AddNumberToObject(json, "count", drop_counts[i].count);
+    cJSON_AddItemToArray(drops, json);
+  }
+  cJSON_AddItemToObject(root, "drops", drops);
+
+  AddHistogramStats(root, "latency_", stats.latency_us);
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+// PUT takes a list of {"tag":"chan", "rate":10, "burst":20, "sample":1}
+// for registered tags. A rate of 0 disables the token bucket and a sample
+// of 1 keeps every line, so all zeros removes the limit. Both GET and PUT
+// reply with every tag as
+//   [{"tag":"chan", "rate":10, "burst":20, "sample":1, "suppressed":42}]
+// where suppressed counts lines held back since the limit was set.
+void ApiEndpoints::LogLimitsEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                             esp_cxx::HttpResponse response) {
+  LogLimiter* limiter = LogLimiter::Get();
+  if (request.method() == esp_cxx::HttpMethod::kPut) {
+    std::string body(request.body());
+    cJSON* root = cJSON_Parse(body.c_str());
+    if (!cJSON_IsArray(root)) {
+      cJSON_Delete(root);
+      response.SendError(400, "Expected array of limits");
+      return;
+    }
+
+    // Validate everything before applying anything.
+    std::vector<std::pair<LogLimiter::Tag*, LogLimit>> limits;
+    const cJSON* item = nullptr;
+    cJSON_ArrayForEach(item, root) {
+      LogLimiter::Tag* tag;
+      LogLimit limit;
+      if (!ParseLogLimit(item, &tag, &limit)) {
+        cJSON_Delete(root);
+        response.SendError(400, "Invalid limit or unknown tag");
+        return;
+      }
+      limits.emplace_back(tag, limit);
+    }
+    cJSON_Delete(root);
+
+    for (const auto& entry : limits) {
+      LogLimiter::SetLimit(entry.first, entry.second);
+    }
+  } else if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  cJSON* root = cJSON_CreateArray();
+  for (size_t i = 0; i < limiter->num_tags(); ++i) {
+    const LogLimiter::Tag& tag = limiter->tag(i);
+    LogLimit limit = tag.limit();
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "tag", tag.name());
+    cJSON_AddNumberToObject(json, "rate", limit.rate_per_sec);
+    cJSON_AddNumberToObject(json, "burst", limit.burst);
+    cJSON_AddNumberToObject(json, "sample", limit.sample_every);
+    cJSON_AddNumberToObject(json, "suppressed", tag.suppressed());
+    cJSON_AddItemToArray(root, json);
+  }
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+constexpr size_t ApiEndpoints::CaptureEndpoint::kMaxConnections;
+constexpr size_t ApiEndpoints::CaptureEndpoint::kFrameSize;
+constexpr size_t ApiEndpoints::CaptureEndpoint::kWindowBytes;
+
+ApiEndpoints::CaptureEndpoint::CaptureEndpoint(esp_cxx::EventManager* event_manager,
+                                               PacketCapture* capture)
+  : event_manager_(event_manager),
+    capture_(capture) {
+}
+
+ApiEndpoints::CaptureEndpoint::~CaptureEndpoint() {
+  for (size_t i = 0; i < num_connections_; ++i) {
+    capture_->RemoveListener();
+  }
+}
+
+void ApiEndpoints::CaptureEndpoint::OnWebsocketConnect(StreamServer::Connection client) {
+  for (auto& connection : connections_) {
+    if (!connection) {
+      size_t header_size = PacketCapture::WriteHeader(frame_.data(), frame_.size());
+      client.SendBinary(frame_.data(), header_size);
+      connection = Connection{client};
+      num_connections_++;
+      capture_->AddListener();
+      if (!is_publish_scheduled_) {
+        is_publish_scheduled_ = true;
+        event_manager_->RunDelayed([this] { PublishBatch(); },
+                                   kEventBatchIntervalMs);
+      }
+      return;
+    }
+  }
+  ESP_LOGW(kTag, "Rejecting /api/capture client. %zu already connected.",
+           kMaxConnections);
+  client.Close();
+}
+
+void ApiEndpoints::CaptureEndpoint::OnClose(StreamServer::Connection client) {
+  for (auto& connection : connections_) {
+    if (connection && connection->client == client) {
+      connection.reset();
+      num_connections_--;
+      capture_->RemoveListener();
+      return;
+    }
+  }
+}
+
+void ApiEndpoints::CaptureEndpoint::PublishBatch() {
+  if (num_connections_ == 0) {
+    is_publish_scheduled_ = false;
+    return;
+  }
+
+  size_t frame_size = 0;
+  while (size_t len = capture_->WriteNextPacket(frame_.data() + frame_size,
+                                                frame_.size() - frame_size)) {
+    frame_size += len;
+  }
+  if (frame_size > 0) {
+    for (auto& connection : connections_) {
+      if (!connection || connection->is_closing) {
+        continue;
+      }
+      StreamServer::Connection& client = connection->client;
+      if (client.pending_bytes() + frame_size > kWindowBytes) {
+        // Stays counted until its close arrives.
+        ESP_LOGW(kTag, "Closing /api/capture client %zu bytes behind.",
+                 client.pending_bytes());
+        connection->is_closing = true;
+        client.Close();
+        continue;
+      }
+      client.SendBinary(frame_.data(), frame_size);
+    }
+  }
+  event_manager_->RunDelayed([this] { PublishBatch(); }, kEventBatchIntervalMs);
+}
+
+void ApiEndpoints::JournalEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                           esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+  PacketJournal* journal = capture_->journal();
+  if (!journal) {
+    response.SendError(404);
+    return;
+  }
+
+  std::string snapshot;
+  journal->Snapshot(&snapshot);
+  response.Send(200, snapshot.size(), kContentTypeBinary, snapshot);
+}
+
+void ApiEndpoints::HistoryEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                           esp_cxx::HttpResponse response) {
+  if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+  if (!flash_ring_) {
+    response.SendError(404);
+    return;
+  }
+
+  std::optional<long> sector = QueryNumber(request.query_string(), "sector");
+  if (!sector) {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "boot", flash_ring_->boot_number());
+    cJSON_AddNumberToObject(root, "sectors", flash_ring_->num_sectors());
+    cJSON_AddNumberToObject(root, "sector_size", FlashPartition::kSectorSize);
+    cJSON_AddNumberToObject(root, "pages_written", flash_ring_->pages_written());
+    cJSON_AddNumberToObject(root, "erases", flash_ring_->erases());
+    cJSON_AddNumberToObject(root, "dropped", flash_ring_->dropped());
+    SendJson(root, &response);
+    cJSON_Delete(root);
+    return;
+  }
+
+  if (*sector < 0 || static_cast<size_t>(*sector) >= flash_ring_->num_sectors()) {
+    response.SendError(400, "Bad sector");
+    return;
+  }
+  // So the newest records are included.
+  flash_ring_->Flush();
+  std::string contents(FlashPartition::kSectorSize, '\0');
+  if (!flash_ring_->ReadSector(*sector, reinterpret_cast<uint8_t*>(&contents[0]))) {
+    response.SendError(404);
+    return;
+  }
+  response.Send(200, contents.size(), kContentTypeBinary, contents);
+}
+
+void ApiEndpoints::UdpLogEndpoint::SetShipper(UdpLogShipper* shipper) {
+  shipper_ = shipper;
+  AttachIfOpen();
+}
+
+void ApiEndpoints::UdpLogEndpoint::AttachIfOpen() {
+  if (shipper_ && shipper_->is_open() && !is_attached_) {
+    is_attached_ = true;
+    events_->AddSink(shipper_);
+  }
+}
+
+void ApiEndpoints::UdpLogEndpoint::OnHttp(esp_cxx::HttpRequest request,
+                                          esp_cxx::HttpResponse response) {
+  if (!shipper_) {
+    response.SendError(404);
+    return;
+  }
+
+  if (request.method() == esp_cxx::HttpMethod::kPut) {
+    std::string body(request.body());
+    cJSON* root = cJSON_Parse(body.c_str());
+    if (!cJSON_IsObject(root)) {
+      cJSON_Delete(root);
+      response.SendError(400, "Expected object");
+      return;
+    }
+    const cJSON* host = cJSON_GetObjectItemCaseSensitive(root, "host");
+    const cJSON* port = cJSON_GetObjectItemCaseSensitive(root, "port");
+    const cJSON* rate = cJSON_GetObjectItemCaseSensitive(root, "rate");
+    const cJSON* burst = cJSON_GetObjectItemCaseSensitive(root, "burst");
+    if ((host && !cJSON_IsString(host)) ||
+        (port && (!cJSON_IsNumber(port) || port->valueint <= 0 || port->valueint > 65535)) ||
+        (rate && (!cJSON_IsNumber(rate) || rate->valueint <= 0 ||
+                  rate->valueint > static_cast<int>(UdpLogShipper::kMaxRate))) ||
+        (burst && (!cJSON_IsNumber(burst) || burst->valueint <= 0 ||
+                   burst->valueint > static_cast<int>(UdpLogShipper::kMaxRate)))) {
+      cJSON_Delete(root);
+      response.SendError(400, "Invalid host, port, rate or burst");
+      return;
+    }
+
+    if (rate || burst) {
+      shipper_->SetRate(rate ? rate->valueint : shipper_->config().datagrams_per_sec,
+                        burst ? burst->valueint : shipper_->config().burst);
+    }
+    if (host || port) {
+      std::string new_host = host ? host->valuestring : shipper_->host();
+      uint16_t new_port = port ? port->valueint : shipper_->port();
+      if (!shipper_->Open(new_host, new_port)) {
+        cJSON_Delete(root);
+        response.SendError(400, "Cannot open host");
+        return;
+      }
+      AttachIfOpen();
+    }
+    cJSON_Delete(root);
+  } else if (request.method() != esp_cxx::HttpMethod::kGet) {
+    response.SendError(405);
+    return;
+  }
+
+  const UdpLogShipper::Stats& stats = shipper_->stats();
+  cJSON* root = cJSON_CreateObject();
+  cJSON_AddItemToObject(root, "open", cJSON_CreateBool(shipper_->is_open()));
+  cJSON_AddStringToObject(root, "host", shipper_->host().c_str());
+  cJSON_AddNumberToObject(root, "port", shipper_->port());
+  cJSON_AddNumberToObject(root, "rate", shipper_->config().datagrams_per_sec);
+  cJSON_AddNumberToObject(root, "burst", shipper_->config().burst);
+  cJSON_AddNumberToObject(root, "records", stats.records);
+  cJSON_AddNumberToObject(root, "datagrams", stats.datagrams_sent);
+  cJSON_AddNumberToObject(root, "bytes", stats.bytes_sent);
+  cJSON_AddNumberToObject(root, "send_errors", stats.send_errors);
+  cJSON_AddNumberToObject(root, "datagrams_dropped", stats.datagrams_dropped);
+  cJSON_AddNumberToObject(root, "records_dropped", stats.records_dropped);
+  cJSON_AddNumberToObject(root, "queued", shipper_->num_queued());
+  SendJson(root, &response);
+  cJSON_Delete(root);
+}
+
+}  // namespace hackvac
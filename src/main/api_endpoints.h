@@ -0,0 +1,291 @@
+#ifndef API_ENDPOINTS_H_
+#define API_ENDPOINTS_H_
+
+#include <array>
+#include <optional>
+
+#include "event_log.h"
+#include "event_streamer.h"
+#include "flash_ring.h"
+#include "packet_capture.h"
+#include "settings_handler.h"
+#include "stream_server.h"
+#include "udp_log_shipper.h"
+
+#include "esp_cxx/event_manager.h"
+#include "esp_cxx/httpd/http_server.h"
+
+namespace hackvac {
+
+class Controller;
+
+// HTTP endpoints for inspecting and controlling the Controller. These sit
+// beside esp_cxx's StandardEndpoints which handle index, firmware, and wifi
+// configuration. The ones that hold their connection open are served by a
+// StreamServer on its own port instead.
+//
+// All handlers run on the network task. They must only use the
+// Controller's thread-safe API.
+//
+//   /api/settings - GET/PUT effective settings with ETag and long-poll.
+//                   StreamServer.
+//   /api/events - websocket of batched log events. StreamServer.
+//   /api/event_stats - GET /api/events throughput, latency, and drops.
+//   /api/log_limits - GET/PUT hot path log rate limits and sampling.
+//   /api/capture - websocket of CN105 packets as pcapng. StreamServer.
+//   /api/journal - GET compressed packet history.
+//   /api/history - GET history kept in flash across reboots.
+//   /api/udp_log - GET/PUT UDP log shipping destination, rate and counters.
+//   /api/rewrite_rules - GET/PUT list of passthru RewriteRules.
+//   /api/rtt - GET per-command round trip stats.
+//   /api/shadow - GET desired vs reported settings and pending fields.
+//   /api/boot - GET when each boot milestone was reached.
+//   /api/jitter - GET scheduling latency of the controller task.
+//   /api/loop - GET per call site profile of the controller task.
+class ApiEndpoints {
+ public:
+  // |net_event_manager| runs the HTTP server and is used to schedule
+  // /api/events and /api/capture batches. |packet_capture| must be the
+  // Controller's packet logger or in front of it. |flash_ring| may be null
+  // if the history partition is missing.
+  ApiEndpoints(Controller* controller, esp_cxx::EventManager* net_event_manager,
+               PacketCapture* packet_capture, FlashRing* flash_ring);
+  ~ApiEndpoints();
+
+  void RegisterEndpoints(esp_cxx::HttpServer* server, StreamServer* stream_server);
+
+  // Serves |shipper|'s settings at /api/udp_log and, once it is open,
+  // feeds it from the event log ring alongside /api/events. Not owned.
+  void SetUdpLogShipper(UdpLogShipper* shipper);
+
+ private:
+  class RewriteRulesEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit RewriteRulesEndpoint(Controller* controller) : controller_(controller) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    Controller* controller_;
+  };
+
+  // Serves a SettingsHandler. Requests it holds are forgotten when their
+  // connection closes.
+  class SettingsEndpoint : public StreamServer::Endpoint {
+   public:
+    SettingsEndpoint(Controller* controller, esp_cxx::EventManager* event_manager);
+
+    void OnHttp(const StreamServer::Request& request,
+                StreamServer::Connection client) override;
+    void OnClose(StreamServer::Connection client) override;
+
+   private:
+    SettingsHandler<StreamServer::Connection> handler_;
+  };
+
+  class RttEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit RttEndpoint(Controller* controller) : controller_(controller) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    Controller* controller_;
+  };
+
+  class ShadowEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit ShadowEndpoint(Controller* controller) : controller_(controller) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    Controller* controller_;
+  };
+
+  class BootEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+  };
+
+  class JitterEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit JitterEndpoint(Controller* controller) : controller_(controller) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    Controller* controller_;
+  };
+
+  class LoopEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit LoopEndpoint(Controller* controller) : controller_(controller) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    Controller* controller_;
+  };
+
+  // Sends the event log to websocket clients as batched JSON frames every
+  // HACKVAC_EVENT_BATCH_INTERVAL_MS (see Kconfig.projbuild) while any are
+  // connected. Frames look like
+  //   {"now":5120, "missed":0, "events":[{"n":17, "t":5101, "m":"I (5101) ..."}]}
+  // where "now" and "t" are ms since boot and "missed" counts events this
+  // client skipped because its socket was backed up.
+  class EventsEndpoint : public StreamServer::Endpoint {
+   public:
+    explicit EventsEndpoint(esp_cxx::EventManager* event_manager);
+    ~EventsEndpoint() override;
+
+    void OnWebsocketConnect(StreamServer::Connection client) override;
+    void OnClose(StreamServer::Connection client) override;
+
+    // Batches also go to |sink| from now on, clients or not.
+    void AddSink(EventStreamer::Sink* sink);
+
+    const EventStreamer& streamer() const { return streamer_; }
+    uint32_t rejected() const { return rejected_; }
+
+   private:
+    // Each websocket costs a Mongoose send buffer up to the window size.
+    static constexpr size_t kMaxConnections = 4;
+
+    class Connection : public EventStreamer::Client {
+     public:
+      explicit Connection(StreamServer::Connection connection) : connection_(connection) {}
+
+      void SendFrame(const std::string& frame) override { connection_.SendText(frame); }
+      size_t pending_bytes() const override { return connection_.pending_bytes(); }
+      void Close() override { connection_.Close(); }
+
+      const StreamServer::Connection& connection() const { return connection_; }
+
+     private:
+      StreamServer::Connection connection_;
+    };
+
+    void SchedulePublish();
+
+    // Publishes one batch and reschedules itself while clients or sinks
+    // remain.
+    void PublishBatch();
+
+    esp_cxx::EventManager* event_manager_;
+    EventStreamer streamer_;
+    std::array<std::optional<Connection>, kMaxConnections> connections_;
+    bool is_publish_scheduled_ = false;
+    uint32_t rejected_ = 0;
+  };
+
+  class EventStatsEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit EventStatsEndpoint(const EventsEndpoint* events) : events_(events) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    const EventsEndpoint* events_;
+  };
+
+  class LogLimitsEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+  };
+
+  // Replies with the shipper's destination, rate and counters as
+  //   {"open":true, "host":"192.168.1.10", "port":5140, "rate":10, "burst":10,
+  //    "records":900, "datagrams":40, "bytes":52000, "send_errors":0,
+  //    "datagrams_dropped":0, "records_dropped":0, "queued":0}
+  // PUT takes any of "host" and "port", which reopen the socket, and
+  // "rate" and "burst" in datagrams per second.
+  //
+  // Log records are only captured and rendered for the shipper after it
+  // first opens, so an unconfigured unit pays nothing.
+  class UdpLogEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit UdpLogEndpoint(EventsEndpoint* events) : events_(events) {}
+    void SetShipper(UdpLogShipper* shipper);
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    void AttachIfOpen();
+
+    EventsEndpoint* events_;
+    UdpLogShipper* shipper_ = nullptr;
+    bool is_attached_ = false;
+  };
+
+  // Streams captured packets to websocket clients as binary frames. The
+  // first frame is the pcapng header and every later frame holds whole
+  // blocks, so the frames concatenated are a valid pcapng file. A client
+  // that falls a window behind is closed rather than handed a capture with
+  // silent holes.
+  class CaptureEndpoint : public StreamServer::Endpoint {
+   public:
+    CaptureEndpoint(esp_cxx::EventManager* event_manager, PacketCapture* capture);
+    ~CaptureEndpoint() override;
+
+    void OnWebsocketConnect(StreamServer::Connection client) override;
+    void OnClose(StreamServer::Connection client) override;
+
+   private:
+    static constexpr size_t kMaxConnections = 2;
+    static constexpr size_t kFrameSize = 1024;
+    static constexpr size_t kWindowBytes = 8192;
+
+    struct Connection {
+      StreamServer::Connection client;
+      bool is_closing = false;
+    };
+
+    // Sends one frame of queued packets and reschedules itself while
+    // clients remain.
+    void PublishBatch();
+
+    esp_cxx::EventManager* event_manager_;
+    PacketCapture* capture_;
+    std::array<std::optional<Connection>, kMaxConnections> connections_;
+    size_t num_connections_ = 0;
+    bool is_publish_scheduled_ = false;
+    std::array<uint8_t, kFrameSize> frame_;
+  };
+
+  // Replies with PacketJournal::Snapshot(). Decode with journal.py.
+  class JournalEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit JournalEndpoint(PacketCapture* capture) : capture_(capture) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    PacketCapture* capture_;
+  };
+
+  // Without a query, replies with the FlashRing's layout and counters as
+  // json. With ?sector=N, flushes and replies with the raw sector N, oldest
+  // first, or 404 if that sector is empty. Decode with history.py.
+  class HistoryEndpoint : public esp_cxx::HttpServer::Endpoint {
+   public:
+    explicit HistoryEndpoint(FlashRing* flash_ring) : flash_ring_(flash_ring) {}
+    void OnHttp(esp_cxx::HttpRequest request, esp_cxx::HttpResponse response) override;
+
+   private:
+    FlashRing* flash_ring_;
+  };
+
+  SettingsEndpoint settings_endpoint_;
+  RewriteRulesEndpoint rewrite_rules_endpoint_;
+  RttEndpoint rtt_endpoint_;
+  ShadowEndpoint shadow_endpoint_;
+  BootEndpoint boot_endpoint_;
+  JitterEndpoint jitter_endpoint_;
+  LoopEndpoint loop_endpoint_;
+  // Before |events_endpoint_| so it outlives the streamer holding it.
+  ConsoleLogSink console_sink_;
+  EventsEndpoint events_endpoint_;
+  EventStatsEndpoint event_stats_endpoint_;
+  LogLimitsEndpoint log_limits_endpoint_;
+  CaptureEndpoint capture_endpoint_;
+  JournalEndpoint journal_endpoint_;
+  HistoryEndpoint history_endpoint_;
+  UdpLogEndpoint udp_log_endpoint_;
+};
+
+}  // namespace hackvac
+
+#endif  // API_ENDPOINTS_H_
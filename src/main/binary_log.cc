@@ -0,0 +1,460 @@
+#include "binary_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace hackvac {
+
+namespace {
+
+// How a conversion's argument is stored.
+enum class ArgKind : uint8_t {
+  kNone,  // %% and %n.
+  kInt,
+  kLong,
+  kLongLong,
+  kSize,
+  kIntMax,
+  kPtrDiff,
+  kDouble,
+  kLongDouble,
+  kPointer,
+  kString,
+};
+
+// One conversion in a format string.
+struct Conversion {
+  const char* start;   // The '%'.
+  const char* end;     // One past the conversion character.
+  int num_stars = 0;   // '*' width or precision, each an int argument.
+  ArgKind kind = ArgKind::kNone;
+};
+
+// Parses the conversion starting at |percent|.
+Conversion ParseConversion(const char* percent) {
+  Conversion conversion;
+  conversion.start = percent;
+  const char* p = percent + 1;
+  while (*p && strchr("-+ #0", *p)) {
+    ++p;
+  }
+  if (*p == '*') {
+    conversion.num_stars++;
+    ++p;
+  }
+  while (*p >= '0' && *p <= '9') {
+    ++p;
+  }
+  if (*p == '.') {
+    ++p;
+    if (*p == '*') {
+      conversion.num_stars++;
+      ++p;
+    }
+    while (*p >= '0' && *p <= '9') {
+      ++p;
+    }
+  }
+
+  enum { kDefault, kL, kLL, kZ, kJ, kT, kBigL } length = kDefault;
+  for (bool done = false; !done && *p;) {
+    switch (*p) {
+      case 'h':
+        ++p;
+        break;
+      case 'l':
+        length = length == kL ? kLL : kL;
+        ++p;
+        break;
+      case 'z':
+        length = kZ;
+        ++p;
+        break;
+      case 'j':
+        length = kJ;
+        ++p;
+        break;
+      case 't':
+        length = kT;
+        ++p;
+        break;
+      case 'L':
+        length = kBigL;
+        ++p;
+        break;
+      default:
+        done = true;
+    }
+  }
+
+  switch (*p) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+      switch (length) {
+        case kL: conversion.kind = ArgKind::kLong; break;
+        case kLL: conversion.kind = ArgKind::kLongLong; break;
+        case kZ: conversion.kind = ArgKind::kSize; break;
+        case kJ: conversion.kind = ArgKind::kIntMax; break;
+        case kT: conversion.kind = ArgKind::kPtrDiff; break;
+        default: conversion.kind = ArgKind::kInt; break;
+      }
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      conversion.kind = length == kBigL ? ArgKind::kLongDouble : ArgKind::kDouble;
+      break;
+    case 'p':
+      conversion.kind = ArgKind::kPointer;
+      break;
+    case 's':
+      conversion.kind = ArgKind::kString;
+      break;
+    case 'n':
+      // Consumes a pointer but writes nothing useful here.
+      conversion.kind = ArgKind::kPointer;
+      break;
+    default:
+      // '%' or malformed. No argument.
+      break;
+  }
+  conversion.end = *p ? p + 1 : p;
+  return conversion;
+}
+
+// Appends raw bytes to the argument area.
+class ArgWriter {
+ public:
+  ArgWriter(uint8_t* buf, size_t size) : buf_(buf), size_(size) {}
+
+  template <typename T>
+  bool Write(T value) {
+    return WriteBytes(&value, sizeof(value));
+  }
+
+  bool WriteString(const char* str) {
+    if (!str) {
+      str = "(null)";
+    }
+    size_t len = strnlen(str, kMaxLogStringArg);
+    if (used_ + 1 + len > size_) {
+      return false;
+    }
+    buf_[used_++] = static_cast<uint8_t>(len);
+    memcpy(buf_ + used_, str, len);
+    used_ += len;
+    return true;
+  }
+
+  size_t used() const { return used_; }
+
+ private:
+  bool WriteBytes(const void* bytes, size_t len) {
+    if (used_ + len > size_) {
+      return false;
+    }
+    memcpy(buf_ + used_, bytes, len);
+    used_ += len;
+    return true;
+  }
+
+  uint8_t* buf_;
+  size_t size_;
+  size_t used_ = 0;
+};
+
+// Reads back what ArgWriter wrote.
+class ArgReader {
+ public:
+  ArgReader(const uint8_t* buf, size_t size) : buf_(buf), size_(size) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (pos_ + sizeof(T) > size_) {
+      return false;
+    }
+    memcpy(value, buf_ + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  // Copies a string into |out|, which holds kMaxLogStringArg + 1.
+  bool ReadString(char* out) {
+    if (pos_ >= size_) {
+      return false;
+    }
+    size_t len = buf_[pos_];
+    if (pos_ + 1 + len > size_ || len > kMaxLogStringArg) {
+      return false;
+    }
+    memcpy(out, buf_ + pos_ + 1, len);
+    out[len] = '\0';
+    pos_ += 1 + len;
+    return true;
+  }
+
+ private:
+  const uint8_t* buf_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+// Appends printf output to a fixed buffer, tracking the full length.
+class TextWriter {
+ public:
+  TextWriter(char* out, size_t size) : out_(out), size_(size) {
+    if (size_) {
+      out_[0] = '\0';
+    }
+  }
+
+  void Append(const char* text, size_t len) {
+    if (length_ + 1 < size_) {
+      size_t fits = std::min(len, size_ - 1 - length_);
+      memcpy(out_ + length_, text, fits);
+      out_[length_ + fits] = '\0';
+    }
+    length_ += len;
+  }
+
+  template <typename... Args>
+  void Printf(const char* spec, Args... args) {
+    char* dest = length_ < size_ ? out_ + length_ : nullptr;
+    size_t room = length_ < size_ ? size_ - length_ : 0;
+    int written = snprintf(dest, room, spec, args...);
+    if (written > 0) {
+      length_ += written;
+    }
+  }
+
+  size_t length() const { return length_; }
+
+ private:
+  char* out_;
+  size_t size_;
+  size_t length_ = 0;
+};
+
+// Prints one argument with up to two star values in front of it.
+template <typename T>
+void PrintWithStars(TextWriter* text, const char* spec, int num_stars,
+                    const int* stars, T value) {
+  switch (num_stars) {
+    case 0:
+      text->Printf(spec, value);
+      break;
+    case 1:
+      text->Printf(spec, stars[0], value);
+      break;
+    default:
+      text->Printf(spec, stars[0], stars[1], value);
+      break;
+  }
+}
+
+// Reads one |T| and prints it, or only skips it if |text| is null. Returns
+// false if the arguments ran out.
+template <typename T>
+bool PrintArg(ArgReader* args, TextWriter* text, const char* spec, int num_stars,
+              const int* stars) {
+  T value;
+  if (!args->Read(&value)) {
+    return false;
+  }
+  if (text) {
+    PrintWithStars(text, spec, num_stars, stars, value);
+  }
+  return true;
+}
+
+}  // namespace
+
+char LogFormatLevel(const char* format) {
+  const char* p = format;
+  if (p[0] == '\033' && p[1] == '[') {
+    p = strchr(p, 'm');
+    if (!p) {
+      return 'I';
+    }
+    ++p;
+  }
+  return *p && strchr("EWIDV", *p) ? *p : 'I';
+}
+
+size_t EncodeLogRecord(uint32_t sequence, uint32_t time_ms, const char* format,
+                       va_list args, uint8_t* buf, size_t size, uint8_t flags) {
+  if (size < sizeof(LogRecordHeader)) {
+    return 0;
+  }
+
+  LogRecordHeader header = {};
+  header.sequence = sequence;
+  header.time_ms = time_ms;
+  header.format = format;
+
+  ArgWriter writer(buf + sizeof(header), size - sizeof(header));
+  bool fits = true;
+  for (const char* p = format; fits && (p = strchr(p, '%'));) {
+    Conversion conversion = ParseConversion(p);
+    p = conversion.end;
+    for (int i = 0; fits && i < conversion.num_stars; ++i) {
+      fits = writer.Write(va_arg(args, int));
+    }
+    if (!fits) {
+      break;
+    }
+    switch (conversion.kind) {
+      case ArgKind::kNone:
+        break;
+      case ArgKind::kInt:
+        fits = writer.Write(va_arg(args, int));
+        break;
+      case ArgKind::kLong:
+        fits = writer.Write(va_arg(args, long));
+        break;
+      case ArgKind::kLongLong:
+        fits = writer.Write(va_arg(args, long long));
+        break;
+      case ArgKind::kSize:
+        fits = writer.Write(va_arg(args, size_t));
+        break;
+      case ArgKind::kIntMax:
+        fits = writer.Write(va_arg(args, intmax_t));
+        break;
+      case ArgKind::kPtrDiff:
+        fits = writer.Write(va_arg(args, ptrdiff_t));
+        break;
+      case ArgKind::kDouble:
+        fits = writer.Write(va_arg(args, double));
+        break;
+      case ArgKind::kLongDouble:
+        fits = writer.Write(va_arg(args, long double));
+        break;
+      case ArgKind::kPointer:
+        fits = writer.Write(va_arg(args, void*));
+        break;
+      case ArgKind::kString: {
+        const char* str = va_arg(args, const char*);
+        if (!header.tag) {
+          header.tag = str;
+        }
+        fits = writer.WriteString(str);
+        break;
+      }
+    }
+  }
+
+  header.args_size = static_cast<uint16_t>(writer.used());
+  header.flags = flags | (fits ? 0 : kLogRecordTruncated);
+  memcpy(buf, &header, sizeof(header));
+  return sizeof(header) + writer.used();
+}
+
+bool ReadLogRecordHeader(const uint8_t* record, size_t size, LogRecordHeader* header) {
+  if (size < sizeof(LogRecordHeader)) {
+    return false;
+  }
+  memcpy(header, record, sizeof(LogRecordHeader));
+  return sizeof(LogRecordHeader) + header->args_size <= size;
+}
+
+size_t RenderLogRecord(const uint8_t* record, size_t size, char* out, size_t out_size) {
+  TextWriter text(out, out_size);
+  LogRecordHeader header;
+  if (!ReadLogRecordHeader(record, size, &header) || !header.format) {
+    text.Append("<bad record>", 12);
+    return text.length();
+  }
+
+  ArgReader args(record + sizeof(header), header.args_size);
+  const char* p = header.format;
+  while (*p) {
+    const char* percent = strchr(p, '%');
+    if (!percent) {
+      text.Append(p, strlen(p));
+      break;
+    }
+    text.Append(p, percent - p);
+
+    Conversion conversion = ParseConversion(percent);
+    p = conversion.end;
+    if (conversion.kind == ArgKind::kNone) {
+      if (*(conversion.end - 1) == '%') {
+        text.Append("%", 1);
+      }
+      continue;
+    }
+
+    // Copy the spec out so it can be handed to snprintf on its own. One too
+    // long for |spec| is shown as written, but its arguments are still read
+    // past so the conversions after it get their own.
+    char spec[16];
+    size_t spec_len = conversion.end - conversion.start;
+    TextWriter* arg_text = &text;
+    if (spec_len >= sizeof(spec)) {
+      text.Append(conversion.start, spec_len);
+      arg_text = nullptr;
+    } else {
+      memcpy(spec, conversion.start, spec_len);
+      spec[spec_len] = '\0';
+    }
+
+    int stars[2] = {};
+    bool ok = true;
+    for (int i = 0; ok && i < conversion.num_stars; ++i) {
+      ok = args.Read(&stars[i]);
+    }
+    if (ok) {
+      switch (conversion.kind) {
+        case ArgKind::kNone:
+          break;
+        case ArgKind::kInt:
+          ok = PrintArg<int>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kLong:
+          ok = PrintArg<long>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kLongLong:
+          ok = PrintArg<long long>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kSize:
+          ok = PrintArg<size_t>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kIntMax:
+          ok = PrintArg<intmax_t>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kPtrDiff:
+          ok = PrintArg<ptrdiff_t>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kDouble:
+          ok = PrintArg<double>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kLongDouble:
+          ok = PrintArg<long double>(&args, arg_text, spec, conversion.num_stars, stars);
+          break;
+        case ArgKind::kPointer:
+          if (*(conversion.end - 1) == 'n') {
+            void* ignored;
+            ok = args.Read(&ignored);
+          } else {
+            ok = PrintArg<void*>(&args, arg_text, spec, conversion.num_stars, stars);
+          }
+          break;
+        case ArgKind::kString: {
+          char str[kMaxLogStringArg + 1];
+          ok = args.ReadString(str);
+          if (ok && arg_text) {
+            PrintWithStars<const char*>(arg_text, spec, conversion.num_stars, stars, str);
+          }
+          break;
+        }
+      }
+    }
+
+    if (!ok) {
+      text.Append("...", 3);
+      break;
+    }
+  }
+  return text.length();
+}
+
+}  // namespace hackvac
@@ -0,0 +1,63 @@
+#ifndef BINARY_LOG_H_
+#define BINARY_LOG_H_
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+
+namespace hackvac {
+
+// Compact binary form of a printf-style log line. Rendering a line costs a
+// vsnprintf() and a few hundred bytes of stack on whichever task logged it.
+// EncodeLogRecord() instead keeps the format string pointer and copies the
+// raw argument bytes. RenderLogRecord() does the formatting later, on the
+// task publishing the log.
+//
+// Format strings must outlive the record, as string literals do. %s
+// arguments are copied, up to kMaxLogStringArg bytes, since they often point
+// into the caller's stack.
+//
+// A record is a LogRecordHeader followed by |args_size| bytes of arguments
+// in format order. Integers, floats and pointers are stored at their
+// promoted size; strings are a length byte then the bytes. Nothing is
+// aligned. Read the header with memcpy.
+struct LogRecordHeader {
+  uint32_t sequence;
+  uint32_t time_ms;
+  const char* format;
+
+  // The first %s argument, which for esp_log lines is the tag. Pointer to
+  // the caller's string, not the copy, so only valid as an identity.
+  const char* tag;
+
+  uint16_t args_size;
+  uint8_t flags;
+};
+
+// Set when arguments did not fit. Rendering stops at the first missing one.
+constexpr uint8_t kLogRecordTruncated = 0x01;
+
+// Set by the logger when it already wrote the line to the console itself.
+constexpr uint8_t kLogRecordOnConsole = 0x02;
+
+constexpr size_t kMaxLogStringArg = 48;
+
+// The esp_log level letter ('E', 'W', 'I', 'D' or 'V') of |format|, after any
+// color escape. 'I' for formats that do not start with one.
+char LogFormatLevel(const char* format);
+
+// Encodes a record into |buf| and returns its size, or 0 if |size| cannot
+// hold even the header. |flags| are added to the header's.
+size_t EncodeLogRecord(uint32_t sequence, uint32_t time_ms, const char* format,
+                       va_list args, uint8_t* buf, size_t size, uint8_t flags = 0);
+
+// Reads the header of |record|. Returns false if |size| is too small.
+bool ReadLogRecordHeader(const uint8_t* record, size_t size, LogRecordHeader* header);
+
+// Renders |record| as text into |out| with snprintf() semantics: the return
+// is the length the full text needs and |out| is always terminated.
+size_t RenderLogRecord(const uint8_t* record, size_t size, char* out, size_t out_size);
+
+}  // namespace hackvac
+
+#endif  // BINARY_LOG_H_
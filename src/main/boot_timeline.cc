@@ -0,0 +1,85 @@
+#include "boot_timeline.h"
+
+#include "esp_cxx/logging.h"
+
+#ifndef FAKE_ESP_IDF
+#include "esp_timer.h"
+#else
+#include <chrono>
+#endif
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "boot";
+
+}  // namespace
+
+constexpr size_t BootTimeline::kNumMilestones;
+
+BootTimeline* BootTimeline::Get() {
+  static BootTimeline timeline;
+  return &timeline;
+}
+
+void BootTimeline::Mark(BootMilestone milestone) {
+  std::atomic<int64_t>& slot = times_[static_cast<size_t>(milestone)];
+  if (slot.load(std::memory_order_relaxed) != 0) {
+    return;
+  }
+
+  // Never store 0 as it means unreached.
+  int64_t now = NowUs();
+  if (now == 0) {
+    now = 1;
+  }
+  int64_t unreached = 0;
+  if (slot.compare_exchange_strong(unreached, now, std::memory_order_relaxed)) {
+    ESP_LOGI(kTag, "%s at %lldms", MilestoneName(milestone),
+             static_cast<long long>(now / 1000));
+  }
+}
+
+const char* BootTimeline::MilestoneName(BootMilestone milestone) {
+  switch (milestone) {
+    case BootMilestone::kNvsReady:
+      return "nvs_ready";
+    case BootMilestone::kControllerStarted:
+      return "controller_started";
+    case BootMilestone::kHvacConnected:
+      return "hvac_connected";
+    case BootMilestone::kHvacFirstInfoAck:
+      return "hvac_first_info_ack";
+    case BootMilestone::kTstatFirstInfoAck:
+      return "tstat_first_info_ack";
+    case BootMilestone::kWifiUp:
+      return "wifi_up";
+    case BootMilestone::kHttpServing:
+      return "http_serving";
+  }
+  return "unknown";
+}
+
+void BootTimeline::LogSummary() const {
+  for (size_t i = 0; i < kNumMilestones; ++i) {
+    BootMilestone milestone = static_cast<BootMilestone>(i);
+    int64_t us = time_us(milestone);
+    if (us) {
+      ESP_LOGI(kTag, "  %-22s %8lldms", MilestoneName(milestone),
+               static_cast<long long>(us / 1000));
+    }
+  }
+}
+
+int64_t BootTimeline::NowUs() {
+#ifndef FAKE_ESP_IDF
+  return esp_timer_get_time();
+#else
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+#endif
+}
+
+}  // namespace hackvac
@@ -0,0 +1,59 @@
+#ifndef BOOT_TIMELINE_H_
+#define BOOT_TIMELINE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace hackvac {
+
+// Milestones of the boot sequence, roughly in the order they are expected.
+// The network and the CN105 link come up in parallel so the two groups may
+// interleave.
+enum class BootMilestone : uint8_t {
+  kNvsReady,           // NVS initialized. Settings are not restored yet.
+  kControllerStarted,  // Settings restored, controller task running and
+                       // channels started.
+  kHvacConnected,      // First ConnectAck from the heat pump.
+  kHvacFirstInfoAck,   // First settings report from the heat pump.
+  kTstatFirstInfoAck,  // First reply served to the thermostat.
+  kWifiUp,             // Station associated or setup network created.
+  kHttpServing,        // HTTP server and API endpoints registered.
+};
+
+// Records when each BootMilestone was first reached, in microseconds since
+// the chip started. Safe to call from any task. Only the first Mark() of a
+// milestone sticks so callers on hot paths need no bookkeeping of their own.
+class BootTimeline {
+ public:
+  static constexpr size_t kNumMilestones = 7;
+
+  // The timeline for this boot.
+  static BootTimeline* Get();
+
+  // Records |milestone| as reached now, if it has not been already.
+  void Mark(BootMilestone milestone);
+
+  // Microseconds since boot at which |milestone| was reached, or 0 if it
+  // has not been.
+  int64_t time_us(BootMilestone milestone) const {
+    return times_[static_cast<size_t>(milestone)].load(std::memory_order_relaxed);
+  }
+
+  // Short stable name for use in logs and JSON.
+  static const char* MilestoneName(BootMilestone milestone);
+
+  // Logs every milestone reached so far.
+  void LogSummary() const;
+
+ private:
+  // The time source. On device this is esp_timer_get_time().
+  static int64_t NowUs();
+
+  std::array<std::atomic<int64_t>, kNumMilestones> times_{};
+};
+
+}  // namespace hackvac
+
+#endif  // BOOT_TIMELINE_H_
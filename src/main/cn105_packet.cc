@@ -2,15 +2,28 @@
 
 #include "esp_cxx/logging.h"
 
+#include "log_limiter.h"
+
 namespace hackvac {
 
+namespace {
+
+constexpr char kPacketTag[] = "hi";
+
+// Hex dump of every logged packet. Bad packet reports are never limited.
+// See /api/log_limits.
+LogLimiter::Tag* const g_hex_log =
+    LogLimiter::Get()->AddTag(kPacketTag, kHotPathLogLimit);
+
+}  // namespace
+
 Cn105Packet::Cn105Packet()
   : bytes_({}) {
 }
 
 Cn105Packet::~Cn105Packet() = default;
 
-std::unique_ptr<Cn105Packet> Cn105Packet::Clone() {
+std::unique_ptr<Cn105Packet> Cn105Packet::Clone() const {
   auto packet = std::make_unique<Cn105Packet>();
   packet->bytes_read_ = bytes_read_;
   packet->bytes_ = bytes_;
@@ -65,6 +78,15 @@ bool Cn105Packet::IsChecksumValid() {
     bytes_.at(packet_size() - 1);
 }
 
+void Cn105Packet::UpdateChecksum() {
+  if (IsJunk() || !IsComplete()) {
+    return;
+  }
+
+  bytes_.at(packet_size() - 1) =
+    CalculateChecksum(bytes_.data(), packet_size() - 1);
+}
+
 uint8_t Cn105Packet::CalculateChecksum(const uint8_t* bytes, size_t size) {
   uint32_t checksum = 0xfc;
   for (size_t i = 0; i < size; ++i) {
@@ -100,11 +122,13 @@ void Cn105Packet::LogPacketThunk(std::unique_ptr<Cn105Packet> packet) {
 
 void Cn105Packet::DebugLog() {
   //      ESP_LOGI("hi", "%s %d bytes", dir == PacketDirection::kTx ? "tx" : "rx", packet->packet_size());
-  ESP_LOG_BUFFER_HEX_LEVEL("hi", raw_bytes(), raw_bytes_size(), ESP_LOG_INFO);
+  if (g_hex_log->Allow()) {
+    ESP_LOG_BUFFER_HEX_LEVEL(kPacketTag, raw_bytes(), raw_bytes_size(), ESP_LOG_INFO);
+  }
   // TODO(awong): Print timestamp.
   if ((packet_size() > 0) &&
       (IsJunk() || !IsComplete() || !IsChecksumValid())) {
-    ESP_LOGI("hi", "Bad packet. junk: %d complete %d expected checksum %x actual %x",
+    ESP_LOGI(kPacketTag, "Bad packet. junk: %d complete %d expected checksum %x actual %x",
              IsJunk(),
              IsComplete(),
              IsHeaderComplete() ? CalculateChecksum(raw_bytes(), packet_size() - 1) : 0,
@@ -87,7 +87,7 @@ class Cn105Packet {
 
     // Makes a copy of the current packet. Mostly useful to pass to the
     // logging system in edge cases.
-    std::unique_ptr<Cn105Packet> Clone();
+    std::unique_ptr<Cn105Packet> Clone() const;
 
     // Prints a packet to the ESP log stream.
     void DebugLog();
@@ -125,6 +125,11 @@ class Cn105Packet {
     std::string_view data_str() const { return {reinterpret_cast<const char*>(&bytes_[kDataStartPos]), data_size()}; }
     size_t packet_size() const { return kHeaderLength + data_size() + kChecksumSize; }
 
+    // Receive error counters. See IncrementErrorCount() and
+    // IncrementUnexpectedEventCount().
+    uint16_t error_count() const { return error_count_; }
+    uint16_t unexpected_event_count() const { return unexpected_event_count_; }
+
 
     //
     // Packet Building functions. Typically used when populating a default
@@ -157,6 +162,10 @@ class Cn105Packet {
     // Verifies the checksum on the packet.
     bool IsChecksumValid();
 
+    // Recomputes the checksum byte after data() has been modified. No-op
+    // unless IsComplete().
+    void UpdateChecksum();
+
     // Returns number of bytes that should be read next.
     size_t NextChunkSize() const;
 
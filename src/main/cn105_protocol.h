@@ -85,6 +85,8 @@ class UpdatePacket {
     return packet;
   };
 
+  CommandType type() const { return static_cast<CommandType>(packet_->data()[0]); }
+
   // TODO(awong): These need to be optionals I think.
   HvacSettings settings() { return HvacSettings(packet_->data()); }
   ExtendedSettings extended_settings() { return ExtendedSettings(packet_->data()); }
@@ -140,7 +142,7 @@ class InfoAckPacket {
   static std::unique_ptr<Cn105Packet> Create(const StoredHvacSettings& settings) {
     auto data = settings.encoded_bytes();
     data[0] = static_cast<uint8_t>(CommandType::kSettings);
-    return std::make_unique<Cn105Packet>(PacketType::kInfoAck, settings.encoded_bytes());
+    return std::make_unique<Cn105Packet>(PacketType::kInfoAck, data);
   }
 
   static std::unique_ptr<Cn105Packet> Create(const StoredExtendedSettings& extended_settings) {
@@ -149,26 +151,63 @@ class InfoAckPacket {
     return std::make_unique<Cn105Packet>(PacketType::kInfoAck, data);
   }
 
+  // Timer reply. From https://github.com/SwiCago/HeatPump
+  //   byte3 = timer mode (0x00 = none, 0x01 = off, 0x02 = on, 0x03 = both)
+  //   byte4 = on minutes set / 10, byte5 = off minutes set / 10
+  //   byte6 = on minutes remaining / 10, byte7 = off minutes remaining / 10
+  // We never run timers so all of these are zero.
+  static std::unique_ptr<Cn105Packet> CreateTimers() {
+    return CreateBlank(CommandType::kTimers);
+  }
+
+  // Operating status reply. From https://github.com/SwiCago/HeatPump
+  //   byte3 = compressor frequency
+  //   byte4 = operating (0x00 = idle, 0x01 = running)
+  // Compressor frequency is not known locally so it is reported as 0.
+  static std::unique_ptr<Cn105Packet> CreateStatus(const HvacSettings& settings) {
+    auto data = kBlank16BytePacket;
+    data[0] = static_cast<uint8_t>(CommandType::kStatus);
+    data[4] = settings.Get<Power>() == Power::kOn ? 0x01 : 0x00;
+    return std::make_unique<Cn105Packet>(PacketType::kInfoAck, data);
+  }
+
+  // Reply for command types whose data is not understood. Echoes the type
+  // with zeroed data.
+  static std::unique_ptr<Cn105Packet> CreateBlank(CommandType type) {
+    auto data = kBlank16BytePacket;
+    data[0] = static_cast<uint8_t>(type);
+    return std::make_unique<Cn105Packet>(PacketType::kInfoAck, data);
+  }
+
   CommandType type() const { return static_cast<CommandType>(packet_->data()[0]); }
 
   bool IsValid() const {
     return packet_ && !packet_->IsJunk() && packet_->IsComplete() && packet_->IsChecksumValid();
   }
 
-  std::optional<HvacSettings> settings() const {
+  // The unit's InfoAcks carry every field but no flag bits, e.g.
+  //   fc,62,01,30,10,02,00,00,00,01,0a,00,05,00,00,00,aa,...
+  // so the returned copies have every field marked present.
+  std::optional<StoredHvacSettings> settings() const {
     if (type() != CommandType::kSettings) {
       return {};
     }
 
-    return HvacSettings(packet_->data());
+    StoredHvacSettings settings;
+    settings = HvacSettings(packet_->data());
+    settings.MarkAllPresent();
+    return settings;
   }
 
-  std::optional<ExtendedSettings> extended_settings() const {
+  std::optional<StoredExtendedSettings> extended_settings() const {
     if (type() != CommandType::kExtendedSettings) {
       return {};
     }
 
-    return ExtendedSettings(packet_->data());
+    StoredExtendedSettings extended_settings;
+    extended_settings = ExtendedSettings(packet_->data());
+    extended_settings.MarkAllPresent();
+    return extended_settings;
   }
 
  private:
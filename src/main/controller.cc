@@ -1,14 +1,26 @@
 #include "controller.h"
 
+#include <algorithm>
 #include <mutex>
 
+#include "boot_timeline.h"
+
 #include "esp_cxx/uart.h"
 #include "esp_cxx/logging.h"
 #include "event_log.h"
+#include "log_limiter.h"
+
+#ifndef FAKE_ESP_IDF
+#include "esp_system.h"
+#endif
 
 namespace {
 constexpr char kTag[] = "controller";
 
+// Per packet "Sending ...ACK" lines. See /api/log_limits.
+hackvac::LogLimiter::Tag* const g_ack_log =
+    hackvac::LogLimiter::Get()->AddTag(kTag, hackvac::kHotPathLogLimit);
+
 constexpr esp_cxx::Uart::Chip kCn105Uart = esp_cxx::Uart::Chip::kUart1;
 constexpr esp_cxx::Gpio kCn105TxPin = esp_cxx::Gpio::Pin<18>();
 constexpr esp_cxx::Gpio kCn105RxPin = esp_cxx::Gpio::Pin<19>();
@@ -17,6 +29,15 @@ constexpr esp_cxx::Uart::Chip kTstatUart = esp_cxx::Uart::Chip::kUart2;
 constexpr esp_cxx::Gpio kTstatTxPin = esp_cxx::Gpio::Pin<5>();
 constexpr esp_cxx::Gpio kTstatRxPin = esp_cxx::Gpio::Pin<17>();
 
+// Seed for the reconnect jitter. Only needs to differ between devices.
+uint32_t LinkJitterSeed() {
+#ifndef FAKE_ESP_IDF
+  return esp_random();
+#else
+  return 1;
+#endif
+}
+
 class RunOnDestruct {
  public:
   template <typename Functor> explicit RunOnDestruct(Functor f) : func_(f) {}
@@ -37,14 +58,15 @@ const char Controller::kHvacTxTag[] = "H-Tx";
 
 StoredHvacSettings Controller::SharedData::GetStoredHvacSettings() const {
   std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
-  return hvac_settings_;
+  return EffectiveHvacSettings();
 }
 
 void Controller::SharedData::SetStoredHvacSettings(const HvacSettings& hvac_settings) {
-  {
-    std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
-    hvac_settings_ = hvac_settings;
-  }
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  StoredHvacSettings old_effective = EffectiveHvacSettings();
+  StampFields(desired_hvac_settings_.Diff(hvac_settings), &desired_changed_at_);
+  desired_hvac_settings_ = hvac_settings;
+  CommitHvacChange(std::move(lock), old_effective);
   /* Crashes due to optional.
   ESP_LOGI(kTag, "settings: p:%d m:%d, t:%d, f:%d, v:%d, wv:%d",
            static_cast<int32_t>(hvac_settings.Get<Power>().value()),
@@ -56,23 +78,208 @@ void Controller::SharedData::SetStoredHvacSettings(const HvacSettings& hvac_sett
            */
 }
 
+void Controller::SharedData::MergeHvacSettings(const HvacSettings& update) {
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  StoredHvacSettings old_effective = EffectiveHvacSettings();
+  StoredHvacSettings merged = desired_hvac_settings_;
+  merged.CopyFields(update, update.present_fields());
+  StampFields(desired_hvac_settings_.Diff(merged), &desired_changed_at_);
+  desired_hvac_settings_ = merged;
+  CommitHvacChange(std::move(lock), old_effective);
+}
+
+void Controller::SharedData::SetReportedHvacSettings(const HvacSettings& reported) {
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  StoredHvacSettings old_effective = EffectiveHvacSettings();
+  reported_hvac_settings_ = StoredHvacSettings();
+  reported_hvac_settings_.CopyFields(reported, reported.present_fields());
+  StampFields(reported.present_fields(), &reported_at_);
+  CommitHvacChange(std::move(lock), old_effective);
+}
+
+void Controller::SharedData::MergeReportedHvacSettings(const HvacSettings& acked) {
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  StoredHvacSettings old_effective = EffectiveHvacSettings();
+  reported_hvac_settings_.CopyFields(acked, acked.present_fields());
+  StampFields(acked.present_fields(), &reported_at_);
+  CommitHvacChange(std::move(lock), old_effective);
+}
+
+StoredHvacSettings Controller::SharedData::GetDesiredHvacSettings() const {
+  std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
+  return desired_hvac_settings_;
+}
+
+StoredHvacSettings Controller::SharedData::GetReportedHvacSettings() const {
+  std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
+  return reported_hvac_settings_;
+}
+
+HvacSettingsShadow Controller::SharedData::GetHvacSettingsShadow() const {
+  std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
+  HvacSettingsShadow shadow;
+  shadow.desired = desired_hvac_settings_;
+  shadow.reported = reported_hvac_settings_;
+  shadow.pending_fields =
+      ComputeSettingsDelta(reported_hvac_settings_, desired_hvac_settings_).present_fields();
+  shadow.desired_changed_at = desired_changed_at_;
+  shadow.reported_at = reported_at_;
+  return shadow;
+}
+
+SettingsFieldMask Controller::SharedData::GetPendingHvacFields() const {
+  std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
+  return ComputeSettingsDelta(reported_hvac_settings_, desired_hvac_settings_).present_fields();
+}
+
+StoredHvacSettings Controller::SharedData::EffectiveHvacSettings() const {
+  StoredHvacSettings effective = reported_hvac_settings_;
+  effective.CopyFields(desired_hvac_settings_, desired_hvac_settings_.present_fields());
+  return effective;
+}
+
+void Controller::SharedData::StampFields(
+    SettingsFieldMask fields,
+    std::array<Clock::time_point, kNumSettingsFields>* stamps) {
+  Clock::time_point now = Clock::now();
+  for (size_t i = 0; i < kNumSettingsFields; ++i) {
+    if (fields & (1 << i)) {
+      (*stamps)[i] = now;
+    }
+  }
+}
+
+void Controller::SharedData::BumpIfReencoded(const std::array<uint8_t, 16>& before,
+                                             const std::array<uint8_t, 16>& after,
+                                             SettingsFieldMask changed_fields,
+                                             std::atomic<uint32_t>* generation) {
+  if (!changed_fields && before != after) {
+    (*generation)++;
+  }
+}
+
+void Controller::SharedData::CommitHvacChange(std::unique_lock<esp_cxx::Mutex> lock,
+                                              const StoredHvacSettings& old_effective) {
+  StoredHvacSettings effective = EffectiveHvacSettings();
+  SettingsChange change;
+  change.changed_fields = old_effective.Diff(effective);
+  BumpIfReencoded(old_effective.encoded_bytes(), effective.encoded_bytes(),
+                  change.changed_fields, &hvac_settings_generation_);
+  CommitChange(std::move(lock), std::move(change));
+  if (hvac_write_callback_) {
+    hvac_write_callback_();
+  }
+}
+
+void Controller::SharedData::Restore(const SettingsStore::Contents& contents) {
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  StoredHvacSettings old_effective = EffectiveHvacSettings();
+  desired_hvac_settings_ = contents.desired;
+  reported_hvac_settings_ = contents.reported;
+  CommitHvacChange(std::move(lock), old_effective);
+}
+
 StoredExtendedSettings Controller::SharedData::GetExtendedSettings() const {
   std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
   return extended_settings_;
 }
 
 void Controller::SharedData::SetExtendedSettings(const ExtendedSettings& extended_settings) {
-  {
-    std::lock_guard<esp_cxx::Mutex> lock_(mutex_);
-    extended_settings_ = extended_settings;
-  }
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  std::array<uint8_t, 16> old_bytes = extended_settings_.encoded_bytes();
+  SettingsChange change;
+  change.changed_fields = extended_settings_.Diff(extended_settings);
+  extended_settings_ = extended_settings;
+  BumpIfReencoded(old_bytes, extended_settings_.encoded_bytes(),
+                  change.changed_fields, &extended_settings_generation_);
+  CommitChange(std::move(lock), std::move(change));
 //  ESP_LOGI(kTag, "extended settings: rt:%d",
 //           static_cast<int32_t>(extended_settings.GetRoomTemp().value().whole_degree()));
 }
 
+void Controller::SharedData::MergeExtendedSettings(const ExtendedSettings& update) {
+  std::unique_lock<esp_cxx::Mutex> lock(mutex_);
+  StoredExtendedSettings merged = extended_settings_;
+  merged.MergeUpdate(update);
+  SettingsChange change;
+  change.changed_fields = extended_settings_.Diff(merged);
+  BumpIfReencoded(extended_settings_.encoded_bytes(), merged.encoded_bytes(),
+                  change.changed_fields, &extended_settings_generation_);
+  extended_settings_ = merged;
+  CommitChange(std::move(lock), std::move(change));
+}
+
+uint32_t Controller::SharedData::hvac_settings_generation() const {
+  return hvac_settings_generation_;
+}
+
+uint32_t Controller::SharedData::extended_settings_generation() const {
+  return extended_settings_generation_;
+}
+
+Controller::ObserverId Controller::SharedData::AddObserver(SettingsObserver observer) {
+  std::lock_guard<esp_cxx::Mutex> lock_(observers_mutex_);
+  ObserverId id = next_observer_id_++;
+  observers_.emplace_back(id, std::move(observer));
+  return id;
+}
+
+void Controller::SharedData::RemoveObserver(ObserverId id) {
+  std::lock_guard<esp_cxx::Mutex> lock_(observers_mutex_);
+  observers_.remove_if([id](const auto& entry) { return entry.first == id; });
+}
+
+void Controller::SharedData::CommitChange(std::unique_lock<esp_cxx::Mutex> lock,
+                                          SettingsChange change) {
+  if (!change.changed_fields) {
+    return;
+  }
+
+  static constexpr SettingsFieldMask kExtendedFields =
+      ToMask(SettingsField::kRoomTemp);
+  if (change.changed_fields & ~kExtendedFields) {
+    hvac_settings_generation_++;
+  }
+  if (change.changed_fields & kExtendedFields) {
+    extended_settings_generation_++;
+  }
+  change.hvac_settings_generation = hvac_settings_generation_;
+  change.extended_settings_generation = extended_settings_generation_;
+  change.hvac_settings = EffectiveHvacSettings();
+  change.extended_settings = extended_settings_;
+  undelivered_changes_.push_back(std::move(change));
+  lock.unlock();
+
+  // Observers run outside of |mutex_| so they may call the getters. Taking
+  // |observers_mutex_| with |mutex_| held would deadlock against them, so
+  // changes queue in generation order instead and whoever holds
+  // |observers_mutex_| delivers all of them. A task that finds its change
+  // already delivered by another has nothing left to do.
+  std::lock_guard<esp_cxx::Mutex> observers_lock(observers_mutex_);
+  for (;;) {
+    lock.lock();
+    if (undelivered_changes_.empty()) {
+      return;
+    }
+    SettingsChange next = std::move(undelivered_changes_.front());
+    undelivered_changes_.pop_front();
+    lock.unlock();
+    for (auto& entry : observers_) {
+      entry.second(next);
+    }
+  }
+}
+
 Controller::Controller(esp_cxx::QueueSetEventManager* event_manager,
                        PacketLoggerType* packet_logger)
   : event_manager_(event_manager),
+    profiler_(event_manager_),
+    request_site_(profiler_.AddSite("mailbox")),
+    persist_site_(profiler_.AddSite("persist")),
+    reconcile_site_(profiler_.AddSite("reconcile")),
+    reconnect_site_(profiler_.AddSite("reconnect")),
+    timeout_site_(profiler_.AddSite("cmd_timeout")),
+    loop_jitter_(event_manager_),
     packet_logger_(packet_logger),
     hvac_control_(event_manager_, kCn105Uart, kCn105TxPin, kCn105RxPin,
                   // TODO(awong): Send status to the controller about once a second.
@@ -86,6 +293,7 @@ Controller::Controller(esp_cxx::QueueSetEventManager* event_manager,
                     OnHvacControlPacket(std::move(packet));
                   },
                   [this](std::unique_ptr<Cn105Packet> packet) {
+                    OnHvacPacketSent();
                     packet_logger_->Log(kHvacTxTag, std::move(packet));
                   }),
     thermostat_(event_manager_, kTstatUart, kTstatTxPin, kTstatRxPin,
@@ -96,43 +304,257 @@ Controller::Controller(esp_cxx::QueueSetEventManager* event_manager,
                   packet_logger_->Log(kTstatTxTag, std::move(packet));
                 },
                 esp_cxx::Gpio::Pin<23>(),
-                esp_cxx::Gpio::Pin<22>()) {
+                esp_cxx::Gpio::Pin<22>()),
+    hvac_to_tstat_([this](const uint8_t* bytes, size_t size) {
+                     thermostat()->WriteThrough(bytes, size);
+                   },
+                   &rewriter_, RewriteDirection::kFromHvac),
+    tstat_to_hvac_([this](const uint8_t* bytes, size_t size) {
+                     hvac_control()->WriteThrough(bytes, size);
+                   },
+                   &rewriter_, RewriteDirection::kFromThermostat),
+    link_state_(LinkJitterSeed()) {
+  // Request and reply sizes on the wire, header and checksum included.
+  static constexpr size_t kConnectBytes = 8;
+  static constexpr size_t kConnectAckBytes = 7;
+  static constexpr size_t k16ByteDataBytes = 22;
+  rtt_[static_cast<size_t>(Command::kConnect)].SetFrameSizes(
+      kConnectBytes, kConnectAckBytes);
+  for (Command command : {Command::kQuerySettings, Command::kQueryExtendedSettings,
+                          Command::kPushSettings, Command::kPushExtendedSettings}) {
+    rtt_[static_cast<size_t>(command)].SetFrameSizes(
+        k16ByteDataBytes, k16ByteDataBytes);
+  }
+
+  // Writes can come from any task. Hop to the controller task to schedule
+  // the flash write.
+  shared_data_.set_hvac_write_callback([this] {
+    if (settings_store_) {
+      PostRequest({Request::Type::kPersist, UpdateCallback()});
+    }
+  });
+
+  link_state_.set_transition_callback(
+      [this](LinkState::State from, LinkState::State to) {
+        ESP_LOGI(kTag, "link %s -> %s (health %d)", LinkState::StateName(from),
+                 LinkState::StateName(to), link_state_.health());
+        if (link_observer_) {
+          link_observer_(from, to);
+        }
+      });
 }
 
 Controller::~Controller() {
 }
 
 void Controller::Start() {
+  hvac_control()->set_rx_tap([this](const uint8_t* bytes, size_t size) {
+                               OnHvacControlBytes(bytes, size);
+                             });
+  hvac_control()->set_rx_timeout_cb([this] { hvac_to_tstat_.Reset(); });
+  thermostat()->set_rx_tap([this](const uint8_t* bytes, size_t size) {
+                             OnThermostatBytes(bytes, size);
+                           });
+  thermostat()->set_rx_timeout_cb([this] { tstat_to_hvac_.Reset(); });
+  hvac_control()->set_loop_profiler(&profiler_, "hvac_");
+  thermostat()->set_loop_profiler(&profiler_, "tstat_");
   hvac_control()->Start();
   thermostat()->Start();
+  bool is_restored = RestoreSettings();
   ScheduleCommand(Command::kConnect);
+  if (is_restored) {
+    // Revalidate the restored settings. Reconcile() pushes back any desired
+    // fields the unit lost across the outage.
+    ScheduleCommand(Command::kQuerySettings);
+  }
+  ScheduleReconcile();
+  loop_jitter_.Start();
+}
+
+bool Controller::RestoreSettings() {
+  SettingsStore::Contents contents;
+  if (!settings_store_ || !settings_store_->Load(&contents)) {
+    return false;
+  }
+  ESP_LOGI(kTag, "restored settings: desired 0x%x reported 0x%x",
+           contents.desired.present_fields(), contents.reported.present_fields());
+  persisted_blob_ = SettingsStore::Encode(contents);
+  shared_data_.Restore(contents);
+  return true;
+}
+
+void Controller::SchedulePersist() {
+  if (!settings_store_) {
+    return;
+  }
+  // A scheduled write sees the new time when its timer fires.
+  last_persist_request_time_ = Clock::now();
+  if (is_persist_scheduled_) {
+    return;
+  }
+  is_persist_scheduled_ = true;
+  ArmPersistTimer();
+}
+
+void Controller::ArmPersistTimer() {
+  Clock::time_point due =
+      last_persist_request_time_ + std::chrono::milliseconds(kPersistDebounceMs);
+  if (last_persist_time_) {
+    due = std::max(due, last_persist_time_.value() +
+                        std::chrono::milliseconds(kMinPersistIntervalMs));
+  }
+  auto delay = std::chrono::ceil<std::chrono::milliseconds>(due - Clock::now());
+  profiler_.RunDelayed(persist_site_, [this] {
+                         // Not quiet yet. Wait out the rest.
+                         if (Clock::now() < last_persist_request_time_ +
+                                 std::chrono::milliseconds(kPersistDebounceMs)) {
+                           ArmPersistTimer();
+                           return;
+                         }
+                         is_persist_scheduled_ = false;
+                         PersistSettings();
+                       }, std::max<int>(delay.count(), 1));
 }
 
-void Controller::SetTemperature(HalfDegreeTemp temp) {
-  StoredHvacSettings new_settings = shared_data_.GetStoredHvacSettings();
-  new_settings.SetTargetTemp(temp);
-  shared_data_.SetStoredHvacSettings(new_settings);
+void Controller::PersistSettings() {
+  SettingsStore::Contents contents;
+  contents.desired = shared_data_.GetDesiredHvacSettings();
+  contents.reported = shared_data_.GetReportedHvacSettings();
+  std::vector<uint8_t> blob = SettingsStore::Encode(contents);
+  if (blob == persisted_blob_) {
+    return;
+  }
 
-  event_manager_->Run([this]{ ScheduleCommand(Command::kPushSettings); });
+  if (settings_store_->Save(contents)) {
+    persisted_blob_ = std::move(blob);
+  }
+  // Failures also count so a flash error does not turn into a write loop.
+  last_persist_time_ = Clock::now();
+}
+
+std::vector<CommandRttStats> Controller::GetRttStats() const {
+  std::vector<CommandRttStats> all_stats;
+  for (size_t i = 0; i < kNumCommands; ++i) {
+    const RttEstimator& rtt = rtt_[i];
+    CommandRttStats stats;
+    stats.command = CommandName(static_cast<Command>(i));
+    stats.srtt = rtt.srtt();
+    stats.rttvar = rtt.rttvar();
+    stats.timeout = rtt.timeout();
+    stats.timeouts = rtt.timeouts();
+    stats.min_us = rtt.histogram().count() ? rtt.histogram().min() : 0;
+    stats.max_us = rtt.histogram().max();
+    for (size_t b = 0; b < Histogram::kNumBuckets; ++b) {
+      stats.histogram[b] = rtt.histogram().bucket(b);
+    }
+    all_stats.push_back(stats);
+  }
+  return all_stats;
 }
 
-void Controller::PushSettings(const HvacSettings& settings) {
+const char* Controller::CommandName(Command command) {
+  switch (command) {
+    case Command::kConnect:
+      return "connect";
+    case Command::kQuerySettings:
+      return "query_settings";
+    case Command::kQueryExtendedSettings:
+      return "query_extended_settings";
+    case Command::kPushSettings:
+      return "push_settings";
+    case Command::kPushExtendedSettings:
+      return "push_extended_settings";
+  }
+  return "unknown";
+}
+
+void Controller::SetTemperature(HalfDegreeTemp temp, UpdateCallback done) {
+  StoredHvacSettings update;
+  update.SetTargetTemp(temp);
+  MergeSettings(update, std::move(done));
+}
+
+void Controller::PushSettings(const HvacSettings& settings, UpdateCallback done) {
   shared_data_.SetStoredHvacSettings(settings);
-  event_manager_->Run([this]{ ScheduleCommand(Command::kPushSettings); });
+  PostRequest({Request::Type::kPushSettings, std::move(done)});
 }
 
 void Controller::PushExtendedSettings(
-    const ExtendedSettings& extended_settings) {
+    const ExtendedSettings& extended_settings, UpdateCallback done) {
   shared_data_.SetExtendedSettings(extended_settings);
-  event_manager_->Run([this]{ ScheduleCommand(Command::kPushExtendedSettings); });
+  PostRequest({Request::Type::kPushExtendedSettings, std::move(done)});
+}
+
+void Controller::MergeSettings(const HvacSettings& update, UpdateCallback done) {
+  shared_data_.MergeHvacSettings(update);
+  PostRequest({Request::Type::kPushSettings, std::move(done)});
+}
+
+void Controller::MergeExtendedSettings(const ExtendedSettings& update,
+                                       UpdateCallback done) {
+  shared_data_.MergeExtendedSettings(update);
+  PostRequest({Request::Type::kPushExtendedSettings, std::move(done)});
 }
 
 void Controller::SyncSettings() {
-  event_manager_->Run([this]{ ScheduleCommand(Command::kQuerySettings); });
+  PostRequest({Request::Type::kSyncSettings, UpdateCallback()});
 }
 
 void Controller::SyncExtendedSettings() {
-  event_manager_->Run([this]{ ScheduleCommand(Command::kQueryExtendedSettings); });
+  PostRequest({Request::Type::kSyncExtendedSettings, UpdateCallback()});
+}
+
+void Controller::PostRequest(Request request) {
+  // Once one request has overflowed, later ones follow it through the
+  // event manager so none of them can pass it by landing in the mailbox.
+  if (num_overflowed_ > 0 || !mailbox_.Push(std::move(request))) {
+    ESP_LOGW(kTag, "mailbox full");
+    ++num_overflowed_;
+    // Whatever was queued ahead still runs first.
+    profiler_.Run(request_site_, [this, request] {
+      DrainMailbox();
+      HandleRequest(request);
+      --num_overflowed_;
+    });
+    return;
+  }
+  // Pairs with the fence in DrainMailbox(). Without both, the Push() and the
+  // flag load here could each miss the other side's store: the drain would
+  // see an empty mailbox while this sees a drain still pending.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!is_drain_pending_.exchange(true)) {
+    profiler_.Run(request_site_, [this] { DrainMailbox(); });
+  }
+}
+
+void Controller::DrainMailbox() {
+  // Cleared first so a Push() racing with the last Pop() posts a new drain.
+  is_drain_pending_ = false;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Request request;
+  while (mailbox_.Pop(&request)) {
+    HandleRequest(std::move(request));
+  }
+}
+
+void Controller::HandleRequest(Request request) {
+  switch (request.type) {
+    case Request::Type::kPushSettings:
+      SchedulePush(Command::kPushSettings, std::move(request.done));
+      break;
+    case Request::Type::kPushExtendedSettings:
+      SchedulePush(Command::kPushExtendedSettings, std::move(request.done));
+      break;
+    case Request::Type::kSyncSettings:
+      ScheduleCommand(Command::kQuerySettings);
+      break;
+    case Request::Type::kSyncExtendedSettings:
+      ScheduleCommand(Command::kQueryExtendedSettings);
+      break;
+    case Request::Type::kPersist:
+      SchedulePersist();
+      break;
+  }
 }
 
 void Controller::ScheduleCommand(Command command) {
@@ -140,9 +562,80 @@ void Controller::ScheduleCommand(Command command) {
   ExecuteNextCommand();
 }
 
+void Controller::SchedulePush(Command command, UpdateCallback done) {
+  PendingPush& pending = command == Command::kPushSettings ?
+      pending_settings_push_ : pending_extended_push_;
+  if (done) {
+    pending.callbacks.push_back(std::move(done));
+  }
+
+  // The Update is built from |shared_data_| when it is sent so a queued
+  // push already carries this change.
+  if (pending.is_queued) {
+    return;
+  }
+  pending.is_queued = true;
+  ScheduleCommand(command);
+}
+
+void Controller::Reconcile() {
+  SettingsFieldMask pending = shared_data_.GetPendingHvacFields();
+  if (pending) {
+    ESP_LOGD(kTag, "reconciling fields 0x%x", pending);
+    SchedulePush(Command::kPushSettings, UpdateCallback());
+  }
+}
+
+void Controller::ScheduleReconcile() {
+  profiler_.RunDelayed(reconcile_site_, [this] {
+                         Reconcile();
+                         ScheduleReconcile();
+                       }, kReconcileIntervalMs);
+}
+
+void Controller::CompleteUpdate(UpdateResult result) {
+  if (inflight_settings_update_ && result == UpdateResult::kAcked) {
+    shared_data_.MergeReportedHvacSettings(inflight_settings_update_.value());
+  }
+  inflight_settings_update_.reset();
+
+  std::vector<UpdateCallback> callbacks;
+  callbacks.swap(inflight_update_callbacks_);
+  for (auto& callback : callbacks) {
+    callback(result);
+  }
+}
+
 void Controller::Reconnect() {
-  command_queue_.push_front(Command::kConnect);
-  ExecuteNextCommand();
+  // Whatever was outstanding has failed. Without clearing this, nothing
+  // would ever be sent again.
+  is_command_oustanding_ = false;
+
+  // A timeout and a truncated packet for the same command both land here.
+  // Only one failure and one Connect should come of it.
+  if (failed_command_number_ == command_number_) {
+    return;
+  }
+  failed_command_number_ = command_number_;
+  LinkState::Duration delay = link_state_.OnFailure();
+  CompleteUpdate(UpdateResult::kFailed);
+  if (is_reconnect_pending_) {
+    return;
+  }
+  is_reconnect_pending_ = true;
+
+  auto queue_connect = [this] {
+    is_reconnect_pending_ = false;
+    command_queue_.push_front(Command::kConnect);
+    ExecuteNextCommand();
+  };
+
+  if (delay == LinkState::Duration::zero()) {
+    queue_connect();
+  } else {
+    ESP_LOGD(kTag, "reconnect in %d ms", static_cast<int>(delay.count()));
+    profiler_.RunDelayed(reconnect_site_, queue_connect, delay.count());
+  }
 }
 
 void Controller::ExecuteNextCommand() {
@@ -150,7 +643,7 @@ void Controller::ExecuteNextCommand() {
   // is complete. In this case, just return as command completion will
   // cause this function to execute again. Note a timeout will force a
   // connect command to execute so that case is handled as well.
-  if (is_command_oustanding_) {
+  if (is_command_oustanding_ || is_reconnect_pending_) {
     return;
   }
 
@@ -162,38 +655,100 @@ void Controller::ExecuteNextCommand() {
   command_queue_.pop_front();
   is_command_oustanding_ = true;
   command_number_++;
+  current_command_ = command;
+  command_sent_time_.reset();
 
+  std::unique_ptr<Cn105Packet> packet;
   switch (command) {
     case Command::kConnect:
-      hvac_control()->EnqueuePacket(ConnectPacket::Create());
+      link_state_.OnConnectAttempt();
+      packet = ConnectPacket::Create();
       break;
 
     case Command::kQuerySettings:
-      hvac_control()->EnqueuePacket(InfoPacket::Create(CommandType::kSettings));
+      packet = InfoPacket::Create(CommandType::kSettings);
       break;
 
     case Command::kQueryExtendedSettings:
-      hvac_control()->EnqueuePacket(InfoPacket::Create(CommandType::kExtendedSettings));
+      packet = InfoPacket::Create(CommandType::kExtendedSettings);
       break;
 
-    case Command::kPushSettings:
-      hvac_control()->EnqueuePacket(UpdatePacket::Create(shared_data_.GetStoredHvacSettings()));
+    case Command::kPushSettings: {
+      inflight_update_callbacks_ = std::move(pending_settings_push_.callbacks);
+      pending_settings_push_ = PendingPush();
+
+      // Resending unchanged fields makes the unit re-apply them which, among
+      // other things, resets the vanes. Only send what differs from what the
+      // unit last told us.
+      StoredHvacSettings desired = shared_data_.GetDesiredHvacSettings();
+      StoredHvacSettings reported = shared_data_.GetReportedHvacSettings();
+      if (reported.present_fields()) {
+        StoredHvacSettings delta = ComputeSettingsDelta(reported, desired);
+        if (!delta.present_fields()) {
+          // Nothing to send. The unit already has these settings.
+          is_command_oustanding_ = false;
+          CompleteUpdate(UpdateResult::kAcked);
+          ExecuteNextCommand();
+          return;
+        }
+        inflight_settings_update_ = delta;
+      } else {
+        inflight_settings_update_ = desired;
+      }
+      packet = UpdatePacket::Create(inflight_settings_update_.value());
       break;
+    }
 
     case Command::kPushExtendedSettings:
-      hvac_control()->EnqueuePacket(UpdatePacket::Create(shared_data_.GetExtendedSettings()));
+      inflight_update_callbacks_ = std::move(pending_extended_push_.callbacks);
+      pending_extended_push_ = PendingPush();
+      packet = UpdatePacket::Create(shared_data_.GetExtendedSettings());
       break;
   }
 
-  static constexpr int kProtocolTimeoutMs = 20;
-  event_manager_->RunDelayed(
-      [this, prev_command_number = command_number_] {
+  // The reply timeout starts when the channel reports the send. If the
+  // channel never does, nothing else would fail the command, so also give
+  // it until its own frame time plus a full reply timeout to go out.
+  RttEstimator::Duration send_deadline =
+      RttEstimator::WireTime(packet->packet_size()) +
+      rtt_[static_cast<size_t>(command)].timeout();
+  ArmCommandTimeout(send_deadline, true);
+  hvac_control()->EnqueuePacket(std::move(packet));
+}
+
+void Controller::OnHvacPacketSent() {
+  // Passthru also sends on this channel. Only the first send after
+  // ExecuteNextCommand() is the command.
+  if (!is_command_oustanding_ || command_sent_time_) {
+    return;
+  }
+  command_sent_time_ = Clock::now();
+  ArmCommandTimeout(rtt_[static_cast<size_t>(current_command_)].timeout(),
+                    false);
+}
+
+void Controller::ArmCommandTimeout(RttEstimator::Duration timeout,
+                                   bool is_send_deadline) {
+  auto timeout_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(timeout);
+  profiler_.RunDelayed(
+      timeout_site_,
+      [this, is_send_deadline, prev_command_number = command_number_] {
         // If the same command is still outstanding, it timed out.
-        if (prev_command_number == command_number_ &&
-            is_command_oustanding_) {
+        if (prev_command_number != command_number_ ||
+            !is_command_oustanding_) {
+          return;
+        }
+        if (!is_send_deadline) {
+          ESP_LOGW(kTag, "%s timed out", CommandName(current_command_));
+          rtt_[static_cast<size_t>(current_command_)].OnTimeout();
+          Reconnect();
+        } else if (!command_sent_time_) {
+          // Never went out. There is no round trip to learn from.
+          ESP_LOGW(kTag, "%s never sent", CommandName(current_command_));
           Reconnect();
         }
-      }, kProtocolTimeoutMs);
+      }, timeout_ms.count() + 1);
 }
 
 void Controller::OnHvacControlPacket(
@@ -201,10 +756,13 @@ void Controller::OnHvacControlPacket(
   RunOnDestruct on_destruct (
       [&]{if (hvac_packet) packet_logger_->Log(kHvacRxTag, std::move(hvac_packet));});
 
-  if (is_passthru_) {
-    ESP_LOGI(kTag, "hvac_ctl: %d bytes", hvac_packet->packet_size());
-    ESP_LOG_BUFFER_HEX_LEVEL(kTag, hvac_packet->raw_bytes(), hvac_packet->packet_size(), ESP_LOG_INFO); 
-    thermostat()->EnqueuePacket(hvac_packet->Clone());
+  if (is_passthru()) {
+    // The packet is logged by |on_destruct| off the forwarding path. In
+    // cut-through mode, the bytes are already on their way.
+    if (!IsCutThroughActive()) {
+      thermostat()->EnqueuePacket(
+          CloneForForwarding(RewriteDirection::kFromHvac, hvac_packet.get()));
+    }
     return;
   }
 
@@ -225,23 +783,43 @@ void Controller::OnHvacControlPacket(
   is_command_oustanding_ = false;
 
   if (!hvac_packet->IsChecksumValid()) {
-    // TODO(awong): Increment error count.
+    // The reply was framed but damaged. The command failed without the link
+    // going down, so move on to the next one. Leaving |command_sent_time_|
+    // set would keep the next command from arming its timeout.
+    link_state_.OnCorrupt();
     ESP_LOGW(kTag, "Pkt type %d corrupt", static_cast<int>(hvac_packet->type()));
+    command_sent_time_.reset();
+    CompleteUpdate(UpdateResult::kFailed);
+    ExecuteNextCommand();
     return;
   }
 
+  link_state_.OnSuccess();
+  if (command_sent_time_) {
+    rtt_[static_cast<size_t>(current_command_)].AddSample(
+        std::chrono::duration_cast<RttEstimator::Duration>(
+            Clock::now() - command_sent_time_.value()));
+    command_sent_time_.reset();
+  }
+  CompleteUpdate(hvac_packet->type() == PacketType::kUpdateAck ?
+                 UpdateResult::kAcked : UpdateResult::kFailed);
+
   switch (hvac_packet->type()) {
     case PacketType::kConnectAck:
+      BootTimeline::Get()->Mark(BootMilestone::kHvacConnected);
+      break;
+
     case PacketType::kExtendedConnectAck:
     case PacketType::kUpdateAck:
       // Nothing to do here.
       break;
 
     case PacketType::kInfoAck: {
-      // Nothing to do here.
       InfoAckPacket info_ack(hvac_packet.get());
       if (auto settings = info_ack.settings()) {
-        shared_data_.SetStoredHvacSettings(settings.value());
+        BootTimeline::Get()->Mark(BootMilestone::kHvacFirstInfoAck);
+        shared_data_.SetReportedHvacSettings(settings.value());
+        Reconcile();
       }
 
       if (auto extended_settings = info_ack.extended_settings()) {
@@ -262,8 +840,12 @@ void Controller::OnThermostatPacket(
     std::unique_ptr<Cn105Packet> thermostat_packet) {
   RunOnDestruct on_destruct (
       [&]{if (thermostat_packet) packet_logger_->Log(kTstatRxTag, std::move(thermostat_packet));});
-  if (is_passthru_) {
-    hvac_control()->EnqueuePacket(thermostat_packet->Clone());
+  if (is_passthru()) {
+    if (!IsCutThroughActive()) {
+      hvac_control()->EnqueuePacket(
+          CloneForForwarding(RewriteDirection::kFromThermostat,
+                             thermostat_packet.get()));
+    }
   } else {
     // TODO(awong): Reject packets if there hasn't been a connect.
     if (!thermostat_packet->IsJunk() &&
@@ -272,12 +854,16 @@ void Controller::OnThermostatPacket(
 
       switch (thermostat_packet->type()) {
         case PacketType::kConnect:
-          ESP_LOGI(kTag, "Sending ConnectACK");
+          if (g_ack_log->Allow()) {
+            ESP_LOGI(kTag, "Sending ConnectACK");
+          }
           thermostat()->EnqueuePacket(ConnectAckPacket::Create());
           break;
 
         case PacketType::kExtendedConnect:
-          ESP_LOGI(kTag, "Sending ExtendedConnectACK");
+          if (g_ack_log->Allow()) {
+            ESP_LOGI(kTag, "Sending ExtendedConnectACK");
+          }
           // TODO(awong): See if there's a way to understand this packet.
           // Ignoring it for now seems to cause Pac444CN-1 to send 2 attempts
           // and then give up and move on.
@@ -288,24 +874,33 @@ void Controller::OnThermostatPacket(
           {
             // TODO(awong): Extract into a process function like CreateInfoAck().
             UpdatePacket update(thermostat_packet.get());
-
-            shared_data_.SetStoredHvacSettings(
-                shared_data_.GetStoredHvacSettings().MergeUpdate(
-                    update.settings()));
-
-            shared_data_.SetExtendedSettings(
-                shared_data_.GetExtendedSettings().MergeUpdate(
-                    update.extended_settings()));
-
-            ESP_LOGI(kTag, "Sending UpdateACK");
+            // Only merge the view matching the command. Otherwise the bytes of
+            // one layout get misread as fields of the other.
+            if (update.type() == CommandType::kSetSettings) {
+              shared_data_.MergeHvacSettings(update.settings());
+              Reconcile();
+            } else if (update.type() == CommandType::kSetExtendedSettings) {
+              shared_data_.MergeExtendedSettings(update.extended_settings());
+            }
+
+            if (g_ack_log->Allow()) {
+              ESP_LOGI(kTag, "Sending UpdateACK");
+            }
             thermostat()->EnqueuePacket(UpdateAckPacket::Create());
             break;
           }
 
         case PacketType::kInfo:
-          ESP_LOGI(kTag, "Sending InfoACK");
+          if (g_ack_log->Allow()) {
+            ESP_LOGI(kTag, "Sending InfoACK");
+          }
+          // The channel takes ownership of what it sends and passes it on
+          // to the packet logger, so the prebuilt image is copied, not
+          // handed out. That is one allocation and a 22 byte copy; the
+          // serialization is what the cache saves.
           thermostat()->EnqueuePacket(
-              CreateInfoAck(InfoPacket(thermostat_packet.get())));
+              GetInfoAck(InfoPacket(thermostat_packet.get()).type()).Clone());
+          BootTimeline::Get()->Mark(BootMilestone::kTstatFirstInfoAck);
           break;
 
         default:
@@ -315,23 +910,93 @@ void Controller::OnThermostatPacket(
   }
 }
 
-std::unique_ptr<Cn105Packet> Controller::CreateInfoAck(InfoPacket info) {
-  switch (info.type()) {
-    case CommandType::kSettings:
-      return InfoAckPacket::Create(shared_data_.GetStoredHvacSettings());
+void Controller::OnHvacControlBytes(const uint8_t* bytes, size_t size) {
+  if (IsCutThroughActive()) {
+    hvac_to_tstat_.OnBytes(bytes, size);
+  }
+}
 
-    case CommandType::kExtendedSettings:
-      return InfoAckPacket::Create(shared_data_.GetExtendedSettings());
+void Controller::OnThermostatBytes(const uint8_t* bytes, size_t size) {
+  if (IsCutThroughActive()) {
+    tstat_to_hvac_.OnBytes(bytes, size);
+  }
+}
+
+std::unique_ptr<Cn105Packet> Controller::CloneForForwarding(
+    RewriteDirection direction, Cn105Packet* packet) {
+  std::unique_ptr<Cn105Packet> copy = packet->Clone();
+  rewriter_.Snapshot()->Apply(direction, copy.get());
+  return copy;
+}
+
+const Cn105Packet& Controller::GetInfoAck(CommandType type) {
+  CachedInfoAck& entry =
+      info_ack_cache_[static_cast<uint8_t>(type) % kInfoAckCacheSize];
+  // Read before the source so a change landing in between leaves the image
+  // stamped older than its bytes and it is merely rebuilt once more.
+  uint32_t generation = InfoAckGeneration(type);
+  if (!entry.packet || entry.generation != generation ||
+      InfoAckPacket(entry.packet.get()).type() != type) {
+    entry.packet = CreateInfoAck(type, InfoAckSource(type));
+    entry.generation = generation;
+  }
+  return *entry.packet;
+}
+
+std::unique_ptr<Cn105Packet> Controller::CreateInfoAck(CommandType type,
+                                                       std::array<uint8_t, 16> source) {
+  switch (type) {
+    case CommandType::kSettings: {
+      StoredHvacSettings settings;
+      settings = HvacSettings(source.data());
+      return InfoAckPacket::Create(settings);
+    }
+
+    case CommandType::kExtendedSettings: {
+      StoredExtendedSettings extended_settings;
+      extended_settings = ExtendedSettings(source.data());
+      return InfoAckPacket::Create(extended_settings);
+    }
 
-      // TODO(awong): Implement.
     case CommandType::kTimers:
+      return InfoAckPacket::CreateTimers();
+
     case CommandType::kStatus:
+      return InfoAckPacket::CreateStatus(HvacSettings(source.data()));
+
     case CommandType::kEnterStandby:
     default:
-      // Unknown packet type. Ack with a status.
-      //
-      // TODO(awong): Make this actaully a status ack.
-      return InfoAckPacket::Create(shared_data_.GetStoredHvacSettings());
+      // TODO(awong): Figure out what these should contain.
+      return InfoAckPacket::CreateBlank(type);
+  }
+}
+
+uint32_t Controller::InfoAckGeneration(CommandType type) const {
+  switch (type) {
+    case CommandType::kSettings:
+    case CommandType::kStatus:
+      return shared_data_.hvac_settings_generation();
+
+    case CommandType::kExtendedSettings:
+      return shared_data_.extended_settings_generation();
+
+    default:
+      // Fixed content.
+      return 0;
+  }
+}
+
+std::array<uint8_t, 16> Controller::InfoAckSource(CommandType type) const {
+  switch (type) {
+    case CommandType::kSettings:
+    case CommandType::kStatus:
+      return shared_data_.GetStoredHvacSettings().encoded_bytes();
+
+    case CommandType::kExtendedSettings:
+      return shared_data_.GetExtendedSettings().encoded_bytes();
+
+    default:
+      return {};
   }
 }
 
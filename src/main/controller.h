@@ -1,10 +1,22 @@
 #ifndef CN105_H_
 #define CN105_H_
 
+#include <array>
+#include <atomic>
 #include <deque>
+#include <list>
+#include <vector>
 
 #include "half_duplex_channel.h"
 #include "cn105_protocol.h"
+#include "link_state.h"
+#include "loop_profiler.h"
+#include "mpsc_mailbox.h"
+#include "loop_jitter.h"
+#include "packet_forwarder.h"
+#include "packet_rewriter.h"
+#include "rtt_estimator.h"
+#include "settings_store.h"
 
 #include "esp_cxx/cxx17hack.h"
 #include "esp_cxx/mutex.h"
@@ -38,6 +50,9 @@
 // Controller object's packet modification configuration. That ensures that each
 // packet is internally consistent. It also means updates to the Controller object
 // only get latched into effect at packet boundaries.
+//
+// The packet modification configuration is a list of RewriteRules set via
+// SetRewriteRules(). See packet_rewriter.h.
 
 #include "esp_cxx/event_manager.h"
 #include "esp_cxx/task.h"
@@ -48,10 +63,69 @@
 
 namespace hackvac {
 
+// Describes a modification to the Controller's settings. Only the fields in
+// |changed_fields| differ from the previous notification; the remaining
+// values in |hvac_settings| and |extended_settings| are the current state
+// provided for convenience.
+struct SettingsChange {
+  SettingsFieldMask changed_fields = 0;
+
+  // Generations after the change. Each one only increments when the
+  // corresponding settings object changes value or encoding. A change of
+  // encoding alone is not notified, so successive notifications may skip
+  // generations.
+  uint32_t hvac_settings_generation = 0;
+  uint32_t extended_settings_generation = 0;
+
+  StoredHvacSettings hvac_settings;
+  StoredExtendedSettings extended_settings;
+};
+
+// The two sides of the settings shadow. |desired| holds what local pushes and
+// the thermostat asked for and |reported| what the heat pump last reported
+// or acknowledged. |pending_fields| are the desired fields the unit does not
+// have yet.
+struct HvacSettingsShadow {
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  StoredHvacSettings desired;
+  StoredHvacSettings reported;
+  SettingsFieldMask pending_fields = 0;
+
+  // Indexed by FieldIndex(). When each desired field last changed value and
+  // when the unit last confirmed each reported field. Default constructed
+  // for fields never seen.
+  std::array<TimePoint, kNumSettingsFields> desired_changed_at{};
+  std::array<TimePoint, kNumSettingsFields> reported_at{};
+};
+
+// Round trip statistics for one kind of command sent to the heat pump.
+struct CommandRttStats {
+  const char* command = nullptr;
+  RttEstimator::Duration srtt{};
+  RttEstimator::Duration rttvar{};
+  RttEstimator::Duration timeout{};
+  uint32_t timeouts = 0;
+  uint32_t min_us = 0;
+  uint32_t max_us = 0;
+
+  // Sample counts per Histogram bucket.
+  std::array<uint32_t, Histogram::kNumBuckets> histogram{};
+};
+
 class Controller {
  public:
   using PacketLoggerType = esp_cxx::DataLogger<std::unique_ptr<Cn105Packet>>;
 
+  // Invoked synchronously, in generation order, before the change's setter
+  // returns. Usually on the task that modified the settings, but a change
+  // racing with one from another task may be delivered by that task.
+  // Observers must be quick and must not call back into
+  // Add/RemoveSettingsObserver() or the setters. Anything non-trivial should
+  // be posted to the observer's own task.
+  using SettingsObserver = std::function<void(const SettingsChange&)>;
+  using ObserverId = int;
+
   Controller(esp_cxx::QueueSetEventManager* event_manager,
              PacketLoggerType* packet_logger);
   ESPCXX_MOCKABLE ~Controller();
@@ -64,23 +138,120 @@ class Controller {
   // Starts the message processing.
   void Start();
 
-  // Mode changes.
-  void set_passthru(bool is_passthru) { is_passthru_ = is_passthru; }
-  bool is_passthru() { return is_passthru_; }
+  // Link health. Safe to read from any task.
+  LinkState::State link_state() const { return link_state_.state(); }
+  int link_health() const { return link_state_.health(); }
+
+  // Per-command round trip times and the timeouts derived from them. Safe
+  // to call from any task.
+  std::vector<CommandRttStats> GetRttStats() const;
+
+  // How late the controller task runs timers, in microseconds. Anything past
+  // a tick means UART events may also be waiting. Safe to call from any
+  // task.
+  const LoopJitterProbe& loop_jitter() const { return loop_jitter_; }
+
+  // Per call site timings of work on the controller task, including the
+  // channels' UART handling. Safe to read from any task.
+  const LoopProfiler& loop_profiler() const { return profiler_; }
+
+  // Registers a callback for link state transitions. Must be set before
+  // Start(). Runs on the controller task.
+  void set_link_observer(LinkState::TransitionCallback cb) { link_observer_ = std::move(cb); }
+
+  // Persists settings to |store| and, on Start(), restores them so the
+  // thermostat and HTTP clients are answered from the last known state while
+  // the unit is queried in the background. Must be set before Start().
+  void set_settings_store(SettingsStore* store) { settings_store_ = store; }
+
+  // Mode changes. Safe to call from any task; the channels pick up the new
+  // mode at their next packet.
+  void set_passthru(bool is_passthru) {
+    is_passthru_.store(is_passthru, std::memory_order_relaxed);
+  }
+  bool is_passthru() const { return is_passthru_.load(std::memory_order_relaxed); }
+
+  // In passthru, selects between forwarding bytes as they arrive (cut-through)
+  // or forwarding whole packets once received (store-and-forward).
+  void set_cut_through(bool is_cut_through) {
+    is_cut_through_.store(is_cut_through, std::memory_order_relaxed);
+  }
+  bool is_cut_through() const { return is_cut_through_.load(std::memory_order_relaxed); }
+
+  // Replaces the rules used to modify packets forwarded in passthru. Safe to
+  // call from any task. Takes effect at the next packet boundary.
+  void SetRewriteRules(std::vector<RewriteRule> rules) {
+    rewriter_.SetRules(std::move(rules));
+  }
+  std::vector<RewriteRule> GetRewriteRules() const {
+    return rewriter_.Snapshot()->rules();
+  }
+
+  // Outcome of a settings push.
+  enum class UpdateResult : uint8_t {
+    kAcked,   // The heat pump replied with an UpdateAck.
+    kFailed,  // No UpdateAck: the reply timed out, was truncated, was
+              // corrupt, or was some other packet type.
+  };
+
+  // Invoked on the controller task once the Update carrying a change is
+  // resolved.
+  using UpdateCallback = std::function<void(UpdateResult)>;
 
-  void SetTemperature(HalfDegreeTemp temp);
+  // The setters below update the local settings immediately and queue an
+  // Update to the heat pump. If an Update of the same kind is already
+  // queued, the change rides along with it so back-to-back setters produce
+  // a single Update covering all of them. |done|, if given, is run when that
+  // Update is resolved.
+  void SetTemperature(HalfDegreeTemp temp, UpdateCallback done = UpdateCallback());
 
+  // The settings the unit is, or is converging to: the reported settings
+  // with every desired field applied on top.
   StoredHvacSettings GetSettings() const {
     return shared_data_.GetStoredHvacSettings();
   }
 
+  // Both sides of the settings and which fields still need to be pushed.
+  HvacSettingsShadow GetSettingsShadow() const {
+    return shared_data_.GetHvacSettingsShadow();
+  }
+
   StoredExtendedSettings GetExtendedSettings() const {
     return shared_data_.GetExtendedSettings();
   }
 
+  // Monotonically increasing counters bumped on each change of the
+  // corresponding settings, including ones that only change how a value is
+  // encoded. Cheap way to check for changes without copying.
+  uint32_t settings_generation() const {
+    return shared_data_.hvac_settings_generation();
+  }
+  uint32_t extended_settings_generation() const {
+    return shared_data_.extended_settings_generation();
+  }
+
+  // Registers |observer| to be pushed each settings change, whether it
+  // comes from the thermostat, the heat pump, or a local Push. Returns an
+  // id for RemoveSettingsObserver().
+  ObserverId AddSettingsObserver(SettingsObserver observer) {
+    return shared_data_.AddObserver(std::move(observer));
+  }
+  void RemoveSettingsObserver(ObserverId id) {
+    shared_data_.RemoveObserver(id);
+  }
+
   // Push new settings to the HVAC controller.
-  void PushSettings(const HvacSettings& settings);
-  void PushExtendedSettings(const ExtendedSettings& extended_settings);
+  void PushSettings(const HvacSettings& settings,
+                    UpdateCallback done = UpdateCallback());
+  void PushExtendedSettings(const ExtendedSettings& extended_settings,
+                            UpdateCallback done = UpdateCallback());
+
+  // Like the Push methods but only the fields present in |update| change;
+  // the rest keep their current values.
+  void MergeSettings(const HvacSettings& update,
+                     UpdateCallback done = UpdateCallback());
+  void MergeExtendedSettings(const ExtendedSettings& update,
+                             UpdateCallback done = UpdateCallback());
 
   // Sync settings that the HVAC controller thinks it has.
   void SyncSettings();
@@ -96,6 +267,20 @@ class Controller {
     kPushSettings,
     kPushExtendedSettings,
   };
+  static constexpr size_t kNumCommands = 5;
+
+  static const char* CommandName(Command command);
+
+  using Clock = std::chrono::steady_clock;
+
+  // How often divergent settings are retried.
+  static constexpr int kReconcileIntervalMs = 30000;
+
+  // A settings change is written to |settings_store_| once things have been
+  // quiet for kPersistDebounceMs, and never sooner than kMinPersistIntervalMs
+  // after the previous write, bounding flash wear to one write a minute.
+  static constexpr int kPersistDebounceMs = 5000;
+  static constexpr int kMinPersistIntervalMs = 60000;
 
   // Accessors that allow for unittest to dependency inject.
   ESPCXX_MOCKABLE HalfDuplexChannel* hvac_control() { return &hvac_control_; }
@@ -107,10 +292,83 @@ class Controller {
   // Runs on the |thermostat_| channel's message pump task.
   void OnThermostatPacket(std::unique_ptr<Cn105Packet> thermostat_packet);
 
+  // Runs after each packet is written to |hvac_control_|. Stamps the send
+  // time of the outstanding command and arms its timeout.
+  void OnHvacPacketSent();
+
+  // Raw byte taps for cut-through passthru. Run on the respective channel's
+  // message pump task before packet parsing.
+  void OnHvacControlBytes(const uint8_t* bytes, size_t size);
+  void OnThermostatBytes(const uint8_t* bytes, size_t size);
+
+  // Whether bytes are being forwarded by the taps above.
+  bool IsCutThroughActive() const { return is_passthru() && is_cut_through(); }
+
+  // Copies |packet| for store-and-forward passthru, applying rewrite rules.
+  std::unique_ptr<Cn105Packet> CloneForForwarding(RewriteDirection direction,
+                                                  Cn105Packet* packet);
+
+  // Work handed to the controller task by the public methods.
+  struct Request {
+    enum class Type : uint8_t {
+      kPushSettings,
+      kPushExtendedSettings,
+      kSyncSettings,
+      kSyncExtendedSettings,
+      kPersist,
+    };
+    Type type = Type::kPushSettings;
+    UpdateCallback done;
+  };
+  static constexpr size_t kMailboxSize = 16;
+
+  // Queues |request| in |mailbox_| and, if no drain is pending, posts one.
+  // Safe from any task. If the mailbox is full, posts a drain that then runs
+  // |request| so no request is lost or run ahead of queued ones.
+  void PostRequest(Request request);
+
+  // Runs every request in |mailbox_|.
+  void DrainMailbox();
+  void HandleRequest(Request request);
+
   // Adds a command to the queue and attempts to run it.
   void ScheduleCommand(Command command);
 
-  // Causes a kConnect command to be put at the front of the queue.
+  // Queues |command|, a kPush command, unless one is already waiting in
+  // |command_queue_|, and attaches |done| to whichever one will run.
+  void SchedulePush(Command command, UpdateCallback done);
+
+  // Queues a kPushSettings if desired settings diverge from what the unit
+  // reported. Costs nothing when they agree.
+  void Reconcile();
+
+  // Runs Reconcile() every kReconcileIntervalMs so fields whose push failed
+  // are retried.
+  void ScheduleReconcile();
+
+  // Seeds |shared_data_| from |settings_store_|. Returns true if anything
+  // was restored.
+  bool RestoreSettings();
+
+  // Arranges for PersistSettings() to run, coalescing with any write that is
+  // already scheduled and pushing it back to kPersistDebounceMs from now.
+  void SchedulePersist();
+
+  // Sets the timer for the scheduled write. When it fires early because of
+  // a later change, it sets itself again for the rest of the quiet period.
+  void ArmPersistTimer();
+
+  // Writes the settings shadow to |settings_store_| unless it matches what
+  // was last written.
+  void PersistSettings();
+
+  // Resolves the Update in flight with |result|, folding an acknowledged
+  // settings payload into the reported settings and running its callbacks.
+  void CompleteUpdate(UpdateResult result);
+
+  // Records a link failure and causes a kConnect command to be put at the
+  // front of the queue once the link's backoff has expired. Repeated calls
+  // while a reconnect is pending are coalesced.
   void Reconnect();
 
   // Starts the next command in |command_queue_|. This the start of the logical
@@ -118,17 +376,62 @@ class Controller {
   // public method call, or in response a packet or uart event.
   void ExecuteNextCommand();
 
-  // Generates an Ack for an info packet.
-  std::unique_ptr<Cn105Packet> CreateInfoAck(InfoPacket info);
+  // Fails the current command with Reconnect() if it is still outstanding
+  // after |timeout|. A |is_send_deadline| timer only fires if the command
+  // has not been sent by then.
+  void ArmCommandTimeout(RttEstimator::Duration timeout, bool is_send_deadline);
+
+  // Returns the prebuilt InfoAck for |type|, rebuilding it only if the
+  // generation of the settings it was built from is stale. On the common
+  // path this is one atomic load and a compare; the settings lock is only
+  // taken to rebuild.
+  const Cn105Packet& GetInfoAck(CommandType type);
+
+  // Builds a fresh Ack for an info packet of |type| carrying |source|.
+  std::unique_ptr<Cn105Packet> CreateInfoAck(CommandType type,
+                                             std::array<uint8_t, 16> source);
+
+  // Returns the generation of the settings an InfoAck of |type| is built
+  // from.
+  uint32_t InfoAckGeneration(CommandType type) const;
+
+  // Returns the bytes of the settings an InfoAck of |type| is built from,
+  // or zeros for fixed content.
+  std::array<uint8_t, 16> InfoAckSource(CommandType type) const;
 
   // Event manager for handling all incoming data.
   esp_cxx::QueueSetEventManager* event_manager_;
 
+  // Everything posted to |event_manager_| goes through here, tagged with
+  // one of the sites below.
+  LoopProfiler profiler_;
+  LoopProfiler::Site* request_site_;    // Mailbox drains.
+  LoopProfiler::Site* persist_site_;
+  LoopProfiler::Site* reconcile_site_;
+  LoopProfiler::Site* reconnect_site_;
+  LoopProfiler::Site* timeout_site_;
+
+  // Samples scheduling latency of |event_manager_|.
+  LoopJitterProbe loop_jitter_;
+
+  // Requests from other tasks. A burst of them costs one event manager
+  // post: |is_drain_pending_| is set by whichever producer posts the drain
+  // and cleared by the drain before it empties the mailbox.
+  MpscMailbox<Request, kMailboxSize> mailbox_;
+  std::atomic<bool> is_drain_pending_{false};
+
+  // Requests posted as closures because the mailbox was full and not yet
+  // run. See PostRequest().
+  std::atomic<int> num_overflowed_{0};
+
   // Asynchronous logger to track protocol interactions.
   PacketLoggerType* packet_logger_;
 
   // Sets the state.
-  bool is_passthru_ = false;
+  std::atomic<bool> is_passthru_{false};
+
+  // Whether passthru forwards bytes as they arrive.
+  std::atomic<bool> is_cut_through_{false};
 
   // Channel talking to the HVAC control unit.
   HalfDuplexChannel hvac_control_;
@@ -136,6 +439,13 @@ class Controller {
   // Channel talking to the thermosat.
   HalfDuplexChannel thermostat_;
 
+  // Rules applied to forwarded packets.
+  PacketRewriter rewriter_;
+
+  // Cut-through forwarders for each direction.
+  CutThroughForwarder hvac_to_tstat_;
+  CutThroughForwarder tstat_to_hvac_;
+
   // Commands to run.
   std::deque<Command> command_queue_;
 
@@ -145,22 +455,185 @@ class Controller {
   // Whether or not the current command has received an ack.
   bool is_command_oustanding_ = false;
 
+  // The most recently started command.
+  Command current_command_ = Command::kConnect;
+
+  // When the outstanding command was written to the UART. Unset until the
+  // channel actually sends it.
+  std::optional<Clock::time_point> command_sent_time_;
+
+  // A push waiting in |command_queue_| and the callbacks of every setter
+  // folded into it.
+  struct PendingPush {
+    bool is_queued = false;
+    std::vector<UpdateCallback> callbacks;
+  };
+  PendingPush pending_settings_push_;
+  PendingPush pending_extended_push_;
+
+  // Callbacks for the push that is currently outstanding.
+  std::vector<UpdateCallback> inflight_update_callbacks_;
+
+  // Payload of the kPushSettings Update that is outstanding.
+  std::optional<StoredHvacSettings> inflight_settings_update_;
+
+  // Round trip estimators indexed by Command.
+  std::array<RttEstimator, kNumCommands> rtt_;
+
+  // A prebuilt InfoAck and the generation of the settings it was built
+  // from.
+  struct CachedInfoAck {
+    uint32_t generation = 0;
+    std::unique_ptr<Cn105Packet> packet;
+  };
+
+  // Replies for the thermostat indexed by the Info command byte. Only
+  // touched on the controller task.
+  static constexpr size_t kInfoAckCacheSize = 16;
+  std::array<CachedInfoAck, kInfoAckCacheSize> info_ack_cache_;
+
+  // Whether a backed-off kConnect is waiting to be queued. Holds off all
+  // other commands until then.
+  bool is_reconnect_pending_ = false;
+
+  // |command_number_| of the last command counted as failed. A timeout and
+  // a truncated reply to the same command are one failure.
+  std::optional<unsigned int> failed_command_number_;
+
+  // Connection state and backoff policy for |hvac_control_|.
+  LinkState link_state_;
+
+  // Forwarded link transitions.
+  LinkState::TransitionCallback link_observer_;
+
+  // Where settings survive a reboot. Optional.
+  SettingsStore* settings_store_ = nullptr;
+
+  // Encoding of the last contents written to, or read from,
+  // |settings_store_|. Writes that would not change it are skipped.
+  std::vector<uint8_t> persisted_blob_;
+
+  // When |settings_store_| was last written, when the settings last asked
+  // to be persisted, and whether a write is waiting on a timer.
+  std::optional<Clock::time_point> last_persist_time_;
+  Clock::time_point last_persist_request_time_;
+  bool is_persist_scheduled_ = false;
+
   // Ensures locked access to shared fields.
+  //
+  // HvacSettings are kept as a desired/reported shadow. Only the effective
+  // view (reported overlaid with desired) is visible to observers and the
+  // generation so a report that merely confirms a push is not a change.
   class SharedData {
    public:
+    // Effective settings.
     StoredHvacSettings GetStoredHvacSettings() const;
+
+    // Replaces the desired settings.
     void SetStoredHvacSettings(const HvacSettings& hvac_settings);
+
+    // Merges the fields present in |update| into the desired settings.
+    void MergeHvacSettings(const HvacSettings& update);
+
+    // Replaces the reported settings with an InfoAck from the unit.
+    void SetReportedHvacSettings(const HvacSettings& reported);
+
+    // Merges an acknowledged Update payload into the reported settings.
+    void MergeReportedHvacSettings(const HvacSettings& acked);
+
+    StoredHvacSettings GetDesiredHvacSettings() const;
+    StoredHvacSettings GetReportedHvacSettings() const;
+    HvacSettingsShadow GetHvacSettingsShadow() const;
+
+    // Desired fields that differ from the reported settings.
+    SettingsFieldMask GetPendingHvacFields() const;
+
     StoredExtendedSettings GetExtendedSettings() const;
     void SetExtendedSettings(const ExtendedSettings& extended_settings);
 
+    // Atomically merges the fields present in |update| into the stored copy.
+    void MergeExtendedSettings(const ExtendedSettings& update);
+
+    uint32_t hvac_settings_generation() const;
+    uint32_t extended_settings_generation() const;
+
+    // Replaces both sides of the shadow with what was persisted.
+    void Restore(const SettingsStore::Contents& contents);
+
+    ObserverId AddObserver(SettingsObserver observer);
+    void RemoveObserver(ObserverId id);
+
+    // Invoked after every write to the desired or reported settings, even
+    // ones that leave the effective view unchanged. Runs on the writing
+    // task outside of any lock. Must be set before any task writes.
+    void set_hvac_write_callback(std::function<void()> cb) {
+      hvac_write_callback_ = std::move(cb);
+    }
+
    private:
+    // Reported overlaid with desired. Requires |mutex_|.
+    StoredHvacSettings EffectiveHvacSettings() const;
+
+    // Stamps |stamps| for each field in |fields| with the current time.
+    static void StampFields(SettingsFieldMask fields,
+                            std::array<Clock::time_point, kNumSettingsFields>* stamps);
+
+    // Bumps |generation| for a write that changed the encoded bytes from
+    // |before| to |after| though no field's value changed, e.g. the unit
+    // dropping the encoded half degree byte. Observers are not told, but
+    // anything keyed on the generation, like the InfoAck images, rebuilds.
+    // Requires |mutex_|.
+    static void BumpIfReencoded(const std::array<uint8_t, 16>& before,
+                                const std::array<uint8_t, 16>& after,
+                                SettingsFieldMask changed_fields,
+                                std::atomic<uint32_t>* generation);
+
+    // Commits a modification of |desired_| or |reported_| given the
+    // effective settings from before it.
+    void CommitHvacChange(std::unique_lock<esp_cxx::Mutex> lock,
+                          const StoredHvacSettings& old_effective);
+
+    // Bumps the generations for whatever is in |change.changed_fields|,
+    // fills in the remaining fields of |change| and, if anything changed,
+    // notifies the observers in generation order. Must be called with
+    // |mutex_| held via |lock| which is released before the observers run.
+    void CommitChange(std::unique_lock<esp_cxx::Mutex> lock,
+                      SettingsChange change);
+
     mutable esp_cxx::Mutex mutex_;
 
-    // Current settings to push to the hvac controller.
-    StoredHvacSettings hvac_settings_;
+    // Settings asked for locally or by the thermostat.
+    StoredHvacSettings desired_hvac_settings_;
+
+    // Settings last reported or acknowledged by the heat pump.
+    StoredHvacSettings reported_hvac_settings_;
+
+    // See HvacSettingsShadow.
+    std::array<Clock::time_point, kNumSettingsFields> desired_changed_at_{};
+    std::array<Clock::time_point, kNumSettingsFields> reported_at_{};
 
     // Current extended settings to push to the hvac controller.
     StoredExtendedSettings extended_settings_;
+
+    // Generation counters for the effective hvac settings and
+    // |extended_settings_|.
+    // Only written under |mutex_| but atomic so readers polling for changes
+    // need not take the lock.
+    std::atomic<uint32_t> hvac_settings_generation_{0};
+    std::atomic<uint32_t> extended_settings_generation_{0};
+
+    // Changes committed but not yet passed to the observers, oldest first.
+    // See CommitChange().
+    std::deque<SettingsChange> undelivered_changes_;
+
+    // See set_hvac_write_callback().
+    std::function<void()> hvac_write_callback_;
+
+    // Guards |observers_|. Separate from |mutex_| so observers can read
+    // settings while being notified.
+    esp_cxx::Mutex observers_mutex_;
+    ObserverId next_observer_id_ = 0;
+    std::list<std::pair<ObserverId, SettingsObserver>> observers_;
   };
 
   // Hvac state being accessed by multiple tasks.
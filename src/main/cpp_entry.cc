@@ -1,13 +1,26 @@
 #include "cpp_entry.h"
 
+#include <iterator>
+
+#include "api_endpoints.h"
+#include "boot_timeline.h"
 #include "controller.h"
 #include "event_log.h"
+#include "flash_ring.h"
+#include "packet_capture.h"
+#include "stream_server.h"
+#include "task_placement.h"
+#include "udp_log_shipper.h"
 
 #ifndef FAKE_ESP_IDF
+#include "esp_attr.h"
 #include "esp_ota_ops.h"
 #include "esp_spi_flash.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #endif
 
 #include "esp_cxx/gpio.h"
@@ -34,6 +47,51 @@ constexpr Gpio kBlinkGpio = Gpio::Pin<2>();
 
 static const char *kTag = "hackvac";
 
+// Keep the controller above the network so HTTP load cannot delay UART
+// handling. See Kconfig.projbuild.
+#ifndef FAKE_ESP_IDF
+constexpr hackvac::TaskPlacement kControllerTask = {
+  "controller",
+  CONFIG_HACKVAC_CONTROLLER_TASK_PRIORITY,
+  CONFIG_HACKVAC_CONTROLLER_TASK_CORE,
+  CONFIG_HACKVAC_CONTROLLER_TASK_STACK_SIZE,
+};
+constexpr hackvac::TaskPlacement kNetTask = {
+  "net",
+  CONFIG_HACKVAC_NET_TASK_PRIORITY,
+  CONFIG_HACKVAC_NET_TASK_CORE,
+  CONFIG_HACKVAC_NET_TASK_STACK_SIZE,
+};
+#else
+constexpr hackvac::TaskPlacement kControllerTask = {"controller", 0, -1, 0};
+#endif
+
+// Unflushed history pages. RTC memory keeps them through a panic or
+// watchdog reset so FlashRing::Open() can write them out on the next boot.
+#ifndef FAKE_ESP_IDF
+RTC_NOINIT_ATTR static hackvac::FlashRing::Retained g_history_retained;
+constexpr int kHistoryFlushIntervalMs = CONFIG_HACKVAC_HISTORY_FLUSH_INTERVAL_S * 1000;
+#else
+static hackvac::FlashRing::Retained g_history_retained;
+constexpr int kHistoryFlushIntervalMs = 30 * 1000;
+#endif
+static hackvac::FlashRing* g_history;
+
+// See Kconfig.projbuild. An empty host leaves UDP logging off until it is
+// set with PUT /api/udp_log.
+#ifndef FAKE_ESP_IDF
+constexpr char kUdpLogHost[] = CONFIG_HACKVAC_UDP_LOG_HOST;
+constexpr uint16_t kUdpLogPort = CONFIG_HACKVAC_UDP_LOG_PORT;
+constexpr uint32_t kUdpLogRate = CONFIG_HACKVAC_UDP_LOG_DATAGRAMS_PER_SEC;
+constexpr int kTelemetryIntervalMs = CONFIG_HACKVAC_UDP_LOG_TELEMETRY_INTERVAL_S * 1000;
+#else
+constexpr char kUdpLogHost[] = "";
+constexpr uint16_t kUdpLogPort = 5140;
+constexpr uint32_t kUdpLogRate = 10;
+constexpr int kTelemetryIntervalMs = 10 * 1000;
+#endif
+static hackvac::PacketJournal* g_history_journal;
+
 void blink_task_func(void* parameters) {
   static const int BLINK_DELAY_MS = 5000;
 //  gpio_pad_select_gpio(hackvac::BLINK_GPIO);
@@ -92,8 +150,85 @@ static void dump_ota_boot_info() {
 #endif
 }
 
+// Keeps the partial history page from sitting in RAM for long. Appending to
+// a partly written page costs no erase.
+static void FlushHistoryPeriodically(EventManager* event_manager) {
+  g_history->Flush();
+  event_manager->RunDelayed([event_manager] { FlushHistoryPeriodically(event_manager); },
+                            kHistoryFlushIntervalMs);
+}
+
+// Queues a telemetry record on |shipper| every kTelemetryIntervalMs. Runs
+// on the network task like the rest of the shipper.
+static void SendTelemetryPeriodically(EventManager* event_manager,
+                                      hackvac::UdpLogShipper* shipper) {
+  if (shipper->is_open()) {
+    uint32_t now_ms = hackvac::EventLogTimestampMs();
+#ifndef FAKE_ESP_IDF
+    int32_t free_heap = esp_get_free_heap_size();
+    int32_t min_free_heap = esp_get_minimum_free_heap_size();
+#else
+    int32_t free_heap = 0;
+    int32_t min_free_heap = 0;
+#endif
+    const hackvac::UdpLogShipper::TelemetryValue values[] = {
+      {"uptime_s", static_cast<int32_t>(now_ms / 1000)},
+      {"free_heap", free_heap},
+      {"min_free_heap", min_free_heap},
+      {"log_drops", static_cast<int32_t>(hackvac::GetEventLogRing()->total_drops())},
+      {"udp_records_dropped", static_cast<int32_t>(shipper->stats().records_dropped)},
+    };
+    shipper->AddTelemetry(now_ms, values, std::size(values));
+  }
+  event_manager->RunDelayed(
+      [event_manager, shipper] { SendTelemetryPeriodically(event_manager, shipper); },
+      kTelemetryIntervalMs);
+}
+
+#ifndef FAKE_ESP_IDF
+// Runs from esp_restart(), such as after an OTA update or an OTA watchdog
+// revert. Flash still works here, unlike in the panic handler.
+static void OnRestart() {
+  if (g_history_journal) {
+    g_history_journal->CloseChunk();
+  }
+  g_history->Append(hackvac::FlashRing::RecordType::kRestart,
+                    hackvac::EventLogTimestampMs(), nullptr, 0);
+  g_history->Flush();
+}
+#endif
+
+static hackvac::FlashRing* OpenHistory() {
+  using hackvac::FlashPartition;
+  using hackvac::FlashRing;
+#ifndef FAKE_ESP_IDF
+  static FlashPartition partition("history");
+  esp_reset_reason_t reset_reason = esp_reset_reason();
+  if (reset_reason == ESP_RST_POWERON) {
+    // RTC memory is random after power on.
+    g_history_retained = {};
+  }
+  bool is_crash = reset_reason == ESP_RST_PANIC || reset_reason == ESP_RST_INT_WDT ||
+      reset_reason == ESP_RST_TASK_WDT || reset_reason == ESP_RST_WDT ||
+      reset_reason == ESP_RST_BROWNOUT;
+  uint32_t running_partition = esp_ota_get_running_partition()->address;
+#else
+  static FlashPartition partition(16 * FlashPartition::kSectorSize);
+  uint8_t reset_reason = 1;
+  bool is_crash = false;
+  uint32_t running_partition = 0;
+#endif
+  static FlashRing history(&partition, &g_history_retained);
+  if (!partition.is_valid() ||
+      !history.Open(reset_reason, is_crash, running_partition)) {
+    return nullptr;
+  }
+  return &history;
+}
+
 void cpp_entry() {
   using namespace hackvac;  // TODO(awong): Remove this.
+  BootTimeline* boot_timeline = BootTimeline::Get();
   dump_chip_info();
   dump_ota_boot_info();
 
@@ -108,10 +243,65 @@ void cpp_entry() {
   }
   ESP_ERROR_CHECK(ret);
 #endif
+  boot_timeline->Mark(BootMilestone::kNvsReady);
+
+  // Warnings, errors and packet history kept across reboots. See
+  // /api/history.
+  g_history = OpenHistory();
+  if (g_history) {
+    SetEventLogFlashRing(g_history);
+#ifndef FAKE_ESP_IDF
+    esp_register_shutdown_handler(&OnRestart);
+#endif
+  }
 
   // Silly debug tasks.
 //  Task blink_task(&blink_task_func, nullptr, "blink_task");
 //  Task uptime_task(&uptime_task_func, nullptr, "uptime_task");
+
+  // The heat pump link does not depend on the network so the controller
+  // comes up first and keeps the thermostat answered during Wifi
+  // association. |data_logger| holds only the first 50 packets until the
+  // network event loop starts draining it. Packets past that are dropped
+  // from the console log, though the journal below still records them.
+  MongooseEventManager net_event_manager;
+  esp_cxx::AsyncDataLogger<std::unique_ptr<Cn105Packet>, 50>
+      data_logger(&net_event_manager, [=](std::unique_ptr<Cn105Packet> packet) {
+                  packet->DebugLog();
+                  });
+
+  // Copies packets for /api/capture and /api/journal before the console
+  // hex dump.
+  static PacketJournal packet_journal;
+  PacketCapture packet_capture(&data_logger);
+  packet_capture.set_journal(&packet_journal);
+
+  // Finished journal chunks go to flash. Full pages are written from the
+  // network task, never the controller.
+  if (g_history) {
+    static_assert(PacketJournal::kChunkSize <= FlashRing::kMaxPayloadSize,
+                  "Journal chunks must fit in one history record");
+    packet_journal.set_on_chunk_closed([](const uint8_t* chunk, size_t size) {
+      g_history->Append(FlashRing::RecordType::kJournalChunk,
+                        EventLogTimestampMs(), chunk, size);
+    });
+    g_history->set_on_page_full([&net_event_manager] {
+      net_event_manager.Run([] { g_history->Flush(); });
+    });
+    g_history_journal = &packet_journal;
+    FlushHistoryPeriodically(&net_event_manager);
+  }
+
+  // Create controller.
+  QueueSetEventManager controller_event_manager(100);  // TODO(awong): Size this from /api/loop queue_high_water.
+  static hackvac::Controller controller(&controller_event_manager, &packet_capture);
+  static hackvac::SettingsStore settings_store;
+  controller.set_settings_store(&settings_store);
+  controller.Start();
+
+  StartEventLoopTask(&controller_event_manager, kControllerTask);
+  boot_timeline->Mark(BootMilestone::kControllerStarted);
+
   RunOtaWatchdog();
 
   // Setup Wifi access.
@@ -122,9 +312,9 @@ void cpp_entry() {
   if (!wifi.ConnectToAP() && !wifi.CreateSetupNetwork(kFallbackSsid, kFallbackPassword)) {
     ESP_LOGE(kTag, "Failed to connect to AP OR create a Setup Network.");
   }
+  boot_timeline->Mark(BootMilestone::kWifiUp);
 
   // Create Webserver
-  MongooseEventManager net_event_manager;
   std::string_view index_html(
       reinterpret_cast<const char*>(HTML_CONTENTS(index_html)),
       HTML_LEN(index_html));
@@ -134,18 +324,35 @@ void cpp_entry() {
   HttpServer http_server(&net_event_manager, ":8080", resp404_html);
   StandardEndpoints standard_endpoints(index_html);
   standard_endpoints.RegisterEndpoints(&http_server);
-  esp_cxx::AsyncDataLogger<std::unique_ptr<Cn105Packet>, 50>
-      data_logger(&net_event_manager, [=](std::unique_ptr<Cn105Packet> packet) {
-                  packet->DebugLog();
-                  });
 
-  // Create controller.
-  QueueSetEventManager controller_event_manager(100);  // TODO(awong): Size this.
-  static hackvac::Controller controller(&controller_event_manager, &data_logger);
-  controller.Start();
+  ApiEndpoints api_endpoints(&controller, &net_event_manager, &packet_capture, g_history);
+  // After |api_endpoints| so its connections close before the endpoints go.
+  StreamServer stream_server(&net_event_manager, ":8081");
+  api_endpoints.RegisterEndpoints(&http_server, &stream_server);
 
-  // Start all event managers.
-  // TODO(awong): Run the controller_task at a higher level.
-  Task controller_task = Task::Create<EventManager, &EventManager::Loop>(&controller_event_manager, "controller");
+  UdpLogShipper::Config udp_log_config;
+  udp_log_config.datagrams_per_sec = kUdpLogRate;
+  udp_log_config.burst = kUdpLogRate;
+#ifndef FAKE_ESP_IDF
+  uint32_t boot_id = g_history ? g_history->boot_number() : esp_random();
+#else
+  uint32_t boot_id = g_history ? g_history->boot_number() : 0;
+#endif
+  static UdpLogShipper udp_log_shipper(udp_log_config, boot_id);
+  if (kUdpLogHost[0]) {
+    udp_log_shipper.Open(kUdpLogHost, kUdpLogPort);
+  }
+  api_endpoints.SetUdpLogShipper(&udp_log_shipper);
+  SendTelemetryPeriodically(&net_event_manager, &udp_log_shipper);
+  boot_timeline->Mark(BootMilestone::kHttpServing);
+  boot_timeline->LogSummary();
+
+#ifndef FAKE_ESP_IDF
+  // Everything above lives on this stack so park the main task instead of
+  // returning.
+  StartEventLoopTask(&net_event_manager, kNetTask);
+  vTaskSuspend(nullptr);
+#else
   net_event_manager.Loop();
+#endif
 }
@@ -0,0 +1,44 @@
+#include "etag.h"
+
+#include <cstdio>
+
+namespace hackvac {
+
+size_t FormatGenerationETag(uint32_t epoch, uint32_t generation,
+                            uint32_t extended_generation, char (&buf)[kMaxETagSize + 1]) {
+  int len = snprintf(buf, sizeof(buf), "\"%x-%x-%x\"", static_cast<unsigned>(epoch),
+                     static_cast<unsigned>(generation),
+                     static_cast<unsigned>(extended_generation));
+  return len > 0 ? len : 0;
+}
+
+bool IfNoneMatchMatches(std::string_view if_none_match, std::string_view etag) {
+  auto trim = [](std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+      s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+      s.remove_suffix(1);
+    }
+    return s;
+  };
+
+  if (trim(if_none_match) == "*") {
+    return true;
+  }
+  while (!if_none_match.empty()) {
+    size_t comma = if_none_match.find(',');
+    std::string_view candidate = trim(if_none_match.substr(0, comma));
+    if_none_match = comma == std::string_view::npos ? std::string_view()
+                                                    : if_none_match.substr(comma + 1);
+    if (candidate.substr(0, 2) == "W/") {
+      candidate.remove_prefix(2);
+    }
+    if (candidate == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace hackvac
@@ -0,0 +1,31 @@
+#ifndef ETAG_H_
+#define ETAG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// HTTP entity tags for state versioned by the Controller's generation
+// counters, so a conditional GET can be answered without reading or
+// serializing the state itself.
+
+namespace hackvac {
+
+// Longest tag FormatGenerationETag() writes, including its quotes.
+constexpr size_t kMaxETagSize = 28;
+
+// Writes a strong tag like "5f3a9c01-12-4" into |buf|. |epoch| should
+// differ between boots since the generations restart from 0. Returns the
+// length written.
+size_t FormatGenerationETag(uint32_t epoch, uint32_t generation,
+                            uint32_t extended_generation, char (&buf)[kMaxETagSize + 1]);
+
+// Whether an If-None-Match header value such as
+//   "a-1-2", W/"a-1-3"
+// lists |etag| or is "*". Uses the weak comparison RFC 7232 specifies for
+// If-None-Match.
+bool IfNoneMatchMatches(std::string_view if_none_match, std::string_view etag);
+
+}  // namespace hackvac
+
+#endif  // ETAG_H_
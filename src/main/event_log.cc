@@ -1,33 +1,35 @@
 #include "event_log.h"
-#ifndef FAKE_ESP_IDF
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#include "binary_log.h"
+#include "flash_ring.h"
+#include "log_ring.h"
+
+#ifndef FAKE_ESP_IDF
+#include <stdio.h>
 #include <string.h>
 
 #include <esp_log.h>
 #include <esp_types.h>
-#include <cJSON.h>
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/ringbuf.h"
+#endif  // FAKE_ESP_IDF
 
 namespace hackvac {
 namespace {
 
-constexpr char kTag[] = "hackvac:eventlog";
-
 std::atomic_int g_listener_count{};
+std::atomic<FlashRing*> g_flash_ring{};
+std::atomic_bool g_console_deferred{};
 
-std::atomic<TaskHandle_t> g_publish_task{};
-RingbufHandle_t g_log_events;
-vprintf_like_t g_original_logger;
-
-// 8kb of log data should be enough for anyone.
-constexpr size_t kLogEventsSize = 8192;
+// 64 records of up to 128 bytes. 8kb of log data should be enough for
+// anyone.
+LogRing g_log_events;
 
-// Packets are ~22bytes. This is ~370 packets of history.
-constexpr size_t kProtocolEventsSize = 8192;
+#ifndef FAKE_ESP_IDF
+vprintf_like_t g_original_logger;
 
 void LogToOrig(const char* fmt, ...) {
   if (!g_original_logger) return;
@@ -38,92 +40,123 @@ void LogToOrig(const char* fmt, ...) {
   va_end(args);
 }
 
+// Longest log line kept in the FlashRing. Longer lines are cut.
+constexpr size_t kMaxFlashLineSize = 120;
+
+// Warnings and errors are rare enough to render here and keep across
+// reboots. FlashRing::Append() only copies into RAM.
+void AppendToFlashRing(const char* fmt, va_list args) {
+  FlashRing* ring = g_flash_ring.load(std::memory_order_relaxed);
+  if (!ring) return;
+
+  char level = LogFormatLevel(fmt);
+  if (level != 'E' && level != 'W') return;
+
+  char line[kMaxFlashLineSize];
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  if (len < 0) return;
+  size_t size = std::min(static_cast<size_t>(len), sizeof(line) - 1);
+  while (size > 0 && (line[size - 1] == '\n' || line[size - 1] == '\r')) {
+    size--;
+  }
+  ring->Append(FlashRing::RecordType::kLog, EventLogTimestampMs(), line, size);
+}
+
+// Largest encoded log record. Header plus about a dozen arguments or a
+// couple of strings.
+constexpr size_t kMaxRecordSize = LogRing::kSlotSize;
+
 int LogHook(const char* fmt, va_list argp) {
   static std::atomic_uint event_num{};
   unsigned int cur_event_num = ++event_num;
 
-  int ret_val = g_original_logger(fmt, argp);
+  va_list args;
+  va_copy(args, argp);
+  va_list flash_args;
+  va_copy(flash_args, argp);
+  AppendToFlashRing(fmt, flash_args);
+  va_end(flash_args);
+
+  // With the console deferred, info and lower lines skip the vsnprintf and
+  // UART write here. ConsoleLogSink prints them from the ring instead.
+  bool has_listeners = g_listener_count > 0;
+  char level = LogFormatLevel(fmt);
+  bool print_now = !has_listeners || !g_console_deferred.load(std::memory_order_relaxed) ||
+                   level == 'E' || level == 'W';
+  int ret_val = print_now ? g_original_logger(fmt, argp) : 0;
   // TODO(awong): The early-out logic here is unclear. Rethink how this works.
-  if (g_listener_count == 0) {
+  if (!has_listeners) {
+    va_end(args);
     return ret_val;
   }
 
-  // Render this into a string now.
-  // 512 is send buffer size.
-  // 9 is max digits for int32.
-  // 17 bytes of overhead for {"n":, "m":""}
-  // 1 byte for null terminator.
-  // 10 more bytes, incase I miscount.
-  static constexpr size_t kMaxEntrySize = 512;
-  static constexpr size_t kMaxMsgSize = kMaxEntrySize - 9 - 17 - 1 - 5;
-  char buf[kMaxEntrySize];
-  int size_left = kMaxMsgSize;
-  size_left -= snprintf(buf, size_left, "%u: ", cur_event_num);
-  vsnprintf(buf, size_left, fmt, argp);
-
-  // Render into JSON.
-  cJSON *root = cJSON_CreateObject();
-  if (root &&
-      cJSON_AddNumberToObject(root, "n", cur_event_num) &&
-      cJSON_AddStringToObject(root, "m", buf) &&
-      cJSON_PrintPreallocated(root, buf, sizeof(buf), false) == 1) {
-    // At 115200 baud, 1-byte takes 1/(1115200/8) * 1000 * 1000 = 69.4ns.
-    // Thus a 512 byte buffer takes minimal 35.6ms. Round to 40ms and give 2x
-    // for contention with 1 other write.
-    if (xRingbufferSend(g_log_events, &buf[0], strlen(buf) + 1, pdMS_TO_TICKS(80)) != pdTRUE) {
-// TODO(ajwong): Figure out how to handle dropped events.
-//      LogToOrig("event dropped %u\n", cur_event_num);;
-    }
-  } else {
-    LogToOrig("Could not render json %u\n", cur_event_num);
-  }
+  // Only the raw arguments are captured here. Formatting and JSON happen on
+  // the network task when the next batch goes out so the logging task,
+  // often the controller, pays for a memcpy rather than a vsnprintf.
+  uint8_t record[kMaxRecordSize];
+  size_t record_size = EncodeLogRecord(cur_event_num, EventLogTimestampMs(), fmt,
+                                       args, record, sizeof(record),
+                                       print_now ? kLogRecordOnConsole : 0);
+  va_end(args);
 
-  cJSON_Delete(root);
+  // Never waits. A full ring drops the record and the next batch carries a
+  // drop marker in its place.
+  g_log_events.Push(record, record_size);
   return ret_val;
 }
-
-void EventLogPublishTask(void* pvParameters) {
-  for(;;) {
-    // Block until woken
-    LogToOrig("%s: Waiting until a listener to show up\n", kTag);
-    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
-    while (g_listener_count > 0) {
-      size_t item_size;
-      void *data = xRingbufferReceive(g_log_events, &item_size, 100000);
-      if (data) {
-//        HttpdPublishEvent(data, item_size);
-        vRingbufferReturnItem(g_log_events, data);
-      }
-    }
-  }
-}
+#endif  // FAKE_ESP_IDF
 
 }  // namespace
 
 void IncrementListeners() {
   ++g_listener_count;
-  xTaskNotifyGive(g_publish_task);
 }
 
 void DecrementListeners() {
   --g_listener_count;
 }
 
+LogRing* GetEventLogRing() {
+  return &g_log_events;
+}
+
+uint32_t EventLogTimestampMs() {
+#ifndef FAKE_ESP_IDF
+  return esp_log_timestamp();
+#else
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif  // FAKE_ESP_IDF
+}
+
+void SetEventLogFlashRing(FlashRing* ring) {
+  g_flash_ring = ring;
+}
+
+void SetEventLogConsoleDeferred(bool deferred) {
+  g_console_deferred = deferred;
+}
+
+void ConsoleLogSink::OnEvent(const EventStreamer::Event& event) {
+  if (event.flags & kLogRecordOnConsole) {
+    return;
+  }
+#ifndef FAKE_ESP_IDF
+  LogToOrig("%.*s", static_cast<int>(event.size), event.text);
+#else
+  fwrite(event.text, 1, event.size, stdout);
+#endif  // FAKE_ESP_IDF
+}
+
+size_t GetEventLogDrops(LogRing::DropCount* out, size_t max) {
+  return g_log_events.GetDropCounts(out, max);
+}
+
 void EventLogInit() {
-  g_log_events = xRingbufferCreate(kLogEventsSize, RINGBUF_TYPE_NOSPLIT);
+#ifndef FAKE_ESP_IDF
   g_original_logger = esp_log_set_vprintf(&LogHook);
   LogToOrig("^^vvv^^ Logger has been hooked ^^vvv^^\n");
-  // TODO(awong): Look at xtensa_config.h for stack size.
-  TaskHandle_t publish_task = nullptr;
-  // mg_broadcast allocates send buffer on stack. Ensure stack is at least that big.
-  static constexpr size_t kMaxMessageSize = 8192;
-  xTaskCreate(&EventLogPublishTask, "event_log_publish", XT_STACK_EXTRA_CLIB + kMaxMessageSize, NULL, 2, &publish_task);
-  g_publish_task = publish_task;
+#endif  // FAKE_ESP_IDF
 }
 
 }  // namespace hackvac
-#else
-namespace hackvac {
-void EventLogInit() {}
-}  // namespace hackvac
-#endif
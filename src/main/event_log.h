@@ -2,16 +2,52 @@
 #define EVENT_LOG_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include <functional>
 #include <memory>
 
+#include "event_streamer.h"
+#include "log_ring.h"
+
 namespace hackvac {
 
+class FlashRing;
+
 void IncrementListeners();
 void DecrementListeners();
 
 void EventLogInit();
 
+// Log records captured while there are listeners. The network task is the
+// only consumer; see EventStreamer.
+LogRing* GetEventLogRing();
+
+// Clock used for record timestamps, in milliseconds.
+uint32_t EventLogTimestampMs();
+
+// Also keeps warning and error lines in |ring| so they survive a reboot.
+// Pass nullptr to stop.
+void SetEventLogFlashRing(FlashRing* ring);
+
+// While deferred and someone drains the ring, info and lower lines are only
+// captured and the logging task skips the console. ConsoleLogSink prints
+// them later from the network task. Errors and warnings always print at
+// once so a crash does not lose them.
+void SetEventLogConsoleDeferred(bool deferred);
+
+// Writes the lines the logger left off the console. Add it to the
+// EventStreamer draining GetEventLogRing() before deferring. Lines dropped
+// from a full ring only show up as the drop marker.
+class ConsoleLogSink : public EventStreamer::Sink {
+ public:
+  void OnEvent(const EventStreamer::Event& event) override;
+  void OnBatchDone(uint32_t) override {}
+};
+
+// Per tag counts of log lines dropped because /api/events fell behind.
+// Returns the number of entries written to |out|.
+size_t GetEventLogDrops(LogRing::DropCount* out, size_t max);
+
 }  // namespace hackvac
 
 #endif   // EVENT_LOG_H_
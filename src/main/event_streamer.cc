@@ -0,0 +1,182 @@
+#include "event_streamer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "event_log.h"
+
+namespace hackvac {
+
+namespace {
+
+// Appends |text| as the body of a JSON string.
+void AppendJsonEscaped(std::string* out, const char* text) {
+  for (const char* p = text; *p; ++p) {
+    unsigned char c = static_cast<unsigned char>(*p);
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      default:
+        if (c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out->append(escaped);
+        } else {
+          out->push_back(static_cast<char>(c));
+        }
+    }
+  }
+}
+
+}  // namespace
+
+EventStreamer::EventStreamer(LogRing* ring, Config config)
+  : ring_(ring),
+    config_(config) {
+  events_json_.reserve(config_.max_frame_bytes);
+  frame_.reserve(config_.max_frame_bytes + 64);
+}
+
+EventStreamer::EventStreamer(LogRing* ring) : EventStreamer(ring, Config()) {
+}
+
+EventStreamer::~EventStreamer() {
+  for (size_t i = 0; i < clients_.size() + sinks_.size(); ++i) {
+    DecrementListeners();
+  }
+}
+
+void EventStreamer::AddClient(Client* client) {
+  clients_.push_back({client});
+  IncrementListeners();
+}
+
+void EventStreamer::RemoveClient(Client* client) {
+  auto it = std::find_if(clients_.begin(), clients_.end(),
+                         [client](const ClientState& state) {
+                           return state.client == client;
+                         });
+  if (it != clients_.end()) {
+    clients_.erase(it);
+    DecrementListeners();
+  }
+}
+
+void EventStreamer::AddSink(Sink* sink) {
+  sinks_.push_back(sink);
+  IncrementListeners();
+}
+
+void EventStreamer::RemoveSink(Sink* sink) {
+  auto it = std::find(sinks_.begin(), sinks_.end(), sink);
+  if (it != sinks_.end()) {
+    sinks_.erase(it);
+    DecrementListeners();
+  }
+}
+
+size_t EventStreamer::PublishBatch(uint32_t now_ms) {
+  bool has_clients = !clients_.empty();
+  if (!has_clients && sinks_.empty()) {
+    return 0;
+  }
+
+  // Leave room for the closing bracket and the per-client wrapper.
+  static constexpr size_t kWrapperBytes = 64;
+  size_t budget = config_.max_frame_bytes > kWrapperBytes ?
+      config_.max_frame_bytes - kWrapperBytes : 0;
+
+  events_json_.clear();
+  size_t num_events = 0;
+  uint8_t record[LogRing::kSlotSize];
+  size_t record_size;
+  while ((!has_clients || events_json_.size() < budget) &&
+         ring_->Pop(record, &record_size)) {
+    LogRecordHeader header = {};
+    ReadLogRecordHeader(record, record_size, &header);
+    char text[256];
+    size_t text_size = std::min(RenderLogRecord(record, record_size, text, sizeof(text)),
+                                sizeof(text) - 1);
+
+    if (has_clients) {
+      if (num_events) {
+        events_json_.push_back(',');
+      }
+      AppendEvent(header, text);
+    }
+    if (!sinks_.empty()) {
+      Event event = {header.sequence, header.time_ms,
+                     header.format ? LogFormatLevel(header.format) : 'I',
+                     text, text_size, header.flags};
+      for (Sink* sink : sinks_) {
+        sink->OnEvent(event);
+      }
+    }
+    stats_.latency_us.Add(now_ms >= header.time_ms ? (now_ms - header.time_ms) * 1000 : 0);
+    num_events++;
+  }
+  for (Sink* sink : sinks_) {
+    sink->OnBatchDone(now_ms);
+  }
+  if (!num_events) {
+    return 0;
+  }
+  stats_.batches++;
+  stats_.events += num_events;
+
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    ClientState& state = *it;
+    size_t frame_estimate = events_json_.size() + kWrapperBytes;
+    if (state.client->pending_bytes() + frame_estimate > config_.window_bytes) {
+      state.missed_events += num_events;
+      stats_.skipped++;
+      if (++state.skipped_batches > config_.max_skipped_batches) {
+        stats_.evictions++;
+        state.client->Close();
+        it = clients_.erase(it);
+        DecrementListeners();
+        continue;
+      }
+      ++it;
+      continue;
+    }
+
+    char header[kWrapperBytes];
+    snprintf(header, sizeof(header), "{\"now\":%u,\"missed\":%u,\"events\":[",
+             now_ms, state.missed_events);
+    frame_.assign(header);
+    frame_.append(events_json_);
+    frame_.append("]}");
+    state.client->SendFrame(frame_);
+    stats_.frames_sent++;
+    stats_.bytes_sent += frame_.size();
+    state.missed_events = 0;
+    state.skipped_batches = 0;
+    ++it;
+  }
+  return num_events;
+}
+
+void EventStreamer::AppendEvent(const LogRecordHeader& header, const char* text) {
+  char prefix[48];
+  snprintf(prefix, sizeof(prefix), "{\"n\":%u,\"t\":%u,\"m\":\"",
+           header.sequence, header.time_ms);
+  events_json_.append(prefix);
+  AppendJsonEscaped(&events_json_, text);
+  events_json_.append("\"}");
+}
+
+}  // namespace hackvac
@@ -0,0 +1,139 @@
+#ifndef EVENT_STREAMER_H_
+#define EVENT_STREAMER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "binary_log.h"
+#include "histogram.h"
+#include "log_ring.h"
+
+namespace hackvac {
+
+// Streams log records from a LogRing to any number of clients, typically
+// /api/events websockets. Each PublishBatch() drains up to one frame worth of
+// records, renders them to JSON once, and sends that frame to every client.
+//
+// Each client has a send window. A client whose unsent bytes would exceed it
+// skips the batch. The next frame it gets reports how many events it missed.
+// A client that skips too many batches in a row is closed and evicted so a
+// stalled dashboard cannot pin memory.
+//
+// Sinks see every drained event as rendered text instead of a JSON frame.
+// They have no window; each sink does its own buffering. See UdpLogShipper.
+//
+// Not thread safe. Everything, including the Client and Sink calls, runs on
+// the network task.
+class EventStreamer {
+ public:
+  class Client {
+   public:
+    virtual ~Client() = default;
+
+    // Queues |frame| as one text frame.
+    virtual void SendFrame(const std::string& frame) = 0;
+
+    // Bytes queued on this connection and not yet written to the socket.
+    virtual size_t pending_bytes() const = 0;
+
+    // Starts closing the connection. RemoveClient() is still expected.
+    virtual void Close() = 0;
+  };
+
+  struct Event {
+    uint32_t sequence;
+    uint32_t time_ms;
+    char level;  // 'E', 'W', 'I', 'D' or 'V'.
+    const char* text;
+    size_t size;
+    uint8_t flags = 0;  // LogRecordHeader::flags.
+  };
+
+  class Sink {
+   public:
+    virtual ~Sink() = default;
+
+    // Called for each event in ring order. |event| is only valid for the
+    // call.
+    virtual void OnEvent(const Event& event) = 0;
+
+    // Called at the end of every PublishBatch(), even one with no events,
+    // so a sink can send what it has buffered.
+    virtual void OnBatchDone(uint32_t now_ms) = 0;
+  };
+
+  struct Config {
+    // Frames are closed off once the next event would push them past this.
+    size_t max_frame_bytes = 4096;
+
+    // Most unsent bytes a client may have before batches skip it.
+    size_t window_bytes = 12288;
+
+    // Consecutive batches a client may skip. One more evicts it.
+    int max_skipped_batches = 40;
+  };
+
+  struct Stats {
+    uint32_t batches = 0;
+    uint32_t events = 0;
+    uint32_t frames_sent = 0;
+    uint32_t bytes_sent = 0;
+    uint32_t skipped = 0;
+    uint32_t evictions = 0;
+
+    // Time from when an event was logged to when its batch was sent. Only
+    // millisecond resolution since that is what records carry.
+    Histogram latency_us;
+  };
+
+  EventStreamer(LogRing* ring, Config config);
+  explicit EventStreamer(LogRing* ring);
+  ~EventStreamer();
+
+  // Clients are not owned and must stay valid until removed.
+  void AddClient(Client* client);
+  void RemoveClient(Client* client);
+  size_t num_clients() const { return clients_.size(); }
+
+  // Sinks are not owned and must stay valid until removed. Like clients,
+  // they keep log records flowing into the ring.
+  void AddSink(Sink* sink);
+  void RemoveSink(Sink* sink);
+  size_t num_sinks() const { return sinks_.size(); }
+
+  // Sends one frame of whatever is in the ring to each client with room in
+  // its window, and every event to each sink. With no clients the whole
+  // ring is drained. |now_ms| is on the same clock as the records' time_ms.
+  // Returns the number of events taken from the ring.
+  size_t PublishBatch(uint32_t now_ms);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct ClientState {
+    Client* client;
+    uint32_t missed_events = 0;
+    int skipped_batches = 0;
+  };
+
+  // Appends |header| and |text| as {"n":..., "t":..., "m":"..."} to
+  // |events_json_|.
+  void AppendEvent(const LogRecordHeader& header, const char* text);
+
+  LogRing* ring_;
+  const Config config_;
+  std::vector<ClientState> clients_;
+  std::vector<Sink*> sinks_;
+
+  // Scratch buffers reused between batches.
+  std::string events_json_;
+  std::string frame_;
+
+  Stats stats_;
+};
+
+}  // namespace hackvac
+
+#endif  // EVENT_STREAMER_H_
@@ -0,0 +1,499 @@
+#include "flash_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+#include "esp_cxx/logging.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "flash_ring";
+
+uint16_t ReadU16(const uint8_t* data) {
+  return data[0] | (data[1] << 8);
+}
+
+uint32_t ReadU32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+      (static_cast<uint32_t>(data[3]) << 24);
+}
+
+void WriteU16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xff;
+  out[1] = value >> 8;
+}
+
+void WriteU32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+size_t Align4(size_t size) {
+  return (size + 3) & ~static_cast<size_t>(3);
+}
+
+class Fletcher16 {
+ public:
+  void Add(const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      sum1_ = (sum1_ + data[i]) % 255;
+      sum2_ = (sum2_ + sum1_) % 255;
+    }
+  }
+  uint16_t value() const { return (sum2_ << 8) | sum1_; }
+
+ private:
+  uint16_t sum1_ = 0;
+  uint16_t sum2_ = 0;
+};
+
+// Walks the records of one sector image. Returns the offset just past the
+// last valid record. |is_torn| is set if decoding stopped on something
+// other than erased flash.
+size_t DecodeRecords(const uint8_t* sector, size_t size, bool* is_torn,
+                     const std::function<void(const FlashRing::Record&)>& on_record) {
+  size_t pos = FlashRing::kSectorHeaderSize;
+  *is_torn = false;
+  while (pos + FlashRing::kRecordHeaderSize <= size) {
+    const uint8_t* header = sector + pos;
+    if (header[0] == 0xff) {
+      return pos;
+    }
+    uint16_t payload_size = ReadU16(header + 2);
+    size_t total = Align4(FlashRing::kRecordHeaderSize + payload_size);
+    if (total > size - pos) {
+      *is_torn = true;
+      return pos;
+    }
+    Fletcher16 check;
+    check.Add(header, 8);
+    check.Add(header + FlashRing::kRecordHeaderSize, payload_size);
+    if (check.value() != ReadU16(header + 8)) {
+      *is_torn = true;
+      return pos;
+    }
+    if (on_record) {
+      FlashRing::Record record;
+      record.type = static_cast<FlashRing::RecordType>(header[0]);
+      record.boot = header[1];
+      record.time_ms = ReadU32(header + 4);
+      record.payload = header + FlashRing::kRecordHeaderSize;
+      record.size = payload_size;
+      on_record(record);
+    }
+    pos += total;
+  }
+  return pos;
+}
+
+}  // namespace
+
+constexpr size_t FlashPartition::kSectorSize;
+
+#ifndef FAKE_ESP_IDF
+FlashPartition::FlashPartition(const char* label)
+  : partition_(esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY, label)) {
+  if (!partition_) {
+    ESP_LOGE(kTag, "No data partition labelled %s", label);
+  }
+}
+
+FlashPartition::~FlashPartition() = default;
+
+bool FlashPartition::is_valid() const {
+  return partition_ != nullptr;
+}
+
+size_t FlashPartition::num_sectors() const {
+  return partition_ ? partition_->size / kSectorSize : 0;
+}
+
+bool FlashPartition::Read(size_t offset, void* out, size_t size) const {
+  return partition_ &&
+      esp_partition_read(partition_, offset, out, size) == ESP_OK;
+}
+
+bool FlashPartition::Write(size_t offset, const void* data, size_t size) {
+  return partition_ &&
+      esp_partition_write(partition_, offset, data, size) == ESP_OK;
+}
+
+bool FlashPartition::EraseSector(size_t sector) {
+  erase_count_++;
+  return partition_ &&
+      esp_partition_erase_range(partition_, sector * kSectorSize, kSectorSize) == ESP_OK;
+}
+#else
+FlashPartition::FlashPartition(size_t size) : fake_flash_(size, 0xff) {
+}
+
+FlashPartition::~FlashPartition() = default;
+
+bool FlashPartition::is_valid() const {
+  return !fake_flash_.empty();
+}
+
+size_t FlashPartition::num_sectors() const {
+  return fake_flash_.size() / kSectorSize;
+}
+
+bool FlashPartition::Read(size_t offset, void* out, size_t size) const {
+  if (offset > fake_flash_.size() || size > fake_flash_.size() - offset) {
+    return false;
+  }
+  memcpy(out, &fake_flash_[offset], size);
+  return true;
+}
+
+bool FlashPartition::Write(size_t offset, const void* data, size_t size) {
+  if (offset > fake_flash_.size() || size > fake_flash_.size() - offset) {
+    return false;
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    fake_flash_[offset + i] &= bytes[i];
+  }
+  return true;
+}
+
+bool FlashPartition::EraseSector(size_t sector) {
+  if (sector >= num_sectors()) {
+    return false;
+  }
+  erase_count_++;
+  std::fill_n(fake_flash_.begin() + sector * kSectorSize, kSectorSize, 0xff);
+  return true;
+}
+#endif  // FAKE_ESP_IDF
+
+constexpr size_t FlashRing::kPageSize;
+constexpr size_t FlashRing::kMaxQueuedPages;
+constexpr uint32_t FlashRing::kSectorMagic;
+constexpr size_t FlashRing::kSectorHeaderSize;
+constexpr size_t FlashRing::kRecordHeaderSize;
+constexpr size_t FlashRing::kMaxPayloadSize;
+constexpr size_t FlashRing::kBootInfoSize;
+constexpr uint32_t FlashRing::kRetainedMagic;
+
+FlashRing::FlashRing(FlashPartition* partition, Retained* retained)
+  : partition_(partition), retained_(retained) {
+}
+
+FlashRing::~FlashRing() = default;
+
+bool FlashRing::Open(uint8_t reset_reason, bool is_crash, uint32_t running_partition) {
+  size_t num_sectors = partition_->num_sectors();
+  if (num_sectors < 2) {
+    ESP_LOGE(kTag, "Partition too small for a ring");
+    return false;
+  }
+
+  // Anything still in RAM from before a reset goes to flash before the scan
+  // so it is found like everything else. Garbage from a power on fails
+  // these checks.
+  bool is_retained_sane = retained_->magic == kRetainedMagic &&
+      retained_->num_queued <= kMaxQueuedPages;
+  for (size_t i = 0; is_retained_sane && i <= retained_->num_queued; ++i) {
+    const Page& page = i < retained_->num_queued ? retained_->queued[i] : retained_->current;
+    is_retained_sane = page.offset % kPageSize == 0 &&
+        page.offset < num_sectors * FlashPartition::kSectorSize &&
+        page.used <= kPageSize && page.flushed <= page.used;
+  }
+  if (is_retained_sane) {
+    Flush();
+  }
+
+  retained_->magic = kRetainedMagic;
+  retained_->num_queued = 0;
+  Scan();
+
+  uint32_t boot_number;
+  {
+    std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+    boot_number = ++retained_->boot_number;
+    is_open_ = true;
+  }
+  ESP_LOGI(kTag, "Boot %u, %u sectors", boot_number, static_cast<unsigned>(num_sectors));
+
+  uint8_t info[kBootInfoSize] = {};
+  WriteU32(info, boot_number);
+  info[4] = reset_reason;
+  WriteU32(info + 8, running_partition);
+  Append(is_crash ? RecordType::kCrash : RecordType::kBoot, 0, info, sizeof(info));
+  Flush();
+  return true;
+}
+
+void FlashRing::set_on_page_full(std::function<void()> on_page_full) {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  on_page_full_ = std::move(on_page_full);
+}
+
+uint32_t FlashRing::write_pos() const {
+  return retained_->current.offset + retained_->current.used;
+}
+
+bool FlashRing::Append(RecordType type, uint32_t time_ms, const void* payload, size_t size) {
+  size_t total = Align4(kRecordHeaderSize + size);
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  if (!is_open_ || size > kMaxPayloadSize) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  uint32_t pos = write_pos();
+  size_t offset_in_sector = pos % FlashPartition::kSectorSize;
+  bool is_new_sector = offset_in_sector == 0 ||
+      offset_in_sector + total > FlashPartition::kSectorSize;
+
+  // Every page this record fills has to fit in the queue.
+  size_t start_used = is_new_sector ? kSectorHeaderSize : retained_->current.used;
+  size_t pages_needed = (is_new_sector ? 1 : 0) + (start_used + total) / kPageSize;
+  if (pages_needed > kMaxQueuedPages - retained_->num_queued) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  if (is_new_sector) {
+    size_t sector = sector_of(pos);
+    if (offset_in_sector != 0) {
+      sector++;
+    }
+    StartSector(sector % partition_->num_sectors());
+  }
+
+  uint8_t header[kRecordHeaderSize];
+  header[0] = static_cast<uint8_t>(type);
+  header[1] = retained_->boot_number & 0xff;
+  WriteU16(header + 2, size);
+  WriteU32(header + 4, time_ms);
+  Fletcher16 check;
+  check.Add(header, 8);
+  check.Add(static_cast<const uint8_t*>(payload), size);
+  WriteU16(header + 8, check.value());
+
+  static constexpr uint8_t kPadding[3] = {0xff, 0xff, 0xff};
+  PutBytes(header, sizeof(header));
+  PutBytes(static_cast<const uint8_t*>(payload), size);
+  PutBytes(kPadding, total - kRecordHeaderSize - size);
+  return true;
+}
+
+void FlashRing::PutBytes(const uint8_t* data, size_t size) {
+  while (size > 0) {
+    Page& page = retained_->current;
+    size_t n = std::min(size, kPageSize - page.used);
+    memcpy(page.bytes + page.used, data, n);
+    page.used += n;
+    data += n;
+    size -= n;
+    if (page.used == kPageSize) {
+      RotatePage(page.offset + kPageSize);
+    }
+  }
+}
+
+bool FlashRing::RotatePage(uint32_t offset) {
+  Page& page = retained_->current;
+  if (page.used > page.flushed) {
+    if (retained_->num_queued == kMaxQueuedPages) {
+      return false;
+    }
+    retained_->queued[retained_->num_queued++] = page;
+    if (on_page_full_ && !is_page_full_signalled_) {
+      is_page_full_signalled_ = true;
+      on_page_full_();
+    }
+  }
+  page.offset = offset;
+  page.used = 0;
+  page.flushed = 0;
+  memset(page.bytes, 0xff, sizeof(page.bytes));
+  return true;
+}
+
+bool FlashRing::StartSector(size_t sector) {
+  if (!RotatePage(sector * FlashPartition::kSectorSize)) {
+    return false;
+  }
+  retained_->sequence++;
+  newest_sector_ = sector;
+  Page& page = retained_->current;
+  WriteU32(page.bytes, kSectorMagic);
+  WriteU32(page.bytes + 4, retained_->sequence);
+  page.used = kSectorHeaderSize;
+  return true;
+}
+
+void FlashRing::Flush() {
+  std::lock_guard<esp_cxx::Mutex> flush_lock(flush_mutex_);
+  for (;;) {
+    Page page;
+    bool is_queued;
+    {
+      std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+      is_queued = retained_->num_queued > 0;
+      if (is_queued) {
+        page = retained_->queued[0];
+      } else {
+        page = retained_->current;
+        is_page_full_signalled_ = false;
+      }
+    }
+
+    // Flash is written without |mutex_| so Append() never waits on an
+    // erase. Logging from here is fine for the same reason.
+    if (page.used > page.flushed && !WritePage(page)) {
+      ESP_LOGW(kTag, "Lost page at 0x%x", page.offset);
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+    if (is_queued) {
+      std::copy(retained_->queued.begin() + 1,
+                retained_->queued.begin() + retained_->num_queued,
+                retained_->queued.begin());
+      retained_->num_queued--;
+    }
+    // The current page may have been queued, or appended to, while it was
+    // being written. Either way the copy must not erase the sector again.
+    for (size_t i = 0; i <= retained_->num_queued; ++i) {
+      Page& other = i < retained_->num_queued ? retained_->queued[i] : retained_->current;
+      if (other.offset == page.offset) {
+        other.flushed = std::max(other.flushed, page.used);
+      }
+    }
+    if (!is_queued) {
+      return;
+    }
+  }
+}
+
+bool FlashRing::WritePage(const Page& page) {
+  if (page.flushed == 0 && page.offset % FlashPartition::kSectorSize == 0 &&
+      !partition_->EraseSector(sector_of(page.offset))) {
+    return false;
+  }
+  // Bytes past |used| are 0xff and bytes before |flushed| match what is on
+  // flash, so widening to whole words changes nothing.
+  size_t start = page.flushed & ~static_cast<size_t>(3);
+  size_t end = Align4(page.used);
+  pages_written_++;
+  return partition_->Write(page.offset + start, page.bytes + start, end - start);
+}
+
+void FlashRing::Scan() {
+  size_t num_sectors = partition_->num_sectors();
+  bool has_newest = false;
+  uint32_t newest_sequence = 0;
+  for (size_t i = 0; i < num_sectors; ++i) {
+    uint8_t header[kSectorHeaderSize];
+    if (!partition_->Read(i * FlashPartition::kSectorSize, header, sizeof(header)) ||
+        ReadU32(header) != kSectorMagic) {
+      continue;
+    }
+    uint32_t sequence = ReadU32(header + 4);
+    if (!has_newest || static_cast<int32_t>(sequence - newest_sequence) > 0) {
+      has_newest = true;
+      newest_sequence = sequence;
+      newest_sector_ = i;
+    }
+  }
+
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  Page& page = retained_->current;
+  memset(page.bytes, 0xff, sizeof(page.bytes));
+  page.offset = 0;
+  page.used = 0;
+  page.flushed = 0;
+  retained_->sequence = newest_sequence;
+  retained_->boot_number = 0;
+  if (!has_newest) {
+    newest_sector_ = num_sectors - 1;
+    return;
+  }
+
+  // Only the boot number is needed from older sectors.
+  std::vector<uint8_t> sector(FlashPartition::kSectorSize);
+  size_t end = 0;
+  for (size_t i = 1; i <= num_sectors; ++i) {
+    size_t index = (newest_sector_ + i) % num_sectors;
+    if (!partition_->Read(index * FlashPartition::kSectorSize, sector.data(), sector.size()) ||
+        ReadU32(sector.data()) != kSectorMagic) {
+      continue;
+    }
+    bool is_torn;
+    end = DecodeRecords(sector.data(), sector.size(), &is_torn, [this](const Record& record) {
+          if ((record.type == RecordType::kBoot || record.type == RecordType::kCrash) &&
+              record.size >= kBootInfoSize) {
+            retained_->boot_number = ReadU32(record.payload);
+          }
+        });
+    if (is_torn) {
+      // Partly written bytes cannot be written over. Move on to the next
+      // sector.
+      end = FlashPartition::kSectorSize;
+    }
+  }
+
+  // |sector| now holds the newest one. Resume in the page |end| falls in.
+  size_t page_start = end & ~(kPageSize - 1);
+  page.offset = newest_sector_ * FlashPartition::kSectorSize + page_start;
+  page.used = end - page_start;
+  page.flushed = page.used;
+  memcpy(page.bytes, sector.data() + page_start, page.used);
+}
+
+size_t FlashRing::num_sectors() const {
+  return partition_->num_sectors();
+}
+
+bool FlashRing::ReadSector(size_t index, uint8_t* out) {
+  std::lock_guard<esp_cxx::Mutex> flush_lock(flush_mutex_);
+  size_t num_sectors = partition_->num_sectors();
+  if (index >= num_sectors) {
+    return false;
+  }
+  size_t sector;
+  {
+    std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+    sector = (newest_sector_ + 1 + index) % num_sectors;
+  }
+  return partition_->Read(sector * FlashPartition::kSectorSize, out,
+                          FlashPartition::kSectorSize) &&
+      ReadU32(out) == kSectorMagic;
+}
+
+void FlashRing::ForEachRecord(const std::function<void(const Record&)>& on_record) {
+  std::vector<uint8_t> sector(FlashPartition::kSectorSize);
+  for (size_t i = 0; i < num_sectors(); ++i) {
+    uint32_t sequence;
+    if (ReadSector(i, sector.data())) {
+      DecodeSector(sector.data(), sector.size(), &sequence, on_record);
+    }
+  }
+}
+
+bool FlashRing::DecodeSector(const uint8_t* sector, size_t size, uint32_t* sequence,
+                             const std::function<void(const Record&)>& on_record) {
+  if (size < kSectorHeaderSize || ReadU32(sector) != kSectorMagic) {
+    return false;
+  }
+  *sequence = ReadU32(sector + 4);
+  bool is_torn;
+  DecodeRecords(sector, size, &is_torn, on_record);
+  return true;
+}
+
+uint32_t FlashRing::boot_number() const {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  return retained_->boot_number;
+}
+
+}  // namespace hackvac
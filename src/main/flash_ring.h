@@ -0,0 +1,214 @@
+#ifndef FLASH_RING_H_
+#define FLASH_RING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "esp_cxx/mutex.h"
+
+#ifndef FAKE_ESP_IDF
+#include "esp_partition.h"
+#endif
+
+namespace hackvac {
+
+// A raw data partition with NOR flash semantics: erase sets a whole sector
+// to 0xff and writes can only clear bits.
+//
+// On device this wraps the partition with the given label from
+// partitions.csv. Host builds keep an in-memory image with the same
+// semantics so FlashRing can be tested against torn writes and reopening.
+class FlashPartition {
+ public:
+  static constexpr size_t kSectorSize = 4096;
+
+#ifndef FAKE_ESP_IDF
+  explicit FlashPartition(const char* label);
+#else
+  explicit FlashPartition(size_t size);
+#endif
+  ~FlashPartition();
+
+  // False if the partition was not found. Every other call then fails.
+  bool is_valid() const;
+  size_t num_sectors() const;
+
+  bool Read(size_t offset, void* out, size_t size) const;
+  bool Write(size_t offset, const void* data, size_t size);
+  bool EraseSector(size_t sector);
+
+  uint32_t erase_count() const { return erase_count_; }
+
+ private:
+#ifndef FAKE_ESP_IDF
+  const esp_partition_t* partition_;
+#else
+  std::vector<uint8_t> fake_flash_;
+#endif
+  uint32_t erase_count_ = 0;
+};
+
+// Append-only log of recent history that survives reboots: compressed
+// packet journal chunks, warning and error log lines, and a marker per boot
+// saying why the previous one ended. Read back over /api/history and decode
+// with history.py at the top of the repo.
+//
+// The partition is used as a ring of sectors. Each sector starts with
+//   u32 kSectorMagic | u32 sequence
+// and the sequence increases by one per sector written, so the newest
+// sector is found on boot by scanning the headers. Records follow, each
+//   u8 type | u8 boot | u16 payload size | u32 ms since boot |
+//   u16 Fletcher-16 of the preceding 8 bytes and the payload | payload
+// padded to a multiple of 4 bytes. |boot| is the low byte of the boot
+// number. Records never straddle sectors; the unused tail of a sector is
+// left erased. Decoding stops at the first 0xff type or bad checksum in a
+// sector, which also covers a write torn by a reset.
+//
+// Wear: a sector is erased only when the ring comes back around to it, so
+// every sector sees the same number of erases and nothing is rewritten in
+// between. Append() never touches flash. It copies into a kPageSize RAM
+// page and queues the page when full. Flush(), on one task, writes queued
+// pages and the new bytes of the partial page. Erased flash can be written
+// more than once, so topping up a partial page costs no erase.
+//
+// The pages live in a Retained block that the caller places in
+// RTC_NOINIT memory. After a panic or watchdog reset, Open() writes out
+// whatever had not been flushed before the reset.
+//
+// Append() is safe from any task. Flush() and the read calls take a
+// separate lock and may block on flash for tens of milliseconds.
+class FlashRing {
+ public:
+  static constexpr size_t kPageSize = 256;
+  static constexpr size_t kMaxQueuedPages = 6;
+  static constexpr uint32_t kSectorMagic = 0x31465648;  // "HVF1"
+  static constexpr size_t kSectorHeaderSize = 8;
+  static constexpr size_t kRecordHeaderSize = 10;
+
+  // Records larger than this are rejected by Append().
+  static constexpr size_t kMaxPayloadSize =
+      (kMaxQueuedPages - 1) * kPageSize - kRecordHeaderSize;
+
+  enum class RecordType : uint8_t {
+    // Payload: BootInfo. Written by Open() each boot.
+    kBoot = 1,
+    // Same payload as kBoot. Used instead when the previous boot ended in a
+    // panic, watchdog or brownout.
+    kCrash = 2,
+    // Payload: the rendered log line.
+    kLog = 3,
+    // Payload: one PacketJournal chunk, header included.
+    kJournalChunk = 4,
+    // No payload. Written on an orderly restart such as an OTA update.
+    kRestart = 5,
+  };
+
+  // BootInfo payload, little-endian:
+  //   u32 boot number | u8 esp_reset_reason_t of the previous boot |
+  //   3 reserved | u32 flash address of the running app
+  static constexpr size_t kBootInfoSize = 12;
+
+  struct Page {
+    uint32_t offset;   // Partition offset of bytes[0]. Multiple of kPageSize.
+    uint16_t used;     // Bytes filled so far.
+    uint16_t flushed;  // Bytes already on flash.
+    uint8_t bytes[kPageSize];
+  };
+
+  // Appended but not yet flushed data. Must outlive the FlashRing.
+  struct Retained {
+    uint32_t magic;
+    uint32_t sequence;  // Sequence of the sector |current| is in.
+    uint32_t boot_number;
+    Page current;
+    std::array<Page, kMaxQueuedPages> queued;
+    uint8_t num_queued;
+  };
+
+  struct Record {
+    RecordType type;
+    uint8_t boot;
+    uint32_t time_ms;
+    const uint8_t* payload;
+    uint16_t size;
+  };
+
+  FlashRing(FlashPartition* partition, Retained* retained);
+  ~FlashRing();
+
+  // Writes out anything retained from before a reset, finds the end of the
+  // newest sector, and appends the boot marker. |reset_reason| and
+  // |running_partition| go into BootInfo. Returns false if the partition is
+  // unusable, after which every Append() fails.
+  bool Open(uint8_t reset_reason, bool is_crash, uint32_t running_partition);
+
+  // Queues a record. Returns false if it is too big or the queue is full
+  // because Flush() is behind, in which case the record is counted in
+  // dropped().
+  bool Append(RecordType type, uint32_t time_ms, const void* payload, size_t size);
+
+  // Writes queued pages and the unflushed tail of the current one.
+  void Flush();
+
+  // Invoked from Append(), under its lock, the first time a page fills
+  // after a Flush(). Lets the owner schedule a Flush() on its own task.
+  void set_on_page_full(std::function<void()> on_page_full);
+
+  // Sectors in ring order: index 0 is the oldest. Copies sector |index|
+  // into |out|, which must hold FlashPartition::kSectorSize bytes. Returns
+  // false if that sector holds nothing yet. Only flushed data is visible.
+  size_t num_sectors() const;
+  bool ReadSector(size_t index, uint8_t* out);
+
+  // Calls |on_record| for every valid record in ring order.
+  void ForEachRecord(const std::function<void(const Record&)>& on_record);
+
+  // Decodes the records in one sector image. Returns false if the header is
+  // not a FlashRing sector.
+  static bool DecodeSector(const uint8_t* sector, size_t size, uint32_t* sequence,
+                           const std::function<void(const Record&)>& on_record);
+
+  uint32_t boot_number() const;
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  uint32_t pages_written() const { return pages_written_; }
+  uint32_t erases() const { return partition_->erase_count(); }
+
+ private:
+  static constexpr uint32_t kRetainedMagic = 0x52465648;  // "HVFR"
+
+  size_t sector_of(uint32_t offset) const { return offset / FlashPartition::kSectorSize; }
+  uint32_t write_pos() const;
+
+  // Moves the current page to the queue and starts the next one at |offset|.
+  bool RotatePage(uint32_t offset);
+  bool StartSector(size_t sector);
+  void PutBytes(const uint8_t* data, size_t size);
+
+  bool WritePage(const Page& page);
+  void Scan();
+
+  FlashPartition* partition_;
+  Retained* retained_;
+  bool is_open_ = false;
+
+  // Guards |retained_|, |newest_sector_| and the page full signal.
+  mutable esp_cxx::Mutex mutex_;
+  // Held across flash access.
+  esp_cxx::Mutex flush_mutex_;
+
+  // Sector holding the current sequence. ReadSector() counts from the one
+  // after it.
+  size_t newest_sector_ = 0;
+  std::function<void()> on_page_full_;
+  bool is_page_full_signalled_ = false;
+  std::atomic<uint32_t> dropped_{0};
+  uint32_t pages_written_ = 0;
+};
+
+}  // namespace hackvac
+
+#endif  // FLASH_RING_H_
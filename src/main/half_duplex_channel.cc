@@ -6,6 +6,7 @@
 #include "esp_cxx/logging.h"
 
 #include "event_log.h"
+#include "log_limiter.h"
 
 namespace hackvac {
 
@@ -13,6 +14,10 @@ namespace {
 // TODO(ajwong): Revisit queue lengths.
 constexpr int kRxQueueLength = 30;
 constexpr char kTag[] = "chan";
+
+// Per packet start and dispatch lines. See /api/log_limits.
+LogLimiter::Tag* const g_packet_log =
+    LogLimiter::Get()->AddTag(kTag, kHotPathLogLimit);
 }  // namespace
 
 HalfDuplexChannel::HalfDuplexChannel(esp_cxx::QueueSetEventManager* event_manager,
@@ -26,7 +31,7 @@ HalfDuplexChannel::HalfDuplexChannel(esp_cxx::QueueSetEventManager* event_manage
   : event_manager_(event_manager),
     uart_(chip, tx_pin, rx_pin, 2400, esp_cxx::Uart::Mode::k8E1),
     on_packet_cb_(callback),
-    after_send_cb_(callback),
+    after_send_cb_(after_send_cb),
     tx_debug_pin_(tx_debug_pin),
     rx_debug_pin_(rx_debug_pin) {
   if (tx_debug_pin_ || rx_debug_pin_) {
@@ -52,7 +57,20 @@ HalfDuplexChannel::~HalfDuplexChannel() {
 void HalfDuplexChannel::Start() {
   // TODO(ajwong): Pick the right sizes and dedup constants with QueueSetHandle_t.
   uart_.Start(&rx_queue_, kRxQueueLength);
-  event_manager_->Add(&rx_queue_, [this]{ OnRxEvent(); });
+  event_manager_->Add(&rx_queue_, [this] {
+                         if (profiler_) {
+                           profiler_->Measure(rx_site_, [this] { OnRxEvent(); });
+                         } else {
+                           OnRxEvent();
+                         }
+                       });
+}
+
+void HalfDuplexChannel::set_loop_profiler(LoopProfiler* profiler, const char* name) {
+  profiler_ = profiler;
+  rx_site_ = profiler_->AddSite(name, "rx");
+  send_site_ = profiler_->AddSite(name, "send");
+  rx_timeout_site_ = profiler_->AddSite(name, "rx_timeout");
 }
 
 void HalfDuplexChannel::EnqueuePacket(std::unique_ptr<Cn105Packet> packet) {
@@ -61,6 +79,11 @@ void HalfDuplexChannel::EnqueuePacket(std::unique_ptr<Cn105Packet> packet) {
   ScheduleSend();
 }
 
+void HalfDuplexChannel::WriteThrough(const uint8_t* bytes, size_t size) {
+  uart_.Write(bytes, size);
+  UpdateReadyTime();
+}
+
 void HalfDuplexChannel::DoSendPacket() {
   // Actually send something.
   if (!tx_packets_.empty()) {
@@ -68,7 +91,9 @@ void HalfDuplexChannel::DoSendPacket() {
     tx_packets_.pop();
     SetTxDebug(true);
     uart_.Write(packet->raw_bytes(), packet->packet_size());
-    after_send_cb_(std::move(packet));
+    if (after_send_cb_) {
+      after_send_cb_(std::move(packet));
+    }
     UpdateReadyTime();
     SetTxDebug(false);
   }
@@ -81,7 +106,7 @@ void HalfDuplexChannel::DoSendPacket() {
 
 void HalfDuplexChannel::ScheduleSend() {
   if (Clock::now() < uart_ready_time_) {
-    event_manager_->RunAfter([=]() { DoSendPacket(); }, uart_ready_time_);
+    RunAfter(send_site_, [=]() { DoSendPacket(); }, uart_ready_time_);
   } else {
     DoSendPacket();
   }
@@ -119,11 +144,15 @@ void HalfDuplexChannel::OnRxEvent() {
         int current_packet_number = rx_packet_count_;
 
         // Schedule a timeout to send the packet if it hasn't finished yet.
-        event_manager_->RunAfter(
+        RunAfter(
+            rx_timeout_site_,
             [=] {
               // If it is the same packet, this is a timeout. dispatch.
               if (current_rx_packet_ && current_packet_number == rx_packet_count_) {
                 ESP_LOGI(kTag, "packet %d timed out", current_packet_number);
+                if (rx_timeout_cb_) {
+                  rx_timeout_cb_();
+                }
                 DispatchRxPacket();
               }
             },
@@ -147,6 +176,12 @@ void HalfDuplexChannel::OnRxEvent() {
     abort();
   }
 
+  // Hand the raw bytes off first so a cut-through forwarder is not delayed
+  // by parsing or by the packet callbacks below.
+  if (rx_tap_) {
+    rx_tap_(buf, bytes);
+  }
+
   // If there is no packet found yet, scan for Cn105Packet::kPacketStartMarker
   // discarding any other bytes until then.
   for (int cursor = 0; cursor < bytes; ++cursor) {
@@ -161,7 +196,9 @@ void HalfDuplexChannel::OnRxEvent() {
       }
 
       current_rx_packet_ = std::make_unique<Cn105Packet>();
-      ESP_LOGI(kTag, "p s: %x %p", buf[cursor], current_rx_packet_.get());
+      if (g_packet_log->Allow()) {
+        ESP_LOGI(kTag, "p s: %x %p", buf[cursor], current_rx_packet_.get());
+      }
       SetRxDebug(true);
     }
 
@@ -172,7 +209,9 @@ void HalfDuplexChannel::OnRxEvent() {
     // On a completed packet, pass off and block for requisite gap
     // between sends.
     if (current_rx_packet_->IsComplete()) {
-      ESP_LOGI(kTag, "p d: %p", current_rx_packet_.get());
+      if (g_packet_log->Allow()) {
+        ESP_LOGI(kTag, "p d: %p", current_rx_packet_.get());
+      }
       DispatchRxPacket();
     }
   }
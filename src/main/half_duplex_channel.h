@@ -13,6 +13,7 @@
 #include "esp_cxx/uart.h"
 
 #include "cn105_packet.h"
+#include "loop_profiler.h"
 
 namespace hackvac {
 
@@ -44,6 +45,7 @@ class HalfDuplexChannel {
 // or more than the previous action.
  public:
   using PacketCallback = std::function<void(std::unique_ptr<Cn105Packet>)>;
+  using RxTapCallback = std::function<void(const uint8_t* bytes, size_t size)>;
 
   // Creaes a half-duplex channel.
   // |name| is used for logging and naming the message pumping task.
@@ -74,6 +76,24 @@ class HalfDuplexChannel {
   // Enqueues a packet for sending.
   ESPCXX_MOCKABLE void EnqueuePacket(std::unique_ptr<Cn105Packet> packet);
 
+  // Writes |bytes| to the UART immediately, skipping the tx queue and the
+  // half-duplex gap. Used for cut-through forwarding where the timing is
+  // dictated by the device on the other channel. Queued sends are held off
+  // until the channel is quiet again.
+  ESPCXX_MOCKABLE void WriteThrough(const uint8_t* bytes, size_t size);
+
+  // Registers |tap| to see every chunk of raw bytes as soon as it is read
+  // from the UART, before packet parsing. Must be set before Start().
+  void set_rx_tap(RxTapCallback tap) { rx_tap_ = std::move(tap); }
+
+  // Registers |cb| to be run when a partially received packet times out.
+  void set_rx_timeout_cb(std::function<void()> cb) { rx_timeout_cb_ = std::move(cb); }
+
+  // Routes this channel's work on |event_manager_| through |profiler| with
+  // sites named |name| plus "rx", "send", and "rx_timeout". Must be set
+  // before Start().
+  void set_loop_profiler(LoopProfiler* profiler, const char* name);
+
  private:
   using Clock = std::chrono::steady_clock;
   using Duration = std::chrono::steady_clock::duration;
@@ -95,6 +115,16 @@ class HalfDuplexChannel {
   // is complete, it is sent off to the |on_packet_cb_| callback.
   void OnRxEvent();
 
+  // RunAfter() on |event_manager_|, through |profiler_| if there is one.
+  template <typename Functor>
+  void RunAfter(LoopProfiler::Site* site, Functor fn, TimePoint when) {
+    if (profiler_) {
+      profiler_->RunAfter(site, fn, when);
+    } else {
+      event_manager_->RunAfter(fn, when);
+    }
+  }
+
   // Sets the |tx_debug_pin_| to |is_high|.
   void SetTxDebug(bool is_high);
 
@@ -116,6 +146,12 @@ class HalfDuplexChannel {
   // Event manager to register events with.
   esp_cxx::QueueSetEventManager* event_manager_ = nullptr;
 
+  // Optional profiler and its sites for this channel.
+  LoopProfiler* profiler_ = nullptr;
+  LoopProfiler::Site* rx_site_ = nullptr;
+  LoopProfiler::Site* send_site_ = nullptr;
+  LoopProfiler::Site* rx_timeout_site_ = nullptr;
+
   // UART to read from.
   esp_cxx::Uart uart_;
 
@@ -131,6 +167,12 @@ class HalfDuplexChannel {
   // Callback to invoke when a packet is send.
   PacketCallback after_send_cb_;
 
+  // Sees raw rx bytes before they are parsed.
+  RxTapCallback rx_tap_;
+
+  // Invoked when a partial packet times out.
+  std::function<void()> rx_timeout_cb_;
+
   // Pin to hold high when sending a packet.
   esp_cxx::Gpio tx_debug_pin_{};
 
@@ -0,0 +1,37 @@
+#include "histogram.h"
+
+namespace hackvac {
+
+constexpr size_t Histogram::kNumBuckets;
+
+void Histogram::Add(uint32_t value) {
+  buckets_[BucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+
+  // Single writer so load/store is enough.
+  if (value < min_.load(std::memory_order_relaxed)) {
+    min_.store(value, std::memory_order_relaxed);
+  }
+  if (value > max_.load(std::memory_order_relaxed)) {
+    max_.store(value, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::Reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  min_.store(UINT32_MAX, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+size_t Histogram::BucketFor(uint32_t value) {
+  if (value == 0) {
+    return 0;
+  }
+  size_t bits = 32 - __builtin_clz(value);
+  return bits < kNumBuckets ? bits : kNumBuckets - 1;
+}
+
+}  // namespace hackvac
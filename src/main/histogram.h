@@ -0,0 +1,47 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace hackvac {
+
+// Fixed-size histogram with power-of-two buckets. Bucket 0 counts zeros and
+// bucket i counts values in [2^(i-1), 2^i). The last bucket also takes
+// everything larger.
+//
+// The unit of the values is up to the caller. With microseconds, the last
+// bucket starts at about half a second.
+//
+// Add() may be called from one task while another reads. Each counter is
+// read atomically but there is no consistent snapshot across counters.
+class Histogram {
+ public:
+  static constexpr size_t kNumBuckets = 20;
+
+  void Add(uint32_t value);
+  void Reset();
+
+  uint32_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+  uint32_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint32_t min() const { return min_.load(std::memory_order_relaxed); }
+  uint32_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // Smallest value counted by bucket |i|.
+  static uint32_t BucketLowerBound(size_t i) { return i == 0 ? 0 : 1u << (i - 1); }
+
+  // Index of the bucket that |value| falls in.
+  static size_t BucketFor(uint32_t value);
+
+ private:
+  std::array<std::atomic<uint32_t>, kNumBuckets> buckets_{};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> min_{UINT32_MAX};
+  std::atomic<uint32_t> max_{0};
+};
+
+}  // namespace hackvac
+
+#endif  // HISTOGRAM_H_
@@ -1,65 +1,93 @@
 #include "hvac_settings.h"
 
+#include <cstring>
+
 namespace hackvac {
 
-const HalfDegreeTemp HvacSettings::kMaxTemp(31, false);
-const HalfDegreeTemp HvacSettings::kMinTemp(16, false);
+constexpr char schema::PowerField::kName[];
+constexpr char schema::ModeField::kName[];
+constexpr char schema::FanField::kName[];
+constexpr char schema::VaneField::kName[];
+constexpr char schema::WideVaneField::kName[];
+constexpr char schema::TargetTempField::kName[];
+constexpr char schema::RoomTempField::kName[];
 
-std::optional<HalfDegreeTemp> HvacSettings::GetTargetTemp() const {
-  if (!Bitfield<SettingsBitfield::kTempFlag>::Has(data_ptr_)) {
-    return {};
-  }
-  if (data_ptr_[11] != 0x00) {
-    return HalfDegreeTemp::ParseEncoded(data_ptr_[11]);
+const HalfDegreeTemp HvacSettings::kMaxTemp = schema::TargetTempField::kMax;
+const HalfDegreeTemp HvacSettings::kMinTemp = schema::TargetTempField::kMin;
+const HalfDegreeTemp ExtendedSettings::kMaxRoomTemp = schema::RoomTempField::kMax;
+const HalfDegreeTemp ExtendedSettings::kMinRoomTemp = schema::RoomTempField::kMin;
+
+namespace schema {
+
+HalfDegreeTemp TargetTempField::Decode(const uint8_t* data) {
+  if (data[11] != 0x00) {
+    return HalfDegreeTemp::ParseEncoded(data[11]);
   } else {
-    return HalfDegreeTemp(kMaxTemp.whole_degree() - data_ptr_[5], false);
+    return HalfDegreeTemp(kMax.whole_degree() - data[5], false);
   }
 }
 
-void HvacSettings::SetTargetTemp(std::optional<HalfDegreeTemp> target_temp) {
-  if (!target_temp) {
-    Bitfield<SettingsBitfield::kTempFlag>::Unset(data_ptr_);
-    data_ptr_[5] = 0x00;
-    data_ptr_[11] = 0x00;
-    return;
-  }
-
-  Bitfield<SettingsBitfield::kTempFlag>::Set(data_ptr_);
-
+void TargetTempField::Encode(uint8_t* data, HalfDegreeTemp temp) {
   // Clamp max and min target temp.
-  HalfDegreeTemp clamped_temp = target_temp.value();
-  if (kMaxTemp < clamped_temp) {
-    clamped_temp = kMaxTemp;
-  } else if (clamped_temp < kMinTemp) {
-    clamped_temp = kMinTemp;
+  HalfDegreeTemp clamped_temp = temp;
+  if (kMax < clamped_temp) {
+    clamped_temp = kMax;
+  } else if (clamped_temp < kMin) {
+    clamped_temp = kMin;
   }
 
-  data_ptr_[5] = kMaxTemp.whole_degree() - clamped_temp.whole_degree();
+  data[5] = kMax.whole_degree() - clamped_temp.whole_degree();
   if (clamped_temp.is_half_degree()) {
-    data_ptr_[11] = clamped_temp.encoded_temp();
+    data[11] = clamped_temp.encoded_temp();
   } else {
-    data_ptr_[11] = 0x00;
+    data[11] = 0x00;
   }
 }
 
-const HalfDegreeTemp ExtendedSettings::kMaxRoomTemp(41, false);
-const HalfDegreeTemp ExtendedSettings::kMinRoomTemp(10, false);
-
-std::optional<HalfDegreeTemp> ExtendedSettings::GetRoomTemp() const {
-  if (!(data_ptr_[0] & static_cast<uint8_t>(internal::ExtendedSettingsBitfield::kRoomTempFlag))) {
-    return {};
-  }
-  if (data_ptr_[6] != 0x00) {
-    return HalfDegreeTemp::ParseEncoded(data_ptr_[6]);
+HalfDegreeTemp RoomTempField::Decode(const uint8_t* data) {
+  if (data[6] != 0x00) {
+    return HalfDegreeTemp::ParseEncoded(data[6]);
   } else {
-    return HalfDegreeTemp(data_ptr_[3] + kMinRoomTemp.whole_degree(), false);
+    return HalfDegreeTemp(data[3] + kMin.whole_degree(), false);
   }
 }
 
-void ExtendedSettings::SetRoomTemp(HalfDegreeTemp temp) {
-  data_ptr_[0] |= static_cast<uint8_t>(internal::ExtendedSettingsBitfield::kRoomTempFlag);
-  data_ptr_[6] = temp.encoded_temp();
-  data_ptr_[3] = temp.whole_degree() - kMinRoomTemp.whole_degree();
+void RoomTempField::Encode(uint8_t* data, HalfDegreeTemp temp) {
+  data[6] = temp.encoded_temp();
+  data[3] = temp.whole_degree() - kMin.whole_degree();
+}
+
+}  // namespace schema
+
+const char* SettingsFieldName(SettingsField field) {
+  const char* name = "unknown";
+  auto match = [&](auto descriptor) {
+    if (decltype(descriptor)::kField == field) {
+      name = decltype(descriptor)::kName;
+    }
+  };
+  schema::HvacSettingsSchema::ForEach(match);
+  schema::ExtendedSettingsSchema::ForEach(match);
+  return name;
+}
+
+std::optional<SettingsField> SettingsFieldFromName(const char* name) {
+  std::optional<SettingsField> field;
+  auto match = [&](auto descriptor) {
+    if (name && strcmp(decltype(descriptor)::kName, name) == 0) {
+      field = decltype(descriptor)::kField;
+    }
+  };
+  schema::HvacSettingsSchema::ForEach(match);
+  schema::ExtendedSettingsSchema::ForEach(match);
+  return field;
+}
+
+StoredHvacSettings ComputeSettingsDelta(const HvacSettings& reported,
+                                        const HvacSettings& desired) {
+  StoredHvacSettings delta;
+  delta.CopyFields(desired, reported.Diff(desired) & desired.present_fields());
+  return delta;
 }
 
 }  // namespace hackvac
@@ -6,6 +6,8 @@
 
 #include "esp_cxx/cxx17hack.h"
 
+#include "settings_schema.h"
+
 // This contains the enums and classes for managing HVAC settings.
 // Note that the enum values are overloaded to be the actual byte
 // values stored in the control protocol. This is a small abstraction
@@ -144,7 +146,14 @@ class HalfDegreeTemp {
   bool is_half_degree() const { return encoded_temp_ % 2 != 0; }
   int whole_degree() const { return encoded_temp_ / 2; }
 
+  // Temperature in units of 0.5 degrees.
+  static constexpr HalfDegreeTemp FromHalfDegrees(int half_degrees) {
+    return HalfDegreeTemp(half_degrees / 2, half_degrees % 2);
+  }
+  constexpr int half_degrees() const { return encoded_temp_; }
+
   bool operator==(const HalfDegreeTemp& rhs) const { return rhs.encoded_temp_ == encoded_temp_; }
+  bool operator!=(const HalfDegreeTemp& rhs) const { return !(*this == rhs); }
 
  private:
   explicit HalfDegreeTemp(uint8_t encoded_temp) : encoded_temp_(encoded_temp & 0x7F) {
@@ -154,138 +163,148 @@ class HalfDegreeTemp {
   uint8_t encoded_temp_;
 };
 
-namespace internal {
-enum class SettingsBitfield : uint8_t {
-  kPowerFlag = 0x01,
-  kModeFlag = 0x02,
-  kTempFlag = 0x04,
-  kFanFlag = 0x08,
-  kVaneFlag = 0x10,
-  kWideVaneFlag,  // 0x01 of bitfield byte #2
+namespace schema {
+
+//  Control Update (byte0)
+//    0x01 = update all standard settings. Next 2 bytes are bitfields.
+//             byte1 = power 0x1, mode 0x2, temp 0x4, fan 0x8, vane 0x10, dir 0x80
+//             byte2 = widevane 0x1
+//           Data for each is in a corresponding byte.
+//             byte3 = Power
+//             byte4 = Mode
+//             byte5 = Temp (0x00 for temp seems to mean "max" and not 31-celcius)
+//             byte6 = Fan
+//             byte7 = Vane
+//             byte10 = Dir
+//             byte11 = Half degree temp, 0x00 on older units.
+struct PowerField : EnumField<Power, SettingsField::kPower, 1, 0x01, 3,
+                              Power::kOff, Power::kOn> {
+  static constexpr char kName[] = "power";
 };
-
-enum class ExtendedSettingsBitfield : uint8_t {
-  kRoomTempFlag = 0x01,
+struct ModeField : EnumField<Mode, SettingsField::kMode, 1, 0x02, 4,
+                             Mode::kHeat, Mode::kDry, Mode::kCool, Mode::kFan, Mode::kAuto,
+                             Mode::kIseeHeat, Mode::kIseeDry, Mode::kIseeCool,
+                             Mode::kIseeFan, Mode::kIseeAuto> {
+  static constexpr char kName[] = "mode";
+};
+struct FanField : EnumField<Fan, SettingsField::kFan, 1, 0x08, 6,
+                            Fan::kAuto, Fan::kQuiet, Fan::kPower1, Fan::kPower2,
+                            Fan::kPower3, Fan::kPower4, Fan::kPower5> {
+  static constexpr char kName[] = "fan";
+};
+struct VaneField : EnumField<Vane, SettingsField::kVane, 1, 0x10, 7,
+                             Vane::kAuto, Vane::kPower1, Vane::kPower2, Vane::kPower3,
+                             Vane::kPower4, Vane::kPower5, Vane::kSwing> {
+  static constexpr char kName[] = "vane";
+};
+struct WideVaneField : EnumField<WideVane, SettingsField::kWideVane, 2, 0x01, 10,
+                                 WideVane::kFarLeft, WideVane::kLeft, WideVane::kCenter,
+                                 WideVane::kRight, WideVane::kFarRight,
+                                 WideVane::kLeftAndRight, WideVane::kSwing> {
+  static constexpr char kName[] = "wide_vane";
 };
 
-template <SettingsBitfield field>
-struct Bitfield {
-  static bool Has(const uint8_t* data_ptr) {
-      return data_ptr[1] & static_cast<uint8_t>(field);
-  }
-  static void Set(uint8_t* data_ptr) {
-      data_ptr[1] |= static_cast<uint8_t>(field);
-  }
-  static void Unset(uint8_t* data_ptr) {
-      data_ptr[1] &= ~static_cast<uint8_t>(field);
+// Target temp is the whole degree offset from kMax in byte 5 and, for half
+// degrees, the encoded temp in byte 11. Clamped to [kMin, kMax] on Encode;
+// IsValidInt() is how callers avoid relying on that.
+struct TargetTempField {
+  using Type = HalfDegreeTemp;
+  static constexpr SettingsField kField = SettingsField::kTargetTemp;
+  static constexpr size_t kFlagPos = 1;
+  static constexpr uint8_t kFlagMask = 0x04;
+  static constexpr char kName[] = "temp";
+  static constexpr int kJsonScale = 2;
+  static constexpr HalfDegreeTemp kMax{31, false};
+  static constexpr HalfDegreeTemp kMin{16, false};
+
+  static HalfDegreeTemp Decode(const uint8_t* data);
+  static void Encode(uint8_t* data, HalfDegreeTemp temp);
+  static void Clear(uint8_t* data) { data[5] = 0x00; data[11] = 0x00; }
+  static int ToInt(HalfDegreeTemp temp) { return temp.half_degrees(); }
+  static HalfDegreeTemp FromInt(int value) { return HalfDegreeTemp::FromHalfDegrees(value); }
+  static bool IsValidInt(int value) {
+    return value >= kMin.half_degrees() && value <= kMax.half_degrees();
   }
 };
 
-template <>
-struct Bitfield<SettingsBitfield::kWideVaneFlag> {
-  static bool Has(const uint8_t* data_ptr) { return data_ptr[2] & 0x1; }
-  static void Set(uint8_t* data_ptr) { data_ptr[2] |= 0x1; }
-  static void Unset(uint8_t* data_ptr) { data_ptr[2] &= 0x1; }
+//  Extended settings (byte0 = bitfield)
+//    byte0 = room temp 0x1
+//    byte3 = room temp - kMin whole degrees
+//    byte6 = encoded room temp, 0x00 on older units.
+//    NOTE: MHK1 sends 0x80 for data if setting is nonsense (negative)
+//          yielding 0x00 on byte0 bitflag.
+struct RoomTempField {
+  using Type = HalfDegreeTemp;
+  static constexpr SettingsField kField = SettingsField::kRoomTemp;
+  static constexpr size_t kFlagPos = 0;
+  static constexpr uint8_t kFlagMask = 0x01;
+  static constexpr char kName[] = "room_temp";
+  static constexpr int kJsonScale = 2;
+  static constexpr HalfDegreeTemp kMax{41, false};
+  static constexpr HalfDegreeTemp kMin{10, false};
+
+  static HalfDegreeTemp Decode(const uint8_t* data);
+  static void Encode(uint8_t* data, HalfDegreeTemp temp);
+  static void Clear(uint8_t* data) { data[3] = 0x00; data[6] = 0x00; }
+  static int ToInt(HalfDegreeTemp temp) { return temp.half_degrees(); }
+  static HalfDegreeTemp FromInt(int value) { return HalfDegreeTemp::FromHalfDegrees(value); }
+  static bool IsValidInt(int value) {
+    return value >= kMin.half_degrees() && value <= kMax.half_degrees();
+  }
 };
 
-template <typename T> struct ExtractConfig;
-template <> struct ExtractConfig<Power> {
-  constexpr static SettingsBitfield kBitfield = SettingsBitfield::kPowerFlag;
-  constexpr static int kDataPos = 3;
-};
-template <> struct ExtractConfig<Mode> {
-  constexpr static SettingsBitfield kBitfield = SettingsBitfield::kModeFlag;
-  constexpr static int kDataPos = 4;
-};
-template <> struct ExtractConfig<Fan> {
-  constexpr static SettingsBitfield kBitfield = SettingsBitfield::kFanFlag;
-  constexpr static int kDataPos = 6;
-};
-template <> struct ExtractConfig<Vane> {
-  constexpr static SettingsBitfield kBitfield = SettingsBitfield::kVaneFlag;
-  constexpr static int kDataPos = 7;
-};
-template <> struct ExtractConfig<WideVane> {
-  constexpr static SettingsBitfield kBitfield = SettingsBitfield::kWideVaneFlag;
-  constexpr static int kDataPos = 10;
-};
-}  // namespace internal
+// Adding a field is a descriptor above plus an entry here.
+using HvacSettingsSchema =
+    FieldList<PowerField, ModeField, TargetTempField, FanField, VaneField, WideVaneField>;
+using ExtendedSettingsSchema = FieldList<RoomTempField>;
+
+}  // namespace schema
+
+// Name of |field| as used in JSON and the API.
+const char* SettingsFieldName(SettingsField field);
+
+// Inverse of SettingsFieldName().
+std::optional<SettingsField> SettingsFieldFromName(const char* name);
 
 // Normal settings for the HVAC controller.
 //
-// This class stores the Power, Mode, TargetTemp, Fan, Vane, and WideVane 
+// This class stores the Power, Mode, TargetTemp, Fan, Vane, and WideVane
 // settings using the wire format for the Info and Update packets in the
-// CN105 protocol.
-//
-// Control Update (byte0)
-//   0x01 = update all standard settings. Next 2 bytes are bitfields.
-//            byte1 = power 0x1, mode 0x2, temp 0x4, fan 0x8, vane 0x10, dir 0x80
-//            byte2 = wiadevane 0x1 
-//          Data for each is in a corresponding byte.
-//            byte3 = Power
-//            byte4 = Mode
-//            byte5 = Temp (0x00 for temp seems to mean "max" and not 31-celcius)
-//            byte6 = Fan
-//            byte7 = Vane
-//            byte10 = Dir
-class HvacSettings {
+// CN105 protocol. See schema::HvacSettingsSchema for the layout.
+class HvacSettings : public SettingsView<schema::HvacSettingsSchema> {
  public:
   static const HalfDegreeTemp kMaxTemp;
   static const HalfDegreeTemp kMinTemp;
 
-  explicit HvacSettings(uint8_t* raw_data) : data_ptr_(raw_data) {
+  explicit HvacSettings(uint8_t* raw_data) : SettingsView(raw_data) {
     // TODO(awong): Assert error is kSetSettings?
   }
 
   template <typename T>
   std::optional<T> Get() const {
-    if (!Bitfield<ExtractConfig<T>::kBitfield>::Has(data_ptr_)) {
-      return {};
-    }
-    return static_cast<T>(data_ptr_[ExtractConfig<T>::kDataPos]);
+    return GetField<FieldFor<T>>();
   }
 
   template <typename T>
   void Set(std::optional<T> setting) const {
-    constexpr SettingsBitfield field = ExtractConfig<T>::kBitfield;
-    if (setting) {
-      Set(setting.value());
-    } else {
-      Bitfield<field>::Unset(data_ptr_);
-      data_ptr_[ExtractConfig<T>::kDataPos] = 0x00;
-    }
+    SetField<FieldFor<T>>(setting);
   }
 
   template <typename T>
   void Set(T setting) const {
-    constexpr SettingsBitfield field = ExtractConfig<T>::kBitfield;
-    Bitfield<field>::Set(data_ptr_);
-    data_ptr_[ExtractConfig<T>::kDataPos] = static_cast<uint8_t>(setting);
+    SetField<FieldFor<T>>(setting);
   }
 
-  std::optional<HalfDegreeTemp> GetTargetTemp() const;
-  void SetTargetTemp(std::optional<HalfDegreeTemp> target_temp);
-
-  const uint8_t* data_pointer() const { return data_ptr_; }
-
-  HvacSettings& MergeUpdate(const HvacSettings& update) {
-    if (auto new_value = update.Get<Power>()) Set(new_value.value());
-    if (auto new_value = update.Get<Mode>()) Set(new_value.value());
-    if (auto new_value = update.Get<Fan>()) Set(new_value.value());
-    if (auto new_value = update.Get<Vane>()) Set(new_value.value());
-    if (auto new_value = update.Get<WideVane>()) Set(new_value.value());
-    return *this;
+  std::optional<HalfDegreeTemp> GetTargetTemp() const {
+    return GetField<schema::TargetTempField>();
+  }
+  void SetTargetTemp(std::optional<HalfDegreeTemp> target_temp) {
+    SetField<schema::TargetTempField>(target_temp);
   }
-    
- protected:
-  void set_data_pointer(uint8_t* ptr) { data_ptr_ = ptr; }
 
  private:
-  using SettingsBitfield = internal::SettingsBitfield;
-  template <SettingsBitfield field> using Bitfield = internal::Bitfield<field>;
-  template <typename T> using ExtractConfig = internal::ExtractConfig<T>;
-
-  uint8_t* data_ptr_ = nullptr;
+  template <typename T>
+  using FieldFor = typename schema::FieldForType<T, schema::HvacSettingsSchema>::type;
 };
 
 // HvacSettings that provides its own storage. This is likely most often
@@ -297,6 +316,18 @@ class StoredHvacSettings : public HvacSettings {
     set_data_pointer(data_.data());
   }
 
+  // The default copy would alias |rhs|'s storage via the data pointer so
+  // copies must rebind to their own |data_|.
+  StoredHvacSettings(const StoredHvacSettings& rhs)
+      : HvacSettings(nullptr), data_(rhs.data_) {
+    set_data_pointer(data_.data());
+  }
+
+  StoredHvacSettings& operator=(const StoredHvacSettings& rhs) {
+    data_ = rhs.data_;
+    return *this;
+  }
+
   StoredHvacSettings& operator=(const HvacSettings& rhs) {
     memcpy(data_.begin(), rhs.data_pointer(), data_.size());
     return *this;
@@ -312,33 +343,27 @@ class StoredHvacSettings : public HvacSettings {
   std::array<uint8_t, 16> data_ = {};
 };
 
-//            byte0 = room temp 0x1, 
-//            byte1 = ???
-//            room temp is first byte after.
-//            NOTE: MHK1 sends 0x80 for data if setting is nonsense (negative)
-//                  yielding 0x00 on byte0 bitflag.
-class ExtendedSettings {
+// Returns an Update payload carrying only the fields that |desired| sets
+// and |reported| does not already match. Fields |desired| leaves unset are
+// never sent since the protocol has no way to clear one. The result has no
+// present_fields() when there is nothing to send.
+StoredHvacSettings ComputeSettingsDelta(const HvacSettings& reported,
+                                        const HvacSettings& desired);
+
+// Extended settings. See schema::ExtendedSettingsSchema for the layout.
+class ExtendedSettings : public SettingsView<schema::ExtendedSettingsSchema> {
  public:
   static const HalfDegreeTemp kMaxRoomTemp;
   static const HalfDegreeTemp kMinRoomTemp;
 
-  explicit ExtendedSettings(uint8_t* raw_data) : data_ptr_(raw_data) {}
-
-  std::optional<HalfDegreeTemp> GetRoomTemp() const;
-  void SetRoomTemp(HalfDegreeTemp temp);
+  explicit ExtendedSettings(uint8_t* raw_data) : SettingsView(raw_data) {}
 
-  const uint8_t* data_pointer() const { return data_ptr_; }
-
-  ExtendedSettings& MergeUpdate(const ExtendedSettings& updae) {
-    if (auto new_value = updae.GetRoomTemp()) SetRoomTemp(new_value.value());
-    return *this;
+  std::optional<HalfDegreeTemp> GetRoomTemp() const {
+    return GetField<schema::RoomTempField>();
+  }
+  void SetRoomTemp(HalfDegreeTemp temp) {
+    SetField<schema::RoomTempField>(temp);
   }
-    
- protected:
-  void set_data_pointer(uint8_t* ptr) { data_ptr_ = ptr; }
-
- private:
-  uint8_t* data_ptr_ = nullptr;
 };
 
 class StoredExtendedSettings : public ExtendedSettings {
@@ -347,6 +372,16 @@ class StoredExtendedSettings : public ExtendedSettings {
     set_data_pointer(data_.data());
   }
 
+  StoredExtendedSettings(const StoredExtendedSettings& rhs)
+      : ExtendedSettings(nullptr), data_(rhs.data_) {
+    set_data_pointer(data_.data());
+  }
+
+  StoredExtendedSettings& operator=(const StoredExtendedSettings& rhs) {
+    data_ = rhs.data_;
+    return *this;
+  }
+
   StoredExtendedSettings& operator=(const ExtendedSettings& rhs) {
     memcpy(data_.begin(), rhs.data_pointer(), data_.size());
     return *this;
@@ -0,0 +1,241 @@
+#include "json_stream.h"
+
+namespace hackvac {
+
+namespace {
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool IsHexDigit(char c) {
+  return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+}  // namespace
+
+void JsonWriter::BeginObject() {
+  Separate();
+  Put('{');
+  needs_comma_ = false;
+}
+
+void JsonWriter::EndObject() {
+  Put('}');
+  needs_comma_ = true;
+}
+
+void JsonWriter::BeginArray() {
+  Separate();
+  Put('[');
+  needs_comma_ = false;
+}
+
+void JsonWriter::EndArray() {
+  Put(']');
+  needs_comma_ = true;
+}
+
+void JsonWriter::Key(std::string_view key) {
+  String(key);
+  Put(':');
+  needs_comma_ = false;
+}
+
+void JsonWriter::String(std::string_view value) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  Separate();
+  Put('"');
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      Put('\\');
+      Put(c);
+    } else if (static_cast<uint8_t>(c) < 0x20) {
+      Put("\\u00");
+      Put(kHex[c >> 4]);
+      Put(kHex[c & 0xf]);
+    } else {
+      Put(c);
+    }
+  }
+  Put('"');
+  needs_comma_ = true;
+}
+
+void JsonWriter::Int(int64_t value) {
+  Separate();
+  uint64_t magnitude = value;
+  if (value < 0) {
+    Put('-');
+    magnitude = -magnitude;
+  }
+  char digits[20];
+  size_t num_digits = 0;
+  do {
+    digits[num_digits++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+  while (num_digits) {
+    Put(digits[--num_digits]);
+  }
+  needs_comma_ = true;
+}
+
+void JsonWriter::Bool(bool value) {
+  Separate();
+  Put(value ? "true" : "false");
+  needs_comma_ = true;
+}
+
+void JsonWriter::Scaled(int value, int scale) {
+  // Int() would print -0 as 0 so the sign of -0.5 is written here.
+  if (value < 0 && value / scale == 0) {
+    Separate();
+    Put('-');
+    needs_comma_ = false;
+  }
+  Int(value / scale);
+  if (value % scale) {
+    Put(".5");
+  }
+}
+
+void JsonWriter::Separate() {
+  if (needs_comma_) {
+    Put(',');
+  }
+}
+
+void JsonWriter::Put(char c) {
+  if (len_ < size_) {
+    buf_[len_++] = c;
+  } else {
+    is_overflow_ = true;
+  }
+}
+
+void JsonWriter::Put(std::string_view s) {
+  for (char c : s) {
+    Put(c);
+  }
+}
+
+JsonScanner::Token JsonScanner::Next() {
+  if (is_failed_) {
+    return Token::kError;
+  }
+  while (pos_ < json_.size() &&
+         (json_[pos_] == ' ' || json_[pos_] == '\t' || json_[pos_] == '\n' ||
+          json_[pos_] == '\r')) {
+    pos_++;
+  }
+  if (pos_ == json_.size()) {
+    return Token::kEnd;
+  }
+
+  switch (json_[pos_]) {
+    case '{': pos_++; return Token::kBeginObject;
+    case '}': pos_++; return Token::kEndObject;
+    case '[': pos_++; return Token::kBeginArray;
+    case ']': pos_++; return Token::kEndArray;
+    case ':': pos_++; return Token::kColon;
+    case ',': pos_++; return Token::kComma;
+    case '"': return ScanString();
+    case 't': return ScanLiteral("true", Token::kTrue);
+    case 'f': return ScanLiteral("false", Token::kFalse);
+    case 'n': return ScanLiteral("null", Token::kNull);
+    default: return ScanNumber();
+  }
+}
+
+JsonScanner::Token JsonScanner::Expect(Token token) {
+  return Next() == token ? token : Fail();
+}
+
+JsonScanner::Token JsonScanner::Fail() {
+  is_failed_ = true;
+  text_ = {};
+  return Token::kError;
+}
+
+JsonScanner::Token JsonScanner::ScanString() {
+  size_t start = ++pos_;
+  while (pos_ < json_.size()) {
+    char c = json_[pos_];
+    if (c == '"') {
+      text_ = json_.substr(start, pos_ - start);
+      pos_++;
+      return Token::kString;
+    }
+    if (static_cast<uint8_t>(c) < 0x20) {
+      return Fail();
+    }
+    if (c == '\\') {
+      if (++pos_ == json_.size()) {
+        return Fail();
+      }
+      switch (json_[pos_]) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+          break;
+        case 'u':
+          for (int i = 0; i < 4; ++i) {
+            if (++pos_ == json_.size() || !IsHexDigit(json_[pos_])) {
+              return Fail();
+            }
+          }
+          break;
+        default:
+          return Fail();
+      }
+    }
+    pos_++;
+  }
+  return Fail();
+}
+
+JsonScanner::Token JsonScanner::ScanNumber() {
+  size_t start = pos_;
+  auto skip_digits = [&] {
+    size_t first = pos_;
+    while (pos_ < json_.size() && IsDigit(json_[pos_])) {
+      pos_++;
+    }
+    return pos_ - first;
+  };
+
+  if (json_[pos_] == '-') {
+    pos_++;
+  }
+  size_t int_start = pos_;
+  size_t int_digits = skip_digits();
+  if (int_digits == 0 || (int_digits > 1 && json_[int_start] == '0')) {
+    return Fail();
+  }
+  if (pos_ < json_.size() && json_[pos_] == '.') {
+    pos_++;
+    if (skip_digits() == 0) {
+      return Fail();
+    }
+  }
+  if (pos_ < json_.size() && (json_[pos_] == 'e' || json_[pos_] == 'E')) {
+    pos_++;
+    if (pos_ < json_.size() && (json_[pos_] == '+' || json_[pos_] == '-')) {
+      pos_++;
+    }
+    if (skip_digits() == 0) {
+      return Fail();
+    }
+  }
+  text_ = json_.substr(start, pos_ - start);
+  return Token::kNumber;
+}
+
+JsonScanner::Token JsonScanner::ScanLiteral(std::string_view literal, Token token) {
+  if (json_.substr(pos_, literal.size()) != literal) {
+    return Fail();
+  }
+  pos_ += literal.size();
+  return token;
+}
+
+}  // namespace hackvac
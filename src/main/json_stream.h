@@ -0,0 +1,108 @@
+#ifndef JSON_STREAM_H_
+#define JSON_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Minimal JSON reading and writing for hot HTTP handlers that should not
+// build cJSON trees. Neither class allocates.
+
+namespace hackvac {
+
+// Writes JSON into a caller provided buffer. Commas are inserted as values
+// are added so callers only describe the structure:
+//
+//   JsonWriter writer(buf, sizeof(buf));
+//   writer.BeginObject();
+//   writer.Key("temp");
+//   writer.Scaled(45, 2);  // 22.5
+//   writer.EndObject();
+//
+// Once the buffer is full further output is dropped and ok() is false. The
+// structure is not validated; unbalanced calls give unbalanced JSON.
+class JsonWriter {
+ public:
+  JsonWriter(char* buf, size_t size) : buf_(buf), size_(size) {}
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+
+  // Starts a member of the enclosing object. Must be followed by a value.
+  void Key(std::string_view key);
+
+  void String(std::string_view value);
+  void Int(int64_t value);
+  void Bool(bool value);
+
+  // |value| / |scale| for a settings field with kJsonScale |scale|, 1 or 2.
+  void Scaled(int value, int scale);
+
+  bool ok() const { return !is_overflow_; }
+  std::string_view text() const { return std::string_view(buf_, len_); }
+
+ private:
+  // Adds the comma before a value or key if one is needed.
+  void Separate();
+  void Put(char c);
+  void Put(std::string_view s);
+
+  char* const buf_;
+  const size_t size_;
+  size_t len_ = 0;
+  bool is_overflow_ = false;
+  bool needs_comma_ = false;
+};
+
+// Splits JSON text into tokens without copying. String and number tokens
+// are views into the original text, which must outlive the scanner.
+//
+// Only the lexical syntax is checked. Callers enforce the grammar they
+// expect, which for a handler is usually one fixed shape of object.
+class JsonScanner {
+ public:
+  enum class Token : uint8_t {
+    kBeginObject,
+    kEndObject,
+    kBeginArray,
+    kEndArray,
+    kColon,
+    kComma,
+    kString,
+    kNumber,
+    kTrue,
+    kFalse,
+    kNull,
+    kEnd,    // Only whitespace remains.
+    kError,  // Malformed. Every later Next() is also kError.
+  };
+
+  explicit JsonScanner(std::string_view json) : json_(json) {}
+
+  Token Next();
+
+  // Returns Next() if it is |token|, otherwise kError.
+  Token Expect(Token token);
+
+  // After a kString, its contents without the quotes. Escapes are left as
+  // written so names compare directly and anything escaped does not match.
+  // After a kNumber, its text.
+  std::string_view text() const { return text_; }
+
+ private:
+  Token Fail();
+  Token ScanString();
+  Token ScanNumber();
+  Token ScanLiteral(std::string_view literal, Token token);
+
+  std::string_view json_;
+  size_t pos_ = 0;
+  std::string_view text_;
+  bool is_failed_ = false;
+};
+
+}  // namespace hackvac
+
+#endif  // JSON_STREAM_H_
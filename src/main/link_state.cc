@@ -0,0 +1,119 @@
+#include "link_state.h"
+
+#include <algorithm>
+
+namespace hackvac {
+
+constexpr LinkState::Duration LinkState::kInitialBackoff;
+constexpr LinkState::Duration LinkState::kMaxBackoff;
+
+LinkState::LinkState(uint32_t seed)
+  : jitter_(seed ? seed : 1) {
+}
+
+void LinkState::OnConnectAttempt() {
+  if (state_ == State::kDisconnected) {
+    TransitionTo(State::kConnecting);
+  }
+}
+
+void LinkState::OnSuccess() {
+  UpdateHealth(true);
+  // A late reply while disconnected says nothing about whether the next
+  // Connect will work. Keep backing off until one does.
+  if (state_ == State::kDisconnected) {
+    return;
+  }
+  consecutive_failures_ = 0;
+  TransitionTo(State::kConnected);
+}
+
+void LinkState::OnCorrupt() {
+  UpdateHealth(false);
+  if (state_ == State::kConnected) {
+    TransitionTo(State::kDegraded);
+  }
+}
+
+LinkState::Duration LinkState::OnFailure() {
+  consecutive_failures_++;
+  UpdateHealth(false);
+
+  switch (state_) {
+    case State::kConnected:
+      TransitionTo(State::kDegraded);
+      break;
+
+    case State::kDegraded:
+      if (consecutive_failures_ >= kMaxDegradedFailures) {
+        TransitionTo(State::kDisconnected);
+      }
+      break;
+
+    case State::kConnecting:
+      TransitionTo(State::kDisconnected);
+      break;
+
+    case State::kDisconnected:
+      break;
+  }
+
+  // First failure retries immediately. Both a working link that dropped one
+  // packet and a unit that is just booting reconnect without delay.
+  if (consecutive_failures_ <= 1) {
+    return Duration::zero();
+  }
+  return NextBackoff();
+}
+
+const char* LinkState::StateName(State state) {
+  switch (state) {
+    case State::kDisconnected:
+      return "disconnected";
+    case State::kConnecting:
+      return "connecting";
+    case State::kConnected:
+      return "connected";
+    case State::kDegraded:
+      return "degraded";
+  }
+  return "unknown";
+}
+
+LinkState::Duration LinkState::NextBackoff() {
+  // Shift is capped well before overflow. kMaxBackoff clamps the rest.
+  int exponent = std::min(consecutive_failures_ - 2, 16);
+  Duration backoff = std::min(kInitialBackoff * (1 << exponent), kMaxBackoff);
+
+  // "Equal jitter": wait at least half the backoff plus a random slice of the
+  // other half. Keeps the exponential growth but decorrelates retries.
+  Duration::rep half = backoff.count() / 2;
+  Duration::rep jitter = half > 0 ? jitter_() % (half + 1) : 0;
+  return Duration(half + jitter);
+}
+
+void LinkState::UpdateHealth(bool success) {
+  // EWMA with alpha = 1/8. Integer math, rounding toward the new sample so
+  // health can actually reach 0 and kMaxHealth.
+  int sample = success ? kMaxHealth : 0;
+  int health = health_;
+  int delta = sample - health;
+  int step = delta / 8;
+  if (step == 0 && delta != 0) {
+    step = delta > 0 ? 1 : -1;
+  }
+  health_ = health + step;
+}
+
+void LinkState::TransitionTo(State new_state) {
+  State old_state = state_;
+  if (old_state == new_state) {
+    return;
+  }
+  state_ = new_state;
+  if (transition_cb_) {
+    transition_cb_(old_state, new_state);
+  }
+}
+
+}  // namespace hackvac
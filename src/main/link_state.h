@@ -0,0 +1,103 @@
+#ifndef LINK_STATE_H_
+#define LINK_STATE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <random>
+
+#include "gtest/gtest_prod.h"
+
+namespace hackvac {
+
+// Tracks the health of the CN105 link to the heat pump and decides how long
+// to wait before the next Connect attempt.
+//
+// The state machine is
+//
+//              attempt            success
+//   kDisconnected --> kConnecting --------> kConnected
+//        ^   ^            |                  |     ^
+//        |   +------------+ failure  failure |     | success
+//        |                                   v     |
+//        +------------------------------- kDegraded
+//             kMaxDegradedFailures failures
+//
+// A link that was working gets one immediate retry so a single dropped
+// packet reconnects fast. After that, retries back off exponentially from
+// kInitialBackoff up to kMaxBackoff with random jitter so a dead or
+// powered-down unit costs close to nothing in CPU or bus time.
+//
+// Not thread-safe except for state() and health() which may be read from
+// any task. All mutations should happen on the Controller's task.
+class LinkState {
+ public:
+  using Duration = std::chrono::milliseconds;
+
+  enum class State : uint8_t {
+    kDisconnected,
+    kConnecting,
+    kConnected,
+    kDegraded,
+  };
+
+  using TransitionCallback = std::function<void(State from, State to)>;
+
+  static constexpr Duration kInitialBackoff = std::chrono::milliseconds(100);
+  static constexpr Duration kMaxBackoff = std::chrono::seconds(30);
+
+  // Number of consecutive failures tolerated in kDegraded before the link is
+  // declared kDisconnected.
+  static constexpr int kMaxDegradedFailures = 3;
+
+  // Health is an exponentially weighted average of outcomes in [0, 100].
+  static constexpr int kMaxHealth = 100;
+
+  // |seed| initializes the jitter source. Pass something device-unique so a
+  // set of units powered on together don't retry in lockstep.
+  explicit LinkState(uint32_t seed);
+
+  // Records that a Connect packet is being sent.
+  void OnConnectAttempt();
+
+  // Records a structurally valid response from the heat pump. Only updates
+  // health in kDisconnected; the link connects on a reply after an attempt.
+  void OnSuccess();
+
+  // Records a response that arrived but was corrupt. Degrades the link
+  // without forcing a reconnect.
+  void OnCorrupt();
+
+  // Records a timeout or truncated response. Returns how long to wait before
+  // sending the next Connect.
+  Duration OnFailure();
+
+  State state() const { return state_; }
+  int health() const { return health_; }
+  int consecutive_failures() const { return consecutive_failures_; }
+
+  // Called on every state change. Runs on the task that caused the change.
+  void set_transition_callback(TransitionCallback cb) { transition_cb_ = std::move(cb); }
+
+  static const char* StateName(State state);
+
+ private:
+  FRIEND_TEST(LinkState, BackoffIsBoundedAndJittered);
+
+  // Returns the jittered backoff for the current |consecutive_failures_|.
+  Duration NextBackoff();
+
+  void UpdateHealth(bool success);
+  void TransitionTo(State new_state);
+
+  std::atomic<State> state_{State::kDisconnected};
+  std::atomic<int> health_{0};
+  int consecutive_failures_ = 0;
+  std::minstd_rand jitter_;
+  TransitionCallback transition_cb_;
+};
+
+}  // namespace hackvac
+
+#endif  // LINK_STATE_H_
@@ -0,0 +1,116 @@
+#include "log_limiter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_cxx/logging.h"
+
+namespace hackvac {
+
+constexpr size_t LogLimiter::kMaxTags;
+constexpr size_t LogLimiter::kMaxTagLength;
+
+// static
+LogLimiter* LogLimiter::Get() {
+  static LogLimiter limiter;
+  return &limiter;
+}
+
+LogLimiter::LogLimiter() = default;
+
+LogLimiter::Tag* LogLimiter::AddTag(const char* name, LogLimit initial) {
+  if (Tag* existing = FindTag(name)) {
+    return existing;
+  }
+  if (num_tags_ == kMaxTags) {
+    return &tags_[kMaxTags - 1];
+  }
+  Tag* tag = &tags_[num_tags_++];
+  strncpy(tag->name_, name, kMaxTagLength);
+  SetLimit(tag, initial);
+  return tag;
+}
+
+LogLimiter::Tag* LogLimiter::FindTag(const char* name) {
+  for (size_t i = 0; i < num_tags_; ++i) {
+    if (strncmp(tags_[i].name_, name, kMaxTagLength) == 0) {
+      return &tags_[i];
+    }
+  }
+  return nullptr;
+}
+
+// static
+void LogLimiter::SetLimit(Tag* tag, LogLimit limit) {
+  SetLimitAt(tag, limit, Tag::NowMs());
+}
+
+// static
+void LogLimiter::SetLimitAt(Tag* tag, LogLimit limit, uint32_t now_ms) {
+  // Disable while the fields change so Allow() does not see a mix.
+  tag->limited_.store(false, std::memory_order_relaxed);
+  uint32_t burst = limit.rate_per_sec ? std::max<uint32_t>(limit.burst, 1) : 0;
+  tag->rate_per_sec_.store(limit.rate_per_sec, std::memory_order_relaxed);
+  tag->burst_.store(burst, std::memory_order_relaxed);
+  tag->sample_every_.store(std::max<uint32_t>(limit.sample_every, 1),
+                           std::memory_order_relaxed);
+  tag->sample_count_.store(0, std::memory_order_relaxed);
+  tag->tokens_.store(burst, std::memory_order_relaxed);
+  tag->last_refill_ms_.store(now_ms, std::memory_order_relaxed);
+  tag->suppressed_.store(0, std::memory_order_relaxed);
+  tag->limited_.store(limit.is_limited(), std::memory_order_release);
+}
+
+LogLimit LogLimiter::Tag::limit() const {
+  LogLimit limit;
+  limit.rate_per_sec = rate_per_sec_.load(std::memory_order_relaxed);
+  limit.burst = burst_.load(std::memory_order_relaxed);
+  limit.sample_every = sample_every_.load(std::memory_order_relaxed);
+  return limit;
+}
+
+// static
+uint32_t LogLimiter::Tag::NowMs() {
+  return esp_log_timestamp();
+}
+
+bool LogLimiter::Tag::AllowLimited(uint32_t now_ms) {
+  uint32_t sample_every = sample_every_.load(std::memory_order_relaxed);
+  if (sample_every > 1 &&
+      sample_count_.fetch_add(1, std::memory_order_relaxed) % sample_every != 0) {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  uint32_t rate = rate_per_sec_.load(std::memory_order_relaxed);
+  if (!rate) {
+    return true;
+  }
+
+  // Refill only whole tokens and advance the refill time by exactly what
+  // they cost so fractions carry over to the next call. Once the bucket is
+  // full, the refill time catches up to now so quiet time past that point
+  // is not credited again later.
+  uint32_t tokens = tokens_.load(std::memory_order_relaxed);
+  uint32_t last_refill_ms = last_refill_ms_.load(std::memory_order_relaxed);
+  uint32_t earned = static_cast<uint64_t>(now_ms - last_refill_ms) * rate / 1000;
+  if (earned) {
+    uint32_t burst = burst_.load(std::memory_order_relaxed);
+    if (earned >= burst - std::min(tokens, burst)) {
+      tokens = burst;
+      last_refill_ms = now_ms;
+    } else {
+      tokens += earned;
+      last_refill_ms += static_cast<uint64_t>(earned) * 1000 / rate;
+    }
+    last_refill_ms_.store(last_refill_ms, std::memory_order_relaxed);
+  }
+  if (!tokens) {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  tokens_.store(tokens - 1, std::memory_order_relaxed);
+  return true;
+}
+
+}  // namespace hackvac
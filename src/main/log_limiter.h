@@ -0,0 +1,122 @@
+#ifndef LOG_LIMITER_H_
+#define LOG_LIMITER_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace hackvac {
+
+// How a LogLimiter::Tag thins out its lines. See LogLimiter.
+struct LogLimit {
+  // 0 disables the token bucket.
+  uint32_t rate_per_sec = 0;
+
+  // Lines allowed back to back after a quiet period. At least 1 when
+  // rate limited.
+  uint32_t burst = 0;
+
+  // Keep 1 in this many lines. 0 and 1 keep all.
+  uint32_t sample_every = 1;
+
+  bool is_limited() const { return rate_per_sec || sample_every > 1; }
+};
+
+// What hot path sites start with. Roughly one packet's worth of lines a
+// second on each link, with room for a connect handshake.
+constexpr LogLimit kHotPathLogLimit = {10, 20, 1};
+
+// Per tag rate limits and sampling for log lines on the packet hot path. At
+// 2400 baud a few lines per packet on UART0 can take longer than the CN105
+// exchange they describe.
+//
+// Only sites that check a Tag are affected. Other logs under the same esp_log
+// tag, such as warnings, always go out. A site looks like
+//
+//   if (g_packet_log->Allow()) {
+//     ESP_LOGI(kTag, "p d: %p", packet);
+//   }
+//
+// With no limit set, Allow() is one relaxed load and a branch. A LogLimit
+// first samples 1 in |sample_every| calls and then passes what is left
+// through a token bucket of |burst| tokens refilled at |rate_per_sec|.
+//
+// Tags are registered at startup, before the tasks that log start. Limits
+// may be changed at any time from any task. Several tasks hitting the same
+// Tag may race on the counters, which at worst lets an extra line through.
+class LogLimiter {
+ public:
+  static constexpr size_t kMaxTags = 8;
+  static constexpr size_t kMaxTagLength = 15;
+
+  class Tag {
+   public:
+    // Returns whether the line should be logged.
+    bool Allow() {
+      if (!limited_.load(std::memory_order_relaxed)) {
+        return true;
+      }
+      return AllowLimited(NowMs());
+    }
+
+    // As Allow() at |now_ms| on the esp_log_timestamp() clock. For tests.
+    bool AllowAt(uint32_t now_ms) {
+      if (!limited_.load(std::memory_order_relaxed)) {
+        return true;
+      }
+      return AllowLimited(now_ms);
+    }
+
+    const char* name() const { return name_; }
+    LogLimit limit() const;
+
+    // Lines held back since the limit was last set.
+    uint32_t suppressed() const { return suppressed_.load(std::memory_order_relaxed); }
+
+   private:
+    friend class LogLimiter;
+
+    static uint32_t NowMs();
+    bool AllowLimited(uint32_t now_ms);
+
+    char name_[kMaxTagLength + 1] = {};
+    std::atomic<bool> limited_{false};
+    std::atomic<uint32_t> rate_per_sec_{0};
+    std::atomic<uint32_t> burst_{0};
+    std::atomic<uint32_t> sample_every_{1};
+
+    std::atomic<uint32_t> sample_count_{0};
+    std::atomic<uint32_t> tokens_{0};
+    std::atomic<uint32_t> last_refill_ms_{0};
+    std::atomic<uint32_t> suppressed_{0};
+  };
+
+  static LogLimiter* Get();
+
+  LogLimiter();
+
+  // Returns the Tag for |name|, registering it with |initial| if new. Past
+  // kMaxTags, the last Tag is shared.
+  Tag* AddTag(const char* name, LogLimit initial = LogLimit());
+
+  // Returns the registered Tag for |name| or nullptr.
+  Tag* FindTag(const char* name);
+
+  // Replaces the limit on |tag| and resets its counters.
+  static void SetLimit(Tag* tag, LogLimit limit);
+
+  // As SetLimit() at |now_ms|. For tests.
+  static void SetLimitAt(Tag* tag, LogLimit limit, uint32_t now_ms);
+
+  size_t num_tags() const { return num_tags_; }
+  const Tag& tag(size_t i) const { return tags_[i]; }
+
+ private:
+  std::array<Tag, kMaxTags> tags_;
+  size_t num_tags_ = 0;
+};
+
+}  // namespace hackvac
+
+#endif  // LOG_LIMITER_H_
@@ -0,0 +1,132 @@
+#include "log_ring.h"
+
+#include <cstring>
+
+#include "binary_log.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kMarkerTag[] = "eventlog";
+constexpr char kMarkerFormat[] = "W (%u) %s: %u events dropped\n";
+
+size_t EncodeMarker(uint8_t* buf, size_t size, uint32_t time_ms, ...) {
+  va_list args;
+  va_start(args, time_ms);
+  size_t len = EncodeLogRecord(0, time_ms, kMarkerFormat, args, buf, size);
+  va_end(args);
+  return len;
+}
+
+}  // namespace
+
+constexpr size_t LogRing::kSlotSize;
+constexpr size_t LogRing::kNumSlots;
+constexpr size_t LogRing::kReservedSlots;
+constexpr size_t LogRing::kMaxDropTags;
+
+LogRing::LogRing(Policy policy) : policy_(policy) {
+}
+
+bool LogRing::Push(const uint8_t* record, size_t size) {
+  if (size > kSlotSize) {
+    CountDrop(record, size);
+    return false;
+  }
+
+  if (policy_ == Policy::kReserveForWarnings) {
+    uint32_t used = pushed_.load(std::memory_order_relaxed) -
+        popped_.load(std::memory_order_relaxed);
+    LogRecordHeader header;
+    if (used >= kNumSlots - kReservedSlots &&
+        ReadLogRecordHeader(record, size, &header) &&
+        !strchr("EW", LogFormatLevel(header.format))) {
+      CountDrop(record, size);
+      return false;
+    }
+  }
+
+  Slot slot;
+  slot.dropped_before = pending_drops_.exchange(0, std::memory_order_relaxed);
+  slot.size = static_cast<uint16_t>(size);
+  memcpy(slot.bytes, record, size);
+  uint32_t dropped_before = slot.dropped_before;
+  if (!slots_.Push(std::move(slot))) {
+    // Hand the earlier drops on to whoever gets in next.
+    pending_drops_.fetch_add(dropped_before, std::memory_order_relaxed);
+    CountDrop(record, size);
+    return false;
+  }
+  pushed_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool LogRing::Pop(uint8_t* out, size_t* size) {
+  if (!held_) {
+    Slot slot;
+    if (!slots_.Pop(&slot)) {
+      return false;
+    }
+    popped_.fetch_add(1, std::memory_order_relaxed);
+
+    if (slot.dropped_before) {
+      LogRecordHeader header;
+      uint32_t time_ms = ReadLogRecordHeader(slot.bytes, slot.size, &header) ?
+          header.time_ms : 0;
+      *size = EncodeMarker(out, kSlotSize, time_ms, time_ms, kMarkerTag,
+                           slot.dropped_before);
+      held_ = slot;
+      return true;
+    }
+    memcpy(out, slot.bytes, slot.size);
+    *size = slot.size;
+    return true;
+  }
+
+  memcpy(out, held_->bytes, held_->size);
+  *size = held_->size;
+  held_.reset();
+  return true;
+}
+
+size_t LogRing::GetDropCounts(DropCount* out, size_t max) const {
+  size_t n = 0;
+  for (size_t i = 0; i < kMaxDropTags && n < max; ++i) {
+    const char* tag = drop_tags_[i].load(std::memory_order_relaxed);
+    if (!tag) {
+      break;
+    }
+    out[n++] = {tag, drop_tag_counts_[i].load(std::memory_order_relaxed)};
+  }
+  uint32_t other = other_drops_.load(std::memory_order_relaxed);
+  if (other && n < max) {
+    out[n++] = {nullptr, other};
+  }
+  return n;
+}
+
+void LogRing::CountDrop(const uint8_t* record, size_t size) {
+  pending_drops_.fetch_add(1, std::memory_order_relaxed);
+  total_drops_.fetch_add(1, std::memory_order_relaxed);
+
+  LogRecordHeader header;
+  const char* tag = ReadLogRecordHeader(record, size, &header) ? header.tag : nullptr;
+  if (tag) {
+    for (size_t i = 0; i < kMaxDropTags; ++i) {
+      const char* existing = drop_tags_[i].load(std::memory_order_relaxed);
+      if (!existing &&
+          drop_tags_[i].compare_exchange_strong(existing, tag,
+                                                std::memory_order_relaxed)) {
+        existing = tag;
+      }
+      if (existing == tag) {
+        drop_tag_counts_[i].fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+  other_drops_.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace hackvac
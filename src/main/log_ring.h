@@ -0,0 +1,94 @@
+#ifndef LOG_RING_H_
+#define LOG_RING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "mpsc_mailbox.h"
+
+#include "esp_cxx/cxx17hack.h"
+
+namespace hackvac {
+
+// Queue of encoded log records (see binary_log.h) between every logging
+// task and the event log publish task. Push() never blocks or takes a lock.
+// When the ring is full the new record is dropped, since the single
+// consumer owns the oldest slot and producers may not reclaim it.
+//
+// Drops are never silent. They are counted per tag, and the next record that
+// makes it in carries the count. Pop() then yields an "N events dropped"
+// record just before it, marking where the gap is in the stream.
+class LogRing {
+ public:
+  static constexpr size_t kSlotSize = 128;
+  static constexpr size_t kNumSlots = 64;
+
+  enum class Policy : uint8_t {
+    // Drop only when the ring is completely full.
+    kDropNewest,
+
+    // Also drop debug and info records once the ring is nearly full,
+    // keeping the last kReservedSlots for warnings and errors.
+    kReserveForWarnings,
+  };
+  static constexpr size_t kReservedSlots = 8;
+
+  // Tags tracked individually in drop counts. Others are lumped together.
+  static constexpr size_t kMaxDropTags = 8;
+
+  // Tags are compared by pointer and assumed static, as esp_log tags are.
+  struct DropCount {
+    const char* tag;  // nullptr for the lumped remainder.
+    uint32_t count;
+  };
+
+  explicit LogRing(Policy policy = Policy::kReserveForWarnings);
+
+  // Copies in an encoded record. Safe from any task. Returns false if it was
+  // dropped. Records larger than kSlotSize are dropped.
+  bool Push(const uint8_t* record, size_t size);
+
+  // Consumer only. Copies the next record into |out|, which holds
+  // kSlotSize, and sets |size|. Returns false when empty.
+  bool Pop(uint8_t* out, size_t* size);
+
+  // Records dropped since construction.
+  uint32_t total_drops() const { return total_drops_.load(std::memory_order_relaxed); }
+
+  // Fills |out| with per-tag drop counts. Returns the number of entries.
+  size_t GetDropCounts(DropCount* out, size_t max) const;
+
+ private:
+  struct Slot {
+    // Records dropped between the previous successful Push() and this one.
+    uint32_t dropped_before = 0;
+    uint16_t size = 0;
+    uint8_t bytes[kSlotSize];
+  };
+
+  void CountDrop(const uint8_t* record, size_t size);
+
+  const Policy policy_;
+  MpscMailbox<Slot, kNumSlots> slots_;
+
+  // Approximate occupancy for the reserve policy.
+  std::atomic<uint32_t> pushed_{0};
+  std::atomic<uint32_t> popped_{0};
+
+  // Drops not yet attached to a record.
+  std::atomic<uint32_t> pending_drops_{0};
+  std::atomic<uint32_t> total_drops_{0};
+
+  std::array<std::atomic<const char*>, kMaxDropTags> drop_tags_{};
+  std::array<std::atomic<uint32_t>, kMaxDropTags> drop_tag_counts_{};
+  std::atomic<uint32_t> other_drops_{0};
+
+  // A popped record held back while its drop marker is returned.
+  std::optional<Slot> held_;
+};
+
+}  // namespace hackvac
+
+#endif  // LOG_RING_H_
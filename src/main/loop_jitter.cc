@@ -0,0 +1,39 @@
+#include "loop_jitter.h"
+
+#include <limits>
+
+namespace hackvac {
+
+constexpr int LoopJitterProbe::kDefaultIntervalMs;
+
+LoopJitterProbe::LoopJitterProbe(esp_cxx::QueueSetEventManager* event_manager,
+                                 int interval_ms)
+  : event_manager_(event_manager),
+    interval_ms_(interval_ms) {
+}
+
+void LoopJitterProbe::Start() {
+  ScheduleProbe();
+}
+
+void LoopJitterProbe::Record(Clock::time_point due, Clock::time_point ran) {
+  if (ran <= due) {
+    lateness_.Add(0);
+    return;
+  }
+  auto late_us = std::chrono::duration_cast<std::chrono::microseconds>(ran - due).count();
+  if (late_us > std::numeric_limits<uint32_t>::max()) {
+    late_us = std::numeric_limits<uint32_t>::max();
+  }
+  lateness_.Add(static_cast<uint32_t>(late_us));
+}
+
+void LoopJitterProbe::ScheduleProbe() {
+  Clock::time_point due = Clock::now() + std::chrono::milliseconds(interval_ms_);
+  event_manager_->RunDelayed([this, due] {
+                               Record(due, Clock::now());
+                               ScheduleProbe();
+                             }, interval_ms_);
+}
+
+}  // namespace hackvac
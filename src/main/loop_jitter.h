@@ -0,0 +1,49 @@
+#ifndef LOOP_JITTER_H_
+#define LOOP_JITTER_H_
+
+#include <chrono>
+
+#include "histogram.h"
+
+#include "esp_cxx/event_manager.h"
+
+namespace hackvac {
+
+// Measures how promptly an event loop runs its work. A probe is scheduled
+// every |interval_ms| and the time between when it was due and when it ran
+// is recorded, in microseconds, in lateness().
+//
+// RunDelayed() rounds to the FreeRTOS tick so up to one tick of lateness is
+// expected even on an idle loop. Anything above that is time the loop spent
+// on other events or was preempted by higher priority tasks.
+class LoopJitterProbe {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr int kDefaultIntervalMs = 100;
+
+  explicit LoopJitterProbe(esp_cxx::QueueSetEventManager* event_manager,
+                           int interval_ms = kDefaultIntervalMs);
+
+  // Schedules the first probe. Must be called on |event_manager|'s task or
+  // before its loop starts.
+  void Start();
+
+  // Records a probe that was due at |due| and ran at |ran|.
+  void Record(Clock::time_point due, Clock::time_point ran);
+
+  // Safe to read from any task.
+  const Histogram& lateness() const { return lateness_; }
+  int interval_ms() const { return interval_ms_; }
+
+ private:
+  void ScheduleProbe();
+
+  esp_cxx::QueueSetEventManager* event_manager_;
+  int interval_ms_;
+  Histogram lateness_;
+};
+
+}  // namespace hackvac
+
+#endif  // LOOP_JITTER_H_
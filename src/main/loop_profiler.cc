@@ -0,0 +1,98 @@
+#include "loop_profiler.h"
+
+#include <cstdio>
+#include <limits>
+
+#include "esp_cxx/logging.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "loop";
+
+uint32_t ToUs(LoopProfiler::Clock::duration duration) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  if (us < 0) {
+    return 0;
+  }
+  if (us > std::numeric_limits<uint32_t>::max()) {
+    return std::numeric_limits<uint32_t>::max();
+  }
+  return static_cast<uint32_t>(us);
+}
+
+int64_t SinceEpochUs(LoopProfiler::Clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      time.time_since_epoch()).count();
+}
+
+}  // namespace
+
+constexpr uint32_t LoopProfiler::kDefaultSlowThresholdUs;
+constexpr size_t LoopProfiler::kMaxSites;
+constexpr size_t LoopProfiler::kMaxSiteNameLength;
+
+LoopProfiler::LoopProfiler(esp_cxx::QueueSetEventManager* event_manager,
+                           uint32_t slow_threshold_us)
+  : event_manager_(event_manager),
+    slow_threshold_us_(slow_threshold_us) {
+}
+
+LoopProfiler::~LoopProfiler() = default;
+
+LoopProfiler::Site* LoopProfiler::AddSite(const char* prefix, const char* suffix) {
+  if (num_sites_ == kMaxSites) {
+    ESP_LOGW(kTag, "Out of sites. %s%s shares %s", prefix, suffix ? suffix : "",
+             sites_[kMaxSites - 1].name_);
+    return &sites_[kMaxSites - 1];
+  }
+  Site* site = &sites_[num_sites_++];
+  snprintf(site->name_, sizeof(site->name_), "%s%s", prefix, suffix ? suffix : "");
+  return site;
+}
+
+uint32_t LoopProfiler::running_us() const {
+  if (!running_site()) {
+    return 0;
+  }
+  int64_t since = running_since_us_.load(std::memory_order_relaxed);
+  int64_t now = SinceEpochUs(Clock::now());
+  return now > since ? static_cast<uint32_t>(now - since) : 0;
+}
+
+void LoopProfiler::OnQueued() {
+  uint32_t depth = queue_depth_.fetch_add(1, std::memory_order_relaxed) + 1;
+  uint32_t high_water = queue_high_water_.load(std::memory_order_relaxed);
+  while (depth > high_water &&
+         !queue_high_water_.compare_exchange_weak(high_water, depth,
+                                                  std::memory_order_relaxed)) {
+  }
+}
+
+void LoopProfiler::OnDequeued() {
+  queue_depth_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+LoopProfiler::Clock::time_point LoopProfiler::Begin(Site* site) {
+  Clock::time_point start = Clock::now();
+  running_since_us_.store(SinceEpochUs(start), std::memory_order_relaxed);
+  running_.store(site, std::memory_order_relaxed);
+  return start;
+}
+
+void LoopProfiler::End(Site* site, Clock::time_point start) {
+  running_.store(nullptr, std::memory_order_relaxed);
+  uint32_t exec_us = ToUs(Clock::now() - start);
+  site->exec_us_.Add(exec_us);
+  if (exec_us > slow_threshold_us_) {
+    site->slow_count_.fetch_add(1, std::memory_order_relaxed);
+    ESP_LOGW(kTag, "slow callback %s: %uus", site->name_, exec_us);
+  }
+}
+
+void LoopProfiler::RecordDelay(Site* site, Clock::time_point due, Clock::time_point start) {
+  site->delay_us_.Add(ToUs(start - due));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,148 @@
+#ifndef LOOP_PROFILER_H_
+#define LOOP_PROFILER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "histogram.h"
+
+#include "esp_cxx/event_manager.h"
+
+namespace hackvac {
+
+// Profiles the work done on one QueueSetEventManager. Code posting to the
+// loop goes through Run()/RunDelayed()/RunAfter() here instead of on the
+// event manager directly and handlers the event manager dispatches itself
+// are wrapped in Measure(). Each is tagged with a Site naming the caller.
+//
+// Per Site, the profiler keeps histograms of how long callbacks ran and how
+// long they waited: queueing delay for Run() and lateness past the
+// scheduled time for timers. Callbacks longer than the slow threshold are
+// logged as they finish. It also tracks how many Run() callbacks are queued
+// and the high-water mark of that, which is what the event manager's queue
+// length must cover.
+//
+// Sites are added before the loop starts. After that, all recording happens
+// on the loop's task and the stats may be read from any task.
+class LoopProfiler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The half-duplex gap. A callback longer than this can delay a reply.
+  static constexpr uint32_t kDefaultSlowThresholdUs = 10000;
+
+  static constexpr size_t kMaxSites = 16;
+  static constexpr size_t kMaxSiteNameLength = 23;
+
+  class Site {
+   public:
+    const char* name() const { return name_; }
+
+    // Microseconds spent in each callback.
+    const Histogram& exec_us() const { return exec_us_; }
+
+    // Microseconds between when each callback should have run and when it
+    // started.
+    const Histogram& delay_us() const { return delay_us_; }
+
+    // Callbacks that exceeded the slow threshold.
+    uint32_t slow_count() const { return slow_count_.load(std::memory_order_relaxed); }
+
+   private:
+    friend class LoopProfiler;
+
+    char name_[kMaxSiteNameLength + 1] = {};
+    Histogram exec_us_;
+    Histogram delay_us_;
+    std::atomic<uint32_t> slow_count_{0};
+  };
+
+  explicit LoopProfiler(esp_cxx::QueueSetEventManager* event_manager,
+                        uint32_t slow_threshold_us = kDefaultSlowThresholdUs);
+  ~LoopProfiler();
+
+  // Adds a site named |prefix| followed by |suffix|, if given. Once all
+  // kMaxSites are used further calls share the last one.
+  Site* AddSite(const char* prefix, const char* suffix = nullptr);
+
+  template <typename Functor>
+  void Run(Site* site, Functor fn) {
+    Clock::time_point posted = Clock::now();
+    OnQueued();
+    event_manager_->Run([=] {
+                          OnDequeued();
+                          Dispatch(site, posted, fn);
+                        });
+  }
+
+  template <typename Functor>
+  void RunDelayed(Site* site, Functor fn, int delay_ms) {
+    RunAfter(site, fn, Clock::now() + std::chrono::milliseconds(delay_ms));
+  }
+
+  template <typename Functor>
+  void RunAfter(Site* site, Functor fn, Clock::time_point when) {
+    event_manager_->RunAfter([=] { Dispatch(site, when, fn); }, when);
+  }
+
+  // Times |fn| running right now. For handlers the event manager invokes
+  // directly, such as queue events. Only exec time is recorded.
+  template <typename Functor>
+  void Measure(Site* site, Functor fn) {
+    Clock::time_point start = Begin(site);
+    fn();
+    End(site, start);
+  }
+
+  size_t num_sites() const { return num_sites_; }
+  const Site& site(size_t i) const { return sites_[i]; }
+
+  // Run() callbacks posted but not yet started, and the most there have
+  // been at once.
+  uint32_t queue_depth() const { return queue_depth_.load(std::memory_order_relaxed); }
+  uint32_t queue_high_water() const {
+    return queue_high_water_.load(std::memory_order_relaxed);
+  }
+
+  uint32_t slow_threshold_us() const { return slow_threshold_us_; }
+
+  // The site whose callback is running now, or nullptr when the loop is
+  // idle. Together with running_us() this shows what a stuck loop is doing.
+  const Site* running_site() const { return running_.load(std::memory_order_relaxed); }
+  uint32_t running_us() const;
+
+ private:
+  template <typename Functor>
+  void Dispatch(Site* site, Clock::time_point due, const Functor& fn) {
+    Clock::time_point start = Begin(site);
+    RecordDelay(site, due, start);
+    fn();
+    End(site, start);
+  }
+
+  void OnQueued();
+  void OnDequeued();
+
+  Clock::time_point Begin(Site* site);
+  void End(Site* site, Clock::time_point start);
+  static void RecordDelay(Site* site, Clock::time_point due, Clock::time_point start);
+
+  esp_cxx::QueueSetEventManager* event_manager_;
+  const uint32_t slow_threshold_us_;
+
+  std::array<Site, kMaxSites> sites_;
+  size_t num_sites_ = 0;
+
+  std::atomic<uint32_t> queue_depth_{0};
+  std::atomic<uint32_t> queue_high_water_{0};
+
+  std::atomic<const Site*> running_{nullptr};
+  std::atomic<int64_t> running_since_us_{0};
+};
+
+}  // namespace hackvac
+
+#endif  // LOOP_PROFILER_H_
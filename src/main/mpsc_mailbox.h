@@ -0,0 +1,91 @@
+#ifndef MPSC_MAILBOX_H_
+#define MPSC_MAILBOX_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace hackvac {
+
+// Fixed-size lock-free queue for handing records from any number of
+// producer tasks to a single consumer task. Nothing is allocated after
+// construction and neither side ever blocks: Push() fails when the mailbox
+// is full and Pop() fails when it is empty.
+//
+// This is the bounded queue from Dmitry Vyukov: each cell carries a sequence
+// number that says whether it is ready to be written for a given lap or read.
+// Producers claim a cell with a CAS on |tail_|. The single consumer owns
+// |head_| outright.
+//
+// |T| should be cheap to move. |kCapacity| must be a power of two.
+template <typename T, size_t kCapacity>
+class MpscMailbox {
+ public:
+  static_assert(kCapacity >= 2 && (kCapacity & (kCapacity - 1)) == 0,
+                "kCapacity must be a power of two");
+
+  MpscMailbox() {
+    for (size_t i = 0; i < kCapacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscMailbox(const MpscMailbox&) = delete;
+  MpscMailbox& operator=(const MpscMailbox&) = delete;
+
+  // Safe from any task. Returns false, leaving |value| untouched, if full.
+  bool Push(T&& value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells_[pos & kMask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The consumer has not emptied this cell since the last lap.
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer task only. Returns false if empty.
+  bool Pop(T* value) {
+    Cell& cell = cells_[head_ & kMask];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(head_ + 1) < 0) {
+      return false;
+    }
+    *value = std::move(cell.value);
+    cell.value = T();
+    cell.sequence.store(head_ + kCapacity, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  static constexpr size_t capacity() { return kCapacity; }
+
+ private:
+  static constexpr size_t kMask = kCapacity - 1;
+
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    T value{};
+  };
+
+  std::array<Cell, kCapacity> cells_;
+  std::atomic<size_t> tail_{0};
+  size_t head_ = 0;
+};
+
+}  // namespace hackvac
+
+#endif  // MPSC_MAILBOX_H_
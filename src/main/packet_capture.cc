@@ -0,0 +1,178 @@
+#include "packet_capture.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "controller.h"
+#include "pcapng.h"
+
+#ifndef FAKE_ESP_IDF
+#include "esp_timer.h"
+#else
+#include <chrono>
+#endif
+
+namespace hackvac {
+
+constexpr size_t PacketCapture::kNumInterfaces;
+constexpr size_t PacketCapture::kPseudoHeaderSize;
+constexpr uint8_t PacketCapture::kPseudoHeaderVersion;
+constexpr uint8_t PacketCapture::kFlagJunk;
+constexpr uint8_t PacketCapture::kFlagIncomplete;
+constexpr uint8_t PacketCapture::kFlagBadChecksum;
+constexpr size_t PacketCapture::kMaxPacketBytes;
+constexpr size_t PacketCapture::kMaxBlockSize;
+constexpr size_t PacketCapture::kQueueSize;
+
+PacketCapture::PacketCapture(PacketLoggerType* next) : next_(next) {
+}
+
+PacketCapture::~PacketCapture() = default;
+
+void PacketCapture::Log(const char* tag, std::unique_ptr<Cn105Packet> packet) {
+  bool is_listening = listeners_.load(std::memory_order_relaxed) > 0;
+  if ((is_listening || journal_) && packet) {
+    auto interface = InterfaceForTag(tag);
+    int64_t now_us = NowUs();
+    if (interface && journal_) {
+      journal_->Append(static_cast<uint8_t>(interface.value()), now_us / 1000,
+                       packet->raw_bytes(), packet->raw_bytes_size());
+    }
+    if (interface && is_listening) {
+      Record record;
+      record.timestamp_us = now_us;
+      record.interface = interface.value();
+      record.uart_errors = packet->error_count();
+      record.unexpected_events = packet->unexpected_event_count();
+      if (packet->IsJunk()) {
+        record.flags |= kFlagJunk;
+      } else if (!packet->IsComplete()) {
+        record.flags |= kFlagIncomplete;
+      } else if (!packet->IsChecksumValid()) {
+        record.flags |= kFlagBadChecksum;
+      }
+      record.size = std::min(packet->raw_bytes_size(), kMaxPacketBytes);
+      memcpy(record.bytes, packet->raw_bytes(), record.size);
+      record.dropped_before = pending_drops_.exchange(0, std::memory_order_relaxed);
+
+      uint32_t dropped_before = record.dropped_before;
+      if (!records_.Push(std::move(record))) {
+        pending_drops_.fetch_add(dropped_before + 1, std::memory_order_relaxed);
+        total_drops_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  if (next_) {
+    next_->Log(tag, std::move(packet));
+  }
+}
+
+void PacketCapture::AddListener() {
+  ++listeners_;
+}
+
+void PacketCapture::RemoveListener() {
+  --listeners_;
+}
+
+// static
+size_t PacketCapture::WriteHeader(uint8_t* out, size_t size) {
+  size_t written = WritePcapngSectionHeader(out, size);
+  if (!written) {
+    return 0;
+  }
+  for (size_t i = 0; i < kNumInterfaces; ++i) {
+    size_t len = WritePcapngInterface(InterfaceName(static_cast<Interface>(i)),
+                                      kPcapngLinkTypeUser0,
+                                      kPseudoHeaderSize + kMaxPacketBytes,
+                                      out + written, size - written);
+    if (!len) {
+      return 0;
+    }
+    written += len;
+  }
+  return written;
+}
+
+size_t PacketCapture::WriteNextPacket(uint8_t* out, size_t size) {
+  if (!held_) {
+    Record record;
+    if (!records_.Pop(&record)) {
+      return 0;
+    }
+    held_ = record;
+  }
+
+  const Record& record = held_.value();
+  uint8_t data[kPseudoHeaderSize + kMaxPacketBytes] = {
+    kPseudoHeaderVersion,
+    record.flags,
+    static_cast<uint8_t>(record.uart_errors),
+    static_cast<uint8_t>(record.uart_errors >> 8),
+    static_cast<uint8_t>(record.unexpected_events),
+    static_cast<uint8_t>(record.unexpected_events >> 8),
+    0,
+    0,
+  };
+  memcpy(data + kPseudoHeaderSize, record.bytes, record.size);
+
+  bool is_rx = record.interface == Interface::kTstatRx ||
+               record.interface == Interface::kHvacRx;
+  uint32_t flags = is_rx ? kPcapngInbound : kPcapngOutbound;
+  if (record.flags & kFlagJunk) {
+    flags |= kPcapngStartFrameError;
+  }
+  if (record.flags & kFlagBadChecksum) {
+    flags |= kPcapngCrcError;
+  }
+
+  size_t written = WritePcapngPacket(static_cast<uint32_t>(record.interface),
+                                     record.timestamp_us, flags, record.dropped_before,
+                                     data, kPseudoHeaderSize + record.size, out, size);
+  if (written) {
+    held_.reset();
+  }
+  return written;
+}
+
+// static
+const char* PacketCapture::InterfaceName(Interface interface) {
+  switch (interface) {
+    case Interface::kTstatRx:
+      return Controller::kTstatRxTag;
+    case Interface::kTstatTx:
+      return Controller::kTstatTxTag;
+    case Interface::kHvacRx:
+      return Controller::kHvacRxTag;
+    case Interface::kHvacTx:
+      return Controller::kHvacTxTag;
+  }
+  return "unknown";
+}
+
+// static
+std::optional<PacketCapture::Interface> PacketCapture::InterfaceForTag(const char* tag) {
+  for (size_t i = 0; i < kNumInterfaces; ++i) {
+    auto interface = static_cast<Interface>(i);
+    const char* name = InterfaceName(interface);
+    // Tags are normally the Controller's own arrays so this rarely gets
+    // past the pointer compare.
+    if (tag == name || strcmp(tag, name) == 0) {
+      return interface;
+    }
+  }
+  return {};
+}
+
+// static
+int64_t PacketCapture::NowUs() {
+#ifndef FAKE_ESP_IDF
+  return esp_timer_get_time();
+#else
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+}  // namespace hackvac
@@ -0,0 +1,119 @@
+#ifndef PACKET_CAPTURE_H_
+#define PACKET_CAPTURE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "cn105_packet.h"
+#include "mpsc_mailbox.h"
+#include "packet_journal.h"
+
+#include "esp_cxx/cxx17hack.h"
+#include "esp_cxx/data_logger.h"
+
+namespace hackvac {
+
+// Captures every packet the Controller logs for /api/capture as pcapng.
+//
+// Sits in front of the usual packet logger. While anyone is listening,
+// Log() copies the packet bytes, a timestamp, and the UART error counters
+// into a lock-free queue and then passes the packet on. Turning records
+// into pcapng blocks happens on the network task when they are sent.
+//
+// Each Controller tag (T-Rx, T-Tx, H-Rx, H-Tx) is its own pcapng interface
+// so Wireshark can filter by link and direction. Packet data is
+// kPseudoHeaderSize bytes of capture metadata followed by the raw CN105
+// bytes. cn105.lua at the top of the repo decodes both.
+//
+// Every packet, listener or not, also goes into the PacketJournal if one is
+// set. Its interface numbers are the Interface values.
+class PacketCapture : public esp_cxx::DataLogger<std::unique_ptr<Cn105Packet>> {
+ public:
+  using PacketLoggerType = esp_cxx::DataLogger<std::unique_ptr<Cn105Packet>>;
+
+  enum class Interface : uint8_t {
+    kTstatRx,
+    kTstatTx,
+    kHvacRx,
+    kHvacTx,
+  };
+  static constexpr size_t kNumInterfaces = 4;
+
+  // Pseudo-header layout, little-endian:
+  //   u8 version (1) | u8 flags | u16 uart errors | u16 unexpected events |
+  //   u16 reserved
+  static constexpr size_t kPseudoHeaderSize = 8;
+  static constexpr uint8_t kPseudoHeaderVersion = 1;
+  static constexpr uint8_t kFlagJunk = 1 << 0;
+  static constexpr uint8_t kFlagIncomplete = 1 << 1;
+  static constexpr uint8_t kFlagBadChecksum = 1 << 2;
+
+  // Longest CN105 packet captured. Matches Cn105Packet's buffer.
+  static constexpr size_t kMaxPacketBytes = 30;
+
+  // Largest block WriteNextPacket() produces.
+  static constexpr size_t kMaxBlockSize = 96;
+
+  // Queued packets. About 3s of both links at full rate.
+  static constexpr size_t kQueueSize = 32;
+
+  // |next| may be null. Otherwise every packet is passed on to it.
+  explicit PacketCapture(PacketLoggerType* next);
+  ~PacketCapture() override;
+
+  // Safe from any task.
+  void Log(const char* tag, std::unique_ptr<Cn105Packet> packet) override;
+
+  // Not owned. Must be set before the Controller starts.
+  void set_journal(PacketJournal* journal) { journal_ = journal; }
+  PacketJournal* journal() const { return journal_; }
+
+  // Packets are only copied while there is at least one listener.
+  void AddListener();
+  void RemoveListener();
+
+  // Writes the pcapng Section Header and one Interface Description per
+  // Interface. Every stream starts with this.
+  static size_t WriteHeader(uint8_t* out, size_t size);
+
+  // Consumer only. Writes the oldest queued packet as an Enhanced Packet
+  // Block. Returns 0 if the queue is empty or the block does not fit, in
+  // which case it stays queued.
+  size_t WriteNextPacket(uint8_t* out, size_t size);
+
+  // Packets lost because the queue was full.
+  uint32_t total_drops() const { return total_drops_.load(std::memory_order_relaxed); }
+
+  static const char* InterfaceName(Interface interface);
+
+ private:
+  struct Record {
+    int64_t timestamp_us = 0;
+
+    // Packets dropped between the previous successful push and this one.
+    uint32_t dropped_before = 0;
+    uint16_t uart_errors = 0;
+    uint16_t unexpected_events = 0;
+    Interface interface = Interface::kTstatRx;
+    uint8_t flags = 0;
+    uint8_t size = 0;
+    uint8_t bytes[kMaxPacketBytes];
+  };
+
+  static std::optional<Interface> InterfaceForTag(const char* tag);
+  static int64_t NowUs();
+
+  PacketLoggerType* next_;
+  PacketJournal* journal_ = nullptr;
+  std::atomic<int> listeners_{0};
+  MpscMailbox<Record, kQueueSize> records_;
+  std::optional<Record> held_;
+  std::atomic<uint32_t> pending_drops_{0};
+  std::atomic<uint32_t> total_drops_{0};
+};
+
+}  // namespace hackvac
+
+#endif  // PACKET_CAPTURE_H_
@@ -0,0 +1,80 @@
+#include "packet_forwarder.h"
+
+namespace hackvac {
+
+CutThroughForwarder::CutThroughForwarder(Writer writer,
+                                         const PacketRewriter* rewriter,
+                                         RewriteDirection direction)
+  : writer_(std::move(writer)),
+    rewriter_(rewriter),
+    direction_(direction) {
+}
+
+CutThroughForwarder::~CutThroughForwarder() = default;
+
+void CutThroughForwarder::OnBytes(const uint8_t* bytes, size_t size) {
+  // Start of the bytes in |bytes| that are neither written nor held.
+  size_t run_start = 0;
+
+  for (size_t i = 0; i < size; ++i) {
+    if (current_.IsComplete() ||
+        (current_.IsJunk() && bytes[i] == Cn105Packet::kPacketStartMarker)) {
+      Reset();
+    }
+    if (current_.raw_bytes_size() == 0 && rewriter_) {
+      rules_ = rewriter_->Snapshot();
+    }
+    current_.AppendByte(bytes[i]);
+
+    if (held_from_) {
+      // Byte lives in |current_| until the packet completes.
+      run_start = i + 1;
+    } else if (rules_ && !current_.IsJunk() &&
+               current_.raw_bytes_size() == kCommandBytePos + 1 &&
+               rules_->HasRules(direction_, current_.type(), bytes[i])) {
+      Write(bytes + run_start, i + 1 - run_start);
+      run_start = i + 1;
+      held_from_ = current_.raw_bytes_size();
+    }
+
+    if (!current_.IsJunk() && current_.IsComplete()) {
+      forwarded_packets_++;
+      if (held_from_) {
+        if (rules_->Apply(direction_, &current_)) {
+          rewritten_packets_++;
+        }
+        ReleaseHeld();
+      }
+    }
+  }
+
+  Write(bytes + run_start, size - run_start);
+}
+
+void CutThroughForwarder::Reset() {
+  ReleaseHeld();
+  current_ = Cn105Packet();
+  rules_.reset();
+}
+
+void CutThroughForwarder::Write(const uint8_t* bytes, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  writer_(bytes, size);
+  forwarded_bytes_ += size;
+}
+
+void CutThroughForwarder::ReleaseHeld() {
+  if (!held_from_) {
+    return;
+  }
+  size_t held_from = held_from_.value();
+  held_from_.reset();
+  if (held_from < current_.raw_bytes_size()) {
+    Write(current_.raw_bytes() + held_from,
+          current_.raw_bytes_size() - held_from);
+  }
+}
+
+}  // namespace hackvac
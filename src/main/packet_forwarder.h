@@ -0,0 +1,95 @@
+#ifndef PACKET_FORWARDER_H_
+#define PACKET_FORWARDER_H_
+
+#include <cstdint>
+#include <functional>
+
+#include "cn105_packet.h"
+#include "packet_rewriter.h"
+
+namespace hackvac {
+
+// Forwards a raw CN105 byte stream from one UART to another with cut-through
+// semantics: every chunk is written out the moment it is read rather than
+// after the whole packet has been parsed, checked, and re-queued.
+//
+// In store-and-forward passthru, each hop costs the full packet time on the
+// wire plus the half-duplex gap before the copy is sent. Cut-through reduces
+// that to the UART driver's rx delivery latency, which keeps the real
+// thermostat's timing close to what it expects from the heat pump.
+//
+// The forwarder still tracks packet framing as bytes flow through so that
+// packet boundaries are known without a second parse. This is intentionally
+// cheap: no allocation and no logging on this path. Logging of the forwarded
+// packets happens later, off the forwarding path, via the normal packet
+// callbacks.
+//
+// If a PacketRewriter is attached, its rules are latched at the start of
+// each packet. Once the command byte arrives, a packet with no matching
+// rules keeps flowing through. A packet with matching rules is held from
+// that point until complete, rewritten, checksum-fixed and then released.
+// Rewriting costs one packet time of latency, and only on matching packets.
+//
+// Not thread-safe. Expected to run on the Controller's task.
+class CutThroughForwarder {
+ public:
+  using Writer = std::function<void(const uint8_t* bytes, size_t size)>;
+
+  // |rewriter| may be null. Otherwise it is not owned and must outlive
+  // this object. |direction| selects which rules apply.
+  explicit CutThroughForwarder(Writer writer,
+                               const PacketRewriter* rewriter = nullptr,
+                               RewriteDirection direction =
+                                   RewriteDirection::kFromThermostat);
+  ~CutThroughForwarder();
+
+  // Writes |bytes| to the other side immediately and advances framing.
+  void OnBytes(const uint8_t* bytes, size_t size);
+
+  // Drops framing state. Called when the receiving channel times out a
+  // partial packet so the next byte is treated as a fresh start. Any held
+  // bytes are released unmodified so the other side sees the same
+  // truncated packet.
+  void Reset();
+
+  uint32_t forwarded_bytes() const { return forwarded_bytes_; }
+  uint32_t forwarded_packets() const { return forwarded_packets_; }
+  uint32_t rewritten_packets() const { return rewritten_packets_; }
+
+ private:
+  // Position of the command byte (first data byte) in the raw packet. All
+  // bytes up to and including this one are never rewritten.
+  static constexpr size_t kCommandBytePos = 5;
+
+  // Writes and counts |size| bytes.
+  void Write(const uint8_t* bytes, size_t size);
+
+  // Writes the held tail of |current_| starting at |held_from_|.
+  void ReleaseHeld();
+
+  // Where forwarded bytes go.
+  Writer writer_;
+
+  // Optional source of rewrite rules. Not owned.
+  const PacketRewriter* rewriter_;
+  RewriteDirection direction_;
+
+  // Rules latched at the start of |current_|.
+  std::shared_ptr<const CompiledRewriteRules> rules_;
+
+  // When set, bytes of |current_| from this offset on have not been
+  // written yet.
+  std::optional<size_t> held_from_;
+
+  // Framing for the packet currently flowing through. Reuses Cn105Packet's
+  // incremental parser.
+  Cn105Packet current_;
+
+  uint32_t forwarded_bytes_ = 0;
+  uint32_t forwarded_packets_ = 0;
+  uint32_t rewritten_packets_ = 0;
+};
+
+}  // namespace hackvac
+
+#endif  // PACKET_FORWARDER_H_
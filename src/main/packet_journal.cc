@@ -0,0 +1,418 @@
+#include "packet_journal.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+namespace hackvac {
+
+namespace {
+
+constexpr uint8_t kOpLiteral = 0;
+constexpr uint8_t kOpRef = 1;
+constexpr uint8_t kOpDelta = 2;
+constexpr uint8_t kOpRun = 3;
+
+uint8_t EntryHeader(uint8_t op, uint8_t interface, uint8_t slot) {
+  return (op << 6) | ((interface & 0x3) << 4) | (slot & 0xf);
+}
+
+uint32_t ZigZag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+int32_t UnZigZag(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+uint16_t ReadU16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+uint32_t ReadU32(const uint8_t* p) {
+  return ReadU16(p) | (static_cast<uint32_t>(ReadU16(p + 2)) << 16);
+}
+
+void WriteU16(uint8_t* p, uint16_t value) {
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+void WriteU32(uint8_t* p, uint32_t value) {
+  WriteU16(p, value & 0xffff);
+  WriteU16(p + 2, value >> 16);
+}
+
+// Bounds-checked reader for DecodePacketJournal().
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  bool Byte(uint8_t* value) {
+    if (pos_ >= size_) {
+      return false;
+    }
+    *value = data_[pos_++];
+    return true;
+  }
+
+  bool Varint(uint32_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      uint8_t byte;
+      if (!Byte(&byte)) {
+        return false;
+      }
+      *value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool done() const { return pos_ >= size_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+}  // namespace
+
+constexpr size_t PacketJournal::kChunkSize;
+constexpr size_t PacketJournal::kNumChunks;
+constexpr size_t PacketJournal::kMaxInterfaces;
+constexpr size_t PacketJournal::kMaxPacketSize;
+constexpr char PacketJournal::kSnapshotMagic[];
+constexpr size_t PacketJournal::kSnapshotHeaderSize;
+constexpr size_t PacketJournal::kChunkHeaderSize;
+constexpr size_t PacketJournal::kNumSlots;
+constexpr size_t PacketJournal::kMaxPeriod;
+constexpr size_t PacketJournal::kMaxEntrySize;
+
+PacketJournal::PacketJournal() = default;
+
+PacketJournal::~PacketJournal() = default;
+
+void PacketJournal::Append(uint8_t interface, uint32_t time_ms,
+                           const uint8_t* bytes, size_t size) {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  size = std::min(size, kMaxPacketSize);
+  interface &= 0x3;
+
+  if (num_used_chunks_ == 0 || write_pos_ + kMaxEntrySize > kChunkSize ||
+      chunk_packets_ == UINT16_MAX) {
+    StartChunk(time_ms);
+  }
+
+  // Time only moves forward within a chunk.
+  uint32_t dt_ms = static_cast<int32_t>(time_ms - last_time_ms_) > 0 ?
+      time_ms - last_time_ms_ : 0;
+  last_time_ms_ += dt_ms;
+
+  uint8_t type = size > 1 ? bytes[1] : 0;
+  uint8_t command = size > 5 ? bytes[5] : 0;
+  DictEntry* entry = nullptr;
+  for (auto& candidate : dict_) {
+    if (candidate.used && candidate.interface == interface &&
+        candidate.type == type && candidate.command == command) {
+      entry = &candidate;
+      break;
+    }
+  }
+  uint8_t slot = entry ? entry - dict_.data() : 0;
+  bool is_same_size = entry && entry->size == size;
+  bool is_exact = is_same_size && memcmp(entry->bytes, bytes, size) == 0;
+
+  if (is_exact && run_count_pos_) {
+    const HistoryEntry* earlier = HistoryBack(run_period_);
+    if (earlier && earlier->interface == interface && earlier->slot == slot &&
+        chunk()[run_count_pos_] < UINT8_MAX) {
+      PutVarint(ZigZag(static_cast<int32_t>(dt_ms - earlier->dt_ms)));
+      chunk()[run_count_pos_]++;
+      PushHistory(interface, slot, dt_ms);
+      chunk_packets_++;
+      chunk_raw_bytes_[current_] += size + 4;
+      WriteChunkHeader();
+      return;
+    }
+  }
+  run_count_pos_ = 0;
+
+  if (is_exact) {
+    // Prefer starting a run. It costs a byte more than a ref up front and
+    // about two bytes less for every packet that follows the pattern.
+    for (size_t period = 1; period <= history_size_; ++period) {
+      const HistoryEntry* earlier = HistoryBack(period);
+      if (earlier->interface == interface && earlier->slot == slot) {
+        PutByte(EntryHeader(kOpRun, 0, period - 1));
+        run_count_pos_ = write_pos_;
+        run_period_ = period;
+        PutByte(1);
+        PutVarint(ZigZag(static_cast<int32_t>(dt_ms - earlier->dt_ms)));
+        break;
+      }
+    }
+    if (!run_count_pos_) {
+      PutByte(EntryHeader(kOpRef, interface, slot));
+      PutVarint(dt_ms);
+    }
+  } else if (is_same_size) {
+    uint32_t changed = 0;
+    for (size_t i = 0; i < size; ++i) {
+      if (entry->bytes[i] != bytes[i]) {
+        changed |= 1u << i;
+      }
+    }
+    PutByte(EntryHeader(kOpDelta, interface, slot));
+    PutVarint(dt_ms);
+    PutVarint(changed);
+    for (size_t i = 0; i < size; ++i) {
+      if (changed & (1u << i)) {
+        PutByte(entry->bytes[i] ^ bytes[i]);
+      }
+    }
+    memcpy(entry->bytes, bytes, size);
+  } else {
+    if (!entry) {
+      slot = next_slot_;
+      next_slot_ = (next_slot_ + 1) % kNumSlots;
+      entry = &dict_[slot];
+      entry->used = true;
+      entry->interface = interface;
+      entry->type = type;
+      entry->command = command;
+    }
+    entry->size = size;
+    memcpy(entry->bytes, bytes, size);
+    PutByte(EntryHeader(kOpLiteral, interface, slot));
+    PutVarint(dt_ms);
+    PutByte(size);
+    memcpy(chunk() + write_pos_, bytes, size);
+    write_pos_ += size;
+  }
+
+  PushHistory(interface, slot, dt_ms);
+  chunk_packets_++;
+  chunk_raw_bytes_[current_] += size + 4;
+  WriteChunkHeader();
+}
+
+void PacketJournal::Snapshot(std::string* out) const {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  out->assign(kSnapshotMagic, 4);
+  uint8_t header[4];
+  WriteU16(header, kChunkSize);
+  WriteU16(header + 2, num_used_chunks_);
+  out->append(reinterpret_cast<const char*>(header), sizeof(header));
+  for (size_t i = 0; i < num_used_chunks_; ++i) {
+    const auto& chunk = chunks_[(oldest_chunk() + i) % kNumChunks];
+    out->append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+  }
+}
+
+uint32_t PacketJournal::num_packets() const {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  uint32_t packets = 0;
+  for (size_t i = 0; i < num_used_chunks_; ++i) {
+    packets += ReadU16(chunks_[(oldest_chunk() + i) % kNumChunks].data() + 6);
+  }
+  return packets;
+}
+
+uint32_t PacketJournal::raw_bytes() const {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  uint32_t bytes = 0;
+  for (size_t i = 0; i < num_used_chunks_; ++i) {
+    bytes += chunk_raw_bytes_[(oldest_chunk() + i) % kNumChunks];
+  }
+  return bytes;
+}
+
+uint32_t PacketJournal::stored_bytes() const {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  uint32_t bytes = 0;
+  for (size_t i = 0; i < num_used_chunks_; ++i) {
+    bytes += kChunkHeaderSize +
+        ReadU16(chunks_[(oldest_chunk() + i) % kNumChunks].data() + 4);
+  }
+  return bytes;
+}
+
+void PacketJournal::set_on_chunk_closed(
+    std::function<void(const uint8_t* chunk, size_t size)> on_chunk_closed) {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  on_chunk_closed_ = std::move(on_chunk_closed);
+}
+
+void PacketJournal::CloseChunk() {
+  std::lock_guard<esp_cxx::Mutex> lock(mutex_);
+  if (num_used_chunks_ > 0 && chunk_packets_ > 0) {
+    StartChunk(last_time_ms_);
+  }
+}
+
+void PacketJournal::StartChunk(uint32_t time_ms) {
+  if (num_used_chunks_ > 0) {
+    if (on_chunk_closed_) {
+      on_chunk_closed_(chunk(), write_pos_);
+    }
+    current_ = (current_ + 1) % kNumChunks;
+  }
+  num_used_chunks_ = std::min(num_used_chunks_ + 1, kNumChunks);
+  write_pos_ = kChunkHeaderSize;
+  chunk_packets_ = 0;
+  chunk_raw_bytes_[current_] = 0;
+  last_time_ms_ = time_ms;
+  WriteU32(chunk(), time_ms);
+  WriteChunkHeader();
+
+  dict_ = {};
+  next_slot_ = 0;
+  history_size_ = 0;
+  history_pos_ = 0;
+  run_count_pos_ = 0;
+}
+
+void PacketJournal::WriteChunkHeader() {
+  WriteU16(chunk() + 4, write_pos_ - kChunkHeaderSize);
+  WriteU16(chunk() + 6, chunk_packets_);
+}
+
+size_t PacketJournal::oldest_chunk() const {
+  return (current_ + kNumChunks + 1 - num_used_chunks_) % kNumChunks;
+}
+
+void PacketJournal::PutByte(uint8_t value) {
+  chunk()[write_pos_++] = value;
+}
+
+void PacketJournal::PutVarint(uint32_t value) {
+  while (value >= 0x80) {
+    PutByte((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  PutByte(value);
+}
+
+void PacketJournal::PushHistory(uint8_t interface, uint8_t slot, uint32_t dt_ms) {
+  history_[history_pos_] = {interface, slot, dt_ms};
+  history_pos_ = (history_pos_ + 1) % kMaxPeriod;
+  history_size_ = std::min(history_size_ + 1, kMaxPeriod);
+}
+
+const PacketJournal::HistoryEntry* PacketJournal::HistoryBack(size_t period) const {
+  if (period == 0 || period > history_size_) {
+    return nullptr;
+  }
+  return &history_[(history_pos_ + kMaxPeriod - period) % kMaxPeriod];
+}
+
+bool DecodePacketJournal(const uint8_t* data, size_t size,
+                         const std::function<void(const JournalPacket&)>& on_packet) {
+  if (size < PacketJournal::kSnapshotHeaderSize ||
+      memcmp(data, PacketJournal::kSnapshotMagic, 4) != 0) {
+    return false;
+  }
+  size_t chunk_size = ReadU16(data + 4);
+  size_t num_chunks = ReadU16(data + 6);
+  if (chunk_size < PacketJournal::kChunkHeaderSize ||
+      size < PacketJournal::kSnapshotHeaderSize + chunk_size * num_chunks) {
+    return false;
+  }
+
+  struct Slot {
+    uint8_t size = 0;
+    uint8_t bytes[PacketJournal::kMaxPacketSize];
+  };
+  struct Earlier {
+    uint8_t interface;
+    uint8_t slot;
+    uint32_t dt_ms;
+  };
+  static constexpr size_t kMaxPeriod = 8;
+
+  const uint8_t* chunk = data + PacketJournal::kSnapshotHeaderSize;
+  for (size_t c = 0; c < num_chunks; ++c, chunk += chunk_size) {
+    uint32_t time_ms = ReadU32(chunk);
+    size_t used = ReadU16(chunk + 4);
+    if (used > chunk_size - PacketJournal::kChunkHeaderSize) {
+      return false;
+    }
+
+    Slot dict[16] = {};
+    Earlier history[kMaxPeriod];
+    size_t history_size = 0;
+    size_t history_pos = 0;
+    auto emit = [&](uint8_t interface, uint8_t slot, uint32_t dt_ms) {
+      time_ms += dt_ms;
+      on_packet({interface, time_ms, dict[slot].size, dict[slot].bytes});
+      history[history_pos] = {interface, slot, dt_ms};
+      history_pos = (history_pos + 1) % kMaxPeriod;
+      history_size = std::min(history_size + 1, kMaxPeriod);
+    };
+
+    Reader reader(chunk + PacketJournal::kChunkHeaderSize, used);
+    while (!reader.done()) {
+      uint8_t header;
+      reader.Byte(&header);
+      uint8_t op = header >> 6;
+      uint8_t interface = (header >> 4) & 0x3;
+      uint8_t slot = header & 0xf;
+
+      if (op == kOpRun) {
+        size_t period = (header & 0x7) + 1;
+        uint8_t count;
+        if (!reader.Byte(&count)) {
+          return false;
+        }
+        for (uint8_t i = 0; i < count; ++i) {
+          uint32_t jitter;
+          if (!reader.Varint(&jitter) || period > history_size) {
+            return false;
+          }
+          Earlier earlier = history[(history_pos + kMaxPeriod - period) % kMaxPeriod];
+          emit(earlier.interface, earlier.slot, earlier.dt_ms + UnZigZag(jitter));
+        }
+        continue;
+      }
+
+      uint32_t dt_ms;
+      if (!reader.Varint(&dt_ms)) {
+        return false;
+      }
+      Slot& entry = dict[slot];
+      if (op == kOpLiteral) {
+        if (!reader.Byte(&entry.size) || entry.size > PacketJournal::kMaxPacketSize) {
+          return false;
+        }
+        for (size_t i = 0; i < entry.size; ++i) {
+          if (!reader.Byte(&entry.bytes[i])) {
+            return false;
+          }
+        }
+      } else if (op == kOpDelta) {
+        uint32_t changed;
+        if (!reader.Varint(&changed)) {
+          return false;
+        }
+        for (size_t i = 0; i < entry.size; ++i) {
+          uint8_t x;
+          if ((changed & (1u << i)) && !reader.Byte(&x)) {
+            return false;
+          }
+          if (changed & (1u << i)) {
+            entry.bytes[i] ^= x;
+          }
+        }
+      }
+      emit(interface, slot, dt_ms);
+    }
+  }
+  return true;
+}
+
+}  // namespace hackvac
@@ -0,0 +1,152 @@
+#ifndef PACKET_JOURNAL_H_
+#define PACKET_JOURNAL_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "esp_cxx/mutex.h"
+
+namespace hackvac {
+
+// Compressed in-RAM history of CN105 packets for post-mortem debugging.
+//
+// Idle polling is the same few Info/InfoAck/Update/UpdateAck frames over and
+// over, almost byte for byte. Each packet is stored against a small
+// dictionary of the last frame seen per (interface, packet type, command):
+//
+//   literal - the first frame for a key. Added to the dictionary.
+//   ref     - identical to the dictionary frame. Just the time.
+//   delta   - same length as the dictionary frame. A bitmap of the changed
+//             bytes and their XOR against it. Replaces the dictionary frame.
+//   run     - a stretch of refs each repeating the packet |period| entries
+//             earlier, such as a polling cycle. One byte of timing jitter per
+//             packet against that earlier packet.
+//
+// The buffer is a ring of kNumChunks chunks. Each chunk starts with an empty
+// dictionary so it decodes on its own, and the oldest whole chunk is dropped
+// when the ring wraps. Times are kept in milliseconds.
+//
+// Snapshot() serializes the ring for /api/journal. DecodePacketJournal() and
+// journal.py at the top of the repo turn that back into packets. Finished
+// chunks can also be handed to set_on_chunk_closed(), which is how they
+// reach the FlashRing.
+//
+// Safe from any task.
+class PacketJournal {
+ public:
+  static constexpr size_t kChunkSize = 1024;
+  static constexpr size_t kNumChunks = 8;
+
+  // Interfaces are 2 bits in an entry header.
+  static constexpr size_t kMaxInterfaces = 4;
+  static constexpr size_t kMaxPacketSize = 32;
+
+  // Snapshot() layout, little-endian:
+  //   "HVJ1" | u16 chunk size | u16 chunks that follow
+  // and then the used chunks, oldest first, each kChunkSize bytes:
+  //   u32 base ms | u16 bytes of entries | u16 packets | entries...
+  static constexpr char kSnapshotMagic[] = "HVJ1";
+  static constexpr size_t kSnapshotHeaderSize = 8;
+  static constexpr size_t kChunkHeaderSize = 8;
+
+  PacketJournal();
+  ~PacketJournal();
+
+  // Records |size| bytes of a packet on |interface| at |time_ms|. Packets
+  // longer than kMaxPacketSize are truncated.
+  void Append(uint8_t interface, uint32_t time_ms, const uint8_t* bytes, size_t size);
+
+  // Called with each chunk, header included, once no more packets will go
+  // into it. Runs under the journal's lock on the appending task.
+  void set_on_chunk_closed(std::function<void(const uint8_t* chunk, size_t size)> on_chunk_closed);
+
+  // Closes the chunk being written, if it holds anything, so it reaches
+  // on_chunk_closed before a restart.
+  void CloseChunk();
+
+  // Replaces |out| with the whole journal.
+  void Snapshot(std::string* out) const;
+
+  // Packets held and what they would take uncompressed: the bytes plus a
+  // 4 byte time stamp each.
+  uint32_t num_packets() const;
+  uint32_t raw_bytes() const;
+  uint32_t stored_bytes() const;
+
+ private:
+  struct DictEntry {
+    bool used = false;
+    uint8_t interface = 0;
+    uint8_t type = 0;
+    uint8_t command = 0;
+    uint8_t size = 0;
+    uint8_t bytes[kMaxPacketSize];
+  };
+
+  struct HistoryEntry {
+    uint8_t interface;
+    uint8_t slot;
+    uint32_t dt_ms;
+  };
+
+  static constexpr size_t kNumSlots = 16;
+  static constexpr size_t kMaxPeriod = 8;
+
+  // Worst case entry: a delta with a full bitmap.
+  static constexpr size_t kMaxEntrySize = 1 + 5 + 5 + kMaxPacketSize;
+
+  uint8_t* chunk() { return chunks_[current_].data(); }
+  void StartChunk(uint32_t time_ms);
+  void WriteChunkHeader();
+  size_t oldest_chunk() const;
+
+  void PutByte(uint8_t value);
+  void PutVarint(uint32_t value);
+  void PushHistory(uint8_t interface, uint8_t slot, uint32_t dt_ms);
+  const HistoryEntry* HistoryBack(size_t period) const;
+
+  mutable esp_cxx::Mutex mutex_;
+  std::function<void(const uint8_t*, size_t)> on_chunk_closed_;
+  std::array<std::array<uint8_t, kChunkSize>, kNumChunks> chunks_{};
+
+  // Index of the chunk being written and how many chunks hold data.
+  size_t current_ = 0;
+  size_t num_used_chunks_ = 0;
+  size_t write_pos_ = kChunkHeaderSize;
+  uint16_t chunk_packets_ = 0;
+  uint32_t last_time_ms_ = 0;
+
+  // Per chunk encoder state.
+  std::array<DictEntry, kNumSlots> dict_;
+  size_t next_slot_ = 0;
+  std::array<HistoryEntry, kMaxPeriod> history_;
+  size_t history_size_ = 0;
+  size_t history_pos_ = 0;
+
+  // Offset of the open run's count byte, or 0 if no run is open.
+  size_t run_count_pos_ = 0;
+  size_t run_period_ = 0;
+
+  // raw_bytes() for each chunk.
+  std::array<uint32_t, kNumChunks> chunk_raw_bytes_{};
+};
+
+struct JournalPacket {
+  uint8_t interface;
+  uint32_t time_ms;
+  uint8_t size;
+  const uint8_t* bytes;
+};
+
+// Decodes a PacketJournal::Snapshot() blob, calling |on_packet| for each
+// packet oldest first. Returns false if the blob is malformed. Packets
+// before the problem have already been reported.
+bool DecodePacketJournal(const uint8_t* data, size_t size,
+                         const std::function<void(const JournalPacket&)>& on_packet);
+
+}  // namespace hackvac
+
+#endif  // PACKET_JOURNAL_H_
@@ -0,0 +1,184 @@
+#include "packet_rewriter.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace hackvac {
+
+namespace {
+
+// Settings layout packets always carry this many data bytes.
+constexpr size_t kSettingsDataSize = 16;
+
+}  // namespace
+
+bool RewriteRule::IsSupported() const {
+  return (packet_type == PacketType::kUpdate &&
+          command_type == CommandType::kSetSettings) ||
+         (packet_type == PacketType::kInfoAck &&
+          command_type == CommandType::kSettings);
+}
+
+std::shared_ptr<const CompiledRewriteRules> CompiledRewriteRules::Compile(
+    std::vector<RewriteRule> rules) {
+  // Constructor is private so std::make_shared cannot be used.
+  std::shared_ptr<CompiledRewriteRules> compiled(new CompiledRewriteRules());
+
+  rules.erase(std::remove_if(rules.begin(), rules.end(),
+                             [](const RewriteRule& rule) {
+                               return !rule.IsSupported();
+                             }),
+              rules.end());
+  if (rules.size() > std::numeric_limits<uint16_t>::max()) {
+    rules.resize(std::numeric_limits<uint16_t>::max());
+  }
+
+  // Stable so rules for the same packet keep their relative order. Later
+  // rules win when two touch the same field.
+  auto index_of = [](const RewriteRule& rule) {
+    return IndexOf(rule.direction, rule.packet_type,
+                   static_cast<uint8_t>(rule.command_type)).value();
+  };
+  std::stable_sort(rules.begin(), rules.end(),
+                   [&](const RewriteRule& a, const RewriteRule& b) {
+                     return index_of(a) < index_of(b);
+                   });
+
+  for (size_t i = 0; i < rules.size(); ++i) {
+    Span& span = compiled->index_[index_of(rules[i])];
+    if (span.count == 0) {
+      span.begin = i;
+    }
+    span.count++;
+  }
+  compiled->rules_ = std::move(rules);
+  return compiled;
+}
+
+bool CompiledRewriteRules::HasRules(RewriteDirection direction,
+                                    PacketType type, uint8_t command) const {
+  auto index = IndexOf(direction, type, command);
+  return index && index_[index.value()].count > 0;
+}
+
+bool CompiledRewriteRules::Apply(RewriteDirection direction,
+                                 Cn105Packet* packet) const {
+  if (!packet->IsComplete() || packet->IsJunk() ||
+      packet->data_size() < kSettingsDataSize) {
+    return false;
+  }
+
+  auto index = IndexOf(direction, packet->type(), packet->data()[0]);
+  if (!index) {
+    return false;
+  }
+
+  const Span& span = index_[index.value()];
+  if (span.count == 0) {
+    return false;
+  }
+
+  std::array<uint8_t, kSettingsDataSize> original;
+  std::copy_n(packet->data(), original.size(), original.begin());
+
+  ApplyRules(&rules_[span.begin], span.count,
+             packet->type() == PacketType::kInfoAck, packet->data());
+
+  if (std::equal(original.begin(), original.end(), packet->data())) {
+    return false;
+  }
+  packet->UpdateChecksum();
+  return true;
+}
+
+void CompiledRewriteRules::ApplyRules(const RewriteRule* rules, size_t count,
+                                      bool is_info_ack, uint8_t* data) {
+  if (!is_info_ack) {
+    HvacSettings settings(data);
+    for (size_t i = 0; i < count; ++i) {
+      ApplyRule(rules[i], &settings);
+    }
+    return;
+  }
+
+  // Flag the fields on a copy so rules see the values the InfoAck carries,
+  // then copy back everything except the flags.
+  std::array<uint8_t, kSettingsDataSize> flagged;
+  std::copy_n(data, flagged.size(), flagged.begin());
+  HvacSettings settings(flagged.data());
+  settings.MarkAllPresent();
+  for (size_t i = 0; i < count; ++i) {
+    ApplyRule(rules[i], &settings);
+  }
+  schema::HvacSettingsSchema::ForEach([&](auto field) {
+    using Field = decltype(field);
+    flagged[Field::kFlagPos] = data[Field::kFlagPos];
+  });
+  std::copy(flagged.begin(), flagged.end(), data);
+}
+
+std::optional<size_t> CompiledRewriteRules::PacketSlot(PacketType type) {
+  switch (type) {
+    case PacketType::kUpdate:
+      return 0;
+    case PacketType::kInfoAck:
+      return 1;
+    default:
+      return {};
+  }
+}
+
+std::optional<size_t> CompiledRewriteRules::IndexOf(RewriteDirection direction,
+                                                    PacketType type,
+                                                    uint8_t command) {
+  auto slot = PacketSlot(type);
+  if (!slot || command >= kNumCommandSlots) {
+    return {};
+  }
+  return (static_cast<size_t>(direction) * kNumPacketSlots + slot.value()) *
+      kNumCommandSlots + command;
+}
+
+bool CompiledRewriteRules::ApplyRule(const RewriteRule& rule,
+                                     HvacSettings* settings) {
+  switch (rule.action) {
+    case RewriteRule::Action::kSetField:
+      // kRoomTemp is not part of the settings layout and is rejected here.
+      return settings->SetFieldFromInt(rule.field, rule.value);
+
+    case RewriteRule::Action::kClampTargetTemp: {
+      std::optional<HalfDegreeTemp> target = settings->GetTargetTemp();
+      if (!target) {
+        return false;
+      }
+      HalfDegreeTemp min = HalfDegreeTemp::FromHalfDegrees(rule.min_half_degrees);
+      HalfDegreeTemp max = HalfDegreeTemp::FromHalfDegrees(rule.max_half_degrees);
+      if (target.value() < min) {
+        settings->SetTargetTemp(min);
+        return true;
+      }
+      if (max < target.value()) {
+        settings->SetTargetTemp(max);
+        return true;
+      }
+      return false;
+    }
+  }
+  return false;
+}
+
+PacketRewriter::PacketRewriter()
+  : rules_(CompiledRewriteRules::Compile({})) {
+}
+
+PacketRewriter::~PacketRewriter() = default;
+
+void PacketRewriter::SetRules(std::vector<RewriteRule> rules) {
+  std::atomic_store(&rules_, CompiledRewriteRules::Compile(std::move(rules)));
+}
+
+std::shared_ptr<const CompiledRewriteRules> PacketRewriter::Snapshot() const {
+  return std::atomic_load(&rules_);
+}
+
+}  // namespace hackvac
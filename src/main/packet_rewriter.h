@@ -0,0 +1,143 @@
+#ifndef PACKET_REWRITER_H_
+#define PACKET_REWRITER_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cn105_packet.h"
+#include "hvac_settings.h"
+
+#include "esp_cxx/cxx17hack.h"
+
+namespace hackvac {
+
+// Which side a forwarded packet came from.
+enum class RewriteDirection : uint8_t {
+  kFromThermostat = 0,
+  kFromHvac = 1,
+};
+
+// A single modification applied to packets forwarded in passthru (MITM)
+// mode. Rules match on direction, packet type, and the command byte that
+// starts the data section. Examples:
+//
+//   On Update/kSetSettings from the tstat, set Fan to kAuto:
+//     { kFromThermostat, kUpdate, kSetSettings, kSetField, kFan, 0x00 }
+//
+//   On Update/kSetSettings from the tstat, clamp target temp to [18, 24]:
+//     { kFromThermostat, kUpdate, kSetSettings, kClampTargetTemp,
+//       kTargetTemp, 0, 18 * 2, 24 * 2 }
+//
+// Only Update/kSetSettings and InfoAck/kSettings carry HvacSettings. Rules
+// for anything else are dropped by Compile(). An Update only carries the
+// fields its flag bits mark; an InfoAck carries every field with the flag
+// bytes zero, so its fields are read and written by position.
+struct RewriteRule {
+  enum class Action : uint8_t {
+    // Forces |field| to the wire value in |value|.
+    kSetField,
+
+    // Clamps the target temp, if present, to [min_half_degrees,
+    // max_half_degrees] expressed in celcius * 2.
+    kClampTargetTemp,
+  };
+
+  RewriteDirection direction = RewriteDirection::kFromThermostat;
+  PacketType packet_type = PacketType::kUnknown;
+  CommandType command_type = CommandType::kSetSettings;
+  Action action = Action::kSetField;
+  SettingsField field = SettingsField::kPower;
+  uint8_t value = 0;
+  uint8_t min_half_degrees = 0;
+  uint8_t max_half_degrees = 0;
+
+  // True if |packet_type| and |command_type| name a settings payload this
+  // rule can rewrite.
+  bool IsSupported() const;
+};
+
+// An immutable rule table compiled into a per (direction, PacketType,
+// CommandType) index. Looking up the rules for a packet is a single array
+// index and evaluation touches only the matching rules. Nothing here
+// allocates after Compile().
+class CompiledRewriteRules {
+ public:
+  // Builds the index from |rules|. Rules that cannot match anything are
+  // dropped.
+  static std::shared_ptr<const CompiledRewriteRules> Compile(
+      std::vector<RewriteRule> rules);
+
+  // True if any rule could modify a packet of |type| whose command byte is
+  // |command| coming from |direction|.
+  bool HasRules(RewriteDirection direction, PacketType type,
+                uint8_t command) const;
+
+  // Applies matching rules to the complete |packet| and fixes up its
+  // checksum. Returns true if any byte changed.
+  bool Apply(RewriteDirection direction, Cn105Packet* packet) const;
+
+  const std::vector<RewriteRule>& rules() const { return rules_; }
+
+ private:
+  // Only Update and InfoAck carry settings data.
+  static constexpr size_t kNumPacketSlots = 2;
+
+  // CommandType values all fit in a nibble.
+  static constexpr size_t kNumCommandSlots = 16;
+
+  static constexpr size_t kNumDirections = 2;
+
+  // Range into |rules_|.
+  struct Span {
+    uint16_t begin = 0;
+    uint16_t count = 0;
+  };
+
+  CompiledRewriteRules() = default;
+
+  // Returns the slot for |type| or nullopt if |type| is not rewritable.
+  static std::optional<size_t> PacketSlot(PacketType type);
+
+  // Returns the index into |index_| or nullopt if nothing can match.
+  static std::optional<size_t> IndexOf(RewriteDirection direction,
+                                       PacketType type, uint8_t command);
+
+  // Applies one rule to a settings view. Returns true if a byte changed.
+  static bool ApplyRule(const RewriteRule& rule, HvacSettings* settings);
+
+  // Applies |rules| to the 16 byte settings payload at |data|. Rules see
+  // every field as present when |is_info_ack| even though the flag bytes
+  // are zero, and the flag bytes are left as they were.
+  static void ApplyRules(const RewriteRule* rules, size_t count,
+                         bool is_info_ack, uint8_t* data);
+
+  // Rules sorted so each index entry is a contiguous run.
+  std::vector<RewriteRule> rules_;
+  std::array<Span, kNumDirections * kNumPacketSlots * kNumCommandSlots> index_{};
+};
+
+// Holds the currently active CompiledRewriteRules and allows them to be
+// swapped from another task (eg, the HTTP server) while packets are being
+// forwarded. Readers take a snapshot at the start of each packet so a
+// packet never sees a mix of old and new rules.
+class PacketRewriter {
+ public:
+  PacketRewriter();
+  ~PacketRewriter();
+
+  // Compiles |rules| and atomically publishes them. Safe from any task.
+  void SetRules(std::vector<RewriteRule> rules);
+
+  // Returns the active rules. Safe from any task. Copying the shared_ptr
+  // only touches its reference count; there is no allocation.
+  std::shared_ptr<const CompiledRewriteRules> Snapshot() const;
+
+ private:
+  std::shared_ptr<const CompiledRewriteRules> rules_;
+};
+
+}  // namespace hackvac
+
+#endif  // PACKET_REWRITER_H_
@@ -0,0 +1,155 @@
+#include "pcapng.h"
+
+#include <cstring>
+
+namespace hackvac {
+
+namespace {
+
+constexpr uint32_t kSectionHeaderBlock = 0x0a0d0d0a;
+constexpr uint32_t kInterfaceDescriptionBlock = 0x00000001;
+constexpr uint32_t kEnhancedPacketBlock = 0x00000006;
+constexpr uint32_t kByteOrderMagic = 0x1a2b3c4d;
+
+constexpr uint16_t kOptEndOfOpt = 0;
+constexpr uint16_t kIfName = 2;
+constexpr uint16_t kEpbFlags = 2;
+constexpr uint16_t kEpbDropCount = 4;
+
+size_t Pad4(size_t len) {
+  return (len + 3) & ~static_cast<size_t>(3);
+}
+
+size_t OptionSize(size_t value_len) {
+  return 4 + Pad4(value_len);
+}
+
+// Appends to a block in a caller-checked buffer.
+class BlockWriter {
+ public:
+  explicit BlockWriter(uint8_t* out) : out_(out) {}
+
+  void U16(uint16_t value) {
+    out_[pos_++] = value & 0xff;
+    out_[pos_++] = value >> 8;
+  }
+
+  void U32(uint32_t value) {
+    U16(value & 0xffff);
+    U16(value >> 16);
+  }
+
+  void U64(uint64_t value) {
+    U32(value & 0xffffffff);
+    U32(value >> 32);
+  }
+
+  void Bytes(const void* data, size_t len) {
+    if (len) {
+      memcpy(out_ + pos_, data, len);
+    }
+    pos_ += len;
+    while (pos_ % 4) {
+      out_[pos_++] = 0;
+    }
+  }
+
+  void Option(uint16_t code, const void* value, size_t len) {
+    U16(code);
+    U16(len);
+    Bytes(value, len);
+  }
+
+  size_t pos() const { return pos_; }
+
+ private:
+  uint8_t* out_;
+  size_t pos_ = 0;
+};
+
+}  // namespace
+
+size_t WritePcapngSectionHeader(uint8_t* out, size_t size) {
+  static constexpr size_t kBlockSize = 28;
+  if (size < kBlockSize) {
+    return 0;
+  }
+  BlockWriter writer(out);
+  writer.U32(kSectionHeaderBlock);
+  writer.U32(kBlockSize);
+  writer.U32(kByteOrderMagic);
+  writer.U16(1);  // Major version.
+  writer.U16(0);  // Minor version.
+  writer.U64(~0ULL);  // Section length unknown since this is a stream.
+  writer.U32(kBlockSize);
+  return writer.pos();
+}
+
+size_t WritePcapngInterface(const char* name, uint16_t link_type, uint32_t snap_len,
+                            uint8_t* out, size_t size) {
+  size_t name_len = strlen(name);
+  size_t block_size = 20 + OptionSize(name_len) + OptionSize(0);
+  if (size < block_size) {
+    return 0;
+  }
+  BlockWriter writer(out);
+  writer.U32(kInterfaceDescriptionBlock);
+  writer.U32(block_size);
+  writer.U16(link_type);
+  writer.U16(0);  // Reserved.
+  writer.U32(snap_len);
+  writer.Option(kIfName, name, name_len);
+  writer.Option(kOptEndOfOpt, nullptr, 0);
+  writer.U32(block_size);
+  return writer.pos();
+}
+
+size_t WritePcapngPacket(uint32_t interface_id, uint64_t timestamp_us, uint32_t flags,
+                         uint64_t dropped, const uint8_t* data, size_t data_size,
+                         uint8_t* out, size_t size) {
+  size_t options_size = 0;
+  if (flags) {
+    options_size += OptionSize(sizeof(flags));
+  }
+  if (dropped) {
+    options_size += OptionSize(sizeof(dropped));
+  }
+  if (options_size) {
+    options_size += OptionSize(0);
+  }
+  size_t block_size = 32 + Pad4(data_size) + options_size;
+  if (size < block_size) {
+    return 0;
+  }
+
+  BlockWriter writer(out);
+  writer.U32(kEnhancedPacketBlock);
+  writer.U32(block_size);
+  writer.U32(interface_id);
+  writer.U32(timestamp_us >> 32);
+  writer.U32(timestamp_us & 0xffffffff);
+  writer.U32(data_size);  // Captured length.
+  writer.U32(data_size);  // Original length.
+  writer.Bytes(data, data_size);
+  if (flags) {
+    uint8_t value[4] = {
+      static_cast<uint8_t>(flags), static_cast<uint8_t>(flags >> 8),
+      static_cast<uint8_t>(flags >> 16), static_cast<uint8_t>(flags >> 24),
+    };
+    writer.Option(kEpbFlags, value, sizeof(value));
+  }
+  if (dropped) {
+    uint8_t value[8];
+    for (size_t i = 0; i < sizeof(value); ++i) {
+      value[i] = dropped >> (8 * i);
+    }
+    writer.Option(kEpbDropCount, value, sizeof(value));
+  }
+  if (options_size) {
+    writer.Option(kOptEndOfOpt, nullptr, 0);
+  }
+  writer.U32(block_size);
+  return writer.pos();
+}
+
+}  // namespace hackvac
@@ -0,0 +1,45 @@
+#ifndef PCAPNG_H_
+#define PCAPNG_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hackvac {
+
+// Minimal pcapng block writers. Just enough to stream a capture that
+// Wireshark can open: one Section Header, some Interface Descriptions, and
+// Enhanced Packet Blocks. Everything is written little-endian, which the
+// Section Header's byte order magic tells readers.
+//
+// See https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html
+//
+// Each writer returns the number of bytes written to |out|, or 0 if the
+// block does not fit in |size|.
+
+// Link type for private use. cn105.lua registers its dissector here.
+constexpr uint16_t kPcapngLinkTypeUser0 = 147;
+
+// epb_flags direction bits.
+constexpr uint32_t kPcapngInbound = 1;
+constexpr uint32_t kPcapngOutbound = 2;
+
+// epb_flags link-layer error bits.
+constexpr uint32_t kPcapngCrcError = 1u << 24;
+constexpr uint32_t kPcapngStartFrameError = 1u << 29;
+
+size_t WritePcapngSectionHeader(uint8_t* out, size_t size);
+
+// Interfaces are numbered in the order they are written, from 0. Time
+// stamps are in microseconds, the pcapng default.
+size_t WritePcapngInterface(const char* name, uint16_t link_type, uint32_t snap_len,
+                            uint8_t* out, size_t size);
+
+// |dropped| is the number of packets lost since the previous one on this
+// interface. epb_flags and epb_dropcount are only written when non-zero.
+size_t WritePcapngPacket(uint32_t interface_id, uint64_t timestamp_us, uint32_t flags,
+                         uint64_t dropped, const uint8_t* data, size_t data_size,
+                         uint8_t* out, size_t size);
+
+}  // namespace hackvac
+
+#endif  // PCAPNG_H_
@@ -0,0 +1,52 @@
+#include "rtt_estimator.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace hackvac {
+
+constexpr RttEstimator::Duration RttEstimator::kGranularity;
+constexpr RttEstimator::Duration RttEstimator::kMaxTimeout;
+
+void RttEstimator::SetFrameSizes(size_t request_bytes, size_t reply_bytes) {
+  floor_us_ = WireTime(request_bytes + reply_bytes).count();
+}
+
+void RttEstimator::AddSample(Duration rtt) {
+  uint32_t sample = static_cast<uint32_t>(std::max<int64_t>(rtt.count(), 0));
+  histogram_.Add(sample);
+  backoff_shift_ = 0;
+
+  if (histogram_.count() == 1) {
+    srtt_us_ = sample;
+    rttvar_us_ = sample / 2;
+    return;
+  }
+
+  int32_t srtt = srtt_us_;
+  int32_t rttvar = rttvar_us_;
+  int32_t error = static_cast<int32_t>(sample) - srtt;
+  rttvar += (std::abs(error) - rttvar) / 4;
+  srtt += error / 8;
+  rttvar_us_ = rttvar;
+  srtt_us_ = srtt;
+}
+
+void RttEstimator::OnTimeout() {
+  timeouts_++;
+  if (backoff_shift_ < kMaxBackoffShift) {
+    backoff_shift_++;
+  }
+}
+
+RttEstimator::Duration RttEstimator::timeout() const {
+  Duration base;
+  if (histogram_.count() == 0) {
+    base = 2 * floor();
+  } else {
+    base = std::max(floor(), srtt() + std::max(kGranularity, 4 * rttvar()));
+  }
+  return std::min(base * (1 << backoff_shift_), Duration(kMaxTimeout));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,80 @@
+#ifndef RTT_ESTIMATOR_H_
+#define RTT_ESTIMATOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "histogram.h"
+
+namespace hackvac {
+
+// Estimates the round trip time of one kind of CN105 command and derives a
+// timeout from it. This is the TCP retransmit timer from RFC 6298:
+//
+//   srtt    = 7/8 srtt + 1/8 rtt
+//   rttvar  = 3/4 rttvar + 1/4 |srtt - rtt|
+//   timeout = srtt + max(kGranularity, 4 * rttvar)
+//
+// The timeout never drops below the time the request and its reply take
+// on the wire, and it doubles on each timeout until the next good sample.
+// Until the first sample it is twice the wire time.
+//
+// RTT is measured from when the request is written to the UART until its
+// reply is parsed so it includes both frames, the unit's turnaround, and
+// the channel's dispatch latency.
+//
+// Not thread-safe except for the getters which may be read from any task.
+// Samples should come from the Controller's task.
+class RttEstimator {
+ public:
+  using Duration = std::chrono::microseconds;
+
+  static constexpr Duration kGranularity = std::chrono::milliseconds(10);
+  static constexpr Duration kMaxTimeout = std::chrono::seconds(2);
+
+  // Time to move |bytes| over the 2400 baud 8E1 CN105 link. Each byte is
+  // 11 bits including start, parity, and stop.
+  static constexpr Duration WireTime(size_t bytes) {
+    return Duration(bytes * 11 * 1000000 / 2400);
+  }
+
+  RttEstimator() = default;
+
+  // Sets the minimum timeout to the wire time of a |request_bytes| packet
+  // and its |reply_bytes| reply.
+  void SetFrameSizes(size_t request_bytes, size_t reply_bytes);
+
+  // Records a completed round trip.
+  void AddSample(Duration rtt);
+
+  // Records that a request went unanswered.
+  void OnTimeout();
+
+  // How long to wait for the reply to the next request.
+  Duration timeout() const;
+
+  Duration srtt() const { return Duration(srtt_us_.load(std::memory_order_relaxed)); }
+  Duration rttvar() const { return Duration(rttvar_us_.load(std::memory_order_relaxed)); }
+  Duration floor() const { return Duration(floor_us_.load(std::memory_order_relaxed)); }
+  uint32_t timeouts() const { return timeouts_.load(std::memory_order_relaxed); }
+
+  // Distribution of raw samples in microseconds.
+  const Histogram& histogram() const { return histogram_; }
+
+ private:
+  // Caps the doubling in OnTimeout() well before kMaxTimeout would overflow.
+  static constexpr int kMaxBackoffShift = 6;
+
+  std::atomic<uint32_t> floor_us_{0};
+  std::atomic<uint32_t> srtt_us_{0};
+  std::atomic<uint32_t> rttvar_us_{0};
+  std::atomic<int> backoff_shift_{0};
+  std::atomic<uint32_t> timeouts_{0};
+  Histogram histogram_;
+};
+
+}  // namespace hackvac
+
+#endif  // RTT_ESTIMATOR_H_
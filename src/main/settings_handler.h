@@ -0,0 +1,270 @@
+#ifndef SETTINGS_HANDLER_H_
+#define SETTINGS_HANDLER_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string_view>
+
+#include "controller.h"
+#include "etag.h"
+#include "settings_json.h"
+
+#include "esp_cxx/event_manager.h"
+#include "esp_cxx/logging.h"
+#include "gtest/gtest_prod.h"
+
+namespace hackvac {
+
+// The /api/settings logic behind ApiEndpoints::SettingsEndpoint, kept apart
+// from the StreamServer so it can be driven on the host.
+//
+// Replies carry the effective settings as described in settings_json.h and
+// an ETag made from the settings generations.
+//
+// A GET whose If-None-Match lists the current ETag gets a 304 built from the
+// generations alone. With a wait such a GET, or one with no If-None-Match,
+// is instead held for up to that many seconds (at most kMaxWaitS) and
+// answered as soon as the settings change. One that times out is answered
+// as if it had just arrived. At most kMaxWaiters are held; more are
+// answered right away.
+//
+// A PUT takes the same form as GET replies with and merges the fields it
+// lists into the desired settings, which queues an Update through the
+// Controller's mailbox, then replies like GET. Serializes into |buf_| and
+// parses the body in place so no cJSON trees are built.
+//
+// |Response| is StreamServer::Connection on the device and a fake in tests.
+// It needs
+//   void Send(int status, size_t size, const char* headers, std::string_view body);
+//   void SendError(int status, const char* message);
+//   bool operator==(const Response& other) const;  // Same connection.
+// A held Response is used until OnClose() is called for its connection, so
+// that must happen before the connection goes away.
+//
+// Not thread safe. Everything except the settings observer runs on
+// |event_manager|'s task.
+template <typename Response>
+class SettingsHandler {
+ public:
+  // Each held request keeps its connection and a Mongoose send buffer.
+  static constexpr size_t kMaxWaiters = 4;
+  static constexpr int kMaxWaitS = 60;
+
+  // |epoch| should differ between boots since the generations restart
+  // from 0.
+  SettingsHandler(Controller* controller, esp_cxx::EventManager* event_manager,
+                  uint32_t epoch);
+  ~SettingsHandler();
+
+  // |wait_s| is from ?wait_for_change=S. A negative wait gets a 400.
+  void Get(std::optional<std::string_view> if_none_match, std::optional<long> wait_s,
+           Response response);
+  void Put(std::string_view body, Response response);
+
+  // The connection |response| came from closed. Forgets it without replying
+  // if it was held.
+  void OnClose(const Response& response);
+
+  size_t num_waiters() const {
+    return std::count_if(waiters_.begin(), waiters_.end(),
+                         [](const auto& waiter) { return waiter.has_value(); });
+  }
+
+ private:
+  FRIEND_TEST(SettingsHandlerTest, WaitTimesOut);
+
+  static constexpr char kTag[] = "api";
+  static constexpr char kSettingsHeadersFormat[] =
+      "Content-Type: application/json\r\nCache-Control: no-cache\r\nETag: %s";
+  static constexpr char kNotModifiedHeadersFormat[] = "Cache-Control: no-cache\r\nETag: %s";
+
+  struct Waiter {
+    Waiter(Response response, uint32_t id) : response(response), id(id) {}
+
+    Response response;
+    uint32_t id;
+
+    // Answered once the current ETag differs from |etag|, which is the
+    // client's If-None-Match if |has_if_none_match|.
+    char etag[kMaxETagSize + 1] = {};
+    bool has_if_none_match = false;
+  };
+
+  // Writes the ETag for the current generations into |etag|.
+  std::string_view CurrentETag(char (&etag)[kMaxETagSize + 1]) const;
+
+  // Replies 304 if |if_none_match| lists the current ETag and with the
+  // settings otherwise.
+  void Reply(std::optional<std::string_view> if_none_match, Response* response);
+  void SendSettings(Response* response);
+
+  // Answers the waiters whose ETag is stale.
+  void OnSettingsChange();
+  void OnWaitExpired(uint32_t id);
+
+  Controller* controller_;
+  esp_cxx::EventManager* event_manager_;
+  const uint32_t epoch_;
+  Controller::ObserverId observer_id_;
+
+  std::array<std::optional<Waiter>, kMaxWaiters> waiters_;
+  uint32_t next_waiter_id_ = 0;
+  std::array<char, kMaxSettingsJsonSize> buf_;
+};
+
+template <typename Response>
+SettingsHandler<Response>::SettingsHandler(Controller* controller,
+                                           esp_cxx::EventManager* event_manager,
+                                           uint32_t epoch)
+  : controller_(controller),
+    event_manager_(event_manager),
+    epoch_(epoch) {
+  // Runs on whichever task changed the settings.
+  observer_id_ = controller_->AddSettingsObserver([this](const SettingsChange&) {
+    event_manager_->Run([this] { OnSettingsChange(); });
+  });
+}
+
+template <typename Response>
+SettingsHandler<Response>::~SettingsHandler() {
+  controller_->RemoveSettingsObserver(observer_id_);
+}
+
+template <typename Response>
+void SettingsHandler<Response>::Get(std::optional<std::string_view> if_none_match,
+                                    std::optional<long> wait_s, Response response) {
+  if (wait_s && *wait_s < 0) {
+    response.SendError(400, "Bad wait_for_change");
+    return;
+  }
+
+  char etag_buf[kMaxETagSize + 1];
+  std::string_view etag = CurrentETag(etag_buf);
+  bool is_current = !if_none_match || IfNoneMatchMatches(*if_none_match, etag);
+  if (!wait_s || *wait_s == 0 || !is_current) {
+    Reply(if_none_match, &response);
+    return;
+  }
+
+  for (auto& waiter : waiters_) {
+    if (waiter) {
+      continue;
+    }
+    uint32_t id = next_waiter_id_++;
+    waiter.emplace(response, id);
+    // The current ETag stands in for the client's, which it matches, so a
+    // list of tags need not be kept.
+    etag.copy(waiter->etag, kMaxETagSize);
+    waiter->has_if_none_match = if_none_match.has_value();
+    int wait_ms = std::min<long>(*wait_s, kMaxWaitS) * 1000;
+    event_manager_->RunDelayed([this, id] { OnWaitExpired(id); }, wait_ms);
+    return;
+  }
+  ESP_LOGW(kTag, "%zu /api/settings requests already waiting", kMaxWaiters);
+  Reply(if_none_match, &response);
+}
+
+template <typename Response>
+void SettingsHandler<Response>::Put(std::string_view body, Response response) {
+  StoredHvacSettings update;
+  StoredExtendedSettings extended_update;
+  if (!ParseSettingsJson(body, &update, &extended_update)) {
+    response.SendError(400, "Invalid settings");
+    return;
+  }
+  if (update.present_fields()) {
+    controller_->MergeSettings(update);
+  }
+  if (extended_update.present_fields()) {
+    controller_->MergeExtendedSettings(extended_update);
+  }
+  SendSettings(&response);
+}
+
+template <typename Response>
+void SettingsHandler<Response>::OnClose(const Response& response) {
+  for (auto& waiter : waiters_) {
+    if (waiter && waiter->response == response) {
+      // The expiry timer finds no waiter with this id and does nothing.
+      waiter.reset();
+    }
+  }
+}
+
+template <typename Response>
+std::string_view SettingsHandler<Response>::CurrentETag(
+    char (&etag)[kMaxETagSize + 1]) const {
+  return std::string_view(
+      etag, FormatGenerationETag(epoch_, controller_->settings_generation(),
+                                 controller_->extended_settings_generation(), etag));
+}
+
+template <typename Response>
+void SettingsHandler<Response>::Reply(std::optional<std::string_view> if_none_match,
+                                      Response* response) {
+  char etag_buf[kMaxETagSize + 1];
+  std::string_view etag = CurrentETag(etag_buf);
+  if (!if_none_match || !IfNoneMatchMatches(*if_none_match, etag)) {
+    SendSettings(response);
+    return;
+  }
+  // Only the generations were read. Nothing is serialized.
+  char headers[sizeof(kNotModifiedHeadersFormat) + kMaxETagSize];
+  snprintf(headers, sizeof(headers), kNotModifiedHeadersFormat, etag_buf);
+  response->Send(304, 0, headers, {});
+}
+
+template <typename Response>
+void SettingsHandler<Response>::SendSettings(Response* response) {
+  // Generations are read first so a change racing with the copies is seen
+  // as newer by the next request rather than missed.
+  uint32_t generation = controller_->settings_generation();
+  uint32_t extended_generation = controller_->extended_settings_generation();
+  size_t len = WriteSettingsJson(controller_->GetSettings(), generation,
+                                 controller_->GetExtendedSettings(), extended_generation,
+                                 buf_.data(), buf_.size());
+  if (!len) {
+    response->SendError(500, nullptr);
+    return;
+  }
+
+  char etag[kMaxETagSize + 1];
+  FormatGenerationETag(epoch_, generation, extended_generation, etag);
+  char headers[sizeof(kSettingsHeadersFormat) + kMaxETagSize];
+  snprintf(headers, sizeof(headers), kSettingsHeadersFormat, etag);
+  response->Send(200, len, headers, std::string_view(buf_.data(), len));
+}
+
+template <typename Response>
+void SettingsHandler<Response>::OnSettingsChange() {
+  char etag_buf[kMaxETagSize + 1];
+  std::string_view etag = CurrentETag(etag_buf);
+  for (auto& waiter : waiters_) {
+    if (waiter && etag != waiter->etag) {
+      SendSettings(&waiter->response);
+      waiter.reset();
+    }
+  }
+}
+
+template <typename Response>
+void SettingsHandler<Response>::OnWaitExpired(uint32_t id) {
+  for (auto& waiter : waiters_) {
+    if (waiter && waiter->id == id) {
+      if (waiter->has_if_none_match) {
+        Reply(std::string_view(waiter->etag), &waiter->response);
+      } else {
+        SendSettings(&waiter->response);
+      }
+      waiter.reset();
+      return;
+    }
+  }
+}
+
+}  // namespace hackvac
+
+#endif  // SETTINGS_HANDLER_H_
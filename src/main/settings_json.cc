@@ -0,0 +1,152 @@
+#include "settings_json.h"
+
+#include <optional>
+
+#include "json_stream.h"
+
+namespace hackvac {
+
+namespace {
+
+using Token = JsonScanner::Token;
+
+template <typename Schema>
+void WriteFields(const SettingsView<Schema>& view, JsonWriter* writer) {
+  writer->BeginObject();
+  view.ForEachPresentField([&](const char* name, SettingsField, int value, int json_scale) {
+    writer->Key(name);
+    writer->Scaled(value, json_scale);
+  });
+  writer->EndObject();
+}
+
+// Converts a JSON number such as "22.5" to units of 1 / |scale|. The
+// scanner has already checked the syntax.
+std::optional<int> ParseScaled(std::string_view number, int scale) {
+  // Exponents are valid JSON but nothing sensible needs them here.
+  if (number[0] == '-' || number.find_first_of("eE") != std::string_view::npos) {
+    return {};
+  }
+  size_t point = number.find('.');
+  std::string_view whole = number.substr(0, point);
+  std::string_view fraction =
+      point == std::string_view::npos ? std::string_view() : number.substr(point + 1);
+  if (whole.size() > 3) {
+    return {};
+  }
+
+  int value = 0;
+  for (char c : whole) {
+    value = value * 10 + (c - '0');
+  }
+  value *= scale;
+  if (scale == 2 && !fraction.empty() && fraction[0] == '5') {
+    value += 1;
+    fraction.remove_prefix(1);
+  }
+  // Trailing zeros are fine so 21.0 and 22.50 parse.
+  for (char c : fraction) {
+    if (c != '0') {
+      return {};
+    }
+  }
+  if (value > 0xff) {
+    return {};
+  }
+  return value;
+}
+
+// Walks the members of an object whose '{' has been consumed, calling
+// |parse_value(key)| to consume each value. Returns false at the first
+// syntax error or if |parse_value| does.
+template <typename ParseValue>
+bool ParseMembers(JsonScanner* scanner, ParseValue&& parse_value) {
+  Token token = scanner->Next();
+  if (token == Token::kEndObject) {
+    return true;
+  }
+  while (token == Token::kString) {
+    std::string_view key = scanner->text();
+    if (scanner->Expect(Token::kColon) == Token::kError || !parse_value(key)) {
+      return false;
+    }
+    token = scanner->Next();
+    if (token == Token::kEndObject) {
+      return true;
+    }
+    if (token != Token::kComma) {
+      return false;
+    }
+    token = scanner->Next();
+  }
+  return false;
+}
+
+template <typename Schema>
+bool ParseFields(JsonScanner* scanner, const SettingsView<Schema>& view) {
+  if (scanner->Next() != Token::kBeginObject) {
+    return false;
+  }
+  return ParseMembers(scanner, [&](std::string_view key) {
+    if (scanner->Next() != Token::kNumber) {
+      return false;
+    }
+    bool is_set = false;
+    Schema::ForEach([&](auto descriptor) {
+      using Field = decltype(descriptor);
+      if (key != Field::kName) {
+        return;
+      }
+      // Out of range values are rejected rather than clamped or stored
+      // as enum values the unit does not know.
+      auto value = ParseScaled(scanner->text(), Field::kJsonScale);
+      if (value && Field::IsValidInt(value.value())) {
+        view.template SetField<Field>(Field::FromInt(value.value()));
+        is_set = true;
+      }
+    });
+    return is_set;
+  });
+}
+
+}  // namespace
+
+size_t WriteSettingsJson(const HvacSettings& settings, uint32_t generation,
+                         const ExtendedSettings& extended, uint32_t extended_generation,
+                         char* buf, size_t size) {
+  JsonWriter writer(buf, size);
+  writer.BeginObject();
+  writer.Key("settings");
+  WriteFields(settings, &writer);
+  writer.Key("extended");
+  WriteFields(extended, &writer);
+  writer.Key("generation");
+  writer.Int(generation);
+  writer.Key("extended_generation");
+  writer.Int(extended_generation);
+  writer.EndObject();
+  return writer.ok() ? writer.text().size() : 0;
+}
+
+bool ParseSettingsJson(std::string_view json, HvacSettings* settings,
+                       ExtendedSettings* extended) {
+  JsonScanner scanner(json);
+  if (scanner.Next() != Token::kBeginObject) {
+    return false;
+  }
+  bool is_valid = ParseMembers(&scanner, [&](std::string_view key) {
+    if (key == "settings") {
+      return ParseFields(&scanner, *settings);
+    }
+    if (key == "extended") {
+      return ParseFields(&scanner, *extended);
+    }
+    if (key == "generation" || key == "extended_generation") {
+      return scanner.Next() == Token::kNumber;
+    }
+    return false;
+  });
+  return is_valid && scanner.Next() == Token::kEnd;
+}
+
+}  // namespace hackvac
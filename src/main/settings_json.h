@@ -0,0 +1,48 @@
+#ifndef SETTINGS_JSON_H_
+#define SETTINGS_JSON_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "hvac_settings.h"
+
+// JSON form of the settings used by /api/settings:
+//
+//   {"settings":{"power":1, "mode":3, "temp":22.5, "fan":0, "vane":0,
+//                "wide_vane":3},
+//    "extended":{"room_temp":21},
+//    "generation":12, "extended_generation":4}
+//
+// Only present fields are listed. Enum fields are their wire values and
+// temperatures are in degrees celcius to the half degree. The generations
+// are Controller::settings_generation() and extended_settings_generation().
+//
+// Serializing writes straight into a caller's buffer and parsing tokenizes
+// the request body in place, so neither allocates.
+
+namespace hackvac {
+
+// Enough for every field of both settings with room to spare.
+constexpr size_t kMaxSettingsJsonSize = 256;
+
+// Writes the document above into |buf|. Returns the length written, or 0
+// if |size| is too small.
+size_t WriteSettingsJson(const HvacSettings& settings, uint32_t generation,
+                         const ExtendedSettings& extended, uint32_t extended_generation,
+                         char* buf, size_t size);
+
+// Parses a document of the same shape into |settings| and |extended|,
+// setting only the fields it lists. Either object may be omitted and the
+// generations are ignored so a GET can be edited and sent back.
+//
+// Returns false, possibly having set some fields, if |json| is malformed,
+// names an unknown field, or has a value the field cannot hold: a number
+// that is not one of an enum's values, or a temperature outside the
+// field's kMin to kMax or not a whole or half degree.
+bool ParseSettingsJson(std::string_view json, HvacSettings* settings,
+                       ExtendedSettings* extended);
+
+}  // namespace hackvac
+
+#endif  // SETTINGS_JSON_H_
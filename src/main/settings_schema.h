@@ -0,0 +1,323 @@
+#ifndef SETTINGS_SCHEMA_H_
+#define SETTINGS_SCHEMA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+#include "esp_cxx/cxx17hack.h"
+
+// Compile-time description of the fields packed into a CN105 settings
+// payload and the generic accessors built from it.
+//
+// Each field is a descriptor type with
+//
+//   using Type = ...;                     // Value type of the field.
+//   static constexpr SettingsField kField;
+//   static constexpr size_t kFlagPos;     // Data byte holding the flag bit.
+//   static constexpr uint8_t kFlagMask;   // Flag bit within that byte.
+//   static constexpr char kName[];        // JSON/API name.
+//   static constexpr int kJsonScale;      // 1, or 2 for half-degree temps.
+//   static Type Decode(const uint8_t* data);
+//   static void Encode(uint8_t* data, Type value);
+//   static void Clear(uint8_t* data);     // Zeros the value bytes.
+//   static int ToInt(Type value);         // Fits in a uint8_t.
+//   static Type FromInt(int value);
+//   static bool IsValidInt(int value);    // A value the unit accepts.
+//
+// A schema is a FieldList of descriptors. SettingsView<Schema> then gives
+// Get/Set/Diff/Merge/equality and JSON and binary serialization with every
+// loop over the fields unrolled by the compiler.
+
+namespace hackvac {
+
+// Identifies individual fields across HvacSettings and ExtendedSettings.
+// Values are bits so a set of changed fields can be passed around as a
+// single SettingsFieldMask.
+enum class SettingsField : uint16_t {
+  kPower = 0x0001,
+  kMode = 0x0002,
+  kTargetTemp = 0x0004,
+  kFan = 0x0008,
+  kVane = 0x0010,
+  kWideVane = 0x0020,
+  kRoomTemp = 0x0040,
+};
+
+using SettingsFieldMask = uint16_t;
+
+constexpr SettingsFieldMask ToMask(SettingsField field) {
+  return static_cast<SettingsFieldMask>(field);
+}
+
+constexpr bool HasField(SettingsFieldMask mask, SettingsField field) {
+  return (mask & ToMask(field)) != 0;
+}
+
+// Number of SettingsFields. FieldIndex() maps each to [0, kNumSettingsFields)
+// for use in per-field arrays.
+constexpr size_t kNumSettingsFields = 7;
+
+constexpr size_t FieldIndex(SettingsField field) {
+  return __builtin_ctz(ToMask(field));
+}
+
+namespace schema {
+
+// A field stored as the single byte wire value of enum |T|. |kValues| are
+// the values of |T| that are valid on the wire.
+template <typename T, SettingsField kId, size_t kFlagByte, uint8_t kFlagBit,
+          size_t kDataPos, T... kValues>
+struct EnumField {
+  using Type = T;
+  static constexpr SettingsField kField = kId;
+  static constexpr size_t kFlagPos = kFlagByte;
+  static constexpr uint8_t kFlagMask = kFlagBit;
+  static constexpr int kJsonScale = 1;
+
+  static T Decode(const uint8_t* data) { return static_cast<T>(data[kDataPos]); }
+  static void Encode(uint8_t* data, T value) { data[kDataPos] = static_cast<uint8_t>(value); }
+  static void Clear(uint8_t* data) { data[kDataPos] = 0x00; }
+  static int ToInt(T value) { return static_cast<uint8_t>(value); }
+  static T FromInt(int value) { return static_cast<T>(value); }
+  static bool IsValidInt(int value) {
+    return ((value == static_cast<int>(kValues)) || ...);
+  }
+};
+
+template <typename... Fields>
+struct FieldList {
+  static constexpr size_t kSize = sizeof...(Fields);
+
+  // Calls |visitor| with a default constructed instance of each descriptor.
+  template <typename Visitor>
+  static void ForEach(Visitor&& visitor) {
+    (visitor(Fields()), ...);
+  }
+};
+
+// Finds the descriptor in |Fields| whose Type is |T|.
+template <typename T, typename... Fields>
+struct FindByType {
+  using type = void;
+};
+
+template <typename T, typename First, typename... Rest>
+struct FindByType<T, First, Rest...> {
+  using type = std::conditional_t<std::is_same<typename First::Type, T>::value,
+                                  First, typename FindByType<T, Rest...>::type>;
+};
+
+template <typename T, typename List> struct FieldForType;
+template <typename T, typename... Fields>
+struct FieldForType<T, FieldList<Fields...>> {
+  using type = typename FindByType<T, Fields...>::type;
+  static_assert(!std::is_void<type>::value, "No field of this type in schema");
+};
+
+}  // namespace schema
+
+// Accessors over a 16 byte settings payload laid out by |Schema|. Does not
+// own the bytes.
+template <typename Schema>
+class SettingsView {
+ public:
+  // Bytes needed by Serialize(): the field mask then one byte per field.
+  static constexpr size_t kMaxSerializedSize = 2 + Schema::kSize;
+
+  explicit SettingsView(uint8_t* raw_data) : data_ptr_(raw_data) {}
+
+  template <typename Field>
+  std::optional<typename Field::Type> GetField() const {
+    if (!(data_ptr_[Field::kFlagPos] & Field::kFlagMask)) {
+      return {};
+    }
+    return Field::Decode(data_ptr_);
+  }
+
+  template <typename Field>
+  void SetField(std::optional<typename Field::Type> value) const {
+    if (value) {
+      data_ptr_[Field::kFlagPos] |= Field::kFlagMask;
+      Field::Encode(data_ptr_, value.value());
+    } else {
+      data_ptr_[Field::kFlagPos] &= ~Field::kFlagMask;
+      Field::Clear(data_ptr_);
+    }
+  }
+
+  const uint8_t* data_pointer() const { return data_ptr_; }
+
+  // Sets every field's flag bit, keeping the value bytes. For payloads such
+  // as InfoAcks that carry every field but leave the flag bytes zero.
+  void MarkAllPresent() const {
+    Schema::ForEach([&](auto field) {
+      using Field = decltype(field);
+      data_ptr_[Field::kFlagPos] |= Field::kFlagMask;
+    });
+  }
+
+  // Returns the set of fields whose flag bit is set.
+  SettingsFieldMask present_fields() const {
+    SettingsFieldMask present = 0;
+    Schema::ForEach([&](auto field) {
+      using Field = decltype(field);
+      if (data_ptr_[Field::kFlagPos] & Field::kFlagMask) {
+        present |= ToMask(Field::kField);
+      }
+    });
+    return present;
+  }
+
+  // Returns the set of fields whose value differs from |other|. A field
+  // that is set in one and unset in the other counts as different.
+  SettingsFieldMask Diff(const SettingsView& other) const {
+    SettingsFieldMask changed = 0;
+    Schema::ForEach([&](auto field) {
+      using Field = decltype(field);
+      if (this->template GetField<Field>() != other.template GetField<Field>()) {
+        changed |= ToMask(Field::kField);
+      }
+    });
+    return changed;
+  }
+
+  // Copies the fields in |mask| from |from|, including unsetting those that
+  // |from| does not have.
+  SettingsView& CopyFields(const SettingsView& from, SettingsFieldMask mask) {
+    Schema::ForEach([&](auto field) {
+      using Field = decltype(field);
+      if (HasField(mask, Field::kField)) {
+        this->template SetField<Field>(from.template GetField<Field>());
+      }
+    });
+    return *this;
+  }
+
+  // Overwrites the fields that |update| has.
+  SettingsView& MergeUpdate(const SettingsView& update) {
+    return CopyFields(update, update.present_fields());
+  }
+
+  // Equal if the same fields are present with the same values. Bytes of
+  // absent fields are ignored.
+  bool operator==(const SettingsView& other) const { return Diff(other) == 0; }
+  bool operator!=(const SettingsView& other) const { return !(*this == other); }
+
+  // Sets |field| from its integer form. Returns false if |field| is not in
+  // this schema.
+  bool SetFieldFromInt(SettingsField field, int value) const {
+    bool found = false;
+    Schema::ForEach([&](auto descriptor) {
+      using Field = decltype(descriptor);
+      if (Field::kField == field) {
+        this->template SetField<Field>(Field::FromInt(value));
+        found = true;
+      }
+    });
+    return found;
+  }
+
+  // True if |field| is in this schema and |value| is a valid integer form
+  // for it.
+  static bool IsValidFieldInt(SettingsField field, int value) {
+    bool valid = false;
+    Schema::ForEach([&](auto descriptor) {
+      using Field = decltype(descriptor);
+      if (Field::kField == field) {
+        valid = Field::IsValidInt(value);
+      }
+    });
+    return valid;
+  }
+
+  // Calls |visitor(name, field, int_value, json_scale)| for each present
+  // field in schema order.
+  template <typename Visitor>
+  void ForEachPresentField(Visitor&& visitor) const {
+    Schema::ForEach([&](auto descriptor) {
+      using Field = decltype(descriptor);
+      if (auto value = this->template GetField<Field>()) {
+        visitor(Field::kName, Field::kField, Field::ToInt(value.value()),
+                Field::kJsonScale);
+      }
+    });
+  }
+
+  // Writes the present fields as a JSON object like {"power":1,"temp":22.5}
+  // into |buf|. Returns the length that would have been written, like
+  // snprintf, so a return >= |size| means |buf| was too small.
+  size_t WriteJson(char* buf, size_t size) const {
+    size_t len = 0;
+    auto append = [&](const char* format, auto... args) {
+      int n = snprintf(len < size ? buf + len : nullptr,
+                       len < size ? size - len : 0, format, args...);
+      len += n > 0 ? n : 0;
+    };
+    append("{");
+    bool first = true;
+    ForEachPresentField([&](const char* name, SettingsField, int value, int scale) {
+      append(first ? "\"%s\":%d" : ",\"%s\":%d", name, value / scale);
+      if (value % scale) {
+        append(".5");
+      }
+      first = false;
+    });
+    append("}");
+    return len;
+  }
+
+  // Packs the present fields into |out| as a little-endian field mask
+  // followed by each field's ToInt() byte in schema order. Returns the
+  // number of bytes written or 0 if |size| is too small.
+  size_t Serialize(uint8_t* out, size_t size) const {
+    if (size < kMaxSerializedSize) {
+      return 0;
+    }
+    SettingsFieldMask present = present_fields();
+    out[0] = present & 0xff;
+    out[1] = present >> 8;
+    size_t len = 2;
+    ForEachPresentField([&](const char*, SettingsField, int value, int) {
+      out[len++] = static_cast<uint8_t>(value);
+    });
+    return len;
+  }
+
+  // Inverse of Serialize(). Fields not in the serialized mask are cleared.
+  // Returns false, leaving the settings untouched, if |in| is malformed.
+  bool Deserialize(const uint8_t* in, size_t size) const {
+    if (size < 2) {
+      return false;
+    }
+    SettingsFieldMask present = in[0] | (in[1] << 8);
+    size_t needed = 2;
+    Schema::ForEach([&](auto field) {
+      needed += HasField(present, decltype(field)::kField) ? 1 : 0;
+    });
+    if (size != needed) {
+      return false;
+    }
+
+    size_t pos = 2;
+    Schema::ForEach([&](auto field) {
+      using Field = decltype(field);
+      if (HasField(present, Field::kField)) {
+        this->template SetField<Field>(Field::FromInt(in[pos++]));
+      } else {
+        this->template SetField<Field>(std::optional<typename Field::Type>());
+      }
+    });
+    return true;
+  }
+
+ protected:
+  void set_data_pointer(uint8_t* ptr) { data_ptr_ = ptr; }
+
+  uint8_t* data_ptr_ = nullptr;
+};
+
+}  // namespace hackvac
+
+#endif  // SETTINGS_SCHEMA_H_
@@ -0,0 +1,120 @@
+#include "settings_store.h"
+
+#include "esp_cxx/logging.h"
+
+#ifndef FAKE_ESP_IDF
+#include "nvs.h"
+#endif
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "store";
+
+#ifndef FAKE_ESP_IDF
+constexpr char kNvsNamespace[] = "hackvac";
+constexpr char kNvsKey[] = "settings";
+#endif
+
+template <typename Settings>
+void EncodeSettings(const Settings& settings, std::vector<uint8_t>* blob) {
+  uint8_t buf[Settings::kMaxSerializedSize];
+  size_t len = settings.Serialize(buf, sizeof(buf));
+  blob->push_back(len);
+  blob->insert(blob->end(), buf, buf + len);
+}
+
+template <typename Settings>
+bool DecodeSettings(const uint8_t** pos, const uint8_t* end, Settings* settings) {
+  if (*pos >= end) {
+    return false;
+  }
+  size_t len = **pos;
+  ++*pos;
+  if (static_cast<size_t>(end - *pos) < len ||
+      !settings->Deserialize(*pos, len)) {
+    return false;
+  }
+  *pos += len;
+  return true;
+}
+
+}  // namespace
+
+constexpr uint8_t SettingsStore::kVersion;
+
+SettingsStore::SettingsStore() = default;
+SettingsStore::~SettingsStore() = default;
+
+std::vector<uint8_t> SettingsStore::Encode(const Contents& contents) {
+  std::vector<uint8_t> blob;
+  blob.push_back(kVersion);
+  EncodeSettings(contents.desired, &blob);
+  EncodeSettings(contents.reported, &blob);
+  return blob;
+}
+
+bool SettingsStore::Decode(const uint8_t* blob, size_t size, Contents* contents) {
+  if (size < 1 || blob[0] != kVersion) {
+    return false;
+  }
+
+  // Decode into a scratch copy so a bad blob leaves |contents| alone.
+  Contents decoded;
+  const uint8_t* pos = blob + 1;
+  const uint8_t* end = blob + size;
+  if (!DecodeSettings(&pos, end, &decoded.desired) ||
+      !DecodeSettings(&pos, end, &decoded.reported) ||
+      pos != end) {
+    return false;
+  }
+  *contents = decoded;
+  return true;
+}
+
+bool SettingsStore::Load(Contents* contents) {
+#ifndef FAKE_ESP_IDF
+  nvs_handle handle;
+  if (nvs_open(kNvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+  uint8_t blob[64];
+  size_t size = sizeof(blob);
+  esp_err_t err = nvs_get_blob(handle, kNvsKey, blob, &size);
+  nvs_close(handle);
+  if (err != ESP_OK) {
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+      ESP_LOGW(kTag, "settings read failed: %d", err);
+    }
+    return false;
+  }
+  return Decode(blob, size, contents);
+#else
+  return Decode(fake_blob_.data(), fake_blob_.size(), contents);
+#endif
+}
+
+bool SettingsStore::Save(const Contents& contents) {
+  std::vector<uint8_t> blob = Encode(contents);
+#ifndef FAKE_ESP_IDF
+  nvs_handle handle;
+  esp_err_t err = nvs_open(kNvsNamespace, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, kNvsKey, blob.data(), blob.size());
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(kTag, "settings write failed: %d", err);
+    return false;
+  }
+#else
+  fake_blob_ = std::move(blob);
+#endif
+  return true;
+}
+
+}  // namespace hackvac
@@ -0,0 +1,51 @@
+#ifndef SETTINGS_STORE_H_
+#define SETTINGS_STORE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "hvac_settings.h"
+
+#include "esp_cxx/test.h"
+
+namespace hackvac {
+
+// Persists the Controller's settings across reboots so the thermostat and
+// HTTP clients can be answered before the heat pump has been queried.
+//
+// On device the contents are a single blob in the "hackvac" NVS namespace.
+// NVS already spreads writes across its pages; callers are still expected
+// to coalesce so a burst of changes costs one write. See
+// Controller::SchedulePersist(). Host builds keep the blob in memory.
+class SettingsStore {
+ public:
+  struct Contents {
+    StoredHvacSettings desired;
+    StoredHvacSettings reported;
+  };
+
+  SettingsStore();
+  ESPCXX_MOCKABLE ~SettingsStore();
+
+  // Reads the stored contents. Returns false if nothing valid is stored.
+  ESPCXX_MOCKABLE bool Load(Contents* contents);
+
+  // Writes |contents|. Returns false on a flash error.
+  ESPCXX_MOCKABLE bool Save(const Contents& contents);
+
+  // Blob format: a version byte then, for each of desired and reported, a
+  // length byte and that settings' Serialize() output.
+  static std::vector<uint8_t> Encode(const Contents& contents);
+  static bool Decode(const uint8_t* blob, size_t size, Contents* contents);
+
+ private:
+  static constexpr uint8_t kVersion = 1;
+
+#ifdef FAKE_ESP_IDF
+  std::vector<uint8_t> fake_blob_;
+#endif
+};
+
+}  // namespace hackvac
+
+#endif  // SETTINGS_STORE_H_
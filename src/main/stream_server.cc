@@ -0,0 +1,160 @@
+#include "stream_server.h"
+
+#include <algorithm>
+
+#include "esp_cxx/logging.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "stream";
+
+}  // namespace
+
+constexpr int StreamServer::kPollIntervalMs;
+
+std::optional<std::string_view> StreamServer::Request::header(const char* name) const {
+  mg_str* value = mg_get_http_header(message_, name);
+  if (!value) {
+    return {};
+  }
+  return ToStringView(*value);
+}
+
+void StreamServer::Connection::Send(int status, size_t size, const char* headers,
+                                    std::string_view body) {
+  mg_send_head(connection_, status, size, headers);
+  mg_send(connection_, body.data(), body.size());
+}
+
+void StreamServer::Connection::SendError(int status, const char* message) {
+  mg_http_send_error(connection_, status, message);
+}
+
+void StreamServer::Connection::SendText(std::string_view text) {
+  mg_send_websocket_frame(connection_, WEBSOCKET_OP_TEXT, text.data(), text.size());
+}
+
+void StreamServer::Connection::SendBinary(const uint8_t* data, size_t size) {
+  mg_send_websocket_frame(connection_, WEBSOCKET_OP_BINARY, data, size);
+}
+
+void StreamServer::Connection::Close() {
+  if (connection_->flags & MG_F_IS_WEBSOCKET) {
+    mg_send_websocket_frame(connection_, WEBSOCKET_OP_CLOSE, nullptr, 0);
+  }
+  connection_->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+void StreamServer::Endpoint::OnHttp(const Request&, Connection connection) {
+  connection.SendError(404);
+}
+
+StreamServer::StreamServer(esp_cxx::EventManager* event_manager, const char* address)
+  : event_manager_(event_manager) {
+  mg_mgr_init(&manager_, nullptr);
+  mg_connection* listener = mg_bind(&manager_, address, &StreamServer::OnEvent, this);
+  if (!listener) {
+    ESP_LOGE(kTag, "Cannot listen on %s", address);
+    return;
+  }
+  mg_set_protocol_http_websocket(listener);
+  event_manager_->RunDelayed([this] { Poll(); }, kPollIntervalMs);
+}
+
+StreamServer::~StreamServer() {
+  mg_mgr_free(&manager_);
+}
+
+void StreamServer::RegisterEndpoint(const char* path, Endpoint* endpoint) {
+  endpoints_.emplace_back(path, endpoint);
+}
+
+void StreamServer::OnEvent(mg_connection* connection, int event, void* event_data,
+                           void* user_data) {
+  static_cast<StreamServer*>(user_data)->HandleEvent(connection, event, event_data);
+}
+
+void StreamServer::HandleEvent(mg_connection* connection, int event, void* event_data) {
+  switch (event) {
+    case MG_EV_HTTP_REQUEST: {
+      auto* message = static_cast<http_message*>(event_data);
+      Endpoint* endpoint = FindEndpoint(message->uri);
+      if (!endpoint) {
+        mg_http_send_error(connection, 404, nullptr);
+        break;
+      }
+      Bind(connection, endpoint);
+      endpoint->OnHttp(Request(message), Connection(connection));
+      break;
+    }
+
+    case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST: {
+      // Refusing here, by replying, keeps Mongoose from upgrading.
+      auto* message = static_cast<http_message*>(event_data);
+      Endpoint* endpoint = FindEndpoint(message->uri);
+      if (!endpoint) {
+        mg_http_send_error(connection, 404, nullptr);
+        connection->flags |= MG_F_SEND_AND_CLOSE;
+        break;
+      }
+      Bind(connection, endpoint);
+      break;
+    }
+
+    case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
+      if (Endpoint* endpoint = BoundEndpoint(connection)) {
+        endpoint->OnWebsocketConnect(Connection(connection));
+      }
+      break;
+
+    case MG_EV_CLOSE: {
+      // Unbound first so an endpoint cannot see the connection again.
+      auto closed = std::stable_partition(
+          bound_.begin(), bound_.end(),
+          [=](const auto& entry) { return entry.first != connection; });
+      std::vector<std::pair<mg_connection*, Endpoint*>> endpoints(closed, bound_.end());
+      bound_.erase(closed, bound_.end());
+      for (const auto& entry : endpoints) {
+        entry.second->OnClose(Connection(connection));
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+StreamServer::Endpoint* StreamServer::FindEndpoint(const mg_str& uri) const {
+  for (const auto& entry : endpoints_) {
+    if (entry.first == ToStringView(uri)) {
+      return entry.second;
+    }
+  }
+  return nullptr;
+}
+
+void StreamServer::Bind(mg_connection* connection, Endpoint* endpoint) {
+  auto entry = std::make_pair(connection, endpoint);
+  if (std::find(bound_.begin(), bound_.end(), entry) == bound_.end()) {
+    bound_.push_back(entry);
+  }
+}
+
+StreamServer::Endpoint* StreamServer::BoundEndpoint(mg_connection* connection) const {
+  for (auto it = bound_.rbegin(); it != bound_.rend(); ++it) {
+    if (it->first == connection) {
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
+void StreamServer::Poll() {
+  mg_mgr_poll(&manager_, 0);
+  event_manager_->RunDelayed([this] { Poll(); }, kPollIntervalMs);
+}
+
+}  // namespace hackvac
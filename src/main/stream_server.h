@@ -0,0 +1,130 @@
+#ifndef STREAM_SERVER_H_
+#define STREAM_SERVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mongoose.h"
+
+#include "esp_cxx/event_manager.h"
+
+namespace hackvac {
+
+// A small HTTP server, directly on Mongoose, for endpoints that keep their
+// connections open: websockets that are pushed to from timers and requests
+// that are answered later. The pinned esp_cxx HttpServer only lends an
+// endpoint its connection for the length of one OnHttp() call and does not
+// say when it closes, so these live here, on their own port, beside it.
+//
+// Owns a Mongoose manager that |event_manager| polls every
+// kPollIntervalMs. Endpoints are matched on the exact path. Everything,
+// including every Endpoint callback, runs on |event_manager|'s task, and
+// the server must outlive that task's loop.
+class StreamServer {
+ public:
+  static constexpr int kPollIntervalMs = 10;
+
+  // A parsed HTTP request. Only valid during OnHttp().
+  class Request {
+   public:
+    explicit Request(http_message* message) : message_(message) {}
+
+    std::string_view method() const { return ToStringView(message_->method); }
+    std::string_view query_string() const { return ToStringView(message_->query_string); }
+    std::string_view body() const { return ToStringView(message_->body); }
+
+    // Value of the header |name|, matched case insensitively.
+    std::optional<std::string_view> header(const char* name) const;
+
+   private:
+    http_message* message_;
+  };
+
+  // Handle to an open connection. Copyable and compared by connection. Only
+  // usable on the network task until the Endpoint's OnClose() for it
+  // returns. A request may be answered any time before then.
+  class Connection {
+   public:
+    explicit Connection(mg_connection* connection) : connection_(connection) {}
+
+    // Replies to the current HTTP request. |headers| is "Name: value" lines
+    // separated by CRLF, without a trailing one, or null.
+    void Send(int status, size_t size, const char* headers, std::string_view body);
+    void SendError(int status, const char* message = nullptr);
+
+    // Queues one websocket text or binary frame.
+    void SendText(std::string_view text);
+    void SendBinary(const uint8_t* data, size_t size);
+
+    // Bytes still waiting in the Mongoose send buffer.
+    size_t pending_bytes() const { return connection_->send_mbuf.len; }
+
+    // Closes once what is queued has been sent. OnClose() follows.
+    void Close();
+
+    bool operator==(const Connection& other) const {
+      return connection_ == other.connection_;
+    }
+    bool operator!=(const Connection& other) const { return !(*this == other); }
+
+   private:
+    mg_connection* connection_;
+  };
+
+  class Endpoint {
+   public:
+    virtual ~Endpoint() = default;
+
+    // An HTTP request for this endpoint's path. Unless overridden, 404.
+    virtual void OnHttp(const Request& request, Connection connection);
+
+    // A websocket handshake on this endpoint's path completed.
+    virtual void OnWebsocketConnect(Connection) {}
+
+    // A connection this endpoint was handed is about to be freed.
+    virtual void OnClose(Connection) {}
+  };
+
+  // Listens on |address|, eg ":8081", if it can be bound.
+  StreamServer(esp_cxx::EventManager* event_manager, const char* address);
+  ~StreamServer();
+
+  // Routes |path| to |endpoint|. Not owned.
+  void RegisterEndpoint(const char* path, Endpoint* endpoint);
+
+ private:
+  static std::string_view ToStringView(const mg_str& str) {
+    return std::string_view(str.p, str.len);
+  }
+
+  static void OnEvent(mg_connection* connection, int event, void* event_data,
+                      void* user_data);
+
+  void HandleEvent(mg_connection* connection, int event, void* event_data);
+
+  Endpoint* FindEndpoint(const mg_str& uri) const;
+
+  // Records that |connection| was handed to |endpoint|.
+  void Bind(mg_connection* connection, Endpoint* endpoint);
+
+  // The endpoint |connection| was most recently handed to, if any.
+  Endpoint* BoundEndpoint(mg_connection* connection) const;
+
+  void Poll();
+
+  esp_cxx::EventManager* event_manager_;
+  mg_mgr manager_;
+  std::vector<std::pair<std::string_view, Endpoint*>> endpoints_;
+
+  // Open connections and each Endpoint they reached, which all get their
+  // OnClose().
+  std::vector<std::pair<mg_connection*, Endpoint*>> bound_;
+};
+
+}  // namespace hackvac
+
+#endif  // STREAM_SERVER_H_
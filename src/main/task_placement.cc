@@ -0,0 +1,59 @@
+#include "task_placement.h"
+
+#include "esp_cxx/logging.h"
+
+#ifndef FAKE_ESP_IDF
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#else
+#include <thread>
+#endif
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "tasks";
+
+#ifndef FAKE_ESP_IDF
+void EventLoopTask(void* parameters) {
+  static_cast<esp_cxx::EventManager*>(parameters)->Loop();
+  vTaskDelete(nullptr);
+}
+#endif
+
+}  // namespace
+
+int TaskCoreId(int configured_core) {
+#ifndef FAKE_ESP_IDF
+#ifdef CONFIG_FREERTOS_UNICORE
+  return 0;
+#else
+  return configured_core < 0 ? tskNO_AFFINITY : configured_core;
+#endif
+#else
+  return configured_core;
+#endif
+}
+
+bool StartEventLoopTask(esp_cxx::EventManager* event_manager,
+                        const TaskPlacement& placement) {
+  ESP_LOGI(kTag, "%s: priority %d core %d stack %d", placement.name,
+           placement.priority, placement.core,
+           static_cast<int>(placement.stack_size));
+#ifndef FAKE_ESP_IDF
+  if (xTaskCreatePinnedToCore(&EventLoopTask, placement.name,
+                              placement.stack_size, event_manager,
+                              placement.priority, nullptr,
+                              TaskCoreId(placement.core)) != pdPASS) {
+    ESP_LOGE(kTag, "Unable to create %s task", placement.name);
+    return false;
+  }
+#else
+  std::thread([event_manager] { event_manager->Loop(); }).detach();
+#endif
+  return true;
+}
+
+}  // namespace hackvac
@@ -0,0 +1,31 @@
+#ifndef TASK_PLACEMENT_H_
+#define TASK_PLACEMENT_H_
+
+#include <cstddef>
+
+#include "esp_cxx/event_manager.h"
+
+namespace hackvac {
+
+// Where and how urgently a task runs. Values normally come from the
+// HACKVAC_*_TASK_* options in Kconfig.projbuild.
+struct TaskPlacement {
+  const char* name;
+  int priority;
+  int core;  // -1 for no affinity.
+  size_t stack_size;
+};
+
+// Maps a configured core to a FreeRTOS core id. -1 means no affinity and
+// single core builds put everything on core 0.
+int TaskCoreId(int configured_core);
+
+// Runs |event_manager|->Loop() on a new task placed per |placement|.
+// Returns false if the task could not be created. On host builds the
+// placement is ignored and a plain thread is used.
+bool StartEventLoopTask(esp_cxx::EventManager* event_manager,
+                        const TaskPlacement& placement);
+
+}  // namespace hackvac
+
+#endif  // TASK_PLACEMENT_H_
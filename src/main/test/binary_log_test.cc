@@ -0,0 +1,89 @@
+#include "../binary_log.h"
+
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+size_t Encode(uint8_t* buf, size_t size, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t len = EncodeLogRecord(7, 1234, format, args, buf, size);
+  va_end(args);
+  return len;
+}
+
+std::string Render(const uint8_t* record, size_t size) {
+  char out[256];
+  size_t len = RenderLogRecord(record, size, out, sizeof(out));
+  EXPECT_EQ(strlen(out), len);
+  return out;
+}
+
+}  // namespace
+
+// * Rendering later matches rendering immediately for the conversions
+//   esp_log lines use.
+TEST(BinaryLog, RendersLikePrintf) {
+  uint8_t buf[256];
+  char tag[] = "controller";
+  char expected[256];
+  const char kFormat[] = "I (%d) %s: %-6s|%5.1f|%lld|%zu|%*d|%.*s|%x|%c|100%%\n";
+  snprintf(expected, sizeof(expected), kFormat, 4242, tag, "rx", 21.55,
+           -123456789012LL, static_cast<size_t>(17), 4, 9, 2, "abcdef", 0xbeef, 'Z');
+
+  size_t len = Encode(buf, sizeof(buf), kFormat, 4242, tag, "rx", 21.55,
+                      -123456789012LL, static_cast<size_t>(17), 4, 9, 2, "abcdef",
+                      0xbeef, 'Z');
+  ASSERT_GT(len, sizeof(LogRecordHeader));
+
+  // String arguments were copied.
+  strcpy(tag, "clobbered");
+  EXPECT_EQ(expected, Render(buf, len));
+
+  LogRecordHeader header;
+  ASSERT_TRUE(ReadLogRecordHeader(buf, len, &header));
+  EXPECT_EQ(7, header.sequence);
+  EXPECT_EQ(1234, header.time_ms);
+  EXPECT_EQ(kFormat, header.format);
+  EXPECT_EQ(tag, header.tag);
+  EXPECT_EQ(0, header.flags);
+}
+
+// * Arguments that do not fit are dropped and rendering marks the cut.
+// * Long strings are clipped to kMaxLogStringArg.
+TEST(BinaryLog, Truncates) {
+  uint8_t buf[sizeof(LogRecordHeader) + 6];
+  size_t len = Encode(buf, sizeof(buf), "a=%d b=%d c=%d", 1, 2, 3);
+  LogRecordHeader header;
+  ASSERT_TRUE(ReadLogRecordHeader(buf, len, &header));
+  EXPECT_EQ(kLogRecordTruncated, header.flags);
+  EXPECT_EQ("a=1 b=...", Render(buf, len));
+
+  EXPECT_EQ(0, Encode(buf, sizeof(LogRecordHeader) - 1, "x"));
+
+  uint8_t big[256];
+  std::string long_string(100, 'x');
+  len = Encode(big, sizeof(big), "[%s]", long_string.c_str());
+  EXPECT_EQ("[" + std::string(kMaxLogStringArg, 'x') + "]", Render(big, len));
+
+  // Output buffer smaller than the text still reports the full length.
+  char small[4];
+  EXPECT_EQ(kMaxLogStringArg + 2, RenderLogRecord(big, len, small, sizeof(small)));
+  EXPECT_STREQ("[xx", small);
+}
+
+// * A spec too long to hand to snprintf is shown as written and its
+//   arguments, stars included, are skipped so later ones line up.
+TEST(BinaryLog, LongSpecConsumesArgument) {
+  uint8_t buf[256];
+  size_t len = Encode(buf, sizeof(buf), "%d %000000000000008.3f %*s %0000000000000*d|%d",
+                      1, 2.5, 3, "ab", 4, 5, 6);
+  EXPECT_EQ("1 %000000000000008.3f  ab %0000000000000*d|6", Render(buf, len));
+}
+
+}  // namespace hackvac
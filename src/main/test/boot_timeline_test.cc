@@ -0,0 +1,31 @@
+#include "../boot_timeline.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+// * Unreached milestones read as 0.
+// * Only the first Mark() of a milestone is kept.
+TEST(BootTimeline, FirstMarkSticks) {
+  BootTimeline timeline;
+  EXPECT_EQ(0, timeline.time_us(BootMilestone::kHvacConnected));
+
+  timeline.Mark(BootMilestone::kHvacConnected);
+  int64_t first = timeline.time_us(BootMilestone::kHvacConnected);
+  EXPECT_NE(0, first);
+
+  timeline.Mark(BootMilestone::kHvacConnected);
+  EXPECT_EQ(first, timeline.time_us(BootMilestone::kHvacConnected));
+
+  timeline.Mark(BootMilestone::kWifiUp);
+  EXPECT_GE(timeline.time_us(BootMilestone::kWifiUp), first);
+  EXPECT_EQ(0, timeline.time_us(BootMilestone::kHttpServing));
+}
+
+TEST(BootTimeline, MilestoneNames) {
+  EXPECT_STREQ("nvs_ready", BootTimeline::MilestoneName(BootMilestone::kNvsReady));
+  EXPECT_STREQ("http_serving",
+               BootTimeline::MilestoneName(BootMilestone::kHttpServing));
+}
+
+}  // namespace hackvac
@@ -1,5 +1,7 @@
 #include "../controller.h"
 
+#include <thread>
+
 #include "esp_cxx/event_manager.h"
 
 #include "gtest/gtest.h"
@@ -23,6 +25,13 @@ constexpr std::array<uint8_t, 6> kConnectIncomplete = { 0xfc, 0x5a, 0x01, 0x30,
 constexpr std::array<uint8_t, 8> kConnectBadChecksum = { 0xfc, 0x5a, 0x01, 0x30, 0x02, 0xca, 0x01, 0xa6 };
 constexpr std::array<uint8_t, 8> kBadType = { 0xfc, 0x59, 0x01, 0x30, 0x02, 0xca, 0x01, 0xa9 };
 
+// A settings InfoAck from packets-idle.csv in docs/pac-us444cn-1: power off,
+// heat, 21C, fan auto, vane 5. Like every InfoAck from the unit it has no
+// flag bits in data[1] and data[2].
+constexpr std::array<uint8_t, 22> kIdleSettingsInfoAck = {
+  0xfc, 0x62, 0x01, 0x30, 0x10, 0x02, 0x00, 0x00, 0x00, 0x01, 0x0a,
+  0x00, 0x05, 0x00, 0x00, 0x00, 0xaa, 0x00, 0x00, 0x00, 0x00, 0xa1 };
+
 template <size_t n>
 std::unique_ptr<Cn105Packet> MakePacket(const std::array<uint8_t, n>& data) {
   auto packet = std::make_unique<Cn105Packet>();
@@ -32,6 +41,28 @@ std::unique_ptr<Cn105Packet> MakePacket(const std::array<uint8_t, n>& data) {
   return packet;
 }
 
+// Settings with every field set, as the unit reports them.
+StoredHvacSettings MakeUnitSettings() {
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(Mode::kCool);
+  settings.SetTargetTemp(HalfDegreeTemp(22, false));
+  settings.Set(Fan::kAuto);
+  settings.Set(Vane::kAuto);
+  settings.Set(WideVane::kCenter);
+  return settings;
+}
+
+// An InfoAck carrying |settings| the way the unit sends it: every field's
+// value and no flag bits.
+std::unique_ptr<Cn105Packet> UnitInfoAck(const StoredHvacSettings& settings) {
+  auto data = settings.encoded_bytes();
+  data[0] = static_cast<uint8_t>(CommandType::kSettings);
+  data[1] = 0x00;
+  data[2] = 0x00;
+  return std::make_unique<Cn105Packet>(PacketType::kInfoAck, data);
+}
+
 }  // namespace
 
 class MockPacketLogger : public esp_cxx::DataLogger<std::unique_ptr<Cn105Packet>> {
@@ -45,6 +76,7 @@ class MockHalfDuplexChannel : public HalfDuplexChannel {
     : HalfDuplexChannel(nullptr, esp_cxx::Uart::Chip::kInvalid, {}, {}, {}) {}
   MOCK_METHOD0(Start, void());
   MOCK_METHOD1(EnqueuePacket, void(std::unique_ptr<Cn105Packet>));
+  MOCK_METHOD2(WriteThrough, void(const uint8_t*, size_t));
 };
 
 class FakeController : public Controller {
@@ -63,7 +95,27 @@ class FakeController : public Controller {
   // Expose for use in testing.
   using Controller::OnThermostatPacket;
   using Controller::OnHvacControlPacket;
+  using Controller::OnThermostatBytes;
+  using Controller::OnHvacControlBytes;
   using Controller::is_command_oustanding_;
+  using Controller::link_state_;
+  using Controller::GetInfoAck;
+  using Controller::OnHvacPacketSent;
+  using Controller::PersistSettings;
+  using Controller::Command;
+  using Controller::ScheduleCommand;
+  using Controller::command_sent_time_;
+};
+
+// Counts writes on top of the in-memory store.
+class CountingSettingsStore : public SettingsStore {
+ public:
+  bool Save(const Contents& contents) override {
+    save_count++;
+    return SettingsStore::Save(contents);
+  }
+
+  int save_count = 0;
 };
 
 class ControllerTest : public ::testing::Test {
@@ -126,7 +178,7 @@ TEST_F(ControllerTest, OnThermostatPacket) {
   controller_.OnThermostatPacket(UpdatePacket::Create(settings));
   StoredHvacSettings new_settings = controller_.GetSettings();
   EXPECT_NE(orig_settings.encoded_bytes(), new_settings.encoded_bytes());
-  EXPECT_EQ(orig_settings.Get<Power>(), Power::kOn);
+  EXPECT_EQ(new_settings.Get<Power>(), Power::kOn);
   Mock::VerifyAndClearExpectations(&controller_.mock_thermostat);
 
   // Responds to a settings query packet.
@@ -175,24 +227,177 @@ TEST_F(ControllerTest, OnThermostatPacket) {
   Mock::VerifyAndClearExpectations(&controller_.mock_thermostat);
 
   // Respond to a timer query packet.
+  std::unique_ptr<Cn105Packet> timers_ack = InfoAckPacket::CreateTimers();
   EXPECT_CALL(controller_.mock_thermostat,
               EnqueuePacket(
-                  Pointee(Property(&Cn105Packet::type, PacketType::kInfoAck)))
+                  Pointee(
+                      AllOf(Property(&Cn105Packet::type, PacketType::kInfoAck),
+                            Property(&Cn105Packet::data_str, timers_ack->data_str())
+                           )
+                      )
+                  )
              );
-  // TODO(awong): Verify the Acked data.
   controller_.OnThermostatPacket(InfoPacket::Create(CommandType::kTimers));
   Mock::VerifyAndClearExpectations(&controller_.mock_thermostat);
 
   // Respond to a status query packet.
+  std::unique_ptr<Cn105Packet> status_ack =
+      InfoAckPacket::CreateStatus(controller_.GetSettings());
   EXPECT_CALL(controller_.mock_thermostat,
               EnqueuePacket(
-                  Pointee(Property(&Cn105Packet::type, PacketType::kInfoAck)))
+                  Pointee(
+                      AllOf(Property(&Cn105Packet::type, PacketType::kInfoAck),
+                            Property(&Cn105Packet::data_str, status_ack->data_str())
+                           )
+                      )
+                  )
              );
-  // TODO(awong): Verify the Acked data.
   controller_.OnThermostatPacket(InfoPacket::Create(CommandType::kStatus));
   Mock::VerifyAndClearExpectations(&controller_.mock_thermostat);
 }
 
+// * Repeated Info queries are served from the same prebuilt image.
+// * A settings change invalidates only the replies built from it.
+TEST_F(ControllerTest, InfoAckCache) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_thermostat, EnqueuePacket(_)).Times(AtLeast(0));
+
+  const Cn105Packet* settings_ack = &controller_.GetInfoAck(CommandType::kSettings);
+  const Cn105Packet* extended_ack =
+      &controller_.GetInfoAck(CommandType::kExtendedSettings);
+  std::string old_bytes(settings_ack->raw_bytes_str());
+  EXPECT_EQ(settings_ack, &controller_.GetInfoAck(CommandType::kSettings));
+  EXPECT_EQ(old_bytes, controller_.GetInfoAck(CommandType::kSettings).raw_bytes_str());
+
+  controller_.SetTemperature(HalfDegreeTemp(22, true));
+  const Cn105Packet& new_settings_ack = controller_.GetInfoAck(CommandType::kSettings);
+  EXPECT_NE(old_bytes, new_settings_ack.raw_bytes_str());
+  EXPECT_EQ(HalfDegreeTemp(22, true),
+            InfoAckPacket(const_cast<Cn105Packet*>(&new_settings_ack))
+                .settings()->GetTargetTemp());
+  EXPECT_EQ(extended_ack, &controller_.GetInfoAck(CommandType::kExtendedSettings));
+}
+
+// * A change to the settings bytes that no field compares different on,
+//   such as the unit dropping the encoded room temp byte, bumps the
+//   generation and so rebuilds the reply.
+// * Observers are not told about it.
+TEST_F(ControllerTest, InfoAckCacheKeyedOnBytes) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(0));
+
+  StoredExtendedSettings extended;
+  extended.SetRoomTemp(HalfDegreeTemp(21, false));
+  auto data = extended.encoded_bytes();
+  data[0] = static_cast<uint8_t>(CommandType::kExtendedSettings);
+  data[1] = 0x00;
+  controller_.is_command_oustanding_ = true;
+  controller_.OnHvacControlPacket(std::make_unique<Cn105Packet>(PacketType::kInfoAck, data));
+  uint32_t generation = controller_.extended_settings_generation();
+  EXPECT_EQ(data[6],
+            controller_.GetInfoAck(CommandType::kExtendedSettings).data()[6]);
+
+  int notifications = 0;
+  controller_.AddSettingsObserver([&](const SettingsChange&) { notifications++; });
+  data[6] = 0x00;
+  controller_.is_command_oustanding_ = true;
+  controller_.OnHvacControlPacket(std::make_unique<Cn105Packet>(PacketType::kInfoAck, data));
+  EXPECT_EQ(generation + 1, controller_.extended_settings_generation());
+  EXPECT_EQ(0, notifications);
+  EXPECT_EQ(0x00, controller_.GetInfoAck(CommandType::kExtendedSettings).data()[6]);
+}
+
+// * Generations only advance on real changes.
+// * Observers see only the changed fields from every source of change.
+// * Removed observers are no longer notified.
+TEST_F(ControllerTest, SettingsObserver) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_thermostat, EnqueuePacket(_)).Times(AtLeast(0));
+
+  std::vector<SettingsChange> changes;
+  Controller::ObserverId id = controller_.AddSettingsObserver(
+      [&](const SettingsChange& change) { changes.push_back(change); });
+
+  EXPECT_EQ(0, controller_.settings_generation());
+  EXPECT_EQ(0, controller_.extended_settings_generation());
+
+  // Thermostat update merges report just the fields in the update.
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(Fan::kQuiet);
+  controller_.OnThermostatPacket(UpdatePacket::Create(settings));
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(ToMask(SettingsField::kPower) | ToMask(SettingsField::kFan),
+            changes[0].changed_fields);
+  EXPECT_EQ(1, changes[0].hvac_settings_generation);
+  EXPECT_EQ(0, changes[0].extended_settings_generation);
+  EXPECT_EQ(Power::kOn, changes[0].hvac_settings.Get<Power>());
+  EXPECT_EQ(1, controller_.settings_generation());
+
+  // Re-sending identical values is not a change.
+  controller_.OnThermostatPacket(UpdatePacket::Create(settings));
+  EXPECT_EQ(1, changes.size());
+  EXPECT_EQ(1, controller_.settings_generation());
+
+  // InfoAck from the heat pump reports every field, including the ones
+  // the thermostat did not set.
+  StoredHvacSettings reported = MakeUnitSettings();
+  reported.Set(Fan::kQuiet);
+  controller_.is_command_oustanding_ = true;
+  controller_.OnHvacControlPacket(UnitInfoAck(reported));
+  ASSERT_EQ(2, changes.size());
+  EXPECT_EQ(ToMask(SettingsField::kMode) | ToMask(SettingsField::kTargetTemp) |
+                ToMask(SettingsField::kVane) | ToMask(SettingsField::kWideVane),
+            changes[1].changed_fields);
+  EXPECT_EQ(2, changes[1].hvac_settings_generation);
+
+  // Extended settings have their own generation.
+  StoredExtendedSettings extended_settings;
+  extended_settings.SetRoomTemp(HalfDegreeTemp(21, false));
+  controller_.OnThermostatPacket(UpdatePacket::Create(extended_settings));
+  ASSERT_EQ(3, changes.size());
+  EXPECT_EQ(ToMask(SettingsField::kRoomTemp), changes[2].changed_fields);
+  EXPECT_EQ(2, changes[2].hvac_settings_generation);
+  EXPECT_EQ(1, changes[2].extended_settings_generation);
+
+  controller_.RemoveSettingsObserver(id);
+  controller_.SetTemperature(HalfDegreeTemp(20, false));
+  EXPECT_EQ(3, changes.size());
+  EXPECT_EQ(3, controller_.settings_generation());
+}
+
+// * Changes from two tasks reach observers in generation order.
+// * Observers may read the settings while another task commits.
+TEST_F(ControllerTest, SettingsObserverOrderAcrossTasks) {
+  IgnoreLogCalls();
+  std::vector<uint32_t> generations;
+  Controller::ObserverId id = controller_.AddSettingsObserver(
+      [&](const SettingsChange& change) {
+        controller_.GetSettings();
+        generations.push_back(change.hvac_settings_generation);
+      });
+
+  // Each merge flips a field only its own task touches, so each is a change.
+  // Eight per task keeps the Updates they queue within the mailbox.
+  auto toggle = [&](auto on, auto off) {
+    for (int i = 0; i < 8; ++i) {
+      StoredHvacSettings update;
+      update.Set(i % 2 ? off : on);
+      controller_.MergeSettings(update);
+    }
+  };
+  std::thread fan_task(toggle, Fan::kQuiet, Fan::kPower3);
+  std::thread vane_task(toggle, Vane::kSwing, Vane::kPower1);
+  fan_task.join();
+  vane_task.join();
+  controller_.RemoveSettingsObserver(id);
+
+  ASSERT_EQ(16, generations.size());
+  for (size_t i = 0; i < generations.size(); ++i) {
+    EXPECT_EQ(i + 1, generations[i]);
+  }
+}
+
 TEST_F(ControllerTest, OnHvacControlPacket_ClearsOutstanding) {
   IgnoreLogCalls();
 
@@ -220,6 +425,23 @@ TEST_F(ControllerTest, OnHvacControlPacket_MergesInfoAckData) {
 }
 
 // Junk packets are ignored.
+// * A real InfoAck, which has no flag bits, fills every reported field.
+TEST_F(ControllerTest, OnHvacControlPacket_ReportsRealInfoAck) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(0));
+  controller_.is_command_oustanding_ = true;
+  controller_.OnHvacControlPacket(MakePacket(kIdleSettingsInfoAck));
+
+  StoredHvacSettings reported = controller_.GetSettingsShadow().reported;
+  EXPECT_EQ(Power::kOff, reported.Get<Power>());
+  EXPECT_EQ(Mode::kHeat, reported.Get<Mode>());
+  EXPECT_EQ(HalfDegreeTemp(21, false), reported.GetTargetTemp());
+  EXPECT_EQ(Fan::kAuto, reported.Get<Fan>());
+  EXPECT_EQ(Vane::kPower5, reported.Get<Vane>());
+  EXPECT_EQ(reported, controller_.GetSettings());
+  EXPECT_EQ(0, controller_.GetSettingsShadow().pending_fields);
+}
+
 TEST_F(ControllerTest, OnHvacControlPacket_IgnoreJunk) {
   IgnoreLogCalls();
 
@@ -239,6 +461,89 @@ TEST_F(ControllerTest, OnHvacControlPacket_IncompleteReconnects) {
   controller_.OnHvacControlPacket(MakePacket(kConnectIncomplete));
 }
 
+// * Only the first reconnect after a failure is immediate.
+// * Further failures back off instead of flooding Connects.
+// * More truncated replies to the same command are not more failures.
+// * A late reply while backing off does not mark the link connected.
+// * A valid response to a Connect attempt marks the link connected.
+TEST_F(ControllerTest, OnHvacControlPacket_ReconnectBacksOff) {
+  IgnoreLogCalls();
+
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kConnect))))
+      .Times(1);
+  controller_.OnHvacControlPacket(MakePacket(kConnectIncomplete));
+  controller_.OnHvacControlPacket(MakePacket(kConnectIncomplete));
+  controller_.OnHvacControlPacket(MakePacket(kConnectIncomplete));
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+  EXPECT_EQ(LinkState::State::kDisconnected, controller_.link_state());
+  // One before the Connect and one for it.
+  EXPECT_EQ(2, controller_.link_state_.consecutive_failures());
+
+  controller_.OnHvacControlPacket(ConnectAckPacket::Create());
+  EXPECT_EQ(LinkState::State::kDisconnected, controller_.link_state());
+  EXPECT_EQ(2, controller_.link_state_.consecutive_failures());
+
+  // Stands in for the delayed Connect.
+  controller_.link_state_.OnConnectAttempt();
+  controller_.OnHvacControlPacket(ConnectAckPacket::Create());
+  EXPECT_EQ(LinkState::State::kConnected, controller_.link_state());
+  EXPECT_LT(0, controller_.link_health());
+}
+
+// * A reply with a bad checksum fails the command without a reconnect.
+// * The next queued command is sent and arms its own timeout.
+TEST_F(ControllerTest, OnHvacControlPacket_CorruptRunsNextCommand) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_hvac_control, Start());
+  EXPECT_CALL(controller_.mock_thermostat, Start());
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kConnect))))
+      .Times(1);
+  controller_.Start();
+  controller_.OnHvacPacketSent();
+  controller_.OnHvacControlPacket(ConnectAckPacket::Create());
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  controller_.ScheduleCommand(FakeController::Command::kQuerySettings);
+  controller_.ScheduleCommand(FakeController::Command::kQueryExtendedSettings);
+  controller_.OnHvacPacketSent();
+
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kInfo))))
+      .Times(1);
+  controller_.OnHvacControlPacket(MakePacket(kConnectBadChecksum));
+  EXPECT_TRUE(controller_.is_command_oustanding_);
+  EXPECT_EQ(LinkState::State::kDegraded, controller_.link_state());
+  EXPECT_EQ(0, controller_.link_state_.consecutive_failures());
+  EXPECT_TRUE(controller_.command_sent_time_ == std::nullopt);
+}
+
+// * The round trip of a sent command is sampled when its reply arrives.
+// * Sends with no command outstanding are not sampled.
+TEST_F(ControllerTest, RttSampledPerCommand) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(0));
+
+  controller_.OnHvacPacketSent();
+  controller_.Start();
+  controller_.OnHvacPacketSent();
+  controller_.OnHvacControlPacket(ConnectAckPacket::Create());
+
+  std::vector<CommandRttStats> stats = controller_.GetRttStats();
+  ASSERT_EQ(5, stats.size());
+  EXPECT_STREQ("connect", stats[0].command);
+  uint32_t samples = 0;
+  for (uint32_t count : stats[0].histogram) {
+    samples += count;
+  }
+  EXPECT_EQ(1, samples);
+  EXPECT_LE(RttEstimator::WireTime(15), stats[0].timeout);
+
+  // Query timeouts start from their longer frames.
+  EXPECT_EQ(2 * RttEstimator::WireTime(44), stats[1].timeout);
+}
+
 // * Packets sent to one interace show up in the other, regardless of type.
 TEST_F(ControllerTest, PassThru) {
   IgnoreLogCalls();
@@ -256,6 +561,32 @@ TEST_F(ControllerTest, PassThru) {
   controller_.OnThermostatPacket(MakePacket(kJunk2));
 }
 
+// * In cut-through passthru, raw bytes are written straight to the other side.
+// * Parsed packets are only logged, never re-queued.
+// * Bytes are not forwarded when passthru is off.
+TEST_F(ControllerTest, CutThroughPassThru) {
+  IgnoreLogCalls();
+
+  EXPECT_CALL(controller_.mock_thermostat, WriteThrough(_, _)).Times(0);
+  controller_.OnHvacControlBytes(kConnect.data(), kConnect.size());
+  Mock::VerifyAndClearExpectations(&controller_.mock_thermostat);
+
+  controller_.set_passthru(true);
+  controller_.set_cut_through(true);
+
+  EXPECT_CALL(controller_.mock_thermostat, WriteThrough(kConnect.data(), 3));
+  EXPECT_CALL(controller_.mock_thermostat, WriteThrough(kConnect.data() + 3, 5));
+  EXPECT_CALL(controller_.mock_hvac_control, WriteThrough(kJunk2.data(), kJunk2.size()));
+  controller_.OnHvacControlBytes(kConnect.data(), 3);
+  controller_.OnHvacControlBytes(kConnect.data() + 3, 5);
+  controller_.OnThermostatBytes(kJunk2.data(), kJunk2.size());
+
+  EXPECT_CALL(controller_.mock_thermostat, EnqueuePacket(_)).Times(0);
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(0);
+  controller_.OnHvacControlPacket(MakePacket(kConnect));
+  controller_.OnThermostatPacket(MakePacket(kJunk2));
+}
+
 // * Logs all packets from both interfaces, including
 //     * junk
 //     * incomplete
@@ -322,6 +653,297 @@ TEST_F(ControllerTest, PushSettings) {
   event_manager_.Loop();
 }
 
+// * Merges leave fields the update does not have alone.
+// * Only the merged field is sent.
+TEST_F(ControllerTest, MergeSettings) {
+  IgnoreLogCalls();
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(Mode::kCool);
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(0));
+  controller_.PushSettings(settings);
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  controller_.OnHvacControlPacket(UpdateAckPacket::Create());
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  StoredHvacSettings update;
+  update.Set(Fan::kQuiet);
+  std::unique_ptr<Cn105Packet> update_packet = UpdatePacket::Create(update);
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::data_str,
+                                             update_packet->data_str()))));
+  controller_.MergeSettings(update);
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  controller_.OnHvacControlPacket(UpdateAckPacket::Create());
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  StoredHvacSettings current = controller_.GetSettings();
+  EXPECT_EQ(Power::kOn, current.Get<Power>());
+  EXPECT_EQ(Mode::kCool, current.Get<Mode>());
+  EXPECT_EQ(Fan::kQuiet, current.Get<Fan>());
+
+  StoredExtendedSettings extended;
+  extended.SetRoomTemp(HalfDegreeTemp(21, true));
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_));
+  controller_.MergeExtendedSettings(extended);
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  EXPECT_EQ(HalfDegreeTemp(21, true), controller_.GetExtendedSettings().GetRoomTemp());
+}
+
+// * Requests from other tasks share one post to the event manager until it
+//   is drained.
+TEST_F(ControllerTest, RequestsShareOneDrain) {
+  IgnoreLogCalls();
+  controller_.SyncSettings();
+  controller_.SyncExtendedSettings();
+  controller_.SetTemperature(HalfDegreeTemp(21, false));
+  EXPECT_EQ(1, controller_.loop_profiler().queue_depth());
+
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kInfo))));
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  EXPECT_EQ(0, controller_.loop_profiler().queue_depth());
+
+  // Drained so the next request posts again.
+  controller_.SyncSettings();
+  EXPECT_EQ(1, controller_.loop_profiler().queue_depth());
+}
+
+// * Past a full mailbox, requests are posted one by one behind a drain.
+// * Once those have run, requests share the mailbox again.
+TEST_F(ControllerTest, MailboxOverflowPostsDrains) {
+  IgnoreLogCalls();
+  for (int i = 0; i < 18; ++i) {
+    controller_.SyncSettings();
+  }
+  EXPECT_EQ(3, controller_.loop_profiler().queue_depth());
+
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(1));
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  EXPECT_EQ(0, controller_.loop_profiler().queue_depth());
+
+  controller_.SyncSettings();
+  controller_.SyncSettings();
+  EXPECT_EQ(1, controller_.loop_profiler().queue_depth());
+}
+
+// * An idle link sends the Update right away and resolves it on UpdateAck.
+// * Setters made while a command is outstanding share one Update.
+// * A failed Update resolves every setter folded into it.
+TEST_F(ControllerTest, PushSettingsBatched) {
+  IgnoreLogCalls();
+  std::vector<Controller::UpdateResult> results;
+  auto record = [&](Controller::UpdateResult result) { results.push_back(result); };
+
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kUpdate))));
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  controller_.PushSettings(settings, record);
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+  EXPECT_TRUE(results.empty());
+
+  controller_.OnHvacControlPacket(UpdateAckPacket::Create());
+  ASSERT_EQ(1, results.size());
+  EXPECT_EQ(Controller::UpdateResult::kAcked, results[0]);
+  results.clear();
+
+  // Hold the link busy with a connect.
+  EXPECT_CALL(controller_.mock_hvac_control, Start());
+  EXPECT_CALL(controller_.mock_thermostat, Start());
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kConnect))));
+  controller_.Start();
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  settings.Set(Fan::kPower2);
+  controller_.PushSettings(settings, record);
+  controller_.SetTemperature(HalfDegreeTemp(21, false), record);
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+
+  // Only the fields changed since the acked push are sent.
+  StoredHvacSettings expected;
+  expected.Set(Fan::kPower2);
+  expected.SetTargetTemp(HalfDegreeTemp(21, false));
+  std::unique_ptr<Cn105Packet> expected_update = UpdatePacket::Create(expected);
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(
+                  Pointee(
+                      AllOf(Property(&Cn105Packet::type, PacketType::kUpdate),
+                            Property(&Cn105Packet::data_str, expected_update->data_str()))
+                      )
+                  )
+             );
+  controller_.OnHvacControlPacket(ConnectAckPacket::Create());
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+  EXPECT_TRUE(results.empty());
+
+  // Truncated reply fails both and reconnects.
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kConnect))));
+  controller_.OnHvacControlPacket(MakePacket(kConnectIncomplete));
+  ASSERT_EQ(2, results.size());
+  EXPECT_EQ(Controller::UpdateResult::kFailed, results[0]);
+  EXPECT_EQ(Controller::UpdateResult::kFailed, results[1]);
+}
+
+// * Once the unit has reported settings, pushes carry only changed fields.
+// * Pushing what the unit already has sends nothing and still completes.
+TEST_F(ControllerTest, PushSettingsDelta) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(0));
+  controller_.SyncSettings();
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  controller_.OnHvacControlPacket(MakePacket(kIdleSettingsInfoAck));
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  StoredHvacSettings desired = controller_.GetSettingsShadow().reported;
+  ASSERT_EQ(Fan::kAuto, desired.Get<Fan>());
+  desired.Set(Fan::kQuiet);
+  StoredHvacSettings delta;
+  delta.Set(Fan::kQuiet);
+  std::unique_ptr<Cn105Packet> delta_update = UpdatePacket::Create(delta);
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(
+                  Pointee(
+                      AllOf(Property(&Cn105Packet::type, PacketType::kUpdate),
+                            Property(&Cn105Packet::data_str, delta_update->data_str()))
+                      )
+                  )
+             );
+  controller_.PushSettings(desired);
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+  controller_.OnHvacControlPacket(UpdateAckPacket::Create());
+
+  // The acked delta is now what the unit has.
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(0);
+  bool done = false;
+  controller_.PushSettings(desired, [&](Controller::UpdateResult result) {
+                             EXPECT_EQ(Controller::UpdateResult::kAcked, result);
+                             done = true;
+                           });
+  event_manager_.Run([=]{event_manager_.Quit();});
+  event_manager_.Loop();
+  EXPECT_TRUE(done);
+  EXPECT_FALSE(controller_.is_command_oustanding_);
+}
+
+// * Reports from the unit fill the reported side without creating work.
+// * A divergent desired field is pushed alone and clears once acked.
+// * A unit that drifts from the desired settings is pushed back.
+TEST_F(ControllerTest, SettingsShadowReconciles) {
+  IgnoreLogCalls();
+  EXPECT_CALL(controller_.mock_thermostat, EnqueuePacket(_)).Times(AtLeast(0));
+
+  StoredHvacSettings reported = MakeUnitSettings();
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(0);
+  controller_.is_command_oustanding_ = true;
+  controller_.OnHvacControlPacket(UnitInfoAck(reported));
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  HvacSettingsShadow shadow = controller_.GetSettingsShadow();
+  EXPECT_EQ(0, shadow.pending_fields);
+  EXPECT_EQ(0, shadow.desired.present_fields());
+  EXPECT_EQ(Fan::kAuto, shadow.reported.Get<Fan>());
+  EXPECT_NE(HvacSettingsShadow::TimePoint(),
+            shadow.reported_at[FieldIndex(SettingsField::kFan)]);
+  EXPECT_EQ(Fan::kAuto, controller_.GetSettings().Get<Fan>());
+
+  // Thermostat asks for a new fan speed.
+  StoredHvacSettings fan_quiet;
+  fan_quiet.Set(Fan::kQuiet);
+  std::unique_ptr<Cn105Packet> fan_update = UpdatePacket::Create(fan_quiet);
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::data_str,
+                                             fan_update->data_str()))));
+  controller_.OnThermostatPacket(UpdatePacket::Create(fan_quiet));
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  shadow = controller_.GetSettingsShadow();
+  EXPECT_EQ(ToMask(SettingsField::kFan), shadow.pending_fields);
+  EXPECT_NE(HvacSettingsShadow::TimePoint(),
+            shadow.desired_changed_at[FieldIndex(SettingsField::kFan)]);
+  EXPECT_EQ(HvacSettingsShadow::TimePoint(),
+            shadow.desired_changed_at[FieldIndex(SettingsField::kPower)]);
+  EXPECT_EQ(Fan::kQuiet, controller_.GetSettings().Get<Fan>());
+
+  controller_.OnHvacControlPacket(UpdateAckPacket::Create());
+  shadow = controller_.GetSettingsShadow();
+  EXPECT_EQ(0, shadow.pending_fields);
+  EXPECT_EQ(Fan::kQuiet, shadow.reported.Get<Fan>());
+  EXPECT_EQ(Power::kOn, shadow.reported.Get<Power>());
+
+  // The unit reverts the fan on its own.
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::data_str,
+                                             fan_update->data_str()))));
+  controller_.is_command_oustanding_ = true;
+  controller_.OnHvacControlPacket(UnitInfoAck(reported));
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+}
+
+// * Start() serves restored settings before the unit answers and queries
+//   the unit to revalidate them.
+// * Persisting skips writes that would not change the stored blob.
+TEST_F(ControllerTest, RestoresAndPersistsSettings) {
+  IgnoreLogCalls();
+  CountingSettingsStore store;
+  SettingsStore::Contents contents;
+  contents.desired.Set(Fan::kQuiet);
+  contents.reported.Set(Power::kOn);
+  contents.reported.Set(Fan::kAuto);
+  ASSERT_TRUE(store.Save(contents));
+  store.save_count = 0;
+  controller_.set_settings_store(&store);
+
+  EXPECT_CALL(controller_.mock_hvac_control, Start());
+  EXPECT_CALL(controller_.mock_thermostat, Start());
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kConnect))));
+  controller_.Start();
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  EXPECT_EQ(Fan::kQuiet, controller_.GetSettings().Get<Fan>());
+  EXPECT_EQ(Power::kOn, controller_.GetSettings().Get<Power>());
+  EXPECT_EQ(ToMask(SettingsField::kFan), controller_.GetSettingsShadow().pending_fields);
+  StoredHvacSettings effective = controller_.GetSettings();
+  EXPECT_EQ(InfoAckPacket::Create(effective)->data_str(),
+            controller_.GetInfoAck(CommandType::kSettings).data_str());
+
+  EXPECT_CALL(controller_.mock_hvac_control,
+              EnqueuePacket(Pointee(Property(&Cn105Packet::type, PacketType::kInfo))));
+  controller_.OnHvacControlPacket(ConnectAckPacket::Create());
+  Mock::VerifyAndClearExpectations(&controller_.mock_hvac_control);
+
+  // Nothing changed since the restore.
+  controller_.PersistSettings();
+  EXPECT_EQ(0, store.save_count);
+
+  StoredHvacSettings reported = MakeUnitSettings();
+  reported.Set(Fan::kQuiet);
+  EXPECT_CALL(controller_.mock_hvac_control, EnqueuePacket(_)).Times(AtLeast(0));
+  controller_.OnHvacControlPacket(UnitInfoAck(reported));
+  controller_.PersistSettings();
+  controller_.PersistSettings();
+  EXPECT_EQ(1, store.save_count);
+
+  SettingsStore::Contents stored;
+  ASSERT_TRUE(store.Load(&stored));
+  EXPECT_EQ(reported, stored.reported);
+  EXPECT_EQ(Fan::kQuiet, stored.desired.Get<Fan>());
+}
+
 TEST_F(ControllerTest, PushExtendedSettings) {
   StoredExtendedSettings extended_settings;
   std::unique_ptr<Cn105Packet> extended_settings_update = UpdatePacket::Create(extended_settings);
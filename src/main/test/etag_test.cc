@@ -0,0 +1,32 @@
+#include "../etag.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+TEST(ETag, Format) {
+  char buf[kMaxETagSize + 1];
+  size_t len = FormatGenerationETag(0x5f3a9c01, 18, 4, buf);
+  EXPECT_EQ("\"5f3a9c01-12-4\"", std::string(buf, len));
+
+  len = FormatGenerationETag(UINT32_MAX, UINT32_MAX, UINT32_MAX, buf);
+  EXPECT_EQ(kMaxETagSize, len);
+}
+
+// * Lists, whitespace and weak tags match.
+// * Tags differing in any generation do not.
+TEST(ETag, IfNoneMatch) {
+  const std::string etag = "\"a-1-2\"";
+  EXPECT_TRUE(IfNoneMatchMatches("\"a-1-2\"", etag));
+  EXPECT_TRUE(IfNoneMatchMatches(" \"x-0-0\" ,W/\"a-1-2\"", etag));
+  EXPECT_TRUE(IfNoneMatchMatches(" * ", etag));
+
+  EXPECT_FALSE(IfNoneMatchMatches("", etag));
+  EXPECT_FALSE(IfNoneMatchMatches("\"a-1-3\"", etag));
+  EXPECT_FALSE(IfNoneMatchMatches("\"b-1-2\", \"a-2-2\"", etag));
+  EXPECT_FALSE(IfNoneMatchMatches("a-1-2", etag));
+}
+
+}  // namespace hackvac
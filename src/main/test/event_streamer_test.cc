@@ -0,0 +1,279 @@
+#include "../event_streamer.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <string>
+#include <vector>
+
+#include "../binary_log.h"
+#include "../event_log.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kFormat[] = "I (%u) %s: \"line\" %d\n";
+constexpr char kTag[] = "test";
+
+size_t Encode(uint32_t time_ms, uint8_t flags, uint8_t* buf, size_t size,
+              const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t len = EncodeLogRecord(time_ms, time_ms, format, args, buf, size, flags);
+  va_end(args);
+  return len;
+}
+
+void PushLine(LogRing* ring, uint32_t time_ms, int line, uint8_t flags = 0) {
+  uint8_t record[LogRing::kSlotSize];
+  size_t len = Encode(time_ms, flags, record, sizeof(record), kFormat, time_ms, kTag, line);
+  ASSERT_TRUE(ring->Push(record, len));
+}
+
+class FakeClient : public EventStreamer::Client {
+ public:
+  void SendFrame(const std::string& frame) override {
+    frames.push_back(frame);
+    pending += frame.size();
+  }
+  size_t pending_bytes() const override { return pending; }
+  void Close() override { closed = true; }
+
+  std::vector<std::string> frames;
+  size_t pending = 0;
+  bool closed = false;
+};
+
+class FakeSink : public EventStreamer::Sink {
+ public:
+  void OnEvent(const EventStreamer::Event& event) override {
+    events.emplace_back(event.text, event.size);
+    levels.push_back(event.level);
+  }
+  void OnBatchDone(uint32_t now_ms) override { batches.push_back(now_ms); }
+
+  std::vector<std::string> events;
+  std::vector<char> levels;
+  std::vector<uint32_t> batches;
+};
+
+size_t CountEvents(const std::string& frame) {
+  size_t count = 0;
+  for (size_t pos = frame.find("{\"n\":"); pos != std::string::npos;
+       pos = frame.find("{\"n\":", pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+}  // namespace
+
+// * One drain of the ring is rendered once and sent to every client.
+// * Messages are JSON escaped.
+// * Latency is measured against the record time.
+TEST(EventStreamer, BatchesToAllClients) {
+  LogRing ring;
+  EventStreamer streamer(&ring);
+  FakeClient a;
+  FakeClient b;
+  streamer.AddClient(&a);
+  streamer.AddClient(&b);
+
+  PushLine(&ring, 100, 1);
+  PushLine(&ring, 110, 2);
+  PushLine(&ring, 120, 3);
+  EXPECT_EQ(3, streamer.PublishBatch(130));
+
+  ASSERT_EQ(1, a.frames.size());
+  ASSERT_EQ(1, b.frames.size());
+  EXPECT_EQ(a.frames[0], b.frames[0]);
+  EXPECT_EQ(
+      "{\"now\":130,\"missed\":0,\"events\":["
+      "{\"n\":100,\"t\":100,\"m\":\"I (100) test: \\\"line\\\" 1\\n\"},"
+      "{\"n\":110,\"t\":110,\"m\":\"I (110) test: \\\"line\\\" 2\\n\"},"
+      "{\"n\":120,\"t\":120,\"m\":\"I (120) test: \\\"line\\\" 3\\n\"}]}",
+      a.frames[0]);
+
+  EXPECT_EQ(1, streamer.stats().batches);
+  EXPECT_EQ(3, streamer.stats().events);
+  EXPECT_EQ(2, streamer.stats().frames_sent);
+  EXPECT_EQ(3, streamer.stats().latency_us.count());
+  EXPECT_EQ(30000, streamer.stats().latency_us.max());
+
+  // Nothing queued, nothing sent.
+  EXPECT_EQ(0, streamer.PublishBatch(140));
+  EXPECT_EQ(1, a.frames.size());
+}
+
+// * A frame stops growing at max_frame_bytes and the rest waits for the next
+//   batch.
+TEST(EventStreamer, FrameSizeLimit) {
+  LogRing ring;
+  EventStreamer::Config config;
+  config.max_frame_bytes = 256;
+  EventStreamer streamer(&ring, config);
+  FakeClient client;
+  streamer.AddClient(&client);
+
+  for (int i = 0; i < 10; ++i) {
+    PushLine(&ring, 100, i);
+  }
+  size_t sent = 0;
+  while (size_t batch = streamer.PublishBatch(100)) {
+    EXPECT_LT(batch, 10);
+    sent += batch;
+  }
+  EXPECT_EQ(10, sent);
+  size_t events = 0;
+  for (const auto& frame : client.frames) {
+    EXPECT_LE(frame.size(), config.max_frame_bytes + 64);
+    events += CountEvents(frame);
+  }
+  EXPECT_EQ(10, events);
+}
+
+// * A client past its window is skipped without holding up the others.
+// * Its next frame reports what it missed.
+// * Skipping too many batches in a row evicts it.
+TEST(EventStreamer, SlowClientSkippedThenEvicted) {
+  LogRing ring;
+  EventStreamer::Config config;
+  config.window_bytes = 1024;
+  config.max_skipped_batches = 2;
+  EventStreamer streamer(&ring, config);
+  FakeClient fast;
+  FakeClient slow;
+  streamer.AddClient(&fast);
+  streamer.AddClient(&slow);
+
+  slow.pending = 1024;
+  PushLine(&ring, 100, 1);
+  PushLine(&ring, 100, 2);
+  streamer.PublishBatch(100);
+  EXPECT_EQ(1, fast.frames.size());
+  EXPECT_EQ(0, slow.frames.size());
+  EXPECT_EQ(1, streamer.stats().skipped);
+
+  // Socket drains. The skipped events are reported, not replayed.
+  slow.pending = 0;
+  fast.pending = 0;
+  PushLine(&ring, 200, 3);
+  streamer.PublishBatch(200);
+  ASSERT_EQ(1, slow.frames.size());
+  EXPECT_EQ(0, slow.frames[0].find("{\"now\":200,\"missed\":2,"));
+  EXPECT_EQ(1, CountEvents(slow.frames[0]));
+
+  // Stalls for good.
+  slow.pending = 4096;
+  for (int i = 0; i < 3; ++i) {
+    fast.pending = 0;
+    PushLine(&ring, 300, i);
+    streamer.PublishBatch(300);
+  }
+  EXPECT_TRUE(slow.closed);
+  EXPECT_FALSE(fast.closed);
+  EXPECT_EQ(1, streamer.stats().evictions);
+  EXPECT_EQ(1, streamer.num_clients());
+  EXPECT_EQ(5, fast.frames.size());
+
+  // Removing an evicted client is harmless.
+  streamer.RemoveClient(&slow);
+  EXPECT_EQ(1, streamer.num_clients());
+}
+
+// * Sinks get every event as text, even with no websocket clients.
+// * OnBatchDone comes every batch, events or not.
+TEST(EventStreamer, SinksDrainWithoutClients) {
+  LogRing ring;
+  EventStreamer streamer(&ring);
+  FakeSink sink;
+  streamer.AddSink(&sink);
+
+  PushLine(&ring, 100, 1);
+  uint8_t record[LogRing::kSlotSize];
+  size_t len = Encode(101, 0, record, sizeof(record), "E (%u) %s: bad\n", 101u, kTag);
+  ASSERT_TRUE(ring.Push(record, len));
+  EXPECT_EQ(2, streamer.PublishBatch(120));
+  EXPECT_EQ(0, streamer.PublishBatch(170));
+
+  ASSERT_EQ(2, sink.events.size());
+  EXPECT_EQ("I (100) test: \"line\" 1\n", sink.events[0]);
+  EXPECT_EQ("E (101) test: bad\n", sink.events[1]);
+  EXPECT_EQ((std::vector<char>{'I', 'E'}), sink.levels);
+  EXPECT_EQ((std::vector<uint32_t>{120, 170}), sink.batches);
+
+  streamer.RemoveSink(&sink);
+  EXPECT_EQ(0, streamer.num_sinks());
+  PushLine(&ring, 200, 2);
+  EXPECT_EQ(0, streamer.PublishBatch(200));
+}
+
+// * The console sink prints only lines the logger did not print itself.
+TEST(EventStreamer, ConsoleSinkSkipsPrintedLines) {
+  LogRing ring;
+  EventStreamer streamer(&ring);
+  ConsoleLogSink sink;
+  streamer.AddSink(&sink);
+
+  PushLine(&ring, 100, 1);
+  PushLine(&ring, 100, 2, kLogRecordOnConsole);
+  PushLine(&ring, 100, 3);
+  testing::internal::CaptureStdout();
+  EXPECT_EQ(3, streamer.PublishBatch(200));
+  EXPECT_EQ("I (100) test: \"line\" 1\nI (100) test: \"line\" 3\n",
+            testing::internal::GetCapturedStdout());
+  streamer.RemoveSink(&sink);
+}
+
+// Host throughput and per batch latency of the /api/events path with the
+// most clients EventsEndpoint allows. Disabled by default; run with
+// --gtest_also_run_disabled_tests and read the results from the test
+// properties in --gtest_output.
+TEST(EventStreamer, DISABLED_Benchmark) {
+  using Clock = std::chrono::steady_clock;
+  static constexpr int kRounds = 5000;
+  static constexpr int kEventsPerRound = LogRing::kNumSlots - LogRing::kReservedSlots;
+  LogRing ring;
+  EventStreamer streamer(&ring);
+  FakeClient clients[4];
+  for (FakeClient& client : clients) {
+    streamer.AddClient(&client);
+  }
+
+  Histogram batch_ns;
+  Clock::duration total = Clock::duration::zero();
+  for (int round = 0; round < kRounds; ++round) {
+    for (int i = 0; i < kEventsPerRound; ++i) {
+      PushLine(&ring, round, i);
+    }
+    for (FakeClient& client : clients) {
+      client.frames.clear();
+      client.pending = 0;
+    }
+    for (;;) {
+      Clock::time_point start = Clock::now();
+      size_t sent = streamer.PublishBatch(round);
+      Clock::duration elapsed = Clock::now() - start;
+      if (sent == 0) {
+        break;
+      }
+      total += elapsed;
+      batch_ns.Add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+  }
+
+  ASSERT_EQ(kRounds * kEventsPerRound, streamer.stats().events);
+  EXPECT_EQ(0, streamer.stats().skipped);
+  double seconds = std::chrono::duration<double>(total).count();
+  RecordProperty("events_per_s", static_cast<int>(streamer.stats().events / seconds));
+  RecordProperty("frame_bytes_per_s", static_cast<int>(streamer.stats().bytes_sent / seconds));
+  RecordProperty("batches", static_cast<int>(batch_ns.count()));
+  RecordProperty("batch_avg_ns",
+                 static_cast<int>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                      total).count() / batch_ns.count()));
+  RecordProperty("batch_max_ns", static_cast<int>(batch_ns.max()));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,220 @@
+#include "../flash_ring.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr size_t kNumSectors = 4;
+constexpr uint8_t kPowerOn = 1;
+constexpr uint8_t kPanic = 4;
+
+struct Entry {
+  FlashRing::RecordType type;
+  uint8_t boot;
+  uint32_t time_ms;
+  std::string payload;
+};
+
+std::vector<Entry> ReadAll(FlashRing* ring) {
+  std::vector<Entry> entries;
+  ring->ForEachRecord([&](const FlashRing::Record& record) {
+    entries.push_back({record.type, record.boot, record.time_ms,
+                       std::string(reinterpret_cast<const char*>(record.payload),
+                                   record.size)});
+  });
+  return entries;
+}
+
+std::vector<std::string> Logs(const std::vector<Entry>& entries) {
+  std::vector<std::string> logs;
+  for (const auto& entry : entries) {
+    if (entry.type == FlashRing::RecordType::kLog) {
+      logs.push_back(entry.payload);
+    }
+  }
+  return logs;
+}
+
+bool AppendLog(FlashRing* ring, uint32_t time_ms, const std::string& line) {
+  return ring->Append(FlashRing::RecordType::kLog, time_ms, line.data(), line.size());
+}
+
+class FlashRingTest : public ::testing::Test {
+ protected:
+  FlashPartition partition_{kNumSectors * FlashPartition::kSectorSize};
+  FlashRing::Retained retained_{};
+};
+
+TEST_F(FlashRingTest, FirstBootWritesBootMarker) {
+  FlashRing ring(&partition_, &retained_);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0x10000));
+  EXPECT_EQ(1u, ring.boot_number());
+
+  auto entries = ReadAll(&ring);
+  ASSERT_EQ(1u, entries.size());
+  EXPECT_EQ(FlashRing::RecordType::kBoot, entries[0].type);
+  EXPECT_EQ(1, entries[0].boot);
+  ASSERT_EQ(FlashRing::kBootInfoSize, entries[0].payload.size());
+  EXPECT_EQ(1, entries[0].payload[0]);
+  EXPECT_EQ(kPowerOn, entries[0].payload[4]);
+  EXPECT_EQ(1u, ring.erases());
+}
+
+TEST_F(FlashRingTest, OnlyFlushedRecordsAreVisible) {
+  FlashRing ring(&partition_, &retained_);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+  ASSERT_TRUE(AppendLog(&ring, 10, "W (10) hi: first"));
+  EXPECT_TRUE(Logs(ReadAll(&ring)).empty());
+
+  ring.Flush();
+  EXPECT_EQ(std::vector<std::string>{"W (10) hi: first"}, Logs(ReadAll(&ring)));
+
+  // Topping up the partial page needs no erase.
+  ASSERT_TRUE(AppendLog(&ring, 20, "E (20) hi: second"));
+  ring.Flush();
+  EXPECT_EQ((std::vector<std::string>{"W (10) hi: first", "E (20) hi: second"}),
+            Logs(ReadAll(&ring)));
+  EXPECT_EQ(1u, ring.erases());
+}
+
+TEST_F(FlashRingTest, ReopenResumesAfterLastRecord) {
+  {
+    FlashRing ring(&partition_, &retained_);
+    ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+    ASSERT_TRUE(AppendLog(&ring, 10, "before"));
+    ring.Flush();
+  }
+
+  // A power cycle loses RTC memory.
+  FlashRing::Retained fresh{};
+  FlashRing ring(&partition_, &fresh);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+  EXPECT_EQ(2u, ring.boot_number());
+  ASSERT_TRUE(AppendLog(&ring, 10, "after"));
+  ring.Flush();
+
+  auto entries = ReadAll(&ring);
+  ASSERT_EQ(4u, entries.size());
+  EXPECT_EQ(FlashRing::RecordType::kBoot, entries[2].type);
+  EXPECT_EQ(2, entries[2].boot);
+  EXPECT_EQ((std::vector<std::string>{"before", "after"}), Logs(entries));
+  EXPECT_EQ(1u, partition_.erase_count());
+}
+
+TEST_F(FlashRingTest, RetainedPagesSurviveCrash) {
+  {
+    FlashRing ring(&partition_, &retained_);
+    ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+    ASSERT_TRUE(AppendLog(&ring, 10, "flushed"));
+    ring.Flush();
+    // Enough to queue a few full pages that never reach flash.
+    for (int i = 0; i < 20; ++i) {
+      ASSERT_TRUE(AppendLog(&ring, 20 + i, "unflushed " + std::to_string(i)));
+    }
+  }
+
+  FlashRing ring(&partition_, &retained_);
+  ASSERT_TRUE(ring.Open(kPanic, true, 0));
+  auto entries = ReadAll(&ring);
+  auto logs = Logs(entries);
+  ASSERT_EQ(21u, logs.size());
+  EXPECT_EQ("unflushed 19", logs.back());
+  EXPECT_EQ(FlashRing::RecordType::kCrash, entries.back().type);
+  EXPECT_EQ(kPanic, entries.back().payload[4]);
+}
+
+TEST_F(FlashRingTest, TornRecordEndsSector) {
+  {
+    FlashRing ring(&partition_, &retained_);
+    ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+    ASSERT_TRUE(AppendLog(&ring, 10, "good"));
+    ring.Flush();
+  }
+  // Half a record header, as if power went mid write.
+  std::vector<uint8_t> sector(FlashPartition::kSectorSize);
+  ASSERT_TRUE(partition_.Read(0, sector.data(), sector.size()));
+  size_t end = FlashRing::kSectorHeaderSize;
+  while (sector[end] != 0xff) {
+    end += 4;
+  }
+  const uint8_t torn[] = {0x03, 0x01, 0x20, 0x00};
+  ASSERT_TRUE(partition_.Write(end, torn, sizeof(torn)));
+
+  FlashRing::Retained fresh{};
+  FlashRing ring(&partition_, &fresh);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+  ASSERT_TRUE(AppendLog(&ring, 10, "next"));
+  ring.Flush();
+  EXPECT_EQ((std::vector<std::string>{"good", "next"}), Logs(ReadAll(&ring)));
+  EXPECT_EQ(2u, partition_.erase_count());
+}
+
+TEST_F(FlashRingTest, WrapsOldestSectorAndSpreadsErases) {
+  FlashRing ring(&partition_, &retained_);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+  std::string payload(200, 'x');
+  for (int i = 0; i < 200; ++i) {
+    payload.replace(0, 4, std::to_string(1000 + i));
+    ASSERT_TRUE(AppendLog(&ring, i, payload));
+    ring.Flush();
+  }
+
+  // 200 records of ~212 bytes is about 10 sectors, so the ring has gone
+  // around twice. Each sector was erased equally often.
+  EXPECT_GE(ring.erases(), 10u);
+  EXPECT_LE(ring.erases(), 11u);
+
+  auto logs = Logs(ReadAll(&ring));
+  ASSERT_FALSE(logs.empty());
+  EXPECT_LT(logs.size(), 4u * 19);
+  EXPECT_EQ("1199", logs.back().substr(0, 4));
+  for (size_t i = 1; i < logs.size(); ++i) {
+    EXPECT_EQ(std::stoi(logs[i - 1].substr(0, 4)) + 1, std::stoi(logs[i].substr(0, 4)));
+  }
+}
+
+TEST_F(FlashRingTest, DropsWhenFlushFallsBehind) {
+  FlashRing ring(&partition_, &retained_);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+  int signalled = 0;
+  ring.set_on_page_full([&] { signalled++; });
+
+  std::string payload(100, 'y');
+  int accepted = 0;
+  for (int i = 0; i < 40; ++i) {
+    accepted += AppendLog(&ring, i, payload);
+  }
+  EXPECT_EQ(1, signalled);
+  EXPECT_LT(accepted, 40);
+  EXPECT_EQ(40u - accepted, ring.dropped());
+
+  ring.Flush();
+  EXPECT_EQ(static_cast<size_t>(accepted), Logs(ReadAll(&ring)).size());
+  EXPECT_TRUE(AppendLog(&ring, 50, payload));
+}
+
+TEST_F(FlashRingTest, RejectsOversizedRecord) {
+  FlashRing ring(&partition_, &retained_);
+  ASSERT_TRUE(ring.Open(kPowerOn, false, 0));
+  std::string payload(FlashRing::kMaxPayloadSize + 1, 'z');
+  EXPECT_FALSE(AppendLog(&ring, 0, payload));
+  payload.pop_back();
+  EXPECT_TRUE(AppendLog(&ring, 0, payload));
+  ring.Flush();
+  EXPECT_EQ(1u, Logs(ReadAll(&ring)).size());
+}
+
+TEST_F(FlashRingTest, AppendFailsWithoutOpen) {
+  FlashRing ring(&partition_, &retained_);
+  EXPECT_FALSE(AppendLog(&ring, 0, "early"));
+  EXPECT_EQ(1u, ring.dropped());
+}
+
+}  // namespace
+
+}  // namespace hackvac
@@ -0,0 +1,40 @@
+#include "../histogram.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+// * Buckets are powers of two with zero in its own bucket.
+// * Large values saturate into the last bucket.
+TEST(Histogram, Buckets) {
+  EXPECT_EQ(0, Histogram::BucketFor(0));
+  EXPECT_EQ(1, Histogram::BucketFor(1));
+  EXPECT_EQ(2, Histogram::BucketFor(2));
+  EXPECT_EQ(2, Histogram::BucketFor(3));
+  EXPECT_EQ(3, Histogram::BucketFor(4));
+  EXPECT_EQ(Histogram::kNumBuckets - 1, Histogram::BucketFor(UINT32_MAX));
+
+  for (size_t i = 0; i < Histogram::kNumBuckets; ++i) {
+    EXPECT_EQ(i, Histogram::BucketFor(Histogram::BucketLowerBound(i)));
+  }
+}
+
+// * Counts, min and max track added values and Reset() clears them.
+TEST(Histogram, AddAndReset) {
+  Histogram histogram;
+  histogram.Add(100);
+  histogram.Add(5);
+  histogram.Add(120);
+  EXPECT_EQ(3, histogram.count());
+  EXPECT_EQ(5, histogram.min());
+  EXPECT_EQ(120, histogram.max());
+  EXPECT_EQ(2, histogram.bucket(Histogram::BucketFor(100)));
+  EXPECT_EQ(1, histogram.bucket(Histogram::BucketFor(5)));
+
+  histogram.Reset();
+  EXPECT_EQ(0, histogram.count());
+  EXPECT_EQ(0, histogram.max());
+  EXPECT_EQ(0, histogram.bucket(Histogram::BucketFor(100)));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,184 @@
+#include "../hvac_settings.h"
+
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+StoredHvacSettings MakeSettings(Fan fan, HalfDegreeTemp temp) {
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(Mode::kCool);
+  settings.Set(fan);
+  settings.Set(Vane::kSwing);
+  settings.Set(WideVane::kCenter);
+  settings.SetTargetTemp(temp);
+  return settings;
+}
+
+}  // namespace
+
+// * present_fields() reports exactly the flagged fields.
+// * CopyFields() moves only the masked fields, including the target temp.
+TEST(HvacSettings, PresentAndCopyFields) {
+  StoredHvacSettings empty;
+  EXPECT_EQ(0, empty.present_fields());
+
+  StoredHvacSettings full = MakeSettings(Fan::kQuiet, HalfDegreeTemp(22, true));
+  EXPECT_EQ(ToMask(SettingsField::kPower) | ToMask(SettingsField::kMode) |
+            ToMask(SettingsField::kTargetTemp) | ToMask(SettingsField::kFan) |
+            ToMask(SettingsField::kVane) | ToMask(SettingsField::kWideVane),
+            full.present_fields());
+
+  StoredHvacSettings copy;
+  copy.CopyFields(full, ToMask(SettingsField::kFan) | ToMask(SettingsField::kTargetTemp));
+  EXPECT_EQ(ToMask(SettingsField::kFan) | ToMask(SettingsField::kTargetTemp),
+            copy.present_fields());
+  EXPECT_EQ(Fan::kQuiet, copy.Get<Fan>());
+  EXPECT_EQ(HalfDegreeTemp(22, true), copy.GetTargetTemp());
+}
+
+// * Only changed fields end up in the delta, with their flag bits.
+// * Identical settings produce an empty delta.
+// * Fields unset in the desired settings are never sent.
+TEST(HvacSettings, ComputeSettingsDelta) {
+  StoredHvacSettings reported = MakeSettings(Fan::kAuto, HalfDegreeTemp(21, false));
+
+  StoredHvacSettings desired = reported;
+  desired.Set(Fan::kPower2);
+  StoredHvacSettings delta = ComputeSettingsDelta(reported, desired);
+  EXPECT_EQ(ToMask(SettingsField::kFan), delta.present_fields());
+  EXPECT_EQ(static_cast<uint8_t>(SettingsField::kFan), delta.encoded_bytes()[1]);
+  EXPECT_EQ(0, delta.encoded_bytes()[2]);
+  EXPECT_EQ(Fan::kPower2, delta.Get<Fan>());
+
+  desired.SetTargetTemp(HalfDegreeTemp(23, true));
+  delta = ComputeSettingsDelta(reported, desired);
+  EXPECT_EQ(ToMask(SettingsField::kFan) | ToMask(SettingsField::kTargetTemp),
+            delta.present_fields());
+  EXPECT_EQ(HalfDegreeTemp(23, true), delta.GetTargetTemp());
+  EXPECT_FALSE(delta.Get<Vane>());
+
+  EXPECT_EQ(0, ComputeSettingsDelta(reported, reported).present_fields());
+
+  StoredHvacSettings power_only;
+  power_only.Set(Power::kOff);
+  delta = ComputeSettingsDelta(reported, power_only);
+  EXPECT_EQ(ToMask(SettingsField::kPower), delta.present_fields());
+}
+
+// * Unsetting a field clears only its own flag bit and value.
+TEST(HvacSettings, UnsetClearsOnlyThatField) {
+  StoredHvacSettings settings = MakeSettings(Fan::kAuto, HalfDegreeTemp(20, false));
+  settings.Set(std::optional<WideVane>());
+  EXPECT_FALSE(settings.Get<WideVane>());
+  EXPECT_EQ(0, settings.encoded_bytes()[2]);
+  EXPECT_EQ(0, settings.encoded_bytes()[10]);
+  EXPECT_EQ(Power::kOn, settings.Get<Power>());
+
+  settings.SetTargetTemp({});
+  EXPECT_FALSE(settings.GetTargetTemp());
+  EXPECT_EQ(0, settings.encoded_bytes()[5]);
+  EXPECT_EQ(Fan::kAuto, settings.Get<Fan>());
+}
+
+// * MergeUpdate() carries every present field, including target temp.
+// * Equality compares present values only.
+TEST(HvacSettings, MergeUpdateAndEquality) {
+  StoredHvacSettings settings = MakeSettings(Fan::kAuto, HalfDegreeTemp(20, false));
+  StoredHvacSettings update;
+  update.SetTargetTemp(HalfDegreeTemp(24, true));
+  update.Set(Vane::kPower2);
+  settings.MergeUpdate(update);
+  EXPECT_EQ(HalfDegreeTemp(24, true), settings.GetTargetTemp());
+  EXPECT_EQ(Vane::kPower2, settings.Get<Vane>());
+  EXPECT_EQ(Mode::kCool, settings.Get<Mode>());
+
+  StoredHvacSettings same = MakeSettings(Fan::kAuto, HalfDegreeTemp(24, true));
+  same.Set(Vane::kPower2);
+  EXPECT_TRUE(settings == same);
+  same.Set(Fan::kQuiet);
+  EXPECT_TRUE(settings != same);
+
+  StoredExtendedSettings room;
+  StoredExtendedSettings room_update;
+  room_update.SetRoomTemp(HalfDegreeTemp(19, true));
+  room.MergeUpdate(room_update);
+  EXPECT_EQ(HalfDegreeTemp(19, true), room.GetRoomTemp());
+  EXPECT_EQ(ToMask(SettingsField::kRoomTemp), StoredExtendedSettings().Diff(room));
+}
+
+// * JSON has present fields in schema order with temps in degrees.
+// * A short buffer reports the needed size.
+TEST(HvacSettings, WriteJson) {
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.SetTargetTemp(HalfDegreeTemp(22, true));
+  settings.Set(WideVane::kSwing);
+
+  char buf[64];
+  size_t len = settings.WriteJson(buf, sizeof(buf));
+  EXPECT_STREQ("{\"power\":1,\"temp\":22.5,\"wide_vane\":12}", buf);
+  EXPECT_EQ(strlen(buf), len);
+
+  char small[8];
+  EXPECT_EQ(len, settings.WriteJson(small, sizeof(small)));
+  EXPECT_EQ(0, small[sizeof(small) - 1]);
+
+  EXPECT_EQ(2, StoredHvacSettings().WriteJson(buf, sizeof(buf)));
+  EXPECT_STREQ("{}", buf);
+}
+
+// * Serialize() round trips through Deserialize().
+// * Malformed input is rejected without modifying the settings.
+TEST(HvacSettings, BinaryRoundTrip) {
+  StoredHvacSettings settings = MakeSettings(Fan::kPower2, HalfDegreeTemp(21, true));
+  uint8_t buf[HvacSettings::kMaxSerializedSize];
+  size_t len = settings.Serialize(buf, sizeof(buf));
+  EXPECT_EQ(HvacSettings::kMaxSerializedSize, len);
+
+  StoredHvacSettings parsed;
+  parsed.Set(Fan::kQuiet);
+  ASSERT_TRUE(parsed.Deserialize(buf, len));
+  EXPECT_TRUE(settings == parsed);
+  EXPECT_EQ(settings.encoded_bytes(), parsed.encoded_bytes());
+
+  StoredHvacSettings partial;
+  partial.Set(Mode::kHeat);
+  len = partial.Serialize(buf, sizeof(buf));
+  EXPECT_EQ(3, len);
+  EXPECT_FALSE(parsed.Deserialize(buf, len - 1));
+  EXPECT_TRUE(settings == parsed);
+  ASSERT_TRUE(parsed.Deserialize(buf, len));
+  EXPECT_EQ(ToMask(SettingsField::kMode), parsed.present_fields());
+
+  EXPECT_EQ(0, settings.Serialize(buf, 2));
+}
+
+// * Names map both ways for every field in either schema.
+TEST(HvacSettings, FieldNames) {
+  EXPECT_STREQ("wide_vane", SettingsFieldName(SettingsField::kWideVane));
+  EXPECT_STREQ("room_temp", SettingsFieldName(SettingsField::kRoomTemp));
+  for (size_t i = 0; i < kNumSettingsFields; ++i) {
+    auto field = static_cast<SettingsField>(1 << i);
+    EXPECT_EQ(field, SettingsFieldFromName(SettingsFieldName(field)));
+  }
+  EXPECT_FALSE(SettingsFieldFromName("bogus"));
+  EXPECT_FALSE(SettingsFieldFromName(nullptr));
+}
+
+// * Only fields of the schema with values the unit accepts are valid.
+TEST(HvacSettings, IsValidFieldInt) {
+  EXPECT_TRUE(HvacSettings::IsValidFieldInt(SettingsField::kFan,
+                                            static_cast<int>(Fan::kQuiet)));
+  EXPECT_FALSE(HvacSettings::IsValidFieldInt(SettingsField::kMode, 0x05));
+  EXPECT_FALSE(HvacSettings::IsValidFieldInt(SettingsField::kPower, 0x100));
+  EXPECT_TRUE(HvacSettings::IsValidFieldInt(SettingsField::kTargetTemp, 2 * 22 + 1));
+  EXPECT_FALSE(HvacSettings::IsValidFieldInt(SettingsField::kTargetTemp, 2 * 35));
+  EXPECT_FALSE(HvacSettings::IsValidFieldInt(SettingsField::kRoomTemp, 2 * 21));
+}
+
+}  // namespace hackvac
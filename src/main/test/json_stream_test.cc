@@ -0,0 +1,116 @@
+#include "../json_stream.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+using Token = JsonScanner::Token;
+
+std::vector<Token> Tokens(std::string_view json) {
+  JsonScanner scanner(json);
+  std::vector<Token> tokens;
+  Token token;
+  do {
+    token = scanner.Next();
+    tokens.push_back(token);
+  } while (token != Token::kEnd && token != Token::kError);
+  return tokens;
+}
+
+}  // namespace
+
+// * Commas go between members and elements but not after keys.
+// * Strings are escaped.
+TEST(JsonWriter, Structure) {
+  char buf[128];
+  JsonWriter writer(buf, sizeof(buf));
+  writer.BeginObject();
+  writer.Key("a");
+  writer.Int(-12);
+  writer.Key("list");
+  writer.BeginArray();
+  writer.Bool(true);
+  writer.String("q\"\\\n");
+  writer.BeginObject();
+  writer.EndObject();
+  writer.EndArray();
+  writer.Key("big");
+  writer.Int(INT64_MIN);
+  writer.EndObject();
+  EXPECT_TRUE(writer.ok());
+  EXPECT_EQ(R"({"a":-12,"list":[true,"q\"\\\u000a",{}],"big":-9223372036854775808})",
+            writer.text());
+}
+
+TEST(JsonWriter, Scaled) {
+  char buf[64];
+  JsonWriter writer(buf, sizeof(buf));
+  writer.BeginArray();
+  writer.Scaled(45, 2);
+  writer.Scaled(44, 2);
+  writer.Scaled(-1, 2);
+  writer.Scaled(-3, 2);
+  writer.Scaled(7, 1);
+  writer.EndArray();
+  EXPECT_EQ("[22.5,22,-0.5,-1.5,7]", writer.text());
+}
+
+TEST(JsonWriter, Overflow) {
+  char buf[8];
+  JsonWriter writer(buf, sizeof(buf));
+  writer.BeginObject();
+  writer.Key("long");
+  writer.String("value");
+  writer.EndObject();
+  EXPECT_FALSE(writer.ok());
+  EXPECT_EQ(R"({"long":)", writer.text());
+}
+
+TEST(JsonScanner, Tokens) {
+  JsonScanner scanner(R"( {"a" : [1, -2.5e+3, true, false, null], "b\"c":"x"} )");
+  EXPECT_EQ(Token::kBeginObject, scanner.Next());
+  EXPECT_EQ(Token::kString, scanner.Next());
+  EXPECT_EQ("a", scanner.text());
+  EXPECT_EQ(Token::kColon, scanner.Next());
+  EXPECT_EQ(Token::kBeginArray, scanner.Next());
+  EXPECT_EQ(Token::kNumber, scanner.Next());
+  EXPECT_EQ("1", scanner.text());
+  EXPECT_EQ(Token::kComma, scanner.Next());
+  EXPECT_EQ(Token::kNumber, scanner.Next());
+  EXPECT_EQ("-2.5e+3", scanner.text());
+  EXPECT_EQ(Token::kComma, scanner.Next());
+  EXPECT_EQ(Token::kTrue, scanner.Next());
+  EXPECT_EQ(Token::kComma, scanner.Next());
+  EXPECT_EQ(Token::kFalse, scanner.Next());
+  EXPECT_EQ(Token::kComma, scanner.Next());
+  EXPECT_EQ(Token::kNull, scanner.Next());
+  EXPECT_EQ(Token::kEndArray, scanner.Next());
+  EXPECT_EQ(Token::kComma, scanner.Next());
+  EXPECT_EQ(Token::kString, scanner.Next());
+  EXPECT_EQ(R"(b\"c)", scanner.text());
+  EXPECT_EQ(Token::kColon, scanner.Expect(Token::kColon));
+  EXPECT_EQ(Token::kString, scanner.Next());
+  EXPECT_EQ(Token::kEndObject, scanner.Next());
+  EXPECT_EQ(Token::kEnd, scanner.Next());
+  EXPECT_EQ(Token::kEnd, scanner.Next());
+}
+
+// * Lexical errors are sticky.
+TEST(JsonScanner, Errors) {
+  for (const char* json : {"\"open", "\"bad \\x escape\"", "\"\\u12\"", "\"tab\there\"",
+                           "01", "-", "1.", "1e", "tru", "nul", "@"}) {
+    EXPECT_EQ(Token::kError, Tokens(json).back()) << json;
+  }
+
+  JsonScanner scanner("[} 1");
+  EXPECT_EQ(Token::kBeginArray, scanner.Next());
+  EXPECT_EQ(Token::kError, scanner.Expect(Token::kEndArray));
+  EXPECT_EQ(Token::kError, scanner.Next());
+}
+
+}  // namespace hackvac
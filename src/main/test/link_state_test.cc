@@ -0,0 +1,123 @@
+#include "../link_state.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace hackvac {
+
+using State = LinkState::State;
+
+TEST(LinkState, Default) {
+  LinkState link(1);
+  EXPECT_EQ(State::kDisconnected, link.state());
+  EXPECT_EQ(0, link.health());
+  EXPECT_EQ(0, link.consecutive_failures());
+}
+
+// * Attempt moves to kConnecting, success to kConnected.
+// * Failures from kConnected degrade and then disconnect.
+// * Every transition is reported.
+TEST(LinkState, Transitions) {
+  LinkState link(1);
+  std::vector<std::pair<State, State>> transitions;
+  link.set_transition_callback([&](State from, State to) {
+    transitions.emplace_back(from, to);
+  });
+
+  link.OnConnectAttempt();
+  EXPECT_EQ(State::kConnecting, link.state());
+  link.OnSuccess();
+  EXPECT_EQ(State::kConnected, link.state());
+
+  // Repeated successes do not report transitions.
+  link.OnSuccess();
+  EXPECT_EQ(2, transitions.size());
+
+  link.OnFailure();
+  EXPECT_EQ(State::kDegraded, link.state());
+
+  // A success recovers.
+  link.OnSuccess();
+  EXPECT_EQ(State::kConnected, link.state());
+
+  for (int i = 0; i < LinkState::kMaxDegradedFailures; ++i) {
+    link.OnFailure();
+  }
+  EXPECT_EQ(State::kDisconnected, link.state());
+
+  std::vector<std::pair<State, State>> expected = {
+    {State::kDisconnected, State::kConnecting},
+    {State::kConnecting, State::kConnected},
+    {State::kConnected, State::kDegraded},
+    {State::kDegraded, State::kConnected},
+    {State::kConnected, State::kDegraded},
+    {State::kDegraded, State::kDisconnected},
+  };
+  EXPECT_EQ(expected, transitions);
+}
+
+// A reply without a connect attempt only counts toward health.
+TEST(LinkState, SuccessWhileDisconnected) {
+  LinkState link(1);
+  link.OnFailure();
+  link.OnSuccess();
+  EXPECT_EQ(State::kDisconnected, link.state());
+  EXPECT_LT(0, link.health());
+  EXPECT_EQ(1, link.consecutive_failures());
+
+  link.OnConnectAttempt();
+  link.OnSuccess();
+  EXPECT_EQ(State::kConnected, link.state());
+  EXPECT_EQ(0, link.consecutive_failures());
+}
+
+// Corrupt responses hurt health but do not force a disconnect.
+TEST(LinkState, Corrupt) {
+  LinkState link(1);
+  link.OnConnectAttempt();
+  link.OnSuccess();
+  int health = link.health();
+  link.OnCorrupt();
+  EXPECT_EQ(State::kDegraded, link.state());
+  EXPECT_LT(link.health(), health);
+  EXPECT_EQ(0, link.consecutive_failures());
+}
+
+// * First failure retries immediately.
+// * Later failures back off exponentially within [backoff/2, backoff].
+// * Backoff is capped at kMaxBackoff.
+TEST(LinkState, BackoffIsBoundedAndJittered) {
+  LinkState link(1234);
+  EXPECT_EQ(LinkState::Duration::zero(), link.OnFailure());
+
+  LinkState::Duration expected_max = LinkState::kInitialBackoff;
+  for (int i = 0; i < 20; ++i) {
+    LinkState::Duration delay = link.OnFailure();
+    EXPECT_LE(expected_max / 2, delay);
+    EXPECT_GE(expected_max, delay);
+    expected_max = std::min(expected_max * 2, LinkState::kMaxBackoff);
+  }
+
+  // A successful connect resets the backoff.
+  link.OnConnectAttempt();
+  link.OnSuccess();
+  EXPECT_EQ(LinkState::Duration::zero(), link.OnFailure());
+}
+
+// Health converges to the extremes and stays in range.
+TEST(LinkState, Health) {
+  LinkState link(1);
+  for (int i = 0; i < 100; ++i) {
+    link.OnSuccess();
+  }
+  EXPECT_EQ(LinkState::kMaxHealth, link.health());
+
+  for (int i = 0; i < 100; ++i) {
+    link.OnFailure();
+  }
+  EXPECT_EQ(0, link.health());
+}
+
+}  // namespace hackvac
@@ -0,0 +1,105 @@
+#include "../log_limiter.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+// * With no limit every line passes and nothing is counted.
+// * Tags are registered once by name.
+TEST(LogLimiter, UnlimitedPassesAll) {
+  LogLimiter limiter;
+  LogLimiter::Tag* tag = limiter.AddTag("a");
+  EXPECT_EQ(tag, limiter.AddTag("a"));
+  EXPECT_EQ(tag, limiter.FindTag("a"));
+  EXPECT_EQ(nullptr, limiter.FindTag("b"));
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(tag->AllowAt(0));
+  }
+  EXPECT_EQ(0, tag->suppressed());
+}
+
+// * A burst passes back to back, then lines pass at the refill rate.
+// * Partial tokens carry over between calls.
+// * Refill never exceeds the burst.
+TEST(LogLimiter, TokenBucket) {
+  LogLimiter limiter;
+  LogLimiter::Tag* tag = limiter.AddTag("a");
+  LogLimiter::SetLimitAt(tag, {10, 3, 1}, 1000);
+
+  int passed = 0;
+  for (int i = 0; i < 10; ++i) {
+    passed += tag->AllowAt(1000);
+  }
+  EXPECT_EQ(3, passed);
+  EXPECT_EQ(7, tag->suppressed());
+
+  // 10/s is one line per 100ms.
+  EXPECT_FALSE(tag->AllowAt(1050));
+  EXPECT_TRUE(tag->AllowAt(1100));
+  EXPECT_FALSE(tag->AllowAt(1150));
+  EXPECT_TRUE(tag->AllowAt(1210));
+  // The extra 10ms counts toward the next token.
+  EXPECT_TRUE(tag->AllowAt(1300));
+
+  // A long quiet period refills only up to the burst.
+  passed = 0;
+  for (int i = 0; i < 10; ++i) {
+    passed += tag->AllowAt(60000);
+  }
+  EXPECT_EQ(3, passed);
+}
+
+// * A burst after a long quiet period is capped at |burst|, however long
+//   the bucket sat full.
+TEST(LogLimiter, BurstAfterQuiet) {
+  LogLimiter limiter;
+  LogLimiter::Tag* tag = limiter.AddTag("a");
+  LogLimiter::SetLimitAt(tag, {10, 20, 1}, 0);
+  int passed = 0;
+  for (int i = 0; i < 100; ++i) {
+    passed += tag->AllowAt(100000);
+  }
+  EXPECT_EQ(20, passed);
+
+  // Full again after two seconds. The quiet time beyond that is not
+  // credited to the next burst either.
+  EXPECT_TRUE(tag->AllowAt(102000));
+  passed = 0;
+  for (int i = 0; i < 100; ++i) {
+    passed += tag->AllowAt(200000);
+  }
+  EXPECT_EQ(20, passed);
+}
+
+// * 1 in N lines pass when sampling.
+// * Setting a new limit resets the counters.
+TEST(LogLimiter, Sampling) {
+  LogLimiter limiter;
+  LogLimiter::Tag* tag = limiter.AddTag("a");
+  LogLimiter::SetLimitAt(tag, {0, 0, 4}, 0);
+  int passed = 0;
+  for (int i = 0; i < 40; ++i) {
+    passed += tag->AllowAt(0);
+  }
+  EXPECT_EQ(10, passed);
+  EXPECT_EQ(30, tag->suppressed());
+
+  LogLimiter::SetLimitAt(tag, {}, 0);
+  EXPECT_EQ(0, tag->suppressed());
+  EXPECT_TRUE(tag->AllowAt(0));
+  EXPECT_TRUE(tag->AllowAt(0));
+}
+
+// * Tags past kMaxTags share the last one.
+TEST(LogLimiter, Overflow) {
+  LogLimiter limiter;
+  const char* names[] = {"0", "1", "2", "3", "4", "5", "6", "7", "8"};
+  LogLimiter::Tag* last = nullptr;
+  for (size_t i = 0; i < LogLimiter::kMaxTags; ++i) {
+    last = limiter.AddTag(names[i]);
+  }
+  EXPECT_EQ(last, limiter.AddTag(names[LogLimiter::kMaxTags]));
+  EXPECT_EQ(LogLimiter::kMaxTags, limiter.num_tags());
+}
+
+}  // namespace hackvac
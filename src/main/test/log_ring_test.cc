@@ -0,0 +1,138 @@
+#include "../log_ring.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+
+#include "../binary_log.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kInfoFormat[] = "I (%u) %s: line %d\n";
+constexpr char kWarnFormat[] = "W (%u) %s: line %d\n";
+constexpr char kTagA[] = "a";
+constexpr char kTagB[] = "b";
+
+int Format(char* buf, size_t size, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, size, format, args);
+  va_end(args);
+  return len;
+}
+
+size_t Encode(uint8_t* buf, size_t size, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t len = EncodeLogRecord(1, 5, format, args, buf, size);
+  va_end(args);
+  return len;
+}
+
+bool PushLine(LogRing* ring, const char* format, const char* tag, int line) {
+  uint8_t record[LogRing::kSlotSize];
+  size_t len = Encode(record, sizeof(record), format, 5u, tag, line);
+  return ring->Push(record, len);
+}
+
+std::string PopText(LogRing* ring) {
+  uint8_t record[LogRing::kSlotSize];
+  size_t size = 0;
+  if (!ring->Pop(record, &size)) {
+    return "";
+  }
+  char text[128];
+  RenderLogRecord(record, size, text, sizeof(text));
+  return text;
+}
+
+}  // namespace
+
+// * Pushes past capacity are dropped and counted per tag.
+// * The first record after the gap is preceded by a drop marker.
+TEST(LogRing, DropNewestWithMarker) {
+  LogRing ring(LogRing::Policy::kDropNewest);
+  for (size_t i = 0; i < LogRing::kNumSlots; ++i) {
+    EXPECT_TRUE(PushLine(&ring, kInfoFormat, kTagA, i));
+  }
+  EXPECT_FALSE(PushLine(&ring, kInfoFormat, kTagA, 100));
+  EXPECT_FALSE(PushLine(&ring, kInfoFormat, kTagB, 101));
+  EXPECT_FALSE(PushLine(&ring, kInfoFormat, kTagB, 102));
+  EXPECT_EQ(3, ring.total_drops());
+
+  LogRing::DropCount counts[4];
+  ASSERT_EQ(2, ring.GetDropCounts(counts, 4));
+  EXPECT_EQ(kTagA, counts[0].tag);
+  EXPECT_EQ(1, counts[0].count);
+  EXPECT_EQ(kTagB, counts[1].tag);
+  EXPECT_EQ(2, counts[1].count);
+
+  EXPECT_EQ("I (5) a: line 0\n", PopText(&ring));
+  EXPECT_TRUE(PushLine(&ring, kInfoFormat, kTagA, 200));
+  for (size_t i = 1; i < LogRing::kNumSlots; ++i) {
+    PopText(&ring);
+  }
+  EXPECT_EQ("W (5) eventlog: 3 events dropped\n", PopText(&ring));
+  EXPECT_EQ("I (5) a: line 200\n", PopText(&ring));
+  EXPECT_EQ("", PopText(&ring));
+}
+
+// * Near full, info is dropped while warnings still get in.
+TEST(LogRing, ReserveForWarnings) {
+  LogRing ring(LogRing::Policy::kReserveForWarnings);
+  size_t accepted = 0;
+  while (PushLine(&ring, kInfoFormat, kTagA, accepted)) {
+    accepted++;
+  }
+  EXPECT_EQ(LogRing::kNumSlots - LogRing::kReservedSlots, accepted);
+  EXPECT_TRUE(PushLine(&ring, kWarnFormat, kTagA, 0));
+  EXPECT_EQ(1, ring.total_drops());
+}
+
+// What the logging task pays per info line: formatting it for the console
+// against capturing it for ConsoleLogSink to print later. The UART write
+// saved on top of that cannot be measured here. Disabled by default; run
+// with --gtest_also_run_disabled_tests and read the results from the test
+// properties in --gtest_output.
+TEST(LogRing, DISABLED_Benchmark) {
+  using Clock = std::chrono::steady_clock;
+  static constexpr int kLines = 200000;
+  static constexpr char kLineFormat[] =
+      "I (%u) %s: rx %d bytes type=0x%02x room=%.1f target=%.1f\n";
+  LogRing ring;
+  char line[LogRing::kSlotSize];
+  uint8_t record[LogRing::kSlotSize];
+  size_t size = 0;
+  int checksum = 0;
+
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < kLines; ++i) {
+    checksum += Format(line, sizeof(line), kLineFormat, i, kTagA, 22, 0x62, 21.5, 23.0);
+  }
+  Clock::duration format_time = Clock::now() - start;
+
+  Clock::duration capture_time = Clock::duration::zero();
+  for (int i = 0; i < kLines; ++i) {
+    start = Clock::now();
+    size_t len = Encode(record, sizeof(record), kLineFormat, i, kTagA, 22, 0x62, 21.5, 23.0);
+    ring.Push(record, len);
+    capture_time += Clock::now() - start;
+    // The network task's side, untimed.
+    ring.Pop(record, &size);
+  }
+
+  auto per_line_ns = [](Clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() / kLines;
+  };
+  EXPECT_GT(checksum, 0);
+  EXPECT_EQ(0, ring.total_drops());
+  RecordProperty("format_ns_per_line", per_line_ns(format_time));
+  RecordProperty("capture_ns_per_line", per_line_ns(capture_time));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,24 @@
+#include "../loop_jitter.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+// * Early or on-time probes count as zero lateness.
+// * Late probes land in the bucket for their lateness in microseconds.
+TEST(LoopJitterProbe, RecordsLateness) {
+  esp_cxx::QueueSetEventManager event_manager(10);
+  LoopJitterProbe probe(&event_manager);
+
+  LoopJitterProbe::Clock::time_point due{};
+  probe.Record(due, due - std::chrono::milliseconds(1));
+  probe.Record(due, due);
+  EXPECT_EQ(2, probe.lateness().bucket(0));
+
+  probe.Record(due, due + std::chrono::milliseconds(12));
+  EXPECT_EQ(1, probe.lateness().bucket(Histogram::BucketFor(12000)));
+  EXPECT_EQ(12000, probe.lateness().max());
+  EXPECT_EQ(3, probe.lateness().count());
+}
+
+}  // namespace hackvac
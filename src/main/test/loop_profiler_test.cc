@@ -0,0 +1,68 @@
+#include "../loop_profiler.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+// * Sites are named by prefix and suffix.
+// * Sites beyond kMaxSites share the last one.
+TEST(LoopProfiler, AddSite) {
+  esp_cxx::QueueSetEventManager event_manager(10);
+  LoopProfiler profiler(&event_manager);
+  EXPECT_STREQ("hvac_rx", profiler.AddSite("hvac_", "rx")->name());
+  EXPECT_STREQ("request", profiler.AddSite("request")->name());
+  EXPECT_EQ(2, profiler.num_sites());
+
+  LoopProfiler::Site* last = nullptr;
+  for (size_t i = profiler.num_sites(); i < LoopProfiler::kMaxSites; ++i) {
+    last = profiler.AddSite("filler");
+  }
+  EXPECT_EQ(last, profiler.AddSite("overflow"));
+  EXPECT_EQ(LoopProfiler::kMaxSites, profiler.num_sites());
+}
+
+// * Run() tracks queue depth and its high-water mark.
+// * Each dispatch records exec and delay on its site.
+// * Measure() records exec only and marks the site as running meanwhile.
+TEST(LoopProfiler, RecordsRunsAndMeasures) {
+  esp_cxx::QueueSetEventManager event_manager(10);
+  LoopProfiler profiler(&event_manager);
+  LoopProfiler::Site* run_site = profiler.AddSite("run");
+  LoopProfiler::Site* measure_site = profiler.AddSite("measure");
+
+  int runs = 0;
+  profiler.Run(run_site, [&] { runs++; });
+  profiler.Run(run_site, [&] { runs++; });
+  EXPECT_EQ(2, profiler.queue_depth());
+  EXPECT_EQ(2, profiler.queue_high_water());
+
+  event_manager.Run([&] { event_manager.Quit(); });
+  event_manager.Loop();
+  EXPECT_EQ(2, runs);
+  EXPECT_EQ(0, profiler.queue_depth());
+  EXPECT_EQ(2, profiler.queue_high_water());
+  EXPECT_EQ(2, run_site->exec_us().count());
+  EXPECT_EQ(2, run_site->delay_us().count());
+
+  const LoopProfiler::Site* running = nullptr;
+  profiler.Measure(measure_site, [&] { running = profiler.running_site(); });
+  EXPECT_EQ(measure_site, running);
+  EXPECT_EQ(nullptr, profiler.running_site());
+  EXPECT_EQ(1, measure_site->exec_us().count());
+  EXPECT_EQ(0, measure_site->delay_us().count());
+  EXPECT_EQ(0, measure_site->slow_count());
+}
+
+// * Callbacks over the threshold count as slow.
+TEST(LoopProfiler, CountsSlowCallbacks) {
+  esp_cxx::QueueSetEventManager event_manager(10);
+  LoopProfiler profiler(&event_manager, 0);
+  LoopProfiler::Site* site = profiler.AddSite("slow");
+  profiler.Measure(site, [] {
+                     auto until = LoopProfiler::Clock::now() + std::chrono::microseconds(50);
+                     while (LoopProfiler::Clock::now() < until) {}
+                   });
+  EXPECT_EQ(1, site->slow_count());
+}
+
+}  // namespace hackvac
@@ -0,0 +1,73 @@
+#include "../mpsc_mailbox.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+// * Values come out in push order.
+// * Push fails when full and succeeds again once drained.
+TEST(MpscMailbox, FifoAndFull) {
+  MpscMailbox<int, 4> mailbox;
+  int value = 0;
+  EXPECT_FALSE(mailbox.Pop(&value));
+
+  for (int lap = 0; lap < 3; ++lap) {
+    for (int i = 0; i < 4; ++i) {
+      int pushed = lap * 10 + i;
+      EXPECT_TRUE(mailbox.Push(std::move(pushed)));
+    }
+    int extra = 99;
+    EXPECT_FALSE(mailbox.Push(std::move(extra)));
+    EXPECT_EQ(99, extra);
+
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_TRUE(mailbox.Pop(&value));
+      EXPECT_EQ(lap * 10 + i, value);
+    }
+    EXPECT_FALSE(mailbox.Pop(&value));
+  }
+}
+
+// * With several producers racing one consumer, every accepted value is
+//   popped exactly once and each producer's values stay in order.
+TEST(MpscMailbox, ConcurrentProducers) {
+  static constexpr int kProducers = 4;
+  static constexpr int kPerProducer = 20000;
+  MpscMailbox<int, 64> mailbox;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&mailbox, p] {
+      for (int i = 0; i < kPerProducer; ++i) {
+        int value = p * kPerProducer + i;
+        while (!mailbox.Push(std::move(value))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  while (received < kProducers * kPerProducer) {
+    int value;
+    if (!mailbox.Pop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int producer = value / kPerProducer;
+    ASSERT_EQ(next[producer], value % kPerProducer);
+    next[producer]++;
+    received++;
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  int value;
+  EXPECT_FALSE(mailbox.Pop(&value));
+}
+
+}  // namespace hackvac
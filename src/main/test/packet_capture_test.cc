@@ -0,0 +1,156 @@
+#include "../packet_capture.h"
+
+#include <cstring>
+#include <vector>
+
+#include "../controller.h"
+#include "../packet_journal.h"
+#include "../pcapng.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+class CountingLogger : public PacketCapture::PacketLoggerType {
+ public:
+  void Log(const char* tag, std::unique_ptr<Cn105Packet> packet) override {
+    tags.push_back(tag);
+    types.push_back(packet->type());
+  }
+  std::vector<const char*> tags;
+  std::vector<PacketType> types;
+};
+
+uint32_t ReadU32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+std::unique_ptr<Cn105Packet> MakeConnect() {
+  return std::make_unique<Cn105Packet>(PacketType::kConnect,
+                                       std::array<uint8_t, 2>{0xca, 0x01});
+}
+
+}  // namespace
+
+// * A section header plus one interface per Controller tag.
+// * Every block's trailing length matches its leading length.
+TEST(PacketCapture, Header) {
+  uint8_t buf[512];
+  size_t size = PacketCapture::WriteHeader(buf, sizeof(buf));
+  ASSERT_GT(size, 0);
+  EXPECT_EQ(0x0a0d0d0a, ReadU32(buf));
+  EXPECT_EQ(0x1a2b3c4d, ReadU32(buf + 8));
+
+  size_t pos = 0;
+  int interfaces = 0;
+  while (pos < size) {
+    uint32_t type = ReadU32(buf + pos);
+    uint32_t len = ReadU32(buf + pos + 4);
+    ASSERT_EQ(0, len % 4);
+    ASSERT_LE(pos + len, size);
+    EXPECT_EQ(len, ReadU32(buf + pos + len - 4));
+    if (type == 1) {
+      EXPECT_EQ(kPcapngLinkTypeUser0, buf[pos + 8] | (buf[pos + 9] << 8));
+      interfaces++;
+    }
+    pos += len;
+  }
+  EXPECT_EQ(PacketCapture::kNumInterfaces, interfaces);
+
+  // Too small a buffer writes nothing.
+  EXPECT_EQ(0, PacketCapture::WriteHeader(buf, 40));
+}
+
+// * Nothing is copied without a listener but packets always pass through.
+// * Captured packets become one Enhanced Packet Block on the tag's
+//   interface with the pseudo-header ahead of the raw bytes.
+// * Unknown tags are not captured.
+TEST(PacketCapture, CapturesWhileListening) {
+  CountingLogger next;
+  PacketCapture capture(&next);
+  uint8_t buf[PacketCapture::kMaxBlockSize];
+
+  capture.Log(Controller::kHvacTxTag, MakeConnect());
+  EXPECT_EQ(0, capture.WriteNextPacket(buf, sizeof(buf)));
+
+  capture.AddListener();
+  capture.Log(Controller::kHvacTxTag, MakeConnect());
+  capture.Log("other", MakeConnect());
+  EXPECT_THAT(next.tags, testing::ElementsAre(Controller::kHvacTxTag,
+                                              Controller::kHvacTxTag, "other"));
+  EXPECT_THAT(next.types, testing::Each(PacketType::kConnect));
+
+  size_t size = capture.WriteNextPacket(buf, sizeof(buf));
+  ASSERT_GT(size, 0);
+  EXPECT_LE(size, PacketCapture::kMaxBlockSize);
+  EXPECT_EQ(6, ReadU32(buf));  // Enhanced Packet Block.
+  EXPECT_EQ(size, ReadU32(buf + 4));
+  EXPECT_EQ(static_cast<uint32_t>(PacketCapture::Interface::kHvacTx), ReadU32(buf + 8));
+
+  // Connect is fc 5a 01 30 02 ca 01 a8.
+  uint32_t captured_len = ReadU32(buf + 20);
+  EXPECT_EQ(PacketCapture::kPseudoHeaderSize + 8, captured_len);
+  const uint8_t* data = buf + 28;
+  EXPECT_EQ(PacketCapture::kPseudoHeaderVersion, data[0]);
+  EXPECT_EQ(0, data[1]);
+  const uint8_t kConnectBytes[] = {0xfc, 0x5a, 0x01, 0x30, 0x02, 0xca, 0x01, 0xa8};
+  EXPECT_EQ(0, memcmp(kConnectBytes, data + PacketCapture::kPseudoHeaderSize,
+                      sizeof(kConnectBytes)));
+
+  // Outbound, no errors.
+  EXPECT_EQ(kPcapngOutbound, ReadU32(buf + 28 + 16 + 4));
+
+  EXPECT_EQ(0, capture.WriteNextPacket(buf, sizeof(buf)));
+}
+
+// * The journal gets every packet with a known tag, listener or not.
+TEST(PacketCapture, Journal) {
+  PacketJournal journal;
+  PacketCapture capture(nullptr);
+  capture.set_journal(&journal);
+  capture.Log(Controller::kHvacRxTag, MakeConnect());
+  capture.Log("other", MakeConnect());
+  EXPECT_EQ(1, journal.num_packets());
+
+  std::string snapshot;
+  journal.Snapshot(&snapshot);
+  std::vector<uint8_t> interfaces;
+  EXPECT_TRUE(DecodePacketJournal(
+      reinterpret_cast<const uint8_t*>(snapshot.data()), snapshot.size(),
+      [&](const JournalPacket& packet) { interfaces.push_back(packet.interface); }));
+  EXPECT_THAT(interfaces, testing::ElementsAre(
+      static_cast<uint8_t>(PacketCapture::Interface::kHvacRx)));
+}
+
+// * A block that does not fit stays queued.
+// * Queue overflow is counted and reported on the next captured packet.
+TEST(PacketCapture, DropsAndPartialWrites) {
+  PacketCapture capture(nullptr);
+  capture.AddListener();
+  for (size_t i = 0; i < PacketCapture::kQueueSize + 3; ++i) {
+    capture.Log(Controller::kTstatRxTag, MakeConnect());
+  }
+  EXPECT_EQ(3, capture.total_drops());
+
+  uint8_t buf[PacketCapture::kMaxBlockSize];
+  EXPECT_EQ(0, capture.WriteNextPacket(buf, 16));
+  for (size_t i = 0; i < PacketCapture::kQueueSize; ++i) {
+    ASSERT_GT(capture.WriteNextPacket(buf, sizeof(buf)), 0);
+  }
+  EXPECT_EQ(0, capture.WriteNextPacket(buf, sizeof(buf)));
+
+  // The next one carries epb_flags and an epb_dropcount of 3.
+  capture.Log(Controller::kTstatRxTag, MakeConnect());
+  size_t size = capture.WriteNextPacket(buf, sizeof(buf));
+  ASSERT_GT(size, 0);
+  const uint8_t* options = buf + 28 + 16;
+  EXPECT_EQ(2, options[0]);  // epb_flags
+  EXPECT_EQ(kPcapngInbound, ReadU32(options + 4));
+  EXPECT_EQ(4, options[8]);  // epb_dropcount
+  EXPECT_EQ(3, ReadU32(options + 12));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,141 @@
+#include "../packet_forwarder.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <vector>
+
+#include "../cn105_protocol.h"
+#include "../packet_rewriter.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using testing::ElementsAreArray;
+
+namespace hackvac {
+
+namespace {
+constexpr std::array<uint8_t, 8> kConnect = { 0xfc, 0x5a, 0x01, 0x30, 0x02, 0xca, 0x01, 0xa8 };
+}  // namespace
+
+// * Every byte is written through, in order, as soon as it is received.
+// * Packet boundaries are counted across chunk splits.
+TEST(CutThroughForwarder, ForwardsImmediately) {
+  std::vector<uint8_t> written;
+  CutThroughForwarder forwarder([&](const uint8_t* bytes, size_t size) {
+    written.insert(written.end(), bytes, bytes + size);
+  });
+
+  // Header bytes go out before the rest of the packet shows up.
+  forwarder.OnBytes(kConnect.data(), 3);
+  EXPECT_EQ(3, written.size());
+  EXPECT_EQ(0, forwarder.forwarded_packets());
+
+  forwarder.OnBytes(kConnect.data() + 3, kConnect.size() - 3);
+  EXPECT_THAT(written, ElementsAreArray(kConnect));
+  EXPECT_EQ(1, forwarder.forwarded_packets());
+
+  // Back to back packets in one chunk.
+  written.clear();
+  std::vector<uint8_t> two(kConnect.begin(), kConnect.end());
+  two.insert(two.end(), kConnect.begin(), kConnect.end());
+  forwarder.OnBytes(two.data(), two.size());
+  EXPECT_EQ(two, written);
+  EXPECT_EQ(3, forwarder.forwarded_packets());
+  EXPECT_EQ(kConnect.size() * 3, forwarder.forwarded_bytes());
+}
+
+// Junk is forwarded verbatim and does not desync framing for the next packet.
+TEST(CutThroughForwarder, JunkThenPacket) {
+  std::vector<uint8_t> written;
+  CutThroughForwarder forwarder([&](const uint8_t* bytes, size_t size) {
+    written.insert(written.end(), bytes, bytes + size);
+  });
+
+  static constexpr std::array<uint8_t, 3> kJunk = {0x01, 0x02, 0x03};
+  forwarder.OnBytes(kJunk.data(), kJunk.size());
+  forwarder.OnBytes(kConnect.data(), kConnect.size());
+  EXPECT_EQ(kJunk.size() + kConnect.size(), written.size());
+  EXPECT_EQ(1, forwarder.forwarded_packets());
+
+  // A timed out partial packet is dropped from framing on Reset().
+  forwarder.OnBytes(kConnect.data(), 4);
+  forwarder.Reset();
+  forwarder.OnBytes(kConnect.data(), kConnect.size());
+  EXPECT_EQ(2, forwarder.forwarded_packets());
+}
+
+// Host cost of CutThroughForwarder::OnBytes(), the call the Controller makes
+// for every chunk a UART delivers, fed one byte at a time as at 2400 baud.
+// Wired as the Controller wires it: a PacketRewriter attached and the writer
+// copying into a transmit buffer. Connects pass through; Updates match a
+// rule and are held, rewritten and released by their last byte. Disabled by
+// default; run with --gtest_also_run_disabled_tests and read the results
+// from the test properties in --gtest_output.
+TEST(CutThroughForwarder, DISABLED_Benchmark) {
+  using Clock = std::chrono::steady_clock;
+  static constexpr int kPackets = 20000;
+
+  RewriteRule fan_auto;
+  fan_auto.direction = RewriteDirection::kFromThermostat;
+  fan_auto.packet_type = PacketType::kUpdate;
+  fan_auto.command_type = CommandType::kSetSettings;
+  fan_auto.action = RewriteRule::Action::kSetField;
+  fan_auto.field = SettingsField::kFan;
+  fan_auto.value = static_cast<uint8_t>(Fan::kAuto);
+  PacketRewriter rewriter;
+  rewriter.SetRules({fan_auto});
+
+  std::array<uint8_t, 64> tx_buffer;
+  size_t tx_used = 0;
+  CutThroughForwarder forwarder(
+      [&](const uint8_t* bytes, size_t size) {
+        if (tx_used + size > tx_buffer.size()) {
+          tx_used = 0;
+        }
+        std::copy(bytes, bytes + size, tx_buffer.begin() + tx_used);
+        tx_used += size;
+      },
+      &rewriter, RewriteDirection::kFromThermostat);
+
+  StoredHvacSettings settings;
+  settings.Set(Fan::kPower3);
+  auto update = UpdatePacket::Create(settings);
+  auto connect = ConnectPacket::Create();
+
+  // Per byte call times for each kind of packet.
+  struct Timing {
+    Clock::duration total = Clock::duration::zero();
+    Clock::duration max = Clock::duration::zero();
+    int bytes = 0;
+  };
+  auto feed = [&](const Cn105Packet& packet, Timing* timing) {
+    for (size_t i = 0; i < packet.raw_bytes_size(); ++i) {
+      Clock::time_point start = Clock::now();
+      forwarder.OnBytes(packet.raw_bytes() + i, 1);
+      Clock::duration elapsed = Clock::now() - start;
+      timing->total += elapsed;
+      timing->max = std::max(timing->max, elapsed);
+      timing->bytes++;
+    }
+  };
+  Timing passed;
+  Timing rewritten;
+  for (int i = 0; i < kPackets; ++i) {
+    feed(*connect, &passed);
+    feed(*update, &rewritten);
+  }
+
+  auto ns = [](Clock::duration time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+  };
+  EXPECT_EQ(passed.bytes + rewritten.bytes, forwarder.forwarded_bytes());
+  EXPECT_EQ(kPackets, forwarder.rewritten_packets());
+  RecordProperty("pass_avg_ns_per_byte", ns(passed.total) / passed.bytes);
+  RecordProperty("pass_max_ns", ns(passed.max));
+  RecordProperty("rewrite_avg_ns_per_byte", ns(rewritten.total) / rewritten.bytes);
+  RecordProperty("rewrite_max_ns", ns(rewritten.max));
+}
+
+}  // namespace hackvac
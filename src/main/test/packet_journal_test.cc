@@ -0,0 +1,178 @@
+#include "../packet_journal.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+struct Packet {
+  uint8_t interface;
+  uint32_t time_ms;
+  std::vector<uint8_t> bytes;
+
+  bool operator==(const Packet& other) const {
+    return interface == other.interface && time_ms == other.time_ms &&
+        bytes == other.bytes;
+  }
+};
+
+// One idle polling cycle from docs/pac-us444cn-1/extracted_packets/packets-idle.csv.
+// Interface 0 is the thermostat side and 1 the heat pump.
+const std::vector<std::vector<uint8_t>> kIdleCycle = {
+  {0xfc,0x42,0x01,0x30,0x10,0x02,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x7b},
+  {0xfc,0x62,0x01,0x30,0x10,0x02,0,0,0,0x01,0x0a,0,0x05,0,0,0,0xaa,0,0,0,0,0xa1},
+  {0xfc,0x42,0x01,0x30,0x10,0x03,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x7a},
+  {0xfc,0x62,0x01,0x30,0x10,0x03,0,0,0x04,0,0x98,0x9d,0,0,0,0,0,0,0,0,0,0x21},
+  {0xfc,0x41,0x01,0x30,0x10,0x01,0x01,0,0,0,0,0,0,0,0,0,0,0,0,0x80,0,0xfc},
+  {0xfc,0x61,0x01,0x30,0x10,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x5e},
+};
+const uint32_t kIdleGapsMs[] = {727, 113, 125, 116, 121, 120};
+
+std::vector<Packet> IdlePackets(size_t count) {
+  std::vector<Packet> packets;
+  uint32_t time_ms = 1000;
+  for (size_t i = 0; i < count; ++i) {
+    size_t step = i % kIdleCycle.size();
+    // A little timing jitter like the real capture.
+    time_ms += kIdleGapsMs[step] + (i * 7) % 5;
+    packets.push_back({static_cast<uint8_t>(step % 2), time_ms, kIdleCycle[step]});
+  }
+  return packets;
+}
+
+std::vector<Packet> Decode(const PacketJournal& journal) {
+  std::string blob;
+  journal.Snapshot(&blob);
+  std::vector<Packet> packets;
+  EXPECT_TRUE(DecodePacketJournal(
+      reinterpret_cast<const uint8_t*>(blob.data()), blob.size(),
+      [&](const JournalPacket& packet) {
+        packets.push_back({packet.interface, packet.time_ms,
+                           {packet.bytes, packet.bytes + packet.size}});
+      }));
+  return packets;
+}
+
+void Append(PacketJournal* journal, const Packet& packet) {
+  journal->Append(packet.interface, packet.time_ms, packet.bytes.data(),
+                  packet.bytes.size());
+}
+
+}  // namespace
+
+TEST(PacketJournal, Empty) {
+  PacketJournal journal;
+  EXPECT_TRUE(Decode(journal).empty());
+  EXPECT_EQ(0, journal.num_packets());
+}
+
+// * Idle polling round trips exactly, times included.
+// * Repeating cycles compress at least 10x.
+TEST(PacketJournal, IdleRoundTrip) {
+  PacketJournal journal;
+  std::vector<Packet> packets = IdlePackets(600);
+  for (const auto& packet : packets) {
+    Append(&journal, packet);
+  }
+  EXPECT_EQ(packets, Decode(journal));
+  EXPECT_EQ(600, journal.num_packets());
+  EXPECT_EQ(600 * (22 + 4), journal.raw_bytes());
+  EXPECT_GE(journal.raw_bytes() / journal.stored_bytes(), 10)
+      << journal.stored_bytes() << " bytes stored";
+}
+
+// * Changed frames are stored as deltas and decode to the new bytes.
+// * Lengths that differ from the dictionary frame fall back to literals.
+TEST(PacketJournal, DeltasAndLiterals) {
+  PacketJournal journal;
+  std::vector<Packet> packets = IdlePackets(6);
+  Packet changed = packets[1];
+  changed.time_ms += 1000;
+  changed.bytes[9] = 0x02;
+  changed.bytes[21] = 0xa0;
+  packets.push_back(changed);
+  Packet shorter = changed;
+  shorter.time_ms += 1000;
+  shorter.bytes.resize(8);
+  packets.push_back(shorter);
+  // Junk with no header still round trips.
+  packets.push_back({1, shorter.time_ms + 5, {0x12}});
+  changed.time_ms = shorter.time_ms + 10;
+  packets.push_back(changed);
+  for (const auto& packet : packets) {
+    Append(&journal, packet);
+  }
+  EXPECT_EQ(packets, Decode(journal));
+}
+
+// * Once the ring wraps, whole old chunks are dropped and what is left
+//   decodes to the newest packets.
+TEST(PacketJournal, Wraps) {
+  PacketJournal journal;
+  // Every packet distinct so nothing compresses.
+  std::vector<Packet> packets;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    std::vector<uint8_t> bytes = {0xfc, static_cast<uint8_t>(i), 0x01, 0x30,
+                                  0x02, static_cast<uint8_t>(i >> 8), 0x00, 0x00};
+    packets.push_back({0, i * 10, bytes});
+    Append(&journal, packets.back());
+  }
+
+  std::vector<Packet> decoded = Decode(journal);
+  ASSERT_FALSE(decoded.empty());
+  ASSERT_LT(decoded.size(), packets.size());
+  EXPECT_EQ(decoded.size(), journal.num_packets());
+  std::vector<Packet> newest(packets.end() - decoded.size(), packets.end());
+  EXPECT_EQ(newest, decoded);
+}
+
+// * Every chunk is handed to on_chunk_closed exactly once, and each decodes
+//   on its own. This is how chunks are stored in the FlashRing.
+TEST(PacketJournal, ClosedChunksDecodeAlone) {
+  PacketJournal journal;
+  std::vector<Packet> closed;
+  journal.set_on_chunk_closed([&](const uint8_t* chunk, size_t size) {
+    std::string blob(PacketJournal::kSnapshotMagic, 4);
+    blob += static_cast<char>(size & 0xff);
+    blob += static_cast<char>(size >> 8);
+    blob += '\1';
+    blob += '\0';
+    blob.append(reinterpret_cast<const char*>(chunk), size);
+    EXPECT_TRUE(DecodePacketJournal(
+        reinterpret_cast<const uint8_t*>(blob.data()), blob.size(),
+        [&](const JournalPacket& packet) {
+          closed.push_back({packet.interface, packet.time_ms,
+                            {packet.bytes, packet.bytes + packet.size}});
+        }));
+  });
+
+  std::vector<Packet> packets;
+  for (uint32_t i = 0; i < 300; ++i) {
+    std::vector<uint8_t> bytes = {0xfc, static_cast<uint8_t>(i), 0x01, 0x30,
+                                  0x02, static_cast<uint8_t>(i >> 8), 0x00, 0x00};
+    packets.push_back({0, i * 10, bytes});
+    Append(&journal, packets.back());
+  }
+  ASSERT_FALSE(closed.empty());
+  ASSERT_LT(closed.size(), packets.size());
+
+  journal.CloseChunk();
+  EXPECT_EQ(packets, closed);
+
+  // Nothing new to close.
+  journal.CloseChunk();
+  EXPECT_EQ(packets.size(), closed.size());
+}
+
+TEST(PacketJournal, RejectsMalformed) {
+  const uint8_t kBadMagic[] = "XXXX\0\2\0\0";
+  EXPECT_FALSE(DecodePacketJournal(kBadMagic, 8, [](const JournalPacket&) {}));
+  const uint8_t kTruncated[] = "HVJ1\0\2\1\0";
+  EXPECT_FALSE(DecodePacketJournal(kTruncated, 8, [](const JournalPacket&) {}));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,216 @@
+#include "../packet_rewriter.h"
+
+#include "../cn105_protocol.h"
+#include "../packet_forwarder.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+namespace hackvac {
+
+namespace {
+
+RewriteRule FanAutoFromTstat() {
+  RewriteRule rule;
+  rule.direction = RewriteDirection::kFromThermostat;
+  rule.packet_type = PacketType::kUpdate;
+  rule.command_type = CommandType::kSetSettings;
+  rule.action = RewriteRule::Action::kSetField;
+  rule.field = SettingsField::kFan;
+  rule.value = static_cast<uint8_t>(Fan::kAuto);
+  return rule;
+}
+
+RewriteRule ClampTempFromTstat(int min, int max) {
+  RewriteRule rule;
+  rule.direction = RewriteDirection::kFromThermostat;
+  rule.packet_type = PacketType::kUpdate;
+  rule.command_type = CommandType::kSetSettings;
+  rule.action = RewriteRule::Action::kClampTargetTemp;
+  rule.field = SettingsField::kTargetTemp;
+  rule.min_half_degrees = min * 2;
+  rule.max_half_degrees = max * 2;
+  return rule;
+}
+
+std::unique_ptr<Cn105Packet> MakeUpdate(Fan fan, HalfDegreeTemp temp) {
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(fan);
+  settings.SetTargetTemp(temp);
+  return UpdatePacket::Create(settings);
+}
+
+// An InfoAck the way the unit sends it: every field's value and no flag bits.
+std::unique_ptr<Cn105Packet> MakeUnitInfoAck(Fan fan, HalfDegreeTemp temp) {
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(Mode::kCool);
+  settings.Set(fan);
+  settings.SetTargetTemp(temp);
+  settings.Set(Vane::kAuto);
+  settings.Set(WideVane::kCenter);
+  auto packet = InfoAckPacket::Create(settings);
+  packet->data()[1] = 0x00;
+  packet->data()[2] = 0x00;
+  packet->UpdateChecksum();
+  return packet;
+}
+
+}  // namespace
+
+// * Only Update/kSetSettings and InfoAck/kSettings are supported.
+TEST(RewriteRule, IsSupported) {
+  RewriteRule rule = FanAutoFromTstat();
+  EXPECT_TRUE(rule.IsSupported());
+
+  rule.packet_type = PacketType::kInfoAck;
+  rule.command_type = CommandType::kSettings;
+  EXPECT_TRUE(rule.IsSupported());
+
+  rule.command_type = CommandType::kSetSettings;
+  EXPECT_FALSE(rule.IsSupported());
+
+  rule.packet_type = PacketType::kInfo;
+  rule.command_type = CommandType::kSettings;
+  EXPECT_FALSE(rule.IsSupported());
+
+  rule.packet_type = PacketType::kUpdateAck;
+  EXPECT_FALSE(rule.IsSupported());
+  rule.command_type = CommandType::kSetSettings;
+  EXPECT_FALSE(rule.IsSupported());
+}
+
+// * Index only reports rules for the matching direction/type/command.
+// * Rules for commands without a settings layout are dropped.
+// * Rules for packets that do not carry settings are dropped.
+TEST(CompiledRewriteRules, Index) {
+  RewriteRule extended = FanAutoFromTstat();
+  extended.command_type = CommandType::kSetExtendedSettings;
+  RewriteRule update_ack = FanAutoFromTstat();
+  update_ack.packet_type = PacketType::kUpdateAck;
+  RewriteRule info = FanAutoFromTstat();
+  info.packet_type = PacketType::kInfo;
+  info.command_type = CommandType::kSettings;
+  auto rules = CompiledRewriteRules::Compile(
+      {FanAutoFromTstat(), extended, update_ack, info});
+  EXPECT_EQ(1, rules->rules().size());
+
+  uint8_t set_settings = static_cast<uint8_t>(CommandType::kSetSettings);
+  EXPECT_TRUE(rules->HasRules(RewriteDirection::kFromThermostat,
+                              PacketType::kUpdate, set_settings));
+  EXPECT_FALSE(rules->HasRules(RewriteDirection::kFromHvac,
+                               PacketType::kUpdate, set_settings));
+  EXPECT_FALSE(rules->HasRules(RewriteDirection::kFromThermostat,
+                               PacketType::kInfoAck, set_settings));
+  EXPECT_FALSE(rules->HasRules(RewriteDirection::kFromThermostat,
+                               PacketType::kConnect, set_settings));
+  EXPECT_FALSE(rules->HasRules(RewriteDirection::kFromThermostat,
+                               PacketType::kUpdate, 0xff));
+}
+
+// * Matching rules rewrite fields and fix the checksum.
+// * Non-matching packets are untouched.
+TEST(CompiledRewriteRules, Apply) {
+  auto rules = CompiledRewriteRules::Compile(
+      {FanAutoFromTstat(), ClampTempFromTstat(18, 24)});
+
+  auto packet = MakeUpdate(Fan::kPower3, HalfDegreeTemp(28, false));
+  EXPECT_TRUE(rules->Apply(RewriteDirection::kFromThermostat, packet.get()));
+  EXPECT_TRUE(packet->IsChecksumValid());
+  HvacSettings settings(packet->data());
+  EXPECT_EQ(Fan::kAuto, settings.Get<Fan>());
+  EXPECT_EQ(HalfDegreeTemp(24, false), settings.GetTargetTemp());
+  EXPECT_EQ(Power::kOn, settings.Get<Power>());
+
+  // Already compliant.
+  packet = MakeUpdate(Fan::kAuto, HalfDegreeTemp(20, true));
+  EXPECT_FALSE(rules->Apply(RewriteDirection::kFromThermostat, packet.get()));
+
+  // Wrong direction.
+  packet = MakeUpdate(Fan::kPower3, HalfDegreeTemp(28, false));
+  auto original = packet->Clone();
+  EXPECT_FALSE(rules->Apply(RewriteDirection::kFromHvac, packet.get()));
+  EXPECT_EQ(original->raw_bytes_str(), packet->raw_bytes_str());
+}
+
+// * InfoAck fields are rewritten by position though no flag bits are set.
+// * The flag bytes stay zero.
+TEST(CompiledRewriteRules, ApplyInfoAck) {
+  RewriteRule fan = FanAutoFromTstat();
+  RewriteRule clamp = ClampTempFromTstat(18, 24);
+  for (RewriteRule* rule : {&fan, &clamp}) {
+    rule->direction = RewriteDirection::kFromHvac;
+    rule->packet_type = PacketType::kInfoAck;
+    rule->command_type = CommandType::kSettings;
+  }
+  auto rules = CompiledRewriteRules::Compile({fan, clamp});
+
+  auto packet = MakeUnitInfoAck(Fan::kPower3, HalfDegreeTemp(28, true));
+  EXPECT_TRUE(rules->Apply(RewriteDirection::kFromHvac, packet.get()));
+  EXPECT_TRUE(packet->IsChecksumValid());
+  EXPECT_EQ(0x00, packet->data()[1]);
+  EXPECT_EQ(0x00, packet->data()[2]);
+
+  auto settings = InfoAckPacket(packet.get()).settings();
+  ASSERT_TRUE(settings);
+  EXPECT_EQ(Fan::kAuto, settings->Get<Fan>());
+  EXPECT_EQ(HalfDegreeTemp(24, false), settings->GetTargetTemp());
+  EXPECT_EQ(Power::kOn, settings->Get<Power>());
+  EXPECT_EQ(Mode::kCool, settings->Get<Mode>());
+  EXPECT_EQ(WideVane::kCenter, settings->Get<WideVane>());
+
+  // Already compliant.
+  packet = MakeUnitInfoAck(Fan::kAuto, HalfDegreeTemp(20, true));
+  EXPECT_FALSE(rules->Apply(RewriteDirection::kFromHvac, packet.get()));
+}
+
+// * Snapshots taken before SetRules() keep the old rules.
+TEST(PacketRewriter, SnapshotSwap) {
+  PacketRewriter rewriter;
+  auto before = rewriter.Snapshot();
+  EXPECT_TRUE(before->rules().empty());
+
+  rewriter.SetRules({FanAutoFromTstat()});
+  EXPECT_TRUE(before->rules().empty());
+  EXPECT_EQ(1, rewriter.Snapshot()->rules().size());
+}
+
+// * Cut-through holds only packets that have matching rules.
+// * The held packet is released rewritten with a valid checksum.
+TEST(PacketRewriter, CutThrough) {
+  PacketRewriter rewriter;
+  rewriter.SetRules({FanAutoFromTstat()});
+
+  std::vector<uint8_t> written;
+  CutThroughForwarder forwarder(
+      [&](const uint8_t* bytes, size_t size) {
+        written.insert(written.end(), bytes, bytes + size);
+      },
+      &rewriter, RewriteDirection::kFromThermostat);
+
+  auto update = MakeUpdate(Fan::kPower3, HalfDegreeTemp(20, false));
+  const uint8_t* raw = update->raw_bytes();
+
+  // Header and command byte flow through, the rest is held.
+  forwarder.OnBytes(raw, 8);
+  EXPECT_EQ(6, written.size());
+  forwarder.OnBytes(raw + 8, update->raw_bytes_size() - 8);
+  ASSERT_EQ(update->raw_bytes_size(), written.size());
+  EXPECT_EQ(1, forwarder.rewritten_packets());
+
+  Cn105Packet result;
+  for (uint8_t byte : written) {
+    result.AppendByte(byte);
+  }
+  EXPECT_TRUE(result.IsChecksumValid());
+  EXPECT_EQ(Fan::kAuto, HvacSettings(result.data()).Get<Fan>());
+
+  // Packets without rules are not held.
+  written.clear();
+  auto connect = ConnectPacket::Create();
+  forwarder.OnBytes(connect->raw_bytes(), connect->raw_bytes_size() - 1);
+  EXPECT_EQ(connect->raw_bytes_size() - 1, written.size());
+}
+
+}  // namespace hackvac
@@ -0,0 +1,72 @@
+#include "../rtt_estimator.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+// * A 22 byte packet takes about 100ms at 2400 baud 8E1.
+// * Before any samples, the timeout is twice the wire time.
+TEST(RttEstimator, InitialTimeoutFromWireTime) {
+  EXPECT_EQ(microseconds(100833), RttEstimator::WireTime(22));
+
+  RttEstimator rtt;
+  rtt.SetFrameSizes(22, 22);
+  EXPECT_EQ(RttEstimator::WireTime(44), rtt.floor());
+  EXPECT_EQ(2 * rtt.floor(), rtt.timeout());
+}
+
+// * Steady samples converge the timeout toward the floor.
+// * Jittery samples widen it.
+// * The timeout never drops below the wire time.
+TEST(RttEstimator, Converges) {
+  RttEstimator steady;
+  steady.SetFrameSizes(22, 22);
+  for (int i = 0; i < 50; ++i) {
+    steady.AddSample(milliseconds(230));
+  }
+  EXPECT_NEAR(230000, steady.srtt().count(), 1000);
+  EXPECT_LT(steady.rttvar(), milliseconds(2));
+  EXPECT_EQ(steady.srtt() + RttEstimator::kGranularity, steady.timeout());
+
+  RttEstimator jittery;
+  jittery.SetFrameSizes(22, 22);
+  for (int i = 0; i < 50; ++i) {
+    jittery.AddSample(milliseconds(i % 2 ? 210 : 290));
+  }
+  EXPECT_GT(jittery.timeout(), steady.timeout());
+  EXPECT_EQ(50, jittery.histogram().count());
+
+  RttEstimator fast;
+  fast.SetFrameSizes(22, 22);
+  for (int i = 0; i < 50; ++i) {
+    fast.AddSample(milliseconds(1));
+  }
+  EXPECT_EQ(fast.floor(), fast.timeout());
+}
+
+// * Timeouts double the timeout up to kMaxTimeout.
+// * A good sample resets the backoff.
+TEST(RttEstimator, TimeoutBacksOff) {
+  RttEstimator rtt;
+  rtt.SetFrameSizes(8, 7);
+  rtt.AddSample(milliseconds(100));
+  RttEstimator::Duration base = rtt.timeout();
+
+  rtt.OnTimeout();
+  EXPECT_EQ(2 * base, rtt.timeout());
+  rtt.OnTimeout();
+  EXPECT_EQ(4 * base, rtt.timeout());
+  for (int i = 0; i < 10; ++i) {
+    rtt.OnTimeout();
+  }
+  EXPECT_EQ(RttEstimator::kMaxTimeout, rtt.timeout());
+  EXPECT_EQ(12, rtt.timeouts());
+
+  rtt.AddSample(milliseconds(100));
+  EXPECT_LT(rtt.timeout(), 2 * base);
+}
+
+}  // namespace hackvac
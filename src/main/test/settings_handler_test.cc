@@ -0,0 +1,214 @@
+#include "../settings_handler.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+struct SentReply {
+  int status;
+  std::string headers;
+  std::string body;
+};
+
+// Stands in for esp_cxx::HttpResponse. Copies share |replies| and compare
+// equal when they are for the same connection.
+class FakeResponse {
+ public:
+  FakeResponse(int connection, std::vector<SentReply>* replies)
+    : connection_(connection), replies_(replies) {}
+
+  void Send(int status, size_t size, const char* headers, std::string_view body) {
+    EXPECT_EQ(size, body.size());
+    replies_->push_back({status, headers, std::string(body)});
+  }
+  void SendError(int status, const char* message) {
+    replies_->push_back({status, "", message ? message : ""});
+  }
+  bool operator==(const FakeResponse& other) const {
+    return connection_ == other.connection_;
+  }
+
+ private:
+  int connection_;
+  std::vector<SentReply>* replies_;
+};
+
+// The quoted tag from an ETag header.
+std::string ETagOf(const SentReply& reply) {
+  size_t pos = reply.headers.find("ETag: ");
+  return pos == std::string::npos ? std::string() : reply.headers.substr(pos + 6);
+}
+
+}  // namespace
+
+class SettingsHandlerTest : public testing::Test {
+ protected:
+  FakeResponse Connection(int connection) {
+    return FakeResponse(connection, &replies_[connection]);
+  }
+
+  // An ETag for the current settings.
+  std::string Fetch() {
+    handler_.Get({}, {}, Connection(0));
+    EXPECT_EQ(200, replies_[0].back().status);
+    return ETagOf(replies_[0].back());
+  }
+
+  // Changes the desired fan and runs the handler's queued work.
+  void ChangeSettings(Fan fan) {
+    StoredHvacSettings update;
+    update.Set(fan);
+    controller_.MergeSettings(update);
+    RunNetworkTask();
+  }
+
+  void RunNetworkTask() {
+    net_event_manager_.Run([=] { net_event_manager_.Quit(); });
+    net_event_manager_.Loop();
+  }
+
+  // Never run, so Updates queued by MergeSettings() stay queued.
+  esp_cxx::QueueSetEventManager controller_event_manager_{10};
+  Controller controller_{&controller_event_manager_, nullptr};
+
+  esp_cxx::QueueSetEventManager net_event_manager_{10};
+  SettingsHandler<FakeResponse> handler_{&controller_, &net_event_manager_, 0x5eed};
+
+  std::map<int, std::vector<SentReply>> replies_;
+};
+
+// * A matching If-None-Match gets an empty 304 with the same ETag.
+// * A stale one gets the settings.
+TEST_F(SettingsHandlerTest, ConditionalGet) {
+  std::string etag = Fetch();
+  EXPECT_EQ("\"5eed-0-0\"", etag);
+  EXPECT_EQ(0, replies_[0][0].body.find("{\"settings\":"));
+
+  handler_.Get(etag, {}, Connection(1));
+  ASSERT_EQ(1, replies_[1].size());
+  EXPECT_EQ(304, replies_[1][0].status);
+  EXPECT_EQ("", replies_[1][0].body);
+  EXPECT_EQ(etag, ETagOf(replies_[1][0]));
+
+  ChangeSettings(Fan::kQuiet);
+  handler_.Get(etag, {}, Connection(1));
+  ASSERT_EQ(2, replies_[1].size());
+  EXPECT_EQ(200, replies_[1][1].status);
+  EXPECT_NE(etag, ETagOf(replies_[1][1]));
+  EXPECT_NE(std::string::npos, replies_[1][1].body.find("\"fan\":1"));
+}
+
+// * A current If-None-Match with a wait is held, not answered.
+// * A change answers it with the new settings.
+// * A stale If-None-Match is answered at once despite the wait.
+TEST_F(SettingsHandlerTest, WaitWokenByChange) {
+  std::string etag = Fetch();
+  handler_.Get(etag, 30, Connection(1));
+  handler_.Get({}, 30, Connection(2));
+  EXPECT_EQ(2, handler_.num_waiters());
+  RunNetworkTask();
+  EXPECT_TRUE(replies_[1].empty());
+  EXPECT_TRUE(replies_[2].empty());
+
+  ChangeSettings(Fan::kQuiet);
+  EXPECT_EQ(0, handler_.num_waiters());
+  for (int connection : {1, 2}) {
+    ASSERT_EQ(1, replies_[connection].size());
+    EXPECT_EQ(200, replies_[connection][0].status);
+    EXPECT_NE(etag, ETagOf(replies_[connection][0]));
+  }
+
+  handler_.Get(etag, 30, Connection(3));
+  EXPECT_EQ(0, handler_.num_waiters());
+  ASSERT_EQ(1, replies_[3].size());
+  EXPECT_EQ(200, replies_[3][0].status);
+}
+
+// * A wait that runs out unchanged is a 304, or the settings if the
+//   request had no If-None-Match.
+TEST_F(SettingsHandlerTest, WaitTimesOut) {
+  std::string etag = Fetch();
+  handler_.Get(etag, 1, Connection(1));
+  handler_.Get({}, 1, Connection(2));
+  ASSERT_EQ(2, handler_.num_waiters());
+
+  handler_.OnWaitExpired(0);
+  handler_.OnWaitExpired(1);
+  EXPECT_EQ(0, handler_.num_waiters());
+  ASSERT_EQ(1, replies_[1].size());
+  EXPECT_EQ(304, replies_[1][0].status);
+  ASSERT_EQ(1, replies_[2].size());
+  EXPECT_EQ(200, replies_[2][0].status);
+  EXPECT_EQ(etag, ETagOf(replies_[2][0]));
+
+  // Expiring an answered waiter again does nothing.
+  handler_.OnWaitExpired(0);
+  EXPECT_EQ(1, replies_[1].size());
+}
+
+// * Past kMaxWaiters a request is answered right away.
+TEST_F(SettingsHandlerTest, FifthWaiterAnsweredNow) {
+  std::string etag = Fetch();
+  for (int connection = 1; connection <= 4; ++connection) {
+    handler_.Get(etag, 30, Connection(connection));
+  }
+  EXPECT_EQ(4, handler_.num_waiters());
+
+  handler_.Get(etag, 30, Connection(5));
+  EXPECT_EQ(4, handler_.num_waiters());
+  ASSERT_EQ(1, replies_[5].size());
+  EXPECT_EQ(304, replies_[5][0].status);
+}
+
+// * A held request whose connection closes is never written to.
+// * Its slot is free for the next one.
+TEST_F(SettingsHandlerTest, CloseDropsWaiter) {
+  std::string etag = Fetch();
+  handler_.Get(etag, 30, Connection(1));
+  handler_.Get(etag, 30, Connection(2));
+  handler_.OnClose(Connection(1));
+  EXPECT_EQ(1, handler_.num_waiters());
+
+  // Closing a connection with nothing held is harmless.
+  handler_.OnClose(Connection(9));
+  EXPECT_EQ(1, handler_.num_waiters());
+
+  for (int connection = 3; connection <= 5; ++connection) {
+    handler_.Get(etag, 30, Connection(connection));
+  }
+  EXPECT_EQ(4, handler_.num_waiters());
+
+  ChangeSettings(Fan::kQuiet);
+  EXPECT_TRUE(replies_[1].empty());
+  for (int connection = 2; connection <= 5; ++connection) {
+    EXPECT_EQ(1, replies_[connection].size());
+  }
+}
+
+// * PUT merges the listed fields and replies with the result.
+// * Bad bodies, out of range values and bad waits are rejected.
+TEST_F(SettingsHandlerTest, PutAndErrors) {
+  handler_.Put(R"({"settings":{"fan":1}})", Connection(1));
+  ASSERT_EQ(1, replies_[1].size());
+  EXPECT_EQ(200, replies_[1][0].status);
+  EXPECT_EQ("\"5eed-1-0\"", ETagOf(replies_[1][0]));
+  EXPECT_EQ(Fan::kQuiet, controller_.GetSettings().Get<Fan>());
+
+  handler_.Put("{", Connection(2));
+  handler_.Put(R"({"settings":{"temp":35}})", Connection(2));
+  handler_.Put(R"({"settings":{"mode":5}})", Connection(2));
+  handler_.Get({}, -1, Connection(2));
+  ASSERT_EQ(4, replies_[2].size());
+  for (const SentReply& reply : replies_[2]) {
+    EXPECT_EQ(400, reply.status);
+  }
+  EXPECT_EQ(Fan::kQuiet, controller_.GetSettings().Get<Fan>());
+}
+
+}  // namespace hackvac
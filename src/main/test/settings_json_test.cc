@@ -0,0 +1,162 @@
+#include "../settings_json.h"
+
+#include <chrono>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+StoredHvacSettings MakeFullSettings() {
+  StoredHvacSettings settings;
+  settings.Set(Power::kOn);
+  settings.Set(Mode::kCool);
+  settings.SetTargetTemp(HalfDegreeTemp(22, true));
+  settings.Set(Fan::kPower2);
+  settings.Set(Vane::kSwing);
+  settings.Set(WideVane::kFarRight);
+  return settings;
+}
+
+std::string Write(const HvacSettings& settings, const ExtendedSettings& extended) {
+  char buf[kMaxSettingsJsonSize];
+  size_t len = WriteSettingsJson(settings, 12, extended, 4, buf, sizeof(buf));
+  return std::string(buf, len);
+}
+
+}  // namespace
+
+TEST(SettingsJson, Write) {
+  StoredExtendedSettings extended;
+  extended.SetRoomTemp(HalfDegreeTemp(21, false));
+  EXPECT_EQ(R"({"settings":{"power":1,"mode":3,"temp":22.5,"fan":3,"vane":7,)"
+            R"("wide_vane":5},"extended":{"room_temp":21},"generation":12,)"
+            R"("extended_generation":4})",
+            Write(MakeFullSettings(), extended));
+  EXPECT_EQ(R"({"settings":{},"extended":{},"generation":12,"extended_generation":4})",
+            Write(StoredHvacSettings(), StoredExtendedSettings()));
+
+  char small[16];
+  EXPECT_EQ(0, WriteSettingsJson(MakeFullSettings(), 1, extended, 1, small, sizeof(small)));
+}
+
+// * What is written parses back to the same settings.
+TEST(SettingsJson, RoundTrip) {
+  StoredHvacSettings settings = MakeFullSettings();
+  StoredExtendedSettings extended;
+  extended.SetRoomTemp(HalfDegreeTemp(19, true));
+
+  StoredHvacSettings parsed;
+  StoredExtendedSettings parsed_extended;
+  ASSERT_TRUE(ParseSettingsJson(Write(settings, extended), &parsed, &parsed_extended));
+  EXPECT_EQ(settings, parsed);
+  EXPECT_EQ(extended, parsed_extended);
+}
+
+// * Only the listed fields are set.
+// * Whitespace and trailing zeros are fine.
+TEST(SettingsJson, ParsePartial) {
+  StoredHvacSettings settings;
+  StoredExtendedSettings extended;
+  ASSERT_TRUE(ParseSettingsJson(" { \"settings\" : { \"temp\" : 21.50 , \"fan\":0 } }\n",
+                                &settings, &extended));
+  EXPECT_EQ(ToMask(SettingsField::kTargetTemp) | ToMask(SettingsField::kFan),
+            settings.present_fields());
+  EXPECT_EQ(HalfDegreeTemp(21, true), settings.GetTargetTemp());
+  EXPECT_EQ(Fan::kAuto, settings.Get<Fan>());
+  EXPECT_EQ(0, extended.present_fields());
+
+  ASSERT_TRUE(ParseSettingsJson(R"({"extended":{"room_temp":20.0}})", &settings, &extended));
+  EXPECT_EQ(HalfDegreeTemp(20, false), extended.GetRoomTemp());
+  ASSERT_TRUE(ParseSettingsJson("{}", &settings, &extended));
+}
+
+// * Temperatures at the ends of their ranges are accepted.
+TEST(SettingsJson, ParseLimits) {
+  StoredHvacSettings settings;
+  StoredExtendedSettings extended;
+  ASSERT_TRUE(ParseSettingsJson(R"({"settings":{"temp":16}})", &settings, &extended));
+  EXPECT_EQ(HvacSettings::kMinTemp, settings.GetTargetTemp());
+  ASSERT_TRUE(ParseSettingsJson(R"({"settings":{"temp":31}})", &settings, &extended));
+  EXPECT_EQ(HvacSettings::kMaxTemp, settings.GetTargetTemp());
+  ASSERT_TRUE(ParseSettingsJson(R"({"extended":{"room_temp":10}})", &settings, &extended));
+  EXPECT_EQ(ExtendedSettings::kMinRoomTemp, extended.GetRoomTemp());
+  ASSERT_TRUE(ParseSettingsJson(R"({"extended":{"room_temp":41}})", &settings, &extended));
+  EXPECT_EQ(ExtendedSettings::kMaxRoomTemp, extended.GetRoomTemp());
+}
+
+TEST(SettingsJson, ParseRejects) {
+  for (const char* json : {
+           "",
+           "[]",
+           R"({"settings":{"temp":22.5})",
+           R"({"settings":{"temp":22.5}} x)",
+           R"({"settings":{"temp":22.5},})",
+           R"({"settings":{"temp":22.25}})",
+           R"({"settings":{"temp":-1}})",
+           R"({"settings":{"temp":2.2e1}})",
+           R"({"settings":{"power":0.5}})",
+           R"({"settings":{"power":256}})",
+           R"({"settings":{"power":2}})",
+           R"({"settings":{"mode":4}})",
+           R"({"settings":{"fan":7}})",
+           R"({"settings":{"vane":6}})",
+           R"({"settings":{"wide_vane":0}})",
+           R"({"settings":{"temp":15.5}})",
+           R"({"settings":{"temp":31.5}})",
+           R"({"extended":{"room_temp":9.5}})",
+           R"({"extended":{"room_temp":41.5}})",
+           R"({"settings":{"power":"on"}})",
+           R"({"settings":{"room_temp":20}})",
+           R"({"settings":{"bogus":1}})",
+           R"({"other":{}})",
+           R"({"generation":"1"})",
+       }) {
+    StoredHvacSettings settings;
+    StoredExtendedSettings extended;
+    EXPECT_FALSE(ParseSettingsJson(json, &settings, &extended)) << json;
+  }
+}
+
+// Handler throughput for /api/settings without the network: a GET
+// serializes both settings and a PUT parses a full body. Disabled by
+// default; run with --gtest_also_run_disabled_tests and read the results
+// from the test properties in --gtest_output.
+TEST(SettingsJson, DISABLED_Benchmark) {
+  using Clock = std::chrono::steady_clock;
+  static constexpr int kIterations = 200000;
+  StoredHvacSettings settings = MakeFullSettings();
+  StoredExtendedSettings extended;
+  extended.SetRoomTemp(HalfDegreeTemp(21, false));
+
+  char buf[kMaxSettingsJsonSize];
+  size_t total_bytes = 0;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    total_bytes += WriteSettingsJson(settings, 12, extended, 4, buf, sizeof(buf));
+  }
+  Clock::duration get_time = Clock::now() - start;
+
+  std::string body = Write(settings, extended);
+  int parsed = 0;
+  start = Clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    StoredHvacSettings update;
+    StoredExtendedSettings extended_update;
+    parsed += ParseSettingsJson(body, &update, &extended_update);
+  }
+  Clock::duration put_time = Clock::now() - start;
+
+  auto per_sec = [](Clock::duration elapsed) {
+    return static_cast<int>(kIterations / std::chrono::duration<double>(elapsed).count());
+  };
+  EXPECT_EQ(body.size() * kIterations, total_bytes);
+  EXPECT_EQ(kIterations, parsed);
+  RecordProperty("get_per_s", per_sec(get_time));
+  RecordProperty("put_per_s", per_sec(put_time));
+  RecordProperty("body_bytes", static_cast<int>(body.size()));
+}
+
+}  // namespace hackvac
@@ -0,0 +1,63 @@
+#include "../settings_store.h"
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+SettingsStore::Contents MakeContents() {
+  SettingsStore::Contents contents;
+  contents.desired.Set(Fan::kQuiet);
+  contents.desired.SetTargetTemp(HalfDegreeTemp(21, true));
+  contents.reported.Set(Power::kOn);
+  contents.reported.Set(Mode::kHeat);
+  contents.reported.Set(Fan::kAuto);
+  return contents;
+}
+
+}  // namespace
+
+// * Nothing stored loads as false.
+// * Saved contents load back field for field.
+TEST(SettingsStore, SaveAndLoad) {
+  SettingsStore store;
+  SettingsStore::Contents loaded;
+  EXPECT_FALSE(store.Load(&loaded));
+
+  SettingsStore::Contents contents = MakeContents();
+  ASSERT_TRUE(store.Save(contents));
+  ASSERT_TRUE(store.Load(&loaded));
+  EXPECT_EQ(contents.desired, loaded.desired);
+  EXPECT_EQ(contents.desired.present_fields(), loaded.desired.present_fields());
+  EXPECT_EQ(contents.reported, loaded.reported);
+  EXPECT_EQ(contents.reported.present_fields(), loaded.reported.present_fields());
+}
+
+// * Truncated, padded, or wrong version blobs are rejected without touching
+//   the output.
+TEST(SettingsStore, DecodeRejectsBadBlobs) {
+  std::vector<uint8_t> blob = SettingsStore::Encode(MakeContents());
+
+  SettingsStore::Contents untouched;
+  untouched.desired.Set(Power::kOff);
+
+  SettingsStore::Contents out = untouched;
+  EXPECT_FALSE(SettingsStore::Decode(blob.data(), blob.size() - 1, &out));
+  EXPECT_EQ(untouched.desired, out.desired);
+
+  std::vector<uint8_t> padded = blob;
+  padded.push_back(0);
+  EXPECT_FALSE(SettingsStore::Decode(padded.data(), padded.size(), &out));
+
+  std::vector<uint8_t> versioned = blob;
+  versioned[0]++;
+  EXPECT_FALSE(SettingsStore::Decode(versioned.data(), versioned.size(), &out));
+  EXPECT_FALSE(SettingsStore::Decode(nullptr, 0, &out));
+  EXPECT_EQ(untouched.desired, out.desired);
+
+  EXPECT_TRUE(SettingsStore::Decode(blob.data(), blob.size(), &out));
+  EXPECT_EQ(MakeContents().desired, out.desired);
+}
+
+}  // namespace hackvac
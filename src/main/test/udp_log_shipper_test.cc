@@ -0,0 +1,235 @@
+#include "../udp_log_shipper.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace hackvac {
+
+namespace {
+
+constexpr uint32_t kBootId = 7;
+
+uint16_t ReadU16(const std::vector<uint8_t>& data, size_t pos) {
+  return data[pos] | (data[pos + 1] << 8);
+}
+
+uint32_t ReadU32(const std::vector<uint8_t>& data, size_t pos) {
+  return data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) |
+      (static_cast<uint32_t>(data[pos + 3]) << 24);
+}
+
+struct Record {
+  uint8_t type;
+  char level;
+  uint32_t sequence;
+  uint32_t time_ms;
+  std::string payload;
+};
+
+std::vector<Record> Records(const std::vector<uint8_t>& datagram) {
+  std::vector<Record> records;
+  size_t pos = UdpLogShipper::kHeaderSize;
+  for (uint16_t i = 0; i < ReadU16(datagram, 2); ++i) {
+    uint16_t size = ReadU16(datagram, pos + 2);
+    records.push_back({datagram[pos], static_cast<char>(datagram[pos + 1]),
+                       ReadU32(datagram, pos + 4), ReadU32(datagram, pos + 8),
+                       std::string(datagram.begin() + pos + UdpLogShipper::kRecordHeaderSize,
+                                   datagram.begin() + pos + UdpLogShipper::kRecordHeaderSize + size)});
+    pos += UdpLogShipper::kRecordHeaderSize + size;
+  }
+  EXPECT_EQ(datagram.size(), pos);
+  return records;
+}
+
+class FakeShipper : public UdpLogShipper {
+ public:
+  explicit FakeShipper(Config config) : UdpLogShipper(config, kBootId) {}
+
+  bool SendDatagram(const uint8_t* data, size_t size) override {
+    if (is_network_down) {
+      return false;
+    }
+    sent.emplace_back(data, data + size);
+    return true;
+  }
+
+  void Log(uint32_t sequence, uint32_t time_ms, const std::string& text) {
+    OnEvent({sequence, time_ms, 'W', text.data(), text.size(), 0});
+  }
+
+  std::vector<std::vector<uint8_t>> sent;
+  bool is_network_down = false;
+};
+
+}  // namespace
+
+// * Events wait for max_delay_ms and then go out together in one datagram.
+// * The header carries version, count, sequence and boot id.
+TEST(UdpLogShipper, PacksRecordsUntilDelay) {
+  FakeShipper shipper(UdpLogShipper::Config{});
+  shipper.Log(1, 100, "W (100) a: one");
+  shipper.Log(2, 150, "W (150) a: two");
+  shipper.OnBatchDone(200);
+  EXPECT_TRUE(shipper.sent.empty());
+
+  shipper.Log(3, 900, "W (900) a: three");
+  shipper.OnBatchDone(1100);
+  ASSERT_EQ(1, shipper.sent.size());
+  const auto& datagram = shipper.sent[0];
+  EXPECT_EQ(UdpLogShipper::kVersion, datagram[0]);
+  EXPECT_EQ(3, ReadU16(datagram, 2));
+  EXPECT_EQ(0, ReadU32(datagram, 4));
+  EXPECT_EQ(kBootId, ReadU32(datagram, 8));
+  EXPECT_EQ(0, ReadU32(datagram, 12));
+
+  auto records = Records(datagram);
+  ASSERT_EQ(3, records.size());
+  EXPECT_EQ(1, records[0].type);
+  EXPECT_EQ('W', records[0].level);
+  EXPECT_EQ(2, records[1].sequence);
+  EXPECT_EQ(900, records[2].time_ms);
+  EXPECT_EQ("W (900) a: three", records[2].payload);
+  EXPECT_EQ(3, shipper.stats().records);
+  EXPECT_EQ(1, shipper.stats().datagrams_sent);
+}
+
+// * A datagram that would pass max_datagram_bytes is closed right away.
+// * Sends are limited to the configured rate after the burst.
+TEST(UdpLogShipper, FullDatagramsAreRateLimited) {
+  UdpLogShipper::Config config;
+  config.max_datagram_bytes = 128;
+  config.datagrams_per_sec = 2;
+  config.burst = 1;
+  FakeShipper shipper(config);
+
+  std::string line(50, 'x');
+  for (uint32_t i = 0; i < 8; ++i) {
+    shipper.Log(i, 0, line);
+  }
+  // 16 + 2 * (12 + 50) = 140 > 128, so one record per datagram. The last is
+  // still open.
+  EXPECT_EQ(7, shipper.num_queued());
+
+  shipper.OnBatchDone(0);
+  EXPECT_EQ(1, shipper.sent.size());
+  shipper.OnBatchDone(250);
+  EXPECT_EQ(1, shipper.sent.size());
+  shipper.OnBatchDone(500);
+  EXPECT_EQ(2, shipper.sent.size());
+  shipper.OnBatchDone(1500);
+  EXPECT_EQ(3, shipper.sent.size());
+  for (size_t i = 0; i < shipper.sent.size(); ++i) {
+    EXPECT_EQ(i, ReadU32(shipper.sent[i], 4));
+    EXPECT_LE(shipper.sent[i].size(), config.max_datagram_bytes);
+  }
+}
+
+// * Rate and burst are clamped to 1 to kMaxRate.
+TEST(UdpLogShipper, SetRateClamps) {
+  FakeShipper shipper(UdpLogShipper::Config{});
+  shipper.SetRate(0, 0);
+  EXPECT_EQ(1, shipper.config().datagrams_per_sec);
+  EXPECT_EQ(1, shipper.config().burst);
+  shipper.SetRate(1000, 5000000);
+  EXPECT_EQ(UdpLogShipper::kMaxRate, shipper.config().datagrams_per_sec);
+  EXPECT_EQ(UdpLogShipper::kMaxRate, shipper.config().burst);
+}
+
+// * Failed sends stay queued without using a sequence number.
+// * A full queue drops the oldest datagram and the next datagram sent
+//   reports the lost records.
+TEST(UdpLogShipper, SurvivesNetworkOutage) {
+  UdpLogShipper::Config config;
+  config.max_datagram_bytes = 64;
+  config.max_queued_datagrams = 3;
+  FakeShipper shipper(config);
+
+  shipper.Log(1, 0, "first");
+  shipper.OnBatchDone(0);
+  shipper.OnBatchDone(1000);
+  ASSERT_EQ(1, shipper.sent.size());
+
+  shipper.is_network_down = true;
+  for (uint32_t i = 2; i < 7; ++i) {
+    shipper.Log(i, 1000, std::string(40, 'a' + i));
+  }
+  shipper.OnBatchDone(3000);
+  EXPECT_EQ(1, shipper.sent.size());
+  EXPECT_GT(shipper.stats().send_errors, 0);
+  EXPECT_EQ(3, shipper.num_queued());
+  EXPECT_EQ(2, shipper.stats().datagrams_dropped);
+  EXPECT_EQ(2, shipper.stats().records_dropped);
+
+  shipper.is_network_down = false;
+  shipper.OnBatchDone(4000);
+  ASSERT_EQ(4, shipper.sent.size());
+  EXPECT_EQ(1, ReadU32(shipper.sent[1], 4));
+  EXPECT_EQ(2, ReadU32(shipper.sent[1], 12));
+  EXPECT_EQ(4, Records(shipper.sent[1])[0].sequence);
+  EXPECT_EQ(0, ReadU32(shipper.sent[2], 12));
+  EXPECT_EQ(3, ReadU32(shipper.sent[3], 4));
+}
+
+TEST(UdpLogShipper, Telemetry) {
+  FakeShipper shipper(UdpLogShipper::Config{});
+  const UdpLogShipper::TelemetryValue values[] = {
+    {"heap", 123456},
+    {"a_name_that_is_much_too_long_to_be_sent", 1},
+    {"rssi", -61},
+  };
+  shipper.AddTelemetry(5000, values, 3);
+  shipper.OnBatchDone(6000);
+  ASSERT_EQ(1, shipper.sent.size());
+
+  auto records = Records(shipper.sent[0]);
+  ASSERT_EQ(1, records.size());
+  EXPECT_EQ(2, records[0].type);
+  EXPECT_EQ(5000, records[0].time_ms);
+  std::vector<uint8_t> payload(records[0].payload.begin(), records[0].payload.end());
+  ASSERT_EQ(2 * (1 + 4 + 4), payload.size());
+  EXPECT_EQ("heap", records[0].payload.substr(1, 4));
+  EXPECT_EQ(123456, ReadU32(payload, 5));
+  EXPECT_EQ("rssi", records[0].payload.substr(10, 4));
+  EXPECT_EQ(-61, static_cast<int32_t>(ReadU32(payload, 14)));
+}
+
+TEST(UdpLogShipper, SendsOverLoopback) {
+  int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(receiver, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, bind(receiver, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+  socklen_t address_size = sizeof(address);
+  ASSERT_EQ(0, getsockname(receiver, reinterpret_cast<sockaddr*>(&address), &address_size));
+
+  UdpLogShipper shipper(UdpLogShipper::Config{}, kBootId);
+  EXPECT_FALSE(shipper.Open("not.an.address", 1));
+  EXPECT_FALSE(shipper.is_open());
+  ASSERT_TRUE(shipper.Open("127.0.0.1", ntohs(address.sin_port)));
+  // A bad address leaves the working socket in place.
+  EXPECT_FALSE(shipper.Open("not.an.address", 1));
+  EXPECT_TRUE(shipper.is_open());
+  EXPECT_EQ("127.0.0.1", shipper.host());
+  std::string text = "E (1) a: over the wire";
+  shipper.OnEvent({1, 1, 'E', text.data(), text.size(), 0});
+  shipper.OnBatchDone(2000);
+  EXPECT_EQ(1, shipper.stats().datagrams_sent);
+
+  uint8_t buf[1500];
+  ssize_t size = recv(receiver, buf, sizeof(buf), 0);
+  close(receiver);
+  ASSERT_EQ(shipper.stats().bytes_sent, size);
+  auto records = Records(std::vector<uint8_t>(buf, buf + size));
+  ASSERT_EQ(1, records.size());
+  EXPECT_EQ(text, records[0].payload);
+}
+
+}  // namespace hackvac
@@ -0,0 +1,209 @@
+#include "udp_log_shipper.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "esp_cxx/logging.h"
+
+#ifndef FAKE_ESP_IDF
+#include "lwip/sockets.h"
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace hackvac {
+
+namespace {
+
+constexpr char kTag[] = "udplog";
+
+constexpr size_t kMaxTelemetryName = 32;
+
+void WriteU16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xff;
+  out[1] = value >> 8;
+}
+
+void WriteU32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+}  // namespace
+
+constexpr uint8_t UdpLogShipper::kVersion;
+constexpr size_t UdpLogShipper::kHeaderSize;
+constexpr size_t UdpLogShipper::kRecordHeaderSize;
+constexpr uint32_t UdpLogShipper::kMaxRate;
+
+UdpLogShipper::UdpLogShipper(Config config, uint32_t boot_id)
+  : config_(config),
+    boot_id_(boot_id) {
+}
+
+UdpLogShipper::~UdpLogShipper() {
+  Close();
+}
+
+bool UdpLogShipper::Open(const std::string& host, uint16_t port) {
+  // Everything is checked before the current socket is closed so a bad
+  // PUT leaves shipping as it was.
+  in_addr address;
+  if (inet_pton(AF_INET, host.c_str(), &address) != 1) {
+    ESP_LOGW(kTag, "Not an IPv4 address: %s", host.c_str());
+    return false;
+  }
+  int new_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (new_socket < 0) {
+    ESP_LOGW(kTag, "No socket for %s:%u", host.c_str(), port);
+    return false;
+  }
+  // A full send buffer during a Wifi outage must never stall the network
+  // task. The datagram stays queued instead.
+  fcntl(new_socket, F_SETFL, fcntl(new_socket, F_GETFL, 0) | O_NONBLOCK);
+  Close();
+  socket_ = new_socket;
+  host_ = host;
+  port_ = port;
+  address_ = address.s_addr;
+  ESP_LOGI(kTag, "Shipping logs to %s:%u", host.c_str(), port);
+  return true;
+}
+
+void UdpLogShipper::Close() {
+  if (socket_ >= 0) {
+    close(socket_);
+    socket_ = -1;
+  }
+}
+
+void UdpLogShipper::SetRate(uint32_t datagrams_per_sec, uint32_t burst) {
+  config_.datagrams_per_sec = std::clamp<uint32_t>(datagrams_per_sec, 1, kMaxRate);
+  config_.burst = std::clamp<uint32_t>(burst, 1, kMaxRate);
+  milli_tokens_ = std::min(milli_tokens_, config_.burst * 1000);
+}
+
+void UdpLogShipper::AddTelemetry(uint32_t time_ms, const TelemetryValue* values,
+                                 size_t count) {
+  size_t max_size = config_.max_datagram_bytes - kHeaderSize - kRecordHeaderSize;
+  std::vector<uint8_t> payload(max_size);
+  size_t size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t name_size = strlen(values[i].name);
+    if (name_size > kMaxTelemetryName || size + 1 + name_size + 4 > max_size) {
+      continue;
+    }
+    payload[size++] = name_size;
+    memcpy(&payload[size], values[i].name, name_size);
+    size += name_size;
+    WriteU32(&payload[size], static_cast<uint32_t>(values[i].value));
+    size += 4;
+  }
+  AddRecord(RecordType::kTelemetry, 'I', 0, time_ms, payload.data(), size);
+}
+
+void UdpLogShipper::OnEvent(const EventStreamer::Event& event) {
+  AddRecord(RecordType::kLog, event.level, event.sequence, event.time_ms,
+            reinterpret_cast<const uint8_t*>(event.text), event.size);
+}
+
+void UdpLogShipper::AddRecord(RecordType type, uint8_t level, uint32_t sequence,
+                              uint32_t time_ms, const uint8_t* payload, size_t size) {
+  size = std::min(size, config_.max_datagram_bytes - kHeaderSize - kRecordHeaderSize);
+  if (open_.bytes.size() + kRecordHeaderSize + size > config_.max_datagram_bytes) {
+    CloseDatagram();
+  }
+  if (open_.bytes.empty()) {
+    open_.bytes.reserve(config_.max_datagram_bytes);
+    open_.bytes.resize(kHeaderSize);
+    open_.bytes[0] = kVersion;
+    WriteU32(&open_.bytes[8], boot_id_);
+    open_since_ms_ = time_ms;
+  }
+
+  size_t pos = open_.bytes.size();
+  open_.bytes.resize(pos + kRecordHeaderSize + size);
+  uint8_t* record = &open_.bytes[pos];
+  record[0] = static_cast<uint8_t>(type);
+  record[1] = level;
+  WriteU16(record + 2, size);
+  WriteU32(record + 4, sequence);
+  WriteU32(record + 8, time_ms);
+  memcpy(record + kRecordHeaderSize, payload, size);
+  open_.num_records++;
+  stats_.records++;
+}
+
+void UdpLogShipper::CloseDatagram() {
+  if (open_.num_records == 0) {
+    return;
+  }
+  WriteU16(&open_.bytes[2], open_.num_records);
+  if (queue_.size() >= config_.max_queued_datagrams) {
+    stats_.datagrams_dropped++;
+    stats_.records_dropped += queue_.front().num_records;
+    unreported_drops_ += queue_.front().num_records;
+    queue_.pop_front();
+  }
+  queue_.push_back(std::move(open_));
+  open_ = Datagram();
+}
+
+void UdpLogShipper::RefillTokens(uint32_t now_ms) {
+  uint32_t max_milli_tokens = config_.burst * 1000;
+  if (!has_refilled_) {
+    has_refilled_ = true;
+    milli_tokens_ = max_milli_tokens;
+  } else {
+    uint64_t added = static_cast<uint64_t>(now_ms - last_refill_ms_) *
+        config_.datagrams_per_sec;
+    milli_tokens_ = std::min<uint64_t>(milli_tokens_ + added, max_milli_tokens);
+  }
+  last_refill_ms_ = now_ms;
+}
+
+void UdpLogShipper::OnBatchDone(uint32_t now_ms) {
+  RefillTokens(now_ms);
+  if (open_.num_records > 0 &&
+      static_cast<int32_t>(now_ms - open_since_ms_) >= static_cast<int32_t>(config_.max_delay_ms)) {
+    CloseDatagram();
+  }
+
+  while (!queue_.empty() && milli_tokens_ >= 1000) {
+    Datagram& datagram = queue_.front();
+    WriteU32(&datagram.bytes[4], next_sequence_);
+    WriteU32(&datagram.bytes[12], unreported_drops_);
+    if (!SendDatagram(datagram.bytes.data(), datagram.bytes.size())) {
+      // Retried on the next batch. Logging here would feed the ring this
+      // is draining.
+      stats_.send_errors++;
+      return;
+    }
+    milli_tokens_ -= 1000;
+    next_sequence_++;
+    unreported_drops_ = 0;
+    stats_.datagrams_sent++;
+    stats_.bytes_sent += datagram.bytes.size();
+    queue_.pop_front();
+  }
+}
+
+bool UdpLogShipper::SendDatagram(const uint8_t* data, size_t size) {
+  if (socket_ < 0) {
+    return false;
+  }
+  sockaddr_in destination = {};
+  destination.sin_family = AF_INET;
+  destination.sin_port = htons(port_);
+  destination.sin_addr.s_addr = address_;
+  return sendto(socket_, data, size, 0, reinterpret_cast<sockaddr*>(&destination),
+                sizeof(destination)) == static_cast<ssize_t>(size);
+}
+
+}  // namespace hackvac
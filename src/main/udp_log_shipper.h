@@ -0,0 +1,149 @@
+#ifndef UDP_LOG_SHIPPER_H_
+#define UDP_LOG_SHIPPER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "event_streamer.h"
+
+#include "esp_cxx/test.h"
+
+namespace hackvac {
+
+// Ships log events and telemetry to a collector as UDP datagrams, many
+// binary records per datagram. See udplog.py at the top of the repo for a
+// receiver.
+//
+// Datagram layout, little-endian:
+//   u8 kVersion | u8 flags (0) | u16 records | u32 sequence | u32 boot id |
+//   u32 records dropped on the device since the previous datagram
+// followed by records:
+//   u8 type | u8 level | u16 payload size | u32 event sequence | u32 ms |
+//   payload
+// A log record's payload is the rendered line. A telemetry record's payload
+// is repeated u8 name size | name | i32 value, and its event sequence is 0.
+//
+// Datagram sequences only advance on a successful send, so a gap at the
+// receiver is loss on the network and the dropped count is loss on the
+// device. A new boot id means the device restarted.
+//
+// Records collect in the open datagram until it is full or its oldest
+// record is max_delay_ms old. Closed datagrams wait in a queue and leave at
+// no more than the configured rate. Failed sends, such as while Wifi is
+// down, stay queued and are retried on the next batch. When the queue is
+// full the oldest datagram is dropped.
+//
+// Not thread safe. Runs on the network task as an EventStreamer::Sink.
+class UdpLogShipper : public EventStreamer::Sink {
+ public:
+  static constexpr uint8_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 16;
+  static constexpr size_t kRecordHeaderSize = 12;
+
+  // Highest rate and burst, as in the HACKVAC_UDP_LOG_DATAGRAMS_PER_SEC
+  // range. Keeps the token bucket's thousandths well inside 32 bits.
+  static constexpr uint32_t kMaxRate = 100;
+
+  enum class RecordType : uint8_t {
+    kLog = 1,
+    kTelemetry = 2,
+  };
+
+  struct Config {
+    // Keeps datagrams under a typical MTU so they are never fragmented.
+    size_t max_datagram_bytes = 1400;
+
+    // Token bucket on datagrams sent.
+    uint32_t datagrams_per_sec = 10;
+    uint32_t burst = 10;
+
+    // An open datagram is closed once its oldest record is this old.
+    uint32_t max_delay_ms = 1000;
+
+    size_t max_queued_datagrams = 8;
+  };
+
+  struct TelemetryValue {
+    const char* name;
+    int32_t value;
+  };
+
+  struct Stats {
+    uint32_t records = 0;
+    uint32_t datagrams_sent = 0;
+    uint32_t bytes_sent = 0;
+    uint32_t send_errors = 0;
+    uint32_t datagrams_dropped = 0;
+    uint32_t records_dropped = 0;
+  };
+
+  // |boot_id| should differ between boots, such as FlashRing::boot_number().
+  UdpLogShipper(Config config, uint32_t boot_id);
+  ~UdpLogShipper() override;
+
+  // Starts sending to |host|, a dotted IPv4 address, and |port|. Returns
+  // false, still sending wherever it was, if the address is bad or no
+  // socket is available. Queued datagrams are kept.
+  bool Open(const std::string& host, uint16_t port);
+  void Close();
+  bool is_open() const { return socket_ >= 0; }
+  const std::string& host() const { return host_; }
+  uint16_t port() const { return port_; }
+
+  // Both are clamped to 1 to kMaxRate.
+  void SetRate(uint32_t datagrams_per_sec, uint32_t burst);
+  const Config& config() const { return config_; }
+
+  // Adds one telemetry record. Values with names over 32 bytes are skipped.
+  void AddTelemetry(uint32_t time_ms, const TelemetryValue* values, size_t count);
+
+  // EventStreamer::Sink.
+  void OnEvent(const EventStreamer::Event& event) override;
+  void OnBatchDone(uint32_t now_ms) override;
+
+  const Stats& stats() const { return stats_; }
+  size_t num_queued() const { return queue_.size(); }
+
+ protected:
+  // Returns false if the datagram could not be handed to the network stack.
+  ESPCXX_MOCKABLE bool SendDatagram(const uint8_t* data, size_t size);
+
+ private:
+  struct Datagram {
+    std::vector<uint8_t> bytes;
+    uint16_t num_records = 0;
+  };
+
+  void AddRecord(RecordType type, uint8_t level, uint32_t sequence, uint32_t time_ms,
+                 const uint8_t* payload, size_t size);
+  void CloseDatagram();
+  void RefillTokens(uint32_t now_ms);
+
+  Config config_;
+  const uint32_t boot_id_;
+
+  int socket_ = -1;
+  std::string host_;
+  uint16_t port_ = 0;
+  uint32_t address_ = 0;  // Network byte order.
+
+  Datagram open_;
+  uint32_t open_since_ms_ = 0;
+  std::deque<Datagram> queue_;
+  uint32_t next_sequence_ = 0;
+  uint32_t unreported_drops_ = 0;
+
+  // Token bucket in thousandths of a datagram so slow rates still refill.
+  uint32_t milli_tokens_ = 0;
+  uint32_t last_refill_ms_ = 0;
+  bool has_refilled_ = false;
+
+  Stats stats_;
+};
+
+}  // namespace hackvac
+
+#endif  // UDP_LOG_SHIPPER_H_
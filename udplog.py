@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""Receives log events and telemetry shipped over UDP by hackvac units.
+
+Usage: ./udplog.py [port] [--bind address] [--quiet]
+
+Point a unit at this host with CONFIG_HACKVAC_UDP_LOG_HOST or
+  curl -X PUT -d '{"host":"<this host>","port":5140}' http://<unit>:8080/api/udp_log
+
+Datagrams are put back in sequence order per unit, holding up to
+REORDER_WINDOW of them while a gap is open, then lines are printed as
+  <unit ip> <ms since boot> <line>
+  <unit ip> <ms since boot> telemetry name=value ...
+Every few seconds prints datagrams lost on the network (sequence gaps) and
+records the unit dropped itself. The format is described in
+src/main/udp_log_shipper.h. Only needs the standard library.
+"""
+
+import socket
+import struct
+import sys
+import time
+
+VERSION = 1
+HEADER = struct.Struct('<BBHIII')
+RECORD_HEADER = struct.Struct('<BBHII')
+LOG, TELEMETRY = 1, 2
+REORDER_WINDOW = 16
+REPORT_INTERVAL_S = 10
+
+
+def decode(datagram):
+  """Returns (sequence, boot id, dropped, [(type, level, seq, ms, payload)])."""
+  version, _, count, sequence, boot_id, dropped = HEADER.unpack_from(datagram, 0)
+  if version != VERSION:
+    raise ValueError('Unknown version %d' % version)
+  records = []
+  pos = HEADER.size
+  for _ in range(count):
+    kind, level, size, event_sequence, time_ms = RECORD_HEADER.unpack_from(datagram, pos)
+    pos += RECORD_HEADER.size
+    payload = datagram[pos:pos + size]
+    if len(payload) != size:
+      raise ValueError('Truncated record')
+    pos += size
+    records.append((kind, chr(level), event_sequence, time_ms, payload))
+  return sequence, boot_id, dropped, records
+
+
+def telemetry(payload):
+  values = []
+  pos = 0
+  while pos < len(payload):
+    size = payload[pos]
+    name = payload[pos + 1:pos + 1 + size].decode(errors='replace')
+    value, = struct.unpack_from('<i', payload, pos + 1 + size)
+    values.append((name, value))
+    pos += 1 + size + 4
+  return values
+
+
+class Unit(object):
+  """Reorders one unit's datagrams and counts what went missing."""
+
+  def __init__(self, address):
+    self.address = address
+    self.boot_id = None
+    self.expected = None
+    self.pending = {}
+    self.lost = 0
+    self.device_dropped = 0
+    self.received = 0
+
+  def receive(self, sequence, boot_id, dropped, records, emit):
+    self.received += 1
+    if boot_id != self.boot_id:
+      if self.boot_id is not None:
+        self.flush(emit)
+        print('%s == new boot %d' % (self.address, boot_id))
+      self.boot_id = boot_id
+      self.expected = sequence
+    if sequence < self.expected:
+      return  # Duplicate, or too late after its gap was given up on.
+    self.pending[sequence] = (dropped, records)
+    self.drain(emit)
+    if len(self.pending) > REORDER_WINDOW:
+      # Give up on the gap.
+      first = min(self.pending)
+      self.lost += first - self.expected
+      self.expected = first
+      self.drain(emit)
+
+  def drain(self, emit):
+    while self.expected in self.pending:
+      dropped, records = self.pending.pop(self.expected)
+      if dropped:
+        self.device_dropped += dropped
+        print('%s -- %d records dropped on the device' % (self.address, dropped))
+      for record in records:
+        emit(self.address, record)
+      self.expected += 1
+
+  def flush(self, emit):
+    for sequence in sorted(self.pending):
+      self.lost += sequence - self.expected
+      self.expected = sequence
+      self.drain(emit)
+
+
+def print_record(address, record):
+  kind, level, _, time_ms, payload = record
+  if kind == LOG:
+    line = payload.decode(errors='replace').rstrip('\n')
+    print('%s %9d %s' % (address, time_ms, line))
+  elif kind == TELEMETRY:
+    print('%s %9d telemetry %s' % (address, time_ms, ' '.join(
+        '%s=%d' % value for value in telemetry(payload))))
+  else:
+    print('%s %9d ?? record type %d' % (address, time_ms, kind))
+
+
+def main():
+  args = sys.argv[1:]
+  bind = ''
+  if '--bind' in args:
+    i = args.index('--bind')
+    bind = args[i + 1]
+    del args[i:i + 2]
+  quiet = '--quiet' in args
+  args = [a for a in args if not a.startswith('--')]
+  port = int(args[0]) if args else 5140
+  emit = (lambda address, record: None) if quiet else print_record
+
+  sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  sock.bind((bind, port))
+  sock.settimeout(1.0)
+  print('Listening on %s:%d' % (bind or '*', port))
+
+  units = {}
+  last_report = time.time()
+  while True:
+    try:
+      datagram, (address, _) = sock.recvfrom(65535)
+      unit = units.setdefault(address, Unit(address))
+      try:
+        unit.receive(*decode(datagram), emit=emit)
+      except (ValueError, struct.error) as e:
+        print('%s !! bad datagram: %s' % (address, e))
+    except socket.timeout:
+      pass
+
+    now = time.time()
+    if now - last_report >= REPORT_INTERVAL_S:
+      for unit in units.values():
+        total = unit.received + unit.lost
+        print('== %s: %d datagrams, %d lost (%.2f%%), %d records dropped on '
+              'the device' % (unit.address, unit.received, unit.lost,
+                              100.0 * unit.lost / total if total else 0,
+                              unit.device_dropped))
+      last_report = now
+
+
+if __name__ == '__main__':
+  main()